@@ -282,7 +282,31 @@ VolumeData* VolumeData::DeepCopy(VolumeData &copy, bool use_default_settings, Da
 	}
 	bool is_brxml = tex->isBrxml();
 	int time = is_brxml ? 0 : copy.GetCurTime();
-	Nrrd *nv = vd->m_reader->Convert(time, copy.GetCurChannel(), true);
+	//the frame shown by the original is usually cached
+	FrameCache *cache = d_manager && !is_brxml ? d_manager->GetFrameCache() : 0;
+	double max_value = 0.0, scalar_scale = 1.0;
+	Nrrd *shared = cache ? cache->Acquire(vd->m_reader, time,
+		copy.GetCurChannel(), true, max_value, scalar_scale) : 0;
+	Nrrd *nv = 0;
+	if (shared)
+	{
+		nv = FrameCache::Copy(shared);
+		cache->Release(shared);
+	}
+	else
+	{
+		//the reader may be decoding frames ahead of playback
+		//the duplicate takes the frame, later ones share it through playback
+		wxMutex *reader_lock = d_manager?
+			d_manager->GetPrefetcher()->GetReaderLock(vd->m_reader):0;
+		if (reader_lock)
+			reader_lock->Lock();
+		nv = vd->m_reader->Convert(time, copy.GetCurChannel(), true);
+		max_value = vd->m_reader->GetMaxValue();
+		scalar_scale = vd->m_reader->GetScalarScale();
+		if (reader_lock)
+			reader_lock->Unlock();
+	}
 	if (!nv)
 	{
 		delete(vd);
@@ -316,8 +340,8 @@ VolumeData* VolumeData::DeepCopy(VolumeData &copy, bool use_default_settings, Da
 			vd->m_reader->GetZSpc());
 		bool valid_spc = vd->m_reader->IsSpcInfoValid();
 		vd->SetSpcFromFile(valid_spc);
-		vd->SetScalarScale(vd->m_reader->GetScalarScale());
-		vd->SetMaxValue(vd->m_reader->GetMaxValue());
+		vd->SetScalarScale(scalar_scale);
+		vd->SetMaxValue(max_value);
 		vd->SetCurTime(time);
 		vd->SetCurChannel(copy.GetCurChannel());
 
@@ -1191,6 +1215,9 @@ void VolumeData::Save(wxString &filename, int mode, bool bake, bool compress, bo
 		case 2://nrrd
 			writer = new NRRDWriter();
 			break;
+		case 3://vvd pyramid
+			writer = new BRKXMLWriter();
+			break;
 		}
 
 		double spcx, spcy, spcz;
@@ -2122,8 +2149,16 @@ void VolumeData::GetFileSpacings(double &spcx, double &spcy, double &spcz)
 //display controls
 void VolumeData::SetDisp(bool disp)
 {
+	bool changed = m_disp != disp;
 	m_disp = disp;
 	GetTexture()->set_sort_bricks();
+	//caches holding the bricks put them in their new classes
+	if (changed)
+	{
+		vector<TextureBrick*> *bricks = GetTexture()->get_bricks();
+		for (size_t i = 0; bricks && i < bricks->size(); i++)
+			(*bricks)[i]->notify_state();
+	}
 	if (!disp)
 	{
 		GetMask(true);
@@ -4945,10 +4980,16 @@ m_vol_exb(0.0),
 	m_timeId = "_T";
 	//load mask
 	m_load_mask = false;
+	//decoding threads
+	m_decode_threads = 0;
+
+	m_prefetcher.SetCache(&m_frame_cache);
 }
 
 DataManager::~DataManager()
 {
+	//background decodes still use the readers
+	m_prefetcher.Clear();
 	for (int i=0 ; i<(int)m_vd_list.size() ; i++)
 		if (m_vd_list[i])
 			delete m_vd_list[i];
@@ -4965,6 +5006,7 @@ DataManager::~DataManager()
 
 void DataManager::ClearAll()
 {
+	m_prefetcher.Clear();
 	for (int i=0 ; i<(int)m_vd_list.size() ; i++)
 		if (m_vd_list[i])
 			delete m_vd_list[i];
@@ -4981,6 +5023,7 @@ void DataManager::ClearAll()
 	m_md_list.clear();
 	m_reader_list.clear();
 	m_annotation_list.clear();
+	m_frame_cache.Clear();
 }
 
 void DataManager::SetVolumeDefault(VolumeData* vd)
@@ -5227,6 +5270,8 @@ int DataManager::LoadVolumeData(wxString &filename, int type, int ch_num, int t_
 		}
 	}
 
+	reader->SetDecodeThreads(m_decode_threads);
+
 	//align data for compression if vtc is not supported
 	if (!GLEW_NV_texture_compression_vtc && m_compression)
 	{
@@ -5235,6 +5280,65 @@ int DataManager::LoadVolumeData(wxString &filename, int type, int ch_num, int t_
 	}
 
 	int chan = reader->GetChanNum();
+	int cur_t = t_num>=0?t_num:reader->GetCurTime();
+	//channels not loaded yet are read in one pass over the file
+	vector<int> load_chans;
+	vector<Nrrd*> load_data;
+	vector<double> load_max, load_scale;
+	if (type != LOAD_TYPE_BRKXML)
+	{
+		for (i=(ch_num>=0?ch_num:0);
+			i<(ch_num>=0?ch_num+1:chan); i++)
+		{
+			bool found = false;
+			for (int j = 0; j < m_vd_list.size(); j++)
+				if (m_vd_list[j] && m_vd_list[j]->GetReader() == reader && !m_vd_list[j]->GetDup() &&
+					m_vd_list[j]->GetCurChannel() == i)
+					found = true;
+			if (!found)
+				load_chans.push_back(i);
+		}
+		//channels decoded before for another view are copied from the cache
+		//a new volume is the only user of the frames it decodes, they are not cached
+		vector<int> decode_chans;
+		for (size_t j = 0; j < load_chans.size(); j++)
+		{
+			double max_value = 0.0, scalar_scale = 1.0;
+			Nrrd* shared = m_frame_cache.Acquire(reader, cur_t, load_chans[j],
+				true, max_value, scalar_scale);
+			load_data.push_back(FrameCache::Copy(shared));
+			load_max.push_back(max_value);
+			load_scale.push_back(scalar_scale);
+			if (shared)
+				m_frame_cache.Release(shared);
+			else
+				decode_chans.push_back(load_chans[j]);
+		}
+		if (!decode_chans.empty())
+		{
+			vector<Nrrd*> decode_data;
+			vector<double> decode_max, decode_scale;
+			{
+				wxMutexLocker lock(*m_prefetcher.GetReaderLock(reader));
+				reader->ConvertChannels(cur_t, decode_chans, true,
+					decode_data, decode_max, decode_scale);
+			}
+			for (size_t j = 0, k = 0; j < decode_chans.size() && j < decode_data.size(); j++)
+			{
+				while (load_chans[k] != decode_chans[j])
+					k++;
+				load_data[k] = decode_data[j];
+				load_max[k] = decode_max[j];
+				load_scale[k] = decode_scale[j];
+			}
+		}
+		if (decode_chans.size() < load_chans.size())
+		{
+			wxMutexLocker lock(*m_prefetcher.GetReaderLock(reader));
+			reader->SetCurTime(cur_t);
+		}
+	}
+
 	for (i=(ch_num>=0?ch_num:0);
 		i<(ch_num>=0?ch_num+1:chan); i++)
 	{
@@ -5244,6 +5348,10 @@ int DataManager::LoadVolumeData(wxString &filename, int type, int ch_num, int t_
 			if (m_vd_list[j] && m_vd_list[j]->GetReader() == reader && !m_vd_list[j]->GetDup() &&
 				m_vd_list[j]->GetCurChannel() == i)
 				found_vd = m_vd_list[j];
+		int load_id = -1;
+		for (int j = 0; j < (int)load_chans.size() && j < (int)load_data.size(); j++)
+			if (load_chans[j] == i)
+				load_id = j;
 		if (found_vd)
 		{
 			vd = VolumeData::DeepCopy(*found_vd, true, this);
@@ -5254,7 +5362,11 @@ int DataManager::LoadVolumeData(wxString &filename, int type, int ch_num, int t_
 		{
 			VolumeData *vd = new VolumeData();
 			vd->SetSkipBrick(m_skip_brick);
-			Nrrd* data = reader->Convert(t_num>=0?t_num:reader->GetCurTime(), i, true);
+			Nrrd* data = 0;
+			if (type == LOAD_TYPE_BRKXML)
+				data = reader->Convert(cur_t, i, true);
+			else if (load_id >= 0)
+				data = load_data[load_id];
 			if (!data)
 				continue;
 
@@ -5285,7 +5397,7 @@ int DataManager::LoadVolumeData(wxString &filename, int type, int ch_num, int t_
 					MSKReader msk_reader;
 					std::wstring str = reader->GetPathName();
 					msk_reader.SetFile(str);
-					Nrrd* mask = msk_reader.Convert(t_num>=0?t_num:reader->GetCurTime(), i, true);
+					Nrrd* mask = msk_reader.Convert(cur_t, i, true);
 					if (mask)
 						vd->LoadMask(mask);
 					//label mask
@@ -5293,7 +5405,7 @@ int DataManager::LoadVolumeData(wxString &filename, int type, int ch_num, int t_
 					str = reader->GetPathName();
 					lbl_reader.SetFile(str);
 
-					Nrrd* label = lbl_reader.Convert(t_num>=0?t_num:reader->GetCurTime(), i, true);
+					Nrrd* label = lbl_reader.Convert(cur_t, i, true);
 					if (label)
 						vd->LoadLabel(label);
 				}
@@ -5306,8 +5418,16 @@ int DataManager::LoadVolumeData(wxString &filename, int type, int ch_num, int t_
 				if (zres == 1) vd->SetBaseSpacings(reader->GetXSpc(), reader->GetYSpc(), reader->GetXSpc()*zspcfac);
 				else vd->SetBaseSpacings(reader->GetXSpc(), reader->GetYSpc(), reader->GetZSpc());
 				vd->SetSpcFromFile(valid_spc);
-				vd->SetScalarScale(reader->GetScalarScale());
-				vd->SetMaxValue(reader->GetMaxValue());
+				if (load_id >= 0)
+				{
+					vd->SetScalarScale(load_scale[load_id]);
+					vd->SetMaxValue(load_max[load_id]);
+				}
+				else
+				{
+					vd->SetScalarScale(reader->GetScalarScale());
+					vd->SetMaxValue(reader->GetMaxValue());
+				}
 				vd->SetCurTime(reader->GetCurTime());
 				vd->SetCurChannel(i);
 				//++
@@ -5556,6 +5676,18 @@ int DataManager::GetVolumeNum()
 	return m_vd_list.size();
 }
 
+bool DataManager::IsFrameShared(BaseReader* reader, int c)
+{
+	int count = 0;
+	for (size_t i = 0; i < m_vd_list.size(); i++)
+	{
+		if (m_vd_list[i] && m_vd_list[i]->GetReader() == reader &&
+			m_vd_list[i]->GetCurChannel() == c)
+			count++;
+	}
+	return count > 1;
+}
+
 int DataManager::GetMeshNum()
 {
 	return m_md_list.size();
@@ -47,6 +47,7 @@ DEALINGS IN THE SOFTWARE.
 #include "Formats/tif_reader.h"
 #include "Formats/nrrd_writer.h"
 #include "Formats/tif_writer.h"
+#include "Formats/brkxml_writer.h"
 #include "Formats/msk_reader.h"
 #include "Formats/msk_writer.h"
 #include "Formats/lsm_reader.h"
@@ -54,6 +55,8 @@ DEALINGS IN THE SOFTWARE.
 #include "Formats/pvxml_reader.h"
 #include "Formats/brkxml_reader.h"
 #include "Formats/swc_reader.h"
+#include "Formats/frame_cache.h"
+#include "Formats/frame_prefetcher.h"
 
 #include "Tracking/TrackMap.h"
 #include "DatabaseDlg.h"
@@ -1499,11 +1502,22 @@ public:
 	bool GetOverrideVox()
 	{ return m_override_vox; }
 
+	//threads decoding the pages of tif/lsm/oib files, 1 for one thread in order
+	void SetDecodeThreads(int num) {m_decode_threads = num;}
+	int GetDecodeThreads() {return m_decode_threads;}
+
 	//flags for pvxml flipping
 	void SetPvxmlFlipX(bool flip) {m_pvxml_flip_x = flip;}
 	bool GetPvxmlFlipX() {return m_pvxml_flip_x;}
 	void SetPvxmlFlipY(bool flip) {m_pvxml_flip_y = flip;}
 	bool GetPvxmlFlipY() {return m_pvxml_flip_y;}
+
+	//decoded frames shared by all views
+	FrameCache* GetFrameCache() {return &m_frame_cache;}
+	//whether more than one volume shows channel c of the reader
+	bool IsFrameShared(BaseReader* reader, int c);
+	//decodes the next frames of time sequences during playback
+	FramePrefetcher* GetPrefetcher() {return &m_prefetcher;}
 public:
 	//default values
 	//volume
@@ -1543,6 +1557,10 @@ private:
 	vector <MeshData*> m_md_list;
 	vector <BaseReader*> m_reader_list;
 	vector <Annotations*> m_annotation_list;
+	//decoded frames of the readers above
+	FrameCache m_frame_cache;
+	//prefetched frames of the readers above, backed by the cache
+	FramePrefetcher m_prefetcher;
 
 	bool m_use_defaults;
 
@@ -1561,6 +1579,8 @@ private:
 	wxString m_prj_path;
 	//override voxel size
 	bool m_override_vox;
+	//decoding threads, 0 for all cores
+	int m_decode_threads;
 	//flgs for pvxml flipping
 	bool m_pvxml_flip_x;
 	bool m_pvxml_flip_y;
@@ -0,0 +1,309 @@
+//
+//  For more information, please see: http://software.sci.utah.edu
+//
+//  The MIT License
+//
+//  Copyright (c) 2004 Scientific Computing and Imaging Institute,
+//  University of Utah.
+//
+//
+//  Permission is hereby granted, free of charge, to any person obtaining a
+//  copy of this software and associated documentation files (the "Software"),
+//  to deal in the Software without restriction, including without limitation
+//  the rights to use, copy, modify, merge, publish, distribute, sublicense,
+//  and/or sell copies of the Software, and to permit persons to whom the
+//  Software is furnished to do so, subject to the following conditions:
+//
+//  The above copyright notice and this permission notice shall be included
+//  in all copies or substantial portions of the Software.
+//
+//  THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS
+//  OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+//  FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL
+//  THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+//  LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+//  FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER
+//  DEALINGS IN THE SOFTWARE.
+//
+
+#include <FLIVR/AsyncBrickReader.h>
+#include <FLIVR/BrickFileCache.h>
+#include <FLIVR/TextureBrick.h>
+#include <boost/chrono.hpp>
+
+#ifdef FLIVR_USE_IO_URING
+#include <errno.h>
+#endif
+
+namespace FLIVR
+{
+	//fallback: one blocking positional read per pool task
+	class AsyncReadTask : public ThreadPoolTask
+	{
+	public:
+		AsyncReadTask(AsyncBrickReader *reader, AsyncReadRequest *req)
+			: m_reader(reader), m_req(req) {}
+
+		virtual void run()
+		{
+			bool ok = BrickFileCache::read(m_req->filename, m_req->data, m_req->size, m_req->offset);
+			m_reader->finish(m_req, ok);
+		}
+		virtual void cancel()
+		{
+			m_reader->finish(m_req, false);
+		}
+
+	private:
+		AsyncBrickReader *m_reader;
+		AsyncReadRequest *m_req;
+	};
+
+#ifdef FLIVR_USE_IO_URING
+	//waits on the completion queue and dispatches finished reads
+	class AsyncReadCompleter : public wxThread
+	{
+	public:
+		AsyncReadCompleter(AsyncBrickReader *reader)
+			: wxThread(wxTHREAD_JOINABLE), m_reader(reader) {}
+	protected:
+		virtual ExitCode Entry()
+		{
+			m_reader->reap_uring();
+			return (wxThread::ExitCode)0;
+		}
+		AsyncBrickReader *m_reader;
+	};
+
+	//IORING_OP_READ needs linux 5.6, an older kernel sets up the ring but fails the reads
+	static bool uring_supports_read(struct io_uring *ring)
+	{
+		struct io_uring_probe *probe = io_uring_get_probe_ring(ring);
+		if (!probe)
+			return false;
+		bool supported = io_uring_opcode_supported(probe, IORING_OP_READ) != 0;
+		io_uring_free_probe(probe);
+		return supported;
+	}
+#endif
+
+	AsyncBrickReader::AsyncBrickReader(int depth) :
+		depth_(depth > 0 ? depth : 1),
+		uring_(false),
+		pool_(NULL),
+		cond_(lock_),
+		in_flight_(0)
+	{
+#ifdef FLIVR_USE_IO_URING
+		completer_ = NULL;
+		if (io_uring_queue_init(depth_ * 2, &ring_, 0) == 0)
+		{
+			if (!uring_supports_read(&ring_))
+				io_uring_queue_exit(&ring_);
+			else
+			{
+				completer_ = new AsyncReadCompleter(this);
+				if (completer_->Create() == wxTHREAD_NO_ERROR &&
+					completer_->Run() == wxTHREAD_NO_ERROR)
+					uring_ = true;
+				else
+				{
+					delete completer_;
+					completer_ = NULL;
+					io_uring_queue_exit(&ring_);
+				}
+			}
+		}
+#endif
+		//no io_uring (or an old kernel): blocking reads on worker threads
+		if (!uring_)
+			pool_ = new ThreadPool(depth_ < 16 ? depth_ : 16);
+	}
+
+	AsyncBrickReader::~AsyncBrickReader()
+	{
+		wait_idle();
+#ifdef FLIVR_USE_IO_URING
+		if (uring_)
+		{
+			//a nop without user data tells the completer to exit
+			sq_lock_.Lock();
+			struct io_uring_sqe *sqe = io_uring_get_sqe(&ring_);
+			if (sqe)
+			{
+				io_uring_prep_nop(sqe);
+				io_uring_sqe_set_data(sqe, NULL);
+				io_uring_submit(&ring_);
+			}
+			sq_lock_.Unlock();
+			completer_->Wait();
+			delete completer_;
+			io_uring_queue_exit(&ring_);
+		}
+#endif
+		if (pool_)
+			delete pool_;
+	}
+
+	void AsyncBrickReader::submit(AsyncReadRequest *req)
+	{
+		if (!req)
+			return;
+
+		lock_.Lock();
+		while (in_flight_ >= depth_)
+			cond_.Wait();
+		in_flight_++;
+		lock_.Unlock();
+
+#ifdef FLIVR_USE_IO_URING
+		if (uring_)
+		{
+			if (!submit_uring(req))
+				finish(req, false);
+			return;
+		}
+#endif
+		pool_->submit(new AsyncReadTask(this, req));
+	}
+
+	void AsyncBrickReader::wait_idle()
+	{
+		wxMutexLocker lock(lock_);
+		while (in_flight_ > 0)
+			cond_.Wait();
+	}
+
+	int AsyncBrickReader::get_in_flight()
+	{
+		wxMutexLocker lock(lock_);
+		return in_flight_;
+	}
+
+	void AsyncBrickReader::finish(AsyncReadRequest *req, bool succeeded)
+	{
+		if (req->file_)
+		{
+			BrickFileCache::release_handle(req->filename);
+			req->file_ = NULL;
+		}
+		req->complete(succeeded);
+		delete req;
+
+		wxMutexLocker lock(lock_);
+		in_flight_--;
+		cond_.Broadcast();
+	}
+
+#ifdef FLIVR_USE_IO_URING
+	bool AsyncBrickReader::submit_uring(AsyncReadRequest *req)
+	{
+		if (!req->file_)
+			req->file_ = BrickFileCache::acquire_handle(req->filename);
+		if (!req->file_ || req->offset + req->size > req->file_->size())
+			return false;
+
+		wxMutexLocker lock(sq_lock_);
+		struct io_uring_sqe *sqe = io_uring_get_sqe(&ring_);
+		if (!sqe)
+		{
+			//the ring holds twice the depth, so this only happens if the kernel lags behind
+			io_uring_submit(&ring_);
+			sqe = io_uring_get_sqe(&ring_);
+			if (!sqe)
+				return false;
+		}
+		io_uring_prep_read(sqe, req->file_->fd(), req->data + req->done_,
+			(unsigned)(req->size - req->done_), req->offset + req->done_);
+		io_uring_sqe_set_data(sqe, req);
+		return io_uring_submit(&ring_) >= 0;
+	}
+
+	void AsyncBrickReader::reap_uring()
+	{
+		while (1)
+		{
+			struct io_uring_cqe *cqe = NULL;
+			int ret = io_uring_wait_cqe(&ring_, &cqe);
+			if (ret == -EINTR)
+				continue;
+			if (ret < 0)
+				break;
+			AsyncReadRequest *req = (AsyncReadRequest *)io_uring_cqe_get_data(cqe);
+			int res = cqe->res;
+			io_uring_cqe_seen(&ring_, cqe);
+			if (!req)
+				break;
+
+			if (res > 0)
+				req->done_ += res;
+			if (res > 0 && req->done_ < req->size)
+			{
+				//short read: queue the remainder
+				if (!submit_uring(req))
+					finish(req, false);
+				continue;
+			}
+			finish(req, res > 0 || (res == 0 && req->size == 0));
+		}
+	}
+#endif
+
+	//reads the data into its own buffer and drops them
+	class BenchmarkReadRequest : public AsyncReadRequest
+	{
+	public:
+		BenchmarkReadRequest(long long *bytes, wxMutex *lock)
+			: m_bytes(bytes), m_lock(lock) {}
+		~BenchmarkReadRequest() { delete [] data; }
+
+		virtual void complete(bool succeeded)
+		{
+			if (!succeeded)
+				return;
+			wxMutexLocker lock(*m_lock);
+			*m_bytes += size;
+		}
+
+	private:
+		long long *m_bytes;
+		wxMutex *m_lock;
+	};
+
+	double AsyncBrickReader::benchmark(const std::vector<FileLocInfo*> &finfos, int depth,
+		long long *bytes, double *seconds, bool *used_uring)
+	{
+		typedef boost::chrono::high_resolution_clock BenchClock;
+
+		long long total = 0;
+		wxMutex total_lock;
+		AsyncBrickReader *reader = new AsyncBrickReader(depth);
+		if (used_uring)
+			*used_uring = reader->uses_io_uring();
+
+		BenchClock::time_point t1 = BenchClock::now();
+		for (size_t i = 0; i < finfos.size(); i++)
+		{
+			FileLocInfo *finfo = finfos[i];
+			if (!finfo || finfo->isurl || finfo->datasize <= 0)
+				continue;
+			BenchmarkReadRequest *req = new BenchmarkReadRequest(&total, &total_lock);
+			req->filename = finfo->filename;
+			req->offset = finfo->offset;
+			req->size = finfo->datasize;
+			req->data = new char[req->size];
+			reader->submit(req);
+		}
+		reader->wait_idle();
+		BenchClock::time_point t2 = BenchClock::now();
+		delete reader;
+
+		double sec = boost::chrono::duration_cast<boost::chrono::duration<double> >(t2 - t1).count();
+		if (bytes)
+			*bytes = total;
+		if (seconds)
+			*seconds = sec;
+		return sec > 0.0 ? (double)total / sec / 1.0e9 : 0.0;
+	}
+
+} // namespace FLIVR
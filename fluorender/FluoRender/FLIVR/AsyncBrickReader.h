@@ -0,0 +1,123 @@
+//
+//  For more information, please see: http://software.sci.utah.edu
+//
+//  The MIT License
+//
+//  Copyright (c) 2004 Scientific Computing and Imaging Institute,
+//  University of Utah.
+//
+//
+//  Permission is hereby granted, free of charge, to any person obtaining a
+//  copy of this software and associated documentation files (the "Software"),
+//  to deal in the Software without restriction, including without limitation
+//  the rights to use, copy, modify, merge, publish, distribute, sublicense,
+//  and/or sell copies of the Software, and to permit persons to whom the
+//  Software is furnished to do so, subject to the following conditions:
+//
+//  The above copyright notice and this permission notice shall be included
+//  in all copies or substantial portions of the Software.
+//
+//  THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS
+//  OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+//  FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL
+//  THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+//  LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+//  FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER
+//  DEALINGS IN THE SOFTWARE.
+//
+
+#ifndef SLIVR_AsyncBrickReader_h
+#define SLIVR_AsyncBrickReader_h
+
+#include <wx/thread.h>
+#include <FLIVR/ThreadPool.h>
+
+#include <string>
+#include <vector>
+#include <stdint.h>
+
+#ifdef FLIVR_USE_IO_URING
+#include <liburing.h>
+#endif
+
+namespace FLIVR
+{
+	class FileHandle;
+	class FileLocInfo;
+	class AsyncBrickReader;
+
+	//one positional read handed to an AsyncBrickReader
+	//complete() is called on a reader thread when the data have arrived
+	//(or the read failed); the reader deletes the request afterwards
+	class AsyncReadRequest
+	{
+	public:
+		AsyncReadRequest() : data(NULL), size(0), offset(0), file_(NULL), done_(0) {}
+		virtual ~AsyncReadRequest() {}
+
+		virtual void complete(bool succeeded) = 0;
+
+		std::wstring filename;
+		char *data;		//destination, owned by the request
+		size_t size;
+		uint64_t offset;
+
+	private:
+		FileHandle *file_;
+		size_t done_;
+
+		friend class AsyncBrickReader;
+	};
+
+	class AsyncReadCompleter;
+
+	//keeps up to depth brick reads in flight
+	//uses io_uring when built with FLIVR_USE_IO_URING and the kernel supports it,
+	//otherwise blocking positional reads on a pool of threads
+	class AsyncBrickReader
+	{
+	public:
+		AsyncBrickReader(int depth = 32);
+		~AsyncBrickReader();
+
+		//blocks while depth reads are in flight
+		void submit(AsyncReadRequest *req);
+		//block until all submitted reads have completed
+		void wait_idle();
+
+		int get_depth() { return depth_; }
+		int get_in_flight();
+		bool uses_io_uring() { return uring_; }
+
+		//read all bricks in finfos through a reader of the given depth
+		//returns the achieved throughput in GB/s, bytes and seconds are optional outputs
+		static double benchmark(const std::vector<FileLocInfo*> &finfos, int depth,
+			long long *bytes = NULL, double *seconds = NULL, bool *used_uring = NULL);
+
+		friend class AsyncReadTask;
+		friend class AsyncReadCompleter;
+
+	private:
+		void finish(AsyncReadRequest *req, bool succeeded);
+
+		int depth_;
+		bool uring_;
+		ThreadPool *pool_;
+
+		wxMutex lock_;
+		wxCondition cond_;
+		int in_flight_;
+
+#ifdef FLIVR_USE_IO_URING
+		bool submit_uring(AsyncReadRequest *req);
+		void reap_uring();
+
+		struct io_uring ring_;
+		wxMutex sq_lock_;
+		AsyncReadCompleter *completer_;
+#endif
+	};
+
+} // namespace FLIVR
+
+#endif // SLIVR_AsyncBrickReader_h
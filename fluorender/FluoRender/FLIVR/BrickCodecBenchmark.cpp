@@ -0,0 +1,170 @@
+//
+//  For more information, please see: http://software.sci.utah.edu
+//
+//  The MIT License
+//
+//  Copyright (c) 2004 Scientific Computing and Imaging Institute,
+//  University of Utah.
+//
+//
+//  Permission is hereby granted, free of charge, to any person obtaining a
+//  copy of this software and associated documentation files (the "Software"),
+//  to deal in the Software without restriction, including without limitation
+//  the rights to use, copy, modify, merge, publish, distribute, sublicense,
+//  and/or sell copies of the Software, and to permit persons to whom the
+//  Software is furnished to do so, subject to the following conditions:
+//
+//  The above copyright notice and this permission notice shall be included
+//  in all copies or substantial portions of the Software.
+//
+//  THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS
+//  OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+//  FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL
+//  THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+//  LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+//  FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER
+//  DEALINGS IN THE SOFTWARE.
+//
+
+#include <FLIVR/BrickCodecBenchmark.h>
+#include <FLIVR/TextureBrick.h>
+#include <boost/chrono.hpp>
+#include <cstdio>
+#include <cstring>
+#include <cmath>
+#include <jpeglib.h>
+
+namespace FLIVR
+{
+	BrickCodecBenchmark::BrickCodecBenchmark(int nx, int ny, int nz, int reps) :
+		nx_(nx), ny_(ny), nz_(nz),
+		reps_(reps > 0 ? reps : 1)
+	{
+	}
+
+	void BrickCodecBenchmark::make_brick(std::vector<char> &data, int bytes)
+	{
+		size_t num = (size_t)nx_*(size_t)ny_*(size_t)nz_;
+		data.resize(num * bytes);
+		double maxv = bytes == 2 ? 4095.0 : 255.0;
+		unsigned int seed = 12345;
+		for (int k = 0; k < nz_; k++)
+		for (int j = 0; j < ny_; j++)
+		for (int i = 0; i < nx_; i++)
+		{
+			//fixed seed lcg: the bricks are the same on every run
+			seed = seed * 1103515245u + 12345u;
+			double noise = ((seed >> 16) & 0xff) / 255.0;
+			double v = 0.04 + 0.02 * noise;
+			for (int b = 0; b < 3; b++)
+			{
+				double cx = nx_ * (0.25 + 0.25 * b);
+				double cy = ny_ * (0.3 + 0.2 * b);
+				double cz = nz_ * 0.5;
+				double r = nx_ * 0.08;
+				double d2 = ((i-cx)*(i-cx) + (j-cy)*(j-cy) + (k-cz)*(k-cz)) / (r*r);
+				v += 0.8 * exp(-d2);
+			}
+			if (v > 1.0) v = 1.0;
+			size_t idx = (size_t)nx_*ny_*k + (size_t)nx_*j + i;
+			if (bytes == 2)
+				((unsigned short*)&data[0])[idx] = (unsigned short)(v * maxv);
+			else
+				((unsigned char*)&data[0])[idx] = (unsigned char)(v * maxv);
+		}
+	}
+
+	bool BrickCodecBenchmark::encode(int type, int filter, const std::vector<char> &raw, int bytes, std::vector<char> &out)
+	{
+		if (type == BRICK_FILE_TYPE_JPEG)
+		{
+			//the bricks are stored as one grayscale image of nx by ny*nz
+			if (bytes != 1)
+				return false;
+			jpeg_compress_struct cinfo;
+			jpeg_error_mgr jerr;
+			cinfo.err = jpeg_std_error(&jerr);
+			jpeg_create_compress(&cinfo);
+			unsigned char *mem = NULL;
+			unsigned long mem_size = 0;
+			jpeg_mem_dest(&cinfo, &mem, &mem_size);
+			cinfo.image_width = nx_;
+			cinfo.image_height = ny_ * nz_;
+			cinfo.input_components = 1;
+			cinfo.in_color_space = JCS_GRAYSCALE;
+			jpeg_set_defaults(&cinfo);
+			jpeg_set_quality(&cinfo, 90, TRUE);
+			jpeg_start_compress(&cinfo, TRUE);
+			while (cinfo.next_scanline < cinfo.image_height)
+			{
+				JSAMPROW row = (JSAMPROW)&raw[(size_t)cinfo.next_scanline * nx_];
+				jpeg_write_scanlines(&cinfo, &row, 1);
+			}
+			jpeg_finish_compress(&cinfo);
+			jpeg_destroy_compress(&cinfo);
+			out.assign((char*)mem, (char*)mem + mem_size);
+			free(mem);
+			return true;
+		}
+		return TextureBrick::compress_brick(out, &raw[0], raw.size(), type, filter);
+	}
+
+	void BrickCodecBenchmark::time_codec(const std::string &name, int type, int filter, int bytes, std::vector<BrickCodecResult> &results)
+	{
+		typedef boost::chrono::high_resolution_clock BenchClock;
+
+		BrickCodecResult r;
+		r.name = name;
+		r.type = type;
+		r.filter = filter;
+		r.bytes = bytes;
+		r.comp_size = 0;
+		r.ms = 0.0;
+		r.mbps = 0.0;
+		r.ok = false;
+
+		std::vector<char> raw, comp;
+		make_brick(raw, bytes);
+		r.raw_size = raw.size();
+		if (!encode(type, filter, raw, bytes, comp))
+		{
+			results.push_back(r);
+			return;
+		}
+		r.comp_size = comp.size();
+
+		std::vector<char> out(raw.size());
+		//one untimed pass warms the caches and checks the round trip
+		r.ok = TextureBrick::decompress_brick(&out[0], &comp[0], out.size(), comp.size(), type, filter);
+		if (r.ok && type != BRICK_FILE_TYPE_JPEG)
+			r.ok = memcmp(&out[0], &raw[0], raw.size()) == 0;
+
+		BenchClock::time_point t1 = BenchClock::now();
+		for (int i = 0; i < reps_; i++)
+			TextureBrick::decompress_brick(&out[0], &comp[0], out.size(), comp.size(), type, filter);
+		BenchClock::time_point t2 = BenchClock::now();
+
+		double sec = boost::chrono::duration_cast<boost::chrono::duration<double> >(t2 - t1).count();
+		r.ms = sec * 1000.0 / reps_;
+		r.mbps = sec > 0.0 ? (double)raw.size() * reps_ / sec / 1.0e6 : 0.0;
+		results.push_back(r);
+	}
+
+	void BrickCodecBenchmark::run(std::vector<BrickCodecResult> &results)
+	{
+		const int df = BRICK_FILE_FILTER_DELTA | BRICK_FILE_FILTER_SHUFFLE;
+		std::string zlib = TextureBrick::zlib_backend();
+
+		time_codec("jpeg 8-bit", BRICK_FILE_TYPE_JPEG, 0, 1, results);
+		time_codec(zlib + " 8-bit", BRICK_FILE_TYPE_ZLIB, 0, 1, results);
+		time_codec(zlib + " 16-bit", BRICK_FILE_TYPE_ZLIB, 0, 2, results);
+		time_codec(zlib + " 16-bit d+s", BRICK_FILE_TYPE_ZLIB, df, 2, results);
+		time_codec("zstd 8-bit", BRICK_FILE_TYPE_ZSTD, 0, 1, results);
+		time_codec("zstd 16-bit", BRICK_FILE_TYPE_ZSTD, 0, 2, results);
+		time_codec("zstd 16-bit d+s", BRICK_FILE_TYPE_ZSTD, df, 2, results);
+		time_codec("lz4 8-bit", BRICK_FILE_TYPE_LZ4, 0, 1, results);
+		time_codec("lz4 16-bit", BRICK_FILE_TYPE_LZ4, 0, 2, results);
+		time_codec("lz4 16-bit d+s", BRICK_FILE_TYPE_LZ4, df, 2, results);
+	}
+
+} // namespace FLIVR
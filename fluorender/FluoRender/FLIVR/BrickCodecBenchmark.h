@@ -0,0 +1,70 @@
+//
+//  For more information, please see: http://software.sci.utah.edu
+//
+//  The MIT License
+//
+//  Copyright (c) 2004 Scientific Computing and Imaging Institute,
+//  University of Utah.
+//
+//
+//  Permission is hereby granted, free of charge, to any person obtaining a
+//  copy of this software and associated documentation files (the "Software"),
+//  to deal in the Software without restriction, including without limitation
+//  the rights to use, copy, modify, merge, publish, distribute, sublicense,
+//  and/or sell copies of the Software, and to permit persons to whom the
+//  Software is furnished to do so, subject to the following conditions:
+//
+//  The above copyright notice and this permission notice shall be included
+//  in all copies or substantial portions of the Software.
+//
+//  THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS
+//  OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+//  FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL
+//  THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+//  LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+//  FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER
+//  DEALINGS IN THE SOFTWARE.
+//
+
+#ifndef SLIVR_BrickCodecBenchmark_h
+#define SLIVR_BrickCodecBenchmark_h
+
+#include <string>
+#include <vector>
+
+namespace FLIVR
+{
+	struct BrickCodecResult
+	{
+		std::string name;
+		int type;			//BRICK_FILE_TYPE_*
+		int filter;			//BRICK_FILE_FILTER_*
+		int bytes;			//bytes per voxel
+		size_t raw_size;
+		size_t comp_size;
+		double ms;			//average TextureBrick::decompress_brick time
+		double mbps;		//decompressed MB/s
+		bool ok;			//round trip matched
+	};
+
+	//times TextureBrick::decompress_brick on synthetic bricks
+	//the bricks mimic light-sheet data: a dim noisy background with a few bright blobs
+	class BrickCodecBenchmark
+	{
+	public:
+		BrickCodecBenchmark(int nx = 256, int ny = 256, int nz = 64, int reps = 10);
+
+		void run(std::vector<BrickCodecResult> &results);
+
+	private:
+		void make_brick(std::vector<char> &data, int bytes);
+		bool encode(int type, int filter, const std::vector<char> &raw, int bytes, std::vector<char> &out);
+		void time_codec(const std::string &name, int type, int filter, int bytes, std::vector<BrickCodecResult> &results);
+
+		int nx_, ny_, nz_;
+		int reps_;
+	};
+
+} // namespace FLIVR
+
+#endif // SLIVR_BrickCodecBenchmark_h
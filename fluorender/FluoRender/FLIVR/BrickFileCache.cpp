@@ -0,0 +1,442 @@
+//
+//  For more information, please see: http://software.sci.utah.edu
+//
+//  The MIT License
+//
+//  Copyright (c) 2004 Scientific Computing and Imaging Institute,
+//  University of Utah.
+//
+//
+//  Permission is hereby granted, free of charge, to any person obtaining a
+//  copy of this software and associated documentation files (the "Software"),
+//  to deal in the Software without restriction, including without limitation
+//  the rights to use, copy, modify, merge, publish, distribute, sublicense,
+//  and/or sell copies of the Software, and to permit persons to whom the
+//  Software is furnished to do so, subject to the following conditions:
+//
+//  The above copyright notice and this permission notice shall be included
+//  in all copies or substantial portions of the Software.
+//
+//  THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS
+//  OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+//  FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL
+//  THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+//  LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+//  FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER
+//  DEALINGS IN THE SOFTWARE.
+//
+
+#include <FLIVR/BrickFileCache.h>
+#include <FLIVR/TextureBrick.h>
+#include "../compatibility.h"
+
+#ifndef _WIN32
+#include <sys/types.h>
+#include <sys/stat.h>
+#include <sys/mman.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <errno.h>
+#endif
+
+namespace FLIVR
+{
+	wxMutex BrickFileCache::lock_;
+	std::map<std::wstring, BrickFileCache::MapEntry> BrickFileCache::mapped_;
+	//mapping whole pyramid files needs a 64-bit address space
+	bool BrickFileCache::mmap_enabled_ = sizeof(void*) >= 8;
+	unsigned long long BrickFileCache::map_clock_ = 0;
+	int BrickFileCache::max_idle_maps_ = 16;
+	wxMutex BrickFileCache::handle_lock_;
+	std::map<std::wstring, BrickFileCache::HandleEntry> BrickFileCache::handles_;
+	unsigned long long BrickFileCache::handle_clock_ = 0;
+	int BrickFileCache::max_handles_ = 64;
+
+	MappedFile::MappedFile() :
+		data_(NULL),
+		size_(0)
+	{
+	}
+
+	MappedFile::~MappedFile()
+	{
+		close();
+	}
+
+	bool MappedFile::open(const std::wstring &filename)
+	{
+		close();
+		//the view holds its own reference to the file,
+		//so no descriptor is kept open for the life of the mapping
+#ifdef _WIN32
+		HANDLE file = CreateFileW(filename.c_str(), GENERIC_READ, FILE_SHARE_READ, NULL,
+			OPEN_EXISTING, FILE_ATTRIBUTE_NORMAL | FILE_FLAG_RANDOM_ACCESS, NULL);
+		if (file == INVALID_HANDLE_VALUE)
+			return false;
+		LARGE_INTEGER fsize;
+		HANDLE mapping = NULL;
+		if (GetFileSizeEx(file, &fsize) && fsize.QuadPart > 0)
+			mapping = CreateFileMappingW(file, NULL, PAGE_READONLY, 0, 0, NULL);
+		if (mapping)
+		{
+			data_ = (char *)MapViewOfFile(mapping, FILE_MAP_READ, 0, 0, 0);
+			CloseHandle(mapping);
+		}
+		CloseHandle(file);
+		if (!data_)
+			return false;
+		size_ = (uint64_t)fsize.QuadPart;
+#else
+		int fd = ::open(ws2s(filename).c_str(), O_RDONLY);
+		if (fd < 0)
+			return false;
+		struct stat st;
+		void *ptr = MAP_FAILED;
+		if (fstat(fd, &st) == 0 && st.st_size > 0)
+			ptr = mmap(NULL, (size_t)st.st_size, PROT_READ, MAP_SHARED, fd, 0);
+		::close(fd);
+		if (ptr == MAP_FAILED)
+			return false;
+		data_ = (char *)ptr;
+		size_ = (uint64_t)st.st_size;
+		//bricks are visited in view order, not file order
+		madvise(data_, (size_t)size_, MADV_RANDOM);
+#endif
+		name_ = filename;
+		return true;
+	}
+
+	void MappedFile::close()
+	{
+		if (data_)
+		{
+#ifdef _WIN32
+			UnmapViewOfFile(data_);
+#else
+			munmap(data_, (size_t)size_);
+#endif
+		}
+		data_ = NULL;
+		size_ = 0;
+		name_.clear();
+	}
+
+	void MappedFile::will_need(uint64_t offset, uint64_t len)
+	{
+		if (!data_ || offset >= size_)
+			return;
+		if (offset + len > size_)
+			len = size_ - offset;
+#ifndef _WIN32
+		//madvise needs a page aligned start
+		uint64_t page = (uint64_t)sysconf(_SC_PAGESIZE);
+		uint64_t start = offset - offset % page;
+		madvise(data_ + start, (size_t)(offset + len - start), MADV_WILLNEED);
+#endif
+	}
+
+	FileHandle::FileHandle() :
+		size_(0)
+	{
+#ifdef _WIN32
+		file_ = INVALID_HANDLE_VALUE;
+#else
+		fd_ = -1;
+#endif
+	}
+
+	FileHandle::~FileHandle()
+	{
+		close();
+	}
+
+	bool FileHandle::open(const std::wstring &filename)
+	{
+		close();
+#ifdef _WIN32
+		file_ = CreateFileW(filename.c_str(), GENERIC_READ, FILE_SHARE_READ, NULL,
+			OPEN_EXISTING, FILE_ATTRIBUTE_NORMAL | FILE_FLAG_RANDOM_ACCESS, NULL);
+		if (file_ == INVALID_HANDLE_VALUE)
+			return false;
+		LARGE_INTEGER fsize;
+		if (!GetFileSizeEx(file_, &fsize))
+		{
+			close();
+			return false;
+		}
+		size_ = (uint64_t)fsize.QuadPart;
+#else
+		fd_ = ::open(ws2s(filename).c_str(), O_RDONLY);
+		if (fd_ < 0)
+			return false;
+		struct stat st;
+		if (fstat(fd_, &st) != 0)
+		{
+			close();
+			return false;
+		}
+		size_ = (uint64_t)st.st_size;
+#endif
+		return true;
+	}
+
+	void FileHandle::close()
+	{
+#ifdef _WIN32
+		if (file_ != INVALID_HANDLE_VALUE)
+			CloseHandle(file_);
+		file_ = INVALID_HANDLE_VALUE;
+#else
+		if (fd_ >= 0)
+			::close(fd_);
+		fd_ = -1;
+#endif
+		size_ = 0;
+	}
+
+	bool FileHandle::valid()
+	{
+#ifdef _WIN32
+		return file_ != INVALID_HANDLE_VALUE;
+#else
+		return fd_ >= 0;
+#endif
+	}
+
+	bool FileHandle::pread(char *data, size_t len, uint64_t offset)
+	{
+		if (!valid() || !data)
+			return false;
+		if (offset + len > size_)
+			return false;
+
+		while (len > 0)
+		{
+#ifdef _WIN32
+			//the offset in OVERLAPPED makes ReadFile positional on a synchronous handle
+			OVERLAPPED ov = {0};
+			ov.Offset = (DWORD)(offset & 0xFFFFFFFFULL);
+			ov.OffsetHigh = (DWORD)(offset >> 32);
+			DWORD chunk = len > 0x40000000 ? 0x40000000 : (DWORD)len;
+			DWORD done = 0;
+			if (!ReadFile(file_, data, chunk, &done, &ov) || done == 0)
+				return false;
+#else
+			size_t chunk = len > 0x40000000 ? 0x40000000 : len;
+			ssize_t done = ::pread(fd_, data, chunk, (off_t)offset);
+			if (done < 0 && errno == EINTR)
+				continue;
+			if (done <= 0)
+				return false;
+#endif
+			data += done;
+			len -= done;
+			offset += done;
+		}
+		return true;
+	}
+
+	FileHandle* BrickFileCache::acquire_handle(const std::wstring &filename)
+	{
+		wxMutexLocker lock(handle_lock_);
+		std::map<std::wstring, HandleEntry>::iterator it = handles_.find(filename);
+		if (it == handles_.end())
+		{
+			FileHandle *fh = new FileHandle();
+			if (!fh->open(filename))
+			{
+				delete fh;
+				return NULL;
+			}
+			HandleEntry e;
+			e.file = fh;
+			e.ref = 0;
+			e.last_use = 0;
+			it = handles_.insert(std::make_pair(filename, e)).first;
+			trim_handles();
+		}
+		it->second.ref++;
+		it->second.last_use = ++handle_clock_;
+		return it->second.file;
+	}
+
+	void BrickFileCache::release_handle(const std::wstring &filename)
+	{
+		wxMutexLocker lock(handle_lock_);
+		std::map<std::wstring, HandleEntry>::iterator it = handles_.find(filename);
+		if (it != handles_.end())
+			it->second.ref--;
+		trim_handles();
+	}
+
+	//close the least recently used idle handles over the limit; handle_lock_ is held
+	void BrickFileCache::trim_handles()
+	{
+		while ((int)handles_.size() > max_handles_)
+		{
+			std::map<std::wstring, HandleEntry>::iterator victim = handles_.end();
+			for (std::map<std::wstring, HandleEntry>::iterator it = handles_.begin();
+				it != handles_.end(); ++it)
+			{
+				if (it->second.ref > 0)
+					continue;
+				if (victim == handles_.end() || it->second.last_use < victim->second.last_use)
+					victim = it;
+			}
+			if (victim == handles_.end())
+				break;
+			delete victim->second.file;
+			handles_.erase(victim);
+		}
+	}
+
+	bool BrickFileCache::read(const std::wstring &filename, char* data, size_t size, uint64_t offset)
+	{
+		FileHandle *fh = acquire_handle(filename);
+		if (!fh)
+			return false;
+		bool result = fh->pread(data, size, offset);
+		release_handle(filename);
+		return result;
+	}
+
+	long long BrickFileCache::file_size(const std::wstring &filename)
+	{
+		FileHandle *fh = acquire_handle(filename);
+		if (!fh)
+			return -1;
+		long long result = (long long)fh->size();
+		release_handle(filename);
+		return result;
+	}
+
+	void BrickFileCache::close_all()
+	{
+		{
+			wxMutexLocker lock(handle_lock_);
+			for (std::map<std::wstring, HandleEntry>::iterator it = handles_.begin();
+				it != handles_.end();)
+			{
+				if (it->second.ref > 0)
+				{
+					++it;
+					continue;
+				}
+				delete it->second.file;
+				handles_.erase(it++);
+			}
+		}
+		wxMutexLocker lock(lock_);
+		trim_maps(0);
+	}
+
+	//unmap the least recently used unreferenced files over max_idle; lock_ is held
+	void BrickFileCache::trim_maps(int max_idle)
+	{
+		int idle = 0;
+		for (std::map<std::wstring, MapEntry>::iterator it = mapped_.begin();
+			it != mapped_.end(); ++it)
+			if (it->second.ref <= 0)
+				idle++;
+		while (idle > max_idle)
+		{
+			std::map<std::wstring, MapEntry>::iterator victim = mapped_.end();
+			for (std::map<std::wstring, MapEntry>::iterator it = mapped_.begin();
+				it != mapped_.end(); ++it)
+			{
+				if (it->second.ref > 0)
+					continue;
+				if (victim == mapped_.end() || it->second.last_use < victim->second.last_use)
+					victim = it;
+			}
+			if (victim == mapped_.end())
+				break;
+			delete victim->second.file;
+			mapped_.erase(victim);
+			idle--;
+		}
+	}
+
+	bool BrickFileCache::mappable(const FileLocInfo* finfo)
+	{
+		//only RAW bricks on a local disk (or in the download cache) can be used in place
+		return mmap_enabled_ && finfo &&
+			finfo->type == BRICK_FILE_TYPE_RAW &&
+			(!finfo->isurl || finfo->cached);
+	}
+
+	std::wstring BrickFileCache::local_name(const FileLocInfo* finfo)
+	{
+		return finfo->cached ? finfo->cache_filename : finfo->filename;
+	}
+
+	const char* BrickFileCache::map_brick(const FileLocInfo* finfo, size_t size, MappedFile* &file)
+	{
+		file = NULL;
+		if (!mappable(finfo))
+			return NULL;
+
+		std::wstring fn = local_name(finfo);
+		wxMutexLocker lock(lock_);
+		std::map<std::wstring, MapEntry>::iterator it = mapped_.find(fn);
+		if (it == mapped_.end())
+		{
+			MappedFile *mf = new MappedFile();
+			if (!mf->open(fn))
+			{
+				delete mf;
+				return NULL;
+			}
+			MapEntry e;
+			e.file = mf;
+			e.ref = 0;
+			e.last_use = 0;
+			it = mapped_.insert(std::make_pair(fn, e)).first;
+		}
+		it->second.last_use = ++map_clock_;
+
+		MappedFile *mf = it->second.file;
+		//the caller reads size bytes from the mapping, a short datasize must not hide that
+		size_t read_size = size;
+		if (finfo->datasize > 0 && (size_t)finfo->datasize > size)
+			read_size = finfo->datasize;
+		if (finfo->offset < 0 || (uint64_t)finfo->offset + read_size > mf->size())
+		{
+			trim_maps(max_idle_maps_);
+			return NULL;
+		}
+
+		it->second.ref++;
+		file = mf;
+		return mf->data() + finfo->offset;
+	}
+
+	void BrickFileCache::unmap_brick(MappedFile* file)
+	{
+		if (!file)
+			return;
+
+		wxMutexLocker lock(lock_);
+		std::map<std::wstring, MapEntry>::iterator it = mapped_.find(file->name());
+		if (it == mapped_.end() || it->second.file != file)
+			return;
+		//keep the idle mapping, the next brick of the same file is likely close behind
+		if (--it->second.ref <= 0)
+			trim_maps(max_idle_maps_);
+	}
+
+	void BrickFileCache::prefetch_brick(const FileLocInfo* finfo, size_t size)
+	{
+		if (!mappable(finfo))
+			return;
+
+		std::wstring fn = local_name(finfo);
+		wxMutexLocker lock(lock_);
+		std::map<std::wstring, MapEntry>::iterator it = mapped_.find(fn);
+		if (it == mapped_.end())
+			return;
+		size_t read_size = finfo->datasize > 0 ? finfo->datasize : size;
+		it->second.file->will_need((uint64_t)finfo->offset, read_size);
+	}
+
+} // namespace FLIVR
@@ -0,0 +1,162 @@
+//
+//  For more information, please see: http://software.sci.utah.edu
+//
+//  The MIT License
+//
+//  Copyright (c) 2004 Scientific Computing and Imaging Institute,
+//  University of Utah.
+//
+//
+//  Permission is hereby granted, free of charge, to any person obtaining a
+//  copy of this software and associated documentation files (the "Software"),
+//  to deal in the Software without restriction, including without limitation
+//  the rights to use, copy, modify, merge, publish, distribute, sublicense,
+//  and/or sell copies of the Software, and to permit persons to whom the
+//  Software is furnished to do so, subject to the following conditions:
+//
+//  The above copyright notice and this permission notice shall be included
+//  in all copies or substantial portions of the Software.
+//
+//  THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS
+//  OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+//  FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL
+//  THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+//  LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+//  FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER
+//  DEALINGS IN THE SOFTWARE.
+//
+
+#ifndef SLIVR_BrickFileCache_h
+#define SLIVR_BrickFileCache_h
+
+#include <wx/thread.h>
+
+#include <string>
+#include <map>
+#include <stdint.h>
+
+#ifdef _WIN32
+#include <windows.h>
+#endif
+
+namespace FLIVR
+{
+	class FileLocInfo;
+
+	//a read-only mapping of a whole brick file
+	//the file is closed as soon as it is mapped; the view keeps the pages reachable
+	class MappedFile
+	{
+	public:
+		MappedFile();
+		~MappedFile();
+
+		bool open(const std::wstring &filename);
+		void close();
+		bool valid() { return data_ != NULL; }
+
+		const char* data() { return data_; }
+		uint64_t size() { return size_; }
+		const std::wstring &name() { return name_; }
+
+		//ask the OS to fetch a range before it is touched
+		void will_need(uint64_t offset, uint64_t len);
+
+	private:
+		char *data_;
+		uint64_t size_;
+		std::wstring name_;
+	};
+
+	//an open brick file for positional reads
+	//reads carry their own offset, so one handle can serve several threads
+	class FileHandle
+	{
+	public:
+		FileHandle();
+		~FileHandle();
+
+		bool open(const std::wstring &filename);
+		void close();
+		bool valid();
+
+		uint64_t size() { return size_; }
+		//read len bytes at offset without moving a shared file pointer
+		bool pread(char *data, size_t len, uint64_t offset);
+#ifndef _WIN32
+		int fd() { return fd_; }
+#endif
+
+	private:
+		uint64_t size_;
+#ifdef _WIN32
+		HANDLE file_;
+#else
+		int fd_;
+#endif
+	};
+
+	//process-wide access to packed brick files
+	//RAW bricks are served as pointers into one mapping per file;
+	//each mapped brick holds a reference that is dropped by unmap_brick().
+	//Unreferenced mappings stay around until they are the oldest of more than max_idle_maps_.
+	//Other reads go through a small pool of open handles keyed by filename
+	class BrickFileCache
+	{
+	public:
+		//read size bytes at offset of filename through a cached handle
+		static bool read(const std::wstring &filename, char* data, size_t size, uint64_t offset);
+		//file size in bytes, -1 if the file cannot be opened
+		static long long file_size(const std::wstring &filename);
+		//close all idle handles and mappings, e.g. before the files are deleted
+		static void close_all();
+		static void set_max_handles(int num) { max_handles_ = num; }
+		//pin a cached handle, e.g. for the duration of an asynchronous read
+		static FileHandle* acquire_handle(const std::wstring &filename);
+		static void release_handle(const std::wstring &filename);
+
+		//pointer to size bytes of finfo at finfo->offset, NULL if the file cannot be mapped
+		static const char* map_brick(const FileLocInfo* finfo, size_t size, MappedFile* &file);
+		static void unmap_brick(MappedFile* file);
+		//readahead hint for a brick that will be loaded soon
+		static void prefetch_brick(const FileLocInfo* finfo, size_t size);
+
+		static void set_mmap_enabled(bool val) { mmap_enabled_ = val; }
+		static bool get_mmap_enabled() { return mmap_enabled_; }
+		static void set_max_idle_maps(int num) { max_idle_maps_ = num; }
+
+	private:
+		struct MapEntry
+		{
+			MappedFile *file;
+			int ref;
+			unsigned long long last_use;
+		};
+
+		struct HandleEntry
+		{
+			FileHandle *file;
+			int ref;
+			unsigned long long last_use;
+		};
+
+		static bool mappable(const FileLocInfo* finfo);
+		static std::wstring local_name(const FileLocInfo* finfo);
+		static void trim_handles();
+		static void trim_maps(int max_idle);
+
+		static wxMutex lock_;
+		static std::map<std::wstring, MapEntry> mapped_;
+		static bool mmap_enabled_;
+		static unsigned long long map_clock_;
+		static int max_idle_maps_;
+
+		static wxMutex handle_lock_;
+		static std::map<std::wstring, HandleEntry> handles_;
+		static unsigned long long handle_clock_;
+		static int max_handles_;
+	};
+
+} // namespace FLIVR
+
+#endif // SLIVR_BrickFileCache_h
@@ -0,0 +1,179 @@
+//
+//  For more information, please see: http://software.sci.utah.edu
+//
+//  The MIT License
+//
+//  Copyright (c) 2004 Scientific Computing and Imaging Institute,
+//  University of Utah.
+//
+//
+//  Permission is hereby granted, free of charge, to any person obtaining a
+//  copy of this software and associated documentation files (the "Software"),
+//  to deal in the Software without restriction, including without limitation
+//  the rights to use, copy, modify, merge, publish, distribute, sublicense,
+//  and/or sell copies of the Software, and to permit persons to whom the
+//  Software is furnished to do so, subject to the following conditions:
+//
+//  The above copyright notice and this permission notice shall be included
+//  in all copies or substantial portions of the Software.
+//
+//  THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS
+//  OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+//  FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL
+//  THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+//  LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+//  FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER
+//  DEALINGS IN THE SOFTWARE.
+//
+
+
+#include <FLIVR/BrickIndex.h>
+#include <algorithm>
+
+namespace FLIVR
+{
+	BrickIndex::BrickIndex() :
+		ox_(0), oy_(0), oz_(0),
+		cx_(1), cy_(1), cz_(1),
+		gx_(0), gy_(0), gz_(0)
+	{
+	}
+
+	void BrickIndex::clear()
+	{
+		boxes_.clear();
+		start_.clear();
+		items_.clear();
+		gx_ = gy_ = gz_ = 0;
+	}
+
+	bool BrickIndex::cells(int v0, int v1, int o, int c, int g, int &i0, int &i1)
+	{
+		if (v1 <= v0)
+			return false;
+		i0 = (v0 - o) / c;
+		i1 = (v1 - 1 - o) / c;
+		if (v0 < o) i0 = 0;
+		if (i1 >= g) i1 = g - 1;
+		return v1 > o && i0 < g && i0 <= i1;
+	}
+
+	void BrickIndex::build(const std::vector<Box> &boxes)
+	{
+		clear();
+		boxes_ = boxes;
+		if (boxes_.empty())
+			return;
+
+		int ex = 0, ey = 0, ez = 0;
+		bool first = true;
+		for (size_t n = 0; n < boxes_.size(); ++n)
+		{
+			const Box &b = boxes_[n];
+			if (b.x1 <= b.x0 || b.y1 <= b.y0 || b.z1 <= b.z0)
+				continue;
+			if (first)
+			{
+				ox_ = b.x0; oy_ = b.y0; oz_ = b.z0;
+				ex = b.x1; ey = b.y1; ez = b.z1;
+				cx_ = cy_ = cz_ = 1;
+				first = false;
+			}
+			ox_ = std::min(ox_, b.x0);
+			oy_ = std::min(oy_, b.y0);
+			oz_ = std::min(oz_, b.z0);
+			ex = std::max(ex, b.x1);
+			ey = std::max(ey, b.y1);
+			ez = std::max(ez, b.z1);
+			cx_ = std::max(cx_, b.x1 - b.x0);
+			cy_ = std::max(cy_, b.y1 - b.y0);
+			cz_ = std::max(cz_, b.z1 - b.z0);
+		}
+		if (first)
+			return;
+		gx_ = (ex - ox_ + cx_ - 1) / cx_;
+		gy_ = (ey - oy_ + cy_ - 1) / cy_;
+		gz_ = (ez - oz_ + cz_ - 1) / cz_;
+
+		//count the bricks of each cell, then fill them in order
+		start_.assign((size_t)gx_*gy_*gz_ + 1, 0);
+		int i0, i1, j0, j1, k0, k1;
+		for (int pass = 0; pass < 2; ++pass)
+		{
+			std::vector<int> fill;
+			if (pass)
+			{
+				for (size_t n = 1; n < start_.size(); ++n)
+					start_[n] += start_[n-1];
+				items_.resize(start_.back());
+				fill.assign(start_.begin(), start_.end() - 1);
+			}
+			for (size_t n = 0; n < boxes_.size(); ++n)
+			{
+				const Box &b = boxes_[n];
+				if (!cells(b.x0, b.x1, ox_, cx_, gx_, i0, i1) ||
+					!cells(b.y0, b.y1, oy_, cy_, gy_, j0, j1) ||
+					!cells(b.z0, b.z1, oz_, cz_, gz_, k0, k1))
+					continue;
+				for (int k = k0; k <= k1; ++k)
+				for (int j = j0; j <= j1; ++j)
+				for (int i = i0; i <= i1; ++i)
+				{
+					if (pass)
+						items_[fill[cell(i, j, k)]++] = (int)n;
+					else
+						start_[cell(i, j, k) + 1]++;
+				}
+			}
+		}
+	}
+
+	int BrickIndex::find(int x, int y, int z) const
+	{
+		if (start_.empty() ||
+			x < ox_ || y < oy_ || z < oz_)
+			return -1;
+		int i = (x - ox_) / cx_;
+		int j = (y - oy_) / cy_;
+		int k = (z - oz_) / cz_;
+		if (i >= gx_ || j >= gy_ || k >= gz_)
+			return -1;
+		int c = cell(i, j, k);
+		for (int n = start_[c]; n < start_[c+1]; ++n)
+		{
+			const Box &b = boxes_[items_[n]];
+			if (x >= b.x0 && y >= b.y0 && z >= b.z0 &&
+				x < b.x1 && y < b.y1 && z < b.z1)
+				return items_[n];
+		}
+		return -1;
+	}
+
+	void BrickIndex::find(const Box &box, std::vector<int> &result) const
+	{
+		result.clear();
+		int i0, i1, j0, j1, k0, k1;
+		if (start_.empty() ||
+			!cells(box.x0, box.x1, ox_, cx_, gx_, i0, i1) ||
+			!cells(box.y0, box.y1, oy_, cy_, gy_, j0, j1) ||
+			!cells(box.z0, box.z1, oz_, cz_, gz_, k0, k1))
+			return;
+		for (int k = k0; k <= k1; ++k)
+		for (int j = j0; j <= j1; ++j)
+		for (int i = i0; i <= i1; ++i)
+		{
+			int c = cell(i, j, k);
+			for (int n = start_[c]; n < start_[c+1]; ++n)
+			{
+				const Box &b = boxes_[items_[n]];
+				if (box.x0 < b.x1 && box.y0 < b.y1 && box.z0 < b.z1 &&
+					b.x0 < box.x1 && b.y0 < box.y1 && b.z0 < box.z1)
+					result.push_back(items_[n]);
+			}
+		}
+		//a brick over several cells is found in each
+		std::sort(result.begin(), result.end());
+		result.erase(std::unique(result.begin(), result.end()), result.end());
+	}
+
+} // namespace FLIVR
@@ -0,0 +1,81 @@
+//
+//  For more information, please see: http://software.sci.utah.edu
+//
+//  The MIT License
+//
+//  Copyright (c) 2004 Scientific Computing and Imaging Institute,
+//  University of Utah.
+//
+//
+//  Permission is hereby granted, free of charge, to any person obtaining a
+//  copy of this software and associated documentation files (the "Software"),
+//  to deal in the Software without restriction, including without limitation
+//  the rights to use, copy, modify, merge, publish, distribute, sublicense,
+//  and/or sell copies of the Software, and to permit persons to whom the
+//  Software is furnished to do so, subject to the following conditions:
+//
+//  The above copyright notice and this permission notice shall be included
+//  in all copies or substantial portions of the Software.
+//
+//  THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS
+//  OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+//  FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL
+//  THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+//  LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+//  FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER
+//  DEALINGS IN THE SOFTWARE.
+//
+
+
+#ifndef SLIVR_BrickIndex_h
+#define SLIVR_BrickIndex_h
+
+#include <vector>
+
+namespace FLIVR
+{
+	//uniform grid over the voxel boxes of bricks
+	//each cell is as large as the largest brick and lists the bricks
+	//overlapping it, so a point is looked up in one cell and a box in
+	//the cells it covers. bricks are identified by their order in build()
+	class BrickIndex
+	{
+	public:
+		//voxels [x0, x1) * [y0, y1) * [z0, z1)
+		struct Box
+		{
+			int x0, y0, z0;
+			int x1, y1, z1;
+		};
+
+		BrickIndex();
+
+		void build(const std::vector<Box> &boxes);
+		void clear();
+		bool empty() const {return boxes_.empty();}
+		int size() const {return (int)boxes_.size();}
+
+		//the first brick containing a voxel, -1 if none
+		int find(int x, int y, int z) const;
+		//bricks overlapping a box, in ascending order
+		void find(const Box &box, std::vector<int> &result) const;
+
+	private:
+		std::vector<Box> boxes_;
+		//grid origin, cell size and number of cells
+		int ox_, oy_, oz_;
+		int cx_, cy_, cz_;
+		int gx_, gy_, gz_;
+		//bricks of cell i are items_[start_[i]] to items_[start_[i+1]-1]
+		std::vector<int> start_;
+		std::vector<int> items_;
+
+		int cell(int i, int j, int k) const
+		{return (k*gy_ + j)*gx_ + i;}
+		//range of cells covering voxels [v0, v1) along an axis
+		static bool cells(int v0, int v1, int o, int c, int g, int &i0, int &i1);
+	};
+
+} // namespace FLIVR
+
+#endif // SLIVR_BrickIndex_h
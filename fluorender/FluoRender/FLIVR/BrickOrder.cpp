@@ -0,0 +1,145 @@
+//
+//  For more information, please see: http://software.sci.utah.edu
+//
+//  The MIT License
+//
+//  Copyright (c) 2004 Scientific Computing and Imaging Institute,
+//  University of Utah.
+//
+//
+//  Permission is hereby granted, free of charge, to any person obtaining a
+//  copy of this software and associated documentation files (the "Software"),
+//  to deal in the Software without restriction, including without limitation
+//  the rights to use, copy, modify, merge, publish, distribute, sublicense,
+//  and/or sell copies of the Software, and to permit persons to whom the
+//  Software is furnished to do so, subject to the following conditions:
+//
+//  The above copyright notice and this permission notice shall be included
+//  in all copies or substantial portions of the Software.
+//
+//  THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS
+//  OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+//  FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL
+//  THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+//  LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+//  FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER
+//  DEALINGS IN THE SOFTWARE.
+//
+
+
+#include <FLIVR/BrickOrder.h>
+#include <boost/chrono.hpp>
+#include <cmath>
+
+namespace FLIVR
+{
+	namespace
+	{
+		//stand-in for a brick: its box and its distance
+		struct BenchBrick
+		{
+			double minp[3];
+			double maxp[3];
+			double d;
+		};
+
+		//farther bricks first, as TextureBrick::sort_asc
+		bool bench_far_first(const BenchBrick* b1, const BenchBrick* b2)
+		{ return b1->d > b2->d; }
+		double bench_d(const BenchBrick* b)
+		{ return b->d; }
+	}
+
+	bool BrickOrder::benchmark(int grid, int frames, double degrees,
+		bool orthographic, double &sort_ms, double &order_ms, int &mismatch)
+	{
+		typedef boost::chrono::high_resolution_clock BenchClock;
+
+		sort_ms = order_ms = 0.0;
+		mismatch = -1;
+		if (grid <= 0 || frames <= 0)
+			return true;
+
+		//bricks of a unit volume in the order they are built
+		std::vector<BenchBrick> bricks(grid * grid * grid);
+		std::vector<BenchBrick*> built;
+		double size = 1.0 / grid;
+		for (int k = 0; k < grid; k++)
+		for (int j = 0; j < grid; j++)
+		for (int i = 0; i < grid; i++)
+		{
+			BenchBrick &b = bricks[(k * grid + j) * grid + i];
+			b.minp[0] = i * size; b.maxp[0] = b.minp[0] + size;
+			b.minp[1] = j * size; b.maxp[1] = b.minp[1] + size;
+			b.minp[2] = k * size; b.maxp[2] = b.minp[2] + size;
+			b.d = 0.0;
+			built.push_back(&b);
+		}
+		std::vector<BenchBrick*> sorted = built;
+		std::vector<BenchBrick*> ordered = built;
+
+		double sort_t = 0.0;
+		double order_t = 0.0;
+		const double pi = 3.14159265358979323846;
+		for (int f = 0; f < frames; f++)
+		{
+			//eye orbiting the volume, a little above it
+			double a = f * degrees * pi / 180.0;
+			double eye[3] = {0.5 + 3.0*cos(a), 1.2, 0.5 + 3.0*sin(a)};
+			double dir[3] = {0.5 - eye[0], 0.5 - eye[1], 0.5 - eye[2]};
+			double len = sqrt(dir[0]*dir[0] + dir[1]*dir[1] + dir[2]*dir[2]);
+			for (int c = 0; c < 3; c++)
+				dir[c] /= len;
+			for (size_t i = 0; i < bricks.size(); i++)
+			{
+				BenchBrick &b = bricks[i];
+				double d = 0.0;
+				for (int c = 0; c < 8; c++)
+				{
+					double p[3] = {
+						c & 4 ? b.maxp[0] : b.minp[0],
+						c & 2 ? b.maxp[1] : b.minp[1],
+						c & 1 ? b.maxp[2] : b.minp[2]};
+					double dd;
+					if (orthographic)
+						dd = p[0]*dir[0] + p[1]*dir[1] + p[2]*dir[2];
+					else
+						dd = sqrt((p[0]-eye[0])*(p[0]-eye[0]) +
+							(p[1]-eye[1])*(p[1]-eye[1]) +
+							(p[2]-eye[2])*(p[2]-eye[2]));
+					if (c == 0 || dd > d)
+						d = dd;
+				}
+				b.d = d;
+			}
+
+			BenchClock::time_point t0 = BenchClock::now();
+			std::sort(sorted.begin(), sorted.end(), bench_far_first);
+			BenchClock::time_point t1 = BenchClock::now();
+			sort(ordered, bench_d, true, &built);
+			BenchClock::time_point t2 = BenchClock::now();
+			sort_t += boost::chrono::duration<double, boost::milli>(t1 - t0).count();
+			order_t += boost::chrono::duration<double, boost::milli>(t2 - t1).count();
+
+			//both orders have the same distances
+			for (size_t i = 0; i < sorted.size(); i++)
+			{
+				if (sorted[i]->d != ordered[i]->d)
+				{
+					mismatch = f;
+					break;
+				}
+			}
+			if (mismatch >= 0)
+			{
+				frames = f + 1;
+				break;
+			}
+		}
+
+		sort_ms = sort_t / frames;
+		order_ms = order_t / frames;
+		return mismatch < 0;
+	}
+
+} // namespace FLIVR
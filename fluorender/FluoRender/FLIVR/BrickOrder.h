@@ -0,0 +1,193 @@
+//
+//  For more information, please see: http://software.sci.utah.edu
+//
+//  The MIT License
+//
+//  Copyright (c) 2004 Scientific Computing and Imaging Institute,
+//  University of Utah.
+//
+//
+//  Permission is hereby granted, free of charge, to any person obtaining a
+//  copy of this software and associated documentation files (the "Software"),
+//  to deal in the Software without restriction, including without limitation
+//  the rights to use, copy, modify, merge, publish, distribute, sublicense,
+//  and/or sell copies of the Software, and to permit persons to whom the
+//  Software is furnished to do so, subject to the following conditions:
+//
+//  The above copyright notice and this permission notice shall be included
+//  in all copies or substantial portions of the Software.
+//
+//  THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS
+//  OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+//  FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL
+//  THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+//  LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+//  FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER
+//  DEALINGS IN THE SOFTWARE.
+//
+
+
+#ifndef SLIVR_BrickOrder_h
+#define SLIVR_BrickOrder_h
+
+#include <cstddef>
+#include <vector>
+#include <algorithm>
+
+namespace FLIVR
+{
+	//orders bricks by their distances to the viewer for every frame.
+	//a full sort is not needed: the order of the last frame is kept, and
+	//when the view has moved a little, it is still made of a few long runs
+	//of sorted bricks. when the view has moved a lot, the bricks are taken
+	//in the order they were built instead, where each row of the grid is
+	//a run of increasing or decreasing distances. whichever has fewer runs
+	//is used, and the runs are merged in passes over the distances
+	class BrickOrder
+	{
+	public:
+		//sort v by the distances given by key, the farthest first or the
+		//nearest first. grid, if given, has the same elements as v in the
+		//order of the brick grid
+		template <class T, class Key>
+		static void sort(std::vector<T> &v, Key key, bool far_first,
+			const std::vector<T> *grid = 0)
+		{
+			std::size_t n = v.size();
+			if (n < 2)
+				return;
+			std::vector<Item<T> > items;
+			std::vector<Item<T> > buf;
+			std::vector<std::size_t> bounds;
+			std::vector<std::size_t> last_bounds;
+			if (grid && grid->size() == n)
+			{
+				fill(*grid, key, items);
+				find_runs(items, far_first, n, bounds);
+			}
+			//the order of the last frame, if it has fewer runs
+			if (bounds.size() != 2)
+			{
+				fill(v, key, buf);
+				if (find_runs(buf, far_first,
+					bounds.empty() ? n : bounds.size() - 2, last_bounds))
+				{
+					items.swap(buf);
+					bounds.swap(last_bounds);
+				}
+			}
+			merge_runs(items, buf, far_first, bounds);
+			for (std::size_t i = 0; i < n; i++)
+				v[i] = items[i].v;
+		}
+
+		//order a grid x grid x grid bricks for frames views orbiting
+		//the volume by degrees per frame, by std::sort on the bricks the
+		//way they used to be sorted and by sort() here
+		//sets milliseconds per frame; returns false if the two orders
+		//differ, with the first differing frame in mismatch
+		static bool benchmark(int grid, int frames, double degrees,
+			bool orthographic, double &sort_ms, double &order_ms, int &mismatch);
+
+	private:
+		template <class T>
+		struct Item
+		{
+			double d;
+			T v;
+		};
+		template <class T>
+		struct ItemLess
+		{
+			bool far_first;
+			bool operator()(const Item<T> &a, const Item<T> &b) const
+			{return far_first ? a.d > b.d : a.d < b.d;}
+		};
+
+		template <class T, class Key>
+		static void fill(const std::vector<T> &v, Key key,
+			std::vector<Item<T> > &items)
+		{
+			items.resize(v.size());
+			for (std::size_t i = 0; i < v.size(); i++)
+			{
+				items[i].d = key(v[i]);
+				items[i].v = v[i];
+			}
+		}
+
+		//bounds of the sorted runs of items, ending with its size
+		//runs in the reverse order are turned around
+		//stops and returns false when there are more than max_runs
+		template <class T>
+		static bool find_runs(std::vector<Item<T> > &items, bool far_first,
+			std::size_t max_runs, std::vector<std::size_t> &bounds)
+		{
+			ItemLess<T> less = {far_first};
+			std::size_t n = items.size();
+			std::size_t i = 0;
+			bounds.clear();
+			while (i < n)
+			{
+				if (bounds.size() >= max_runs)
+					return false;
+				bounds.push_back(i);
+				std::size_t j = i + 1;
+				if (j < n && less(items[j], items[j-1]))
+				{
+					while (j < n && less(items[j], items[j-1]))
+						j++;
+					std::reverse(items.begin() + i, items.begin() + j);
+				}
+				else
+				{
+					while (j < n && !less(items[j], items[j-1]))
+						j++;
+				}
+				i = j;
+			}
+			bounds.push_back(n);
+			return true;
+		}
+
+		//merge neighboring runs back and forth between items and buf
+		//until one is left in items
+		template <class T>
+		static void merge_runs(std::vector<Item<T> > &items,
+			std::vector<Item<T> > &buf, bool far_first,
+			std::vector<std::size_t> &bounds)
+		{
+			ItemLess<T> less = {far_first};
+			std::size_t n = items.size();
+			buf.resize(n);
+			std::vector<std::size_t> merged;
+			while (bounds.size() > 2)
+			{
+				merged.clear();
+				std::size_t r;
+				for (r = 0; r + 2 < bounds.size(); r += 2)
+				{
+					std::merge(items.begin() + bounds[r],
+						items.begin() + bounds[r+1],
+						items.begin() + bounds[r+1],
+						items.begin() + bounds[r+2],
+						buf.begin() + bounds[r], less);
+					merged.push_back(bounds[r]);
+				}
+				if (r + 1 < bounds.size())
+				{
+					std::copy(items.begin() + bounds[r],
+						items.begin() + bounds[r+1],
+						buf.begin() + bounds[r]);
+					merged.push_back(bounds[r]);
+				}
+				merged.push_back(n);
+				items.swap(buf);
+				bounds.swap(merged);
+			}
+		}
+	};
+
+} // namespace FLIVR
+
+#endif // SLIVR_BrickOrder_h
@@ -26,11 +26,13 @@
 //  DEALINGS IN THE SOFTWARE.
 //  
 
+#include <FLIVR/BrickOrder.h>
 #include <FLIVR/ShaderProgram.h>
 #include <FLIVR/Texture.h>
 #include <FLIVR/TextureRenderer.h>
 #include <FLIVR/Utils.h>
 #include <algorithm>
+#include <cmath>
 #include <inttypes.h>
 
 #include <wx/progdlg.h>
@@ -79,6 +81,7 @@ namespace FLIVR
 		}
 
 		bricks_ = &default_vec_;
+		cur_lookup_ = &brick_lookup_;
 	}
 
 	Texture::~Texture()
@@ -153,23 +156,71 @@ namespace FLIVR
 		}
 	}
 
-	int Texture::get_brick_id_point(int ix, int iy, int iz)
+	void Texture::index_bricks(const vector<TextureBrick*> &bricks, BrickLookup &lookup)
 	{
-		for (unsigned int i = 0; i < (*bricks_).size(); i++)
+		vector<BrickIndex::Box> boxes(bricks.size());
+		for (size_t i = 0; i < bricks.size(); i++)
 		{
-			int ox = (*bricks_)[i]->ox();
-			int oy = (*bricks_)[i]->oy();
-			int oz = (*bricks_)[i]->oz();
-			int ex = ox + (*bricks_)[i]->nx();
-			int ey = oy + (*bricks_)[i]->ny();
-			int ez = oz + (*bricks_)[i]->nz();
-			
-			if (ix >= ox && iy >= oy && iz >= oz &&
-				ix < ex && iy < ey && iz < ez)
-				return i;
+			TextureBrick *b = bricks[i];
+			BrickIndex::Box box = {b->ox(), b->oy(), b->oz(),
+				b->ox()+b->nx(), b->oy()+b->ny(), b->oz()+b->nz()};
+			boxes[i] = box;
 		}
+		lookup.bricks = bricks;
+		lookup.index.build(boxes);
+	}
+
+	int Texture::brick_pos(TextureBrick* b)
+	{
+		unordered_map<TextureBrick*, int>::iterator it = brick_pos_.find(b);
+		if (it != brick_pos_.end() &&
+			it->second < (int)(*bricks_).size() &&
+			(*bricks_)[it->second] == b)
+			return it->second;
+
+		//bricks_ has been sorted since
+		brick_pos_.clear();
+		for (int i = 0; i < (int)(*bricks_).size(); i++)
+			brick_pos_[(*bricks_)[i]] = i;
+		it = brick_pos_.find(b);
+		return it == brick_pos_.end() ? -1 : it->second;
+	}
+
+	int Texture::get_brick_id_point(int ix, int iy, int iz)
+	{
+		if (cur_lookup_->bricks.size() != (*bricks_).size())
+			index_bricks(*bricks_, *cur_lookup_);
+
+		int i = cur_lookup_->index.find(ix, iy, iz);
+		if (i < 0)
+			return -1;
+		return brick_pos(cur_lookup_->bricks[i]);
+	}
 
-		return -1;
+	void Texture::get_bricks_box(const BBox &box, vector<TextureBrick*> &result)
+	{
+		result.clear();
+		if (!box.valid())
+			return;
+		if (cur_lookup_->bricks.size() != (*bricks_).size())
+			index_bricks(*bricks_, *cur_lookup_);
+
+		//voxels around the box; the bricks are then tested with their own boxes
+		BrickIndex::Box vbox = {
+			int(floor(box.min().x()*nx_)) - 1,
+			int(floor(box.min().y()*ny_)) - 1,
+			int(floor(box.min().z()*nz_)) - 1,
+			int(ceil(box.max().x()*nx_)) + 1,
+			int(ceil(box.max().y()*ny_)) + 1,
+			int(ceil(box.max().z()*nz_)) + 1};
+		vector<int> ids;
+		cur_lookup_->index.find(vbox, ids);
+		for (size_t i = 0; i < ids.size(); i++)
+		{
+			TextureBrick *b = cur_lookup_->bricks[ids[i]];
+			if (b->bbox().overlaps(box))
+				result.push_back(b);
+		}
 	}
 
 	double Texture::get_brick_original_value(int brick_id, int i, int j, int k, bool normalize)
@@ -286,10 +337,17 @@ namespace FLIVR
 				}
 				(*bricks_)[i]->set_d(d);
 			}
-			if (TextureRenderer::get_update_order() == 0)
-				std::sort((*bricks_).begin(), (*bricks_).end(), TextureBrick::sort_asc);
-			else if (TextureRenderer::get_update_order() == 1)
-				std::sort((*bricks_).begin(), (*bricks_).end(), TextureBrick::sort_dsc);
+			//bricks_ is still in the order of the last view
+			//the order of the grid is kept by the index
+			if (TextureRenderer::get_update_order() == 0 ||
+				TextureRenderer::get_update_order() == 1)
+			{
+				if (cur_lookup_->bricks.size() != (*bricks_).size())
+					index_bricks(*bricks_, *cur_lookup_);
+				BrickOrder::sort(*bricks_, TextureBrick::sort_key,
+					TextureRenderer::get_update_order() == 0,
+					&cur_lookup_->bricks);
+			}
 
 			sort_bricks_ = false;
 		}
@@ -529,8 +587,11 @@ namespace FLIVR
 				clearPyramid();
 				bricks_ = &default_vec_;
 				build_bricks((*bricks_), size[0], size[1], size[2], numc, numb);
+				index_bricks(*bricks_, brick_lookup_);
 				set_size(size[0], size[1], size[2], numc, numb);
 			}
+			if (bricks_ == &default_vec_)
+				cur_lookup_ = &brick_lookup_;
 			brkxml_ = false;
 		}
 		else
@@ -869,6 +930,8 @@ namespace FLIVR
 		if (lv < 0 || lv >= pyramid_lv_num_ || !brkxml_ || pyramid_cur_lv_ == lv) return;
 		pyramid_cur_lv_ = lv;
 		build(pyramid_[pyramid_cur_lv_].data, 0, 0, 256, 0, 0, &pyramid_[pyramid_cur_lv_].bricks);
+		if (lv < (int)level_lookup_.size())
+			cur_lookup_ = &level_lookup_[lv];
 		set_data_file(pyramid_[pyramid_cur_lv_].filenames, pyramid_[pyramid_cur_lv_].filetype);
 		
 		int offset = 0;
@@ -910,6 +973,9 @@ namespace FLIVR
 				pyramid_[i].bricks[j]->set_nrrd(0, 1);
 			}
 		}
+		level_lookup_.resize(pyramid_.size());
+		for (int i = 0; i < pyramid_.size(); i++)
+			index_bricks(pyramid_[i].bricks, level_lookup_[i]);
 		setLevel(pyramid_lv_num_ - 1);
 		pyramid_cur_lv_ = -1;
 
@@ -922,6 +988,10 @@ namespace FLIVR
 
 		if (pyramid_.empty()) return;
 
+		cur_lookup_ = &brick_lookup_;
+		vector<BrickLookup>().swap(level_lookup_);
+		brick_pos_.clear();
+
 		for (int i=0; i<(int)pyramid_.size(); i++)
 		{
 			for (int j=0; j<(int)pyramid_[i].bricks.size(); j++)
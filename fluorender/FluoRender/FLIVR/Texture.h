@@ -33,7 +33,9 @@
 #include <fstream>
 #include "Transform.h"
 #include "TextureBrick.h"
+#include "BrickIndex.h"
 #include "Utils.h"
+#include <unordered_map>
 
 namespace FLIVR
 {
@@ -132,6 +134,8 @@ namespace FLIVR
 		vector<TextureBrick*>* get_quota_bricks();
 
 		int get_brick_id_point(int ix, int iy, int iz);
+		//bricks overlapping a box in the normalized coordinates of the volume
+		void get_bricks_box(const BBox &box, vector<TextureBrick*> &result);
 		//relative coordinate
 		double get_brick_original_value(int brick_id, int i, int j, int k, bool normalize);
 		//absolute coordinate
@@ -207,6 +211,20 @@ namespace FLIVR
 
 		//! data carved up to texture memory sized chunks.
 		vector<TextureBrick*>						*bricks_;
+		//spatial index of bricks, which are kept in the order of the index
+		//because bricks_ is sorted in place
+		struct BrickLookup
+		{
+			BrickIndex index;
+			vector<TextureBrick*> bricks;
+		};
+		BrickLookup									brick_lookup_;
+		vector<BrickLookup>							level_lookup_;
+		BrickLookup									*cur_lookup_;
+		//positions of bricks in bricks_ when they were last looked up
+		unordered_map<TextureBrick*, int>			brick_pos_;
+		static void index_bricks(const vector<TextureBrick*> &bricks, BrickLookup &lookup);
+		int brick_pos(TextureBrick* b);
 		//for limited number of bricks during interactions
 		vector<TextureBrick*>						quota_bricks_;
 		//sort texture brick
@@ -39,6 +39,16 @@
 #include "../compatibility.h"
 #include <setjmp.h>
 #include <zlib.h>
+#ifdef FLIVR_USE_LIBDEFLATE
+#include <libdeflate.h>
+#endif
+#ifdef FLIVR_USE_ZSTD
+#include <zstd.h>
+#endif
+#ifdef FLIVR_USE_LZ4
+#include <lz4.h>
+#endif
+#include <limits.h>
 #include <wx/stdpaths.h>
 
 using namespace std;
@@ -48,6 +58,7 @@ namespace FLIVR
     CURL* TextureBrick::s_curl_ = NULL;
 	CURL* TextureBrick::s_curlm_ = NULL;
 	map<wstring, wstring> TextureBrick::cache_table_ = map<wstring, wstring>();
+	wxMutex TextureBrick::listener_lock_;
     
    TextureBrick::TextureBrick (Nrrd* n0, Nrrd* n1,
          int nx, int ny, int nz, int nc, int* nb,
@@ -94,6 +105,7 @@ namespace FLIVR
       priority_ = 0;
 
 	  brkdata_ = NULL;
+	  brkmap_ = NULL;
 	  id_in_loadedbrks = -1;
 	  loading_ = false;
 	  
@@ -108,7 +120,7 @@ namespace FLIVR
       data_[0] = 0;
       data_[1] = 0;
 
-	  if (brkdata_) delete [] brkdata_;
+	  freeBrkData();
    }
 
    /* The cube is numbered in the following way
@@ -904,6 +916,13 @@ z
 	   else
 	   {
 		   int bd = tex_type_size(tex_type(c));
+		   MappedFile *mf = NULL;
+		   const char *mptr = BrickFileCache::map_brick(finfo, (size_t)nx_*(size_t)ny_*(size_t)nz_*(size_t)bd, mf);
+		   if (mptr)
+		   {
+			   set_brkdata_mapped(mptr, mf);
+			   return brkdata_;
+		   }
 		   ptr = new unsigned char[(size_t)nx_*(size_t)ny_*(size_t)nz_*(size_t)bd];
 		   if (!read_brick((char *)ptr, (size_t)nx_*(size_t)ny_*(size_t)nz_*(size_t)bd, finfo))
 		   {
@@ -1043,13 +1062,17 @@ z
 	   {
 		   if (finfo->type == BRICK_FILE_TYPE_RAW)  return raw_brick_reader_url(data, size, finfo);
 		   if (finfo->type == BRICK_FILE_TYPE_JPEG) return jpeg_brick_reader_url(data, size, finfo);
-		   if (finfo->type == BRICK_FILE_TYPE_ZLIB) return zlib_brick_reader_url(data, size, finfo);
+		   if (finfo->type == BRICK_FILE_TYPE_ZLIB ||
+			   finfo->type == BRICK_FILE_TYPE_ZSTD ||
+			   finfo->type == BRICK_FILE_TYPE_LZ4) return compressed_brick_reader_url(data, size, finfo);
 	   }
 	   else
 	   {
 		   if (finfo->type == BRICK_FILE_TYPE_RAW)  return raw_brick_reader(data, size, finfo);
 		   if (finfo->type == BRICK_FILE_TYPE_JPEG) return jpeg_brick_reader(data, size, finfo);
-		   if (finfo->type == BRICK_FILE_TYPE_ZLIB) return zlib_brick_reader(data, size, finfo);
+		   if (finfo->type == BRICK_FILE_TYPE_ZLIB ||
+			   finfo->type == BRICK_FILE_TYPE_ZSTD ||
+			   finfo->type == BRICK_FILE_TYPE_LZ4) return compressed_brick_reader(data, size, finfo);
 	   }
 
 	   return false;
@@ -1209,30 +1232,177 @@ z
 		   }
 	   }
 
-	   ifstream ifs;
 	   wstring fn = finfo->cached ? finfo->cache_filename : finfo->filename;
-	   ifs.open(ws2s(fn), ios::binary);
-	   if (!ifs) return false;
 	   size_t zsize = finfo->datasize;
-	   if (zsize <= 0) zsize = (size_t)ifs.seekg(0, std::ios::end).tellg();
+	   if (finfo->datasize <= 0)
+	   {
+		   long long fsize = BrickFileCache::file_size(fn);
+		   if (fsize <= finfo->offset) return false;
+		   zsize = (size_t)(fsize - finfo->offset);
+	   }
 	   char *zdata = new char[zsize];
-	   ifs.seekg(finfo->offset, ios_base::beg);
-	   ifs.read((char*)zdata, zsize);
-	   if (ifs) ifs.close();
+	   if (!BrickFileCache::read(fn, zdata, zsize, finfo->offset))
+	   {
+		   delete [] zdata;
+		   return false;
+	   }
 	   data = zdata;
 	   readsize = zsize;
 
 	   return true;
    }
 
-   bool TextureBrick::decompress_brick(char *out, char* in, size_t out_size, size_t in_size, int type)
+   bool TextureBrick::decompress_brick(char *out, char* in, size_t out_size, size_t in_size, int type, int filter)
    {
 	   if (type == BRICK_FILE_TYPE_JPEG) return jpeg_decompressor(out, in, out_size, in_size);
-	   if (type == BRICK_FILE_TYPE_ZLIB) return zlib_decompressor(out, in, out_size, in_size);
 
+	   //filtered bricks are decoded into a scratch buffer and unfiltered into out
+	   char *dst = filter != BRICK_FILE_FILTER_NONE ? new char[out_size] : out;
+	   bool result = false;
+	   if (type == BRICK_FILE_TYPE_ZLIB) result = zlib_decompressor(dst, in, out_size, in_size);
+	   else if (type == BRICK_FILE_TYPE_ZSTD) result = zstd_decompressor(dst, in, out_size, in_size);
+	   else if (type == BRICK_FILE_TYPE_LZ4) result = lz4_decompressor(dst, in, out_size, in_size);
+
+	   if (dst != out)
+	   {
+		   if (result) remove_filter(out, dst, out_size, filter);
+		   delete [] dst;
+	   }
+
+	   return result;
+   }
+
+   bool TextureBrick::compress_brick(std::vector<char> &out, const char* in, size_t in_size, int type, int filter, int level)
+   {
+	   std::vector<char> filtered;
+	   if (filter != BRICK_FILE_FILTER_NONE)
+	   {
+		   filtered.resize(in_size);
+		   apply_filter(in_size ? &filtered[0] : NULL, in, in_size, filter);
+		   in = in_size ? &filtered[0] : NULL;
+	   }
+
+	   if (type == BRICK_FILE_TYPE_ZLIB)
+	   {
+		   uLongf len = compressBound((uLong)in_size);
+		   out.resize(len);
+		   if (compress2((Bytef*)&out[0], &len, (const Bytef*)in, (uLong)in_size,
+			   level < 0 ? Z_DEFAULT_COMPRESSION : level) != Z_OK)
+			   return false;
+		   out.resize(len);
+		   return true;
+	   }
+#ifdef FLIVR_USE_ZSTD
+	   if (type == BRICK_FILE_TYPE_ZSTD)
+	   {
+		   out.resize(ZSTD_compressBound(in_size));
+		   size_t len = ZSTD_compress(&out[0], out.size(), in, in_size, level < 0 ? 3 : level);
+		   if (ZSTD_isError(len))
+			   return false;
+		   out.resize(len);
+		   return true;
+	   }
+#endif
+#ifdef FLIVR_USE_LZ4
+	   if (type == BRICK_FILE_TYPE_LZ4)
+	   {
+		   if (in_size > (size_t)LZ4_MAX_INPUT_SIZE)
+			   return false;
+		   out.resize(LZ4_compressBound((int)in_size));
+		   int len = LZ4_compress_default(in, &out[0], (int)in_size, (int)out.size());
+		   if (len <= 0)
+			   return false;
+		   out.resize(len);
+		   return true;
+	   }
+#endif
+	   return false;
+   }
+
+   bool TextureBrick::codec_available(int type)
+   {
+	   switch (type)
+	   {
+	   case BRICK_FILE_TYPE_RAW:
+	   case BRICK_FILE_TYPE_JPEG:
+	   case BRICK_FILE_TYPE_ZLIB:
+		   return true;
+#ifdef FLIVR_USE_ZSTD
+	   case BRICK_FILE_TYPE_ZSTD:
+		   return true;
+#endif
+#ifdef FLIVR_USE_LZ4
+	   case BRICK_FILE_TYPE_LZ4:
+		   return true;
+#endif
+	   }
 	   return false;
    }
 
+   void TextureBrick::apply_filter(char *out, const char *in, size_t size, int filter)
+   {
+	   size_t num = size / 2;
+	   const unsigned short *src = (const unsigned short *)in;
+	   std::vector<unsigned short> delta;
+	   if (filter & BRICK_FILE_FILTER_DELTA)
+	   {
+		   delta.resize(num);
+		   unsigned short prev = 0;
+		   for (size_t i = 0; i < num; i++)
+		   {
+			   delta[i] = (unsigned short)(src[i] - prev);
+			   prev = src[i];
+		   }
+		   if (num) src = &delta[0];
+	   }
+
+	   unsigned char *dst = (unsigned char *)out;
+	   const unsigned char *bsrc = (const unsigned char *)src;
+	   if (filter & BRICK_FILE_FILTER_SHUFFLE)
+	   {
+		   for (size_t i = 0; i < num; i++)
+		   {
+			   dst[i] = bsrc[2*i];
+			   dst[num+i] = bsrc[2*i+1];
+		   }
+	   }
+	   else
+		   memcpy(dst, bsrc, num*2);
+	   //an odd trailing byte is stored as is
+	   if (size & 1)
+		   dst[size-1] = ((const unsigned char *)in)[size-1];
+   }
+
+   void TextureBrick::remove_filter(char *out, const char *in, size_t size, int filter)
+   {
+	   size_t num = size / 2;
+	   const unsigned char *src = (const unsigned char *)in;
+	   unsigned char *dst = (unsigned char *)out;
+	   if (filter & BRICK_FILE_FILTER_SHUFFLE)
+	   {
+		   for (size_t i = 0; i < num; i++)
+		   {
+			   dst[2*i] = src[i];
+			   dst[2*i+1] = src[num+i];
+		   }
+	   }
+	   else
+		   memcpy(dst, src, num*2);
+	   if (size & 1)
+		   dst[size-1] = src[size-1];
+
+	   if (filter & BRICK_FILE_FILTER_DELTA)
+	   {
+		   unsigned short *words = (unsigned short *)out;
+		   unsigned short prev = 0;
+		   for (size_t i = 0; i < num; i++)
+		   {
+			   prev = (unsigned short)(prev + words[i]);
+			   words[i] = prev;
+		   }
+	   }
+   }
+
    struct my_error_mgr {
 	   struct jpeg_error_mgr pub;	/* "public" fields */
 
@@ -1292,8 +1462,36 @@ z
 	   return true;
    }
 
+   const char* TextureBrick::zlib_backend()
+   {
+#ifdef FLIVR_USE_LIBDEFLATE
+	   return "libdeflate";
+#else
+	   return "zlib";
+#endif
+   }
+
+#ifdef FLIVR_USE_LIBDEFLATE
+   //a decompressor keeps no state between calls, so each thread reuses one
+   struct DeflateDecompressor
+   {
+	   libdeflate_decompressor *dc;
+	   DeflateDecompressor() : dc(libdeflate_alloc_decompressor()) {}
+	   ~DeflateDecompressor() { if (dc) libdeflate_free_decompressor(dc); }
+   };
+   static thread_local DeflateDecompressor s_deflate_;
+#endif
+
    bool TextureBrick::zlib_decompressor(char *out, char* in, size_t out_size, size_t in_size)
    {
+#ifdef FLIVR_USE_LIBDEFLATE
+	   //the brick size is known, so the whole stream is inflated in one call
+	   libdeflate_decompressor *dc = s_deflate_.dc;
+	   if (!dc) return false;
+	   size_t actual = 0;
+	   libdeflate_result ret = libdeflate_zlib_decompress(dc, in, in_size, out, out_size, &actual);
+	   return ret == LIBDEFLATE_SUCCESS && actual == out_size;
+#else
 	   try
 	   {
 		   z_stream zInfo = {0};
@@ -1322,10 +1520,37 @@ z
 	   }
 
 	   return true;
+#endif
+   }
+
+   bool TextureBrick::zstd_decompressor(char *out, char* in, size_t out_size, size_t in_size)
+   {
+#ifdef FLIVR_USE_ZSTD
+	   size_t ret = ZSTD_decompress(out, out_size, in, in_size);
+	   return !ZSTD_isError(ret) && ret == out_size;
+#else
+	   cerr << "zstd bricks are not supported by this build" << endl;
+	   return false;
+#endif
+   }
+
+   bool TextureBrick::lz4_decompressor(char *out, char* in, size_t out_size, size_t in_size)
+   {
+#ifdef FLIVR_USE_LZ4
+	   if (in_size > INT_MAX || out_size > INT_MAX)
+		   return false;
+	   int ret = LZ4_decompress_safe(in, out, (int)in_size, (int)out_size);
+	   return ret >= 0 && (size_t)ret == out_size;
+#else
+	   cerr << "lz4 bricks are not supported by this build" << endl;
+	   return false;
+#endif
    }
 
    void TextureBrick::delete_all_cache_files()
    {
+	   //release the handles so the files can be removed
+	   BrickFileCache::close_all();
 	   for(auto itr = cache_table_.begin(); itr != cache_table_.end(); ++itr)
 	   {
 		   wxString tmp = itr->second;
@@ -1338,14 +1563,10 @@ z
    {
 	   try
 	   {
-		   ifstream ifs;
-		   ifs.open(ws2s(finfo->filename), ios::binary);
-		   if (!ifs) return false;
 		   if (finfo->datasize > 0 && size != finfo->datasize) return false;
 		   size_t read_size = finfo->datasize > 0 ? finfo->datasize : size;
-		   ifs.seekg(finfo->offset, ios_base::beg); 
-		   ifs.read(data, read_size);
-		   if (ifs) ifs.close();
+		   if (!BrickFileCache::read(finfo->filename, data, read_size, finfo->offset))
+			   return false;
 /*
 		   FILE* fp = fopen(ws2s(finfo->filename).c_str(), "rb");
 		   if (!fp) return false;
@@ -1410,46 +1631,24 @@ z
 
    bool TextureBrick::jpeg_brick_reader(char* data, size_t size, const FileLocInfo* finfo)
    {
-	   jpeg_decompress_struct cinfo;
-	   struct my_error_mgr jerr;
-	   
-       FILE *fp = 0;
-	   if (!WFOPEN(&fp, finfo->filename.c_str(), L"rb"))
-           return false;
-
-	   cinfo.err = jpeg_std_error(&jerr.pub);
-	   jerr.pub.error_exit = my_error_exit;
-	   /* Establish the setjmp return context for my_error_exit to use. */
-	   if (setjmp(jerr.setjmp_buffer)) {
-		   /* If we get here, the JPEG code has signaled an error.
-		   * We need to clean up the JPEG object, close the input file, and return.
-		   */
-		   jpeg_destroy_decompress(&cinfo);
-		   fclose(fp);
-		   return false;
+	   size_t jsize = finfo->datasize;
+	   if (finfo->datasize <= 0)
+	   {
+		   long long fsize = BrickFileCache::file_size(finfo->filename);
+		   if (fsize <= finfo->offset) return false;
+		   jsize = (size_t)(fsize - finfo->offset);
 	   }
-	   jpeg_create_decompress(&cinfo);
-
-	   fseek(fp, finfo->offset, SEEK_SET);
-	   jpeg_stdio_src(&cinfo, fp);
-	   jpeg_read_header(&cinfo, TRUE);
-	   jpeg_start_decompress(&cinfo);
-	   
-	   if(cinfo.jpeg_color_space != JCS_GRAYSCALE || cinfo.output_components != 1) longjmp(jerr.setjmp_buffer, 1);
-	   
-	   size_t jpgsize = cinfo.output_width * cinfo.output_height;
-	   if (jpgsize != size) longjmp(jerr.setjmp_buffer, 1);
-	   unsigned char *ptr[1];
-	   ptr[0] = (unsigned char *)data;
-	   while (cinfo.output_scanline < cinfo.output_height) {
-		   ptr[0] = (unsigned char *)data + cinfo.output_scanline * cinfo.output_width;
-		   jpeg_read_scanlines(&cinfo, ptr, 1);
+	   char *jdata = new char[jsize];
+	   if (!BrickFileCache::read(finfo->filename, jdata, jsize, finfo->offset))
+	   {
+		   delete [] jdata;
+		   return false;
 	   }
 
-	   jpeg_destroy_decompress(&cinfo);
-	   fclose(fp);
+	   bool result = jpeg_decompressor(data, jdata, size, jsize);
+	   delete [] jdata;
 	   
-	   return true;
+	   return result;
    }
 
    bool TextureBrick::jpeg_brick_reader_url(char* data, size_t size, const FileLocInfo* finfo)
@@ -1515,40 +1714,29 @@ z
 	   return true;
    }
 
-   bool TextureBrick::zlib_brick_reader(char* data, size_t size, const FileLocInfo* finfo)
+   bool TextureBrick::compressed_brick_reader(char* data, size_t size, const FileLocInfo* finfo)
    {
 	   try
 	   {
-		   ifstream ifs;
-		   ifs.open(ws2s(finfo->filename), ios::binary);
-		   if (!ifs) return false;
-		   
 		   size_t zsize = finfo->datasize;
-		   if (zsize <= 0) zsize = (size_t)ifs.seekg(0, std::ios::end).tellg();
+		   if (finfo->datasize <= 0)
+		   {
+			   long long fsize = BrickFileCache::file_size(finfo->filename);
+			   if (fsize <= finfo->offset) return false;
+			   zsize = (size_t)(fsize - finfo->offset);
+		   }
 		   
 		   unsigned char *zdata = new unsigned char[zsize];
-		   ifs.seekg(finfo->offset, ios_base::beg);
-		   ifs.read((char*)zdata, zsize);
-		   if (ifs) ifs.close();
-
-		   z_stream zInfo = {0};
-		   zInfo.total_in  = zInfo.avail_in  = zsize;
-		   zInfo.total_out = zInfo.avail_out = size;
-		   zInfo.next_in  = zdata;
-		   zInfo.next_out = (Bytef *)data;
-
-		   int nErr, nOut = -1;
-		   nErr = inflateInit( &zInfo );
-		   if ( nErr == Z_OK ) {
-			   nErr = inflate( &zInfo, Z_FINISH );
-			   if ( nErr == Z_STREAM_END ) {
-				   nOut = zInfo.total_out;
-			   }
+		   if (!BrickFileCache::read(finfo->filename, (char*)zdata, zsize, finfo->offset))
+		   {
+			   delete [] zdata;
+			   return false;
 		   }
-		   inflateEnd( &zInfo );
+
+		   bool result = decompress_brick(data, (char*)zdata, size, zsize, finfo->type, finfo->filter);
 		   delete [] zdata;
 
-		   if (nOut != size || nErr != Z_STREAM_END)
+		   if (!result)
 			   return false;
 	   }
 	   catch (std::exception &e)
@@ -1560,14 +1748,91 @@ z
 	   return true;
    }
 
-   bool TextureBrick::zlib_brick_reader_url(char* data, size_t size, const FileLocInfo* finfo)
+   bool TextureBrick::compressed_brick_reader_url(char* data, size_t size, const FileLocInfo* finfo)
    {
-	   return true;
+	   CURLcode ret;
+	   struct MemoryStruct chunk;
+	   chunk.memory = (char *)malloc(1);
+	   chunk.size = 0;
+
+	   if (s_curl_ == NULL) {
+		   cerr << "curl_easy_init() failed" << endl;
+		   free(chunk.memory);
+		   return false;
+	   }
+	   curl_easy_reset(s_curl_);
+	   curl_easy_setopt(s_curl_, CURLOPT_URL, wxString::wxString(finfo->filename).ToStdString().c_str());
+	   curl_easy_setopt(s_curl_, CURLOPT_TIMEOUT, 10L);
+	   curl_easy_setopt(s_curl_, CURLOPT_USERAGENT, "libcurl-agent/1.0");
+	   curl_easy_setopt(s_curl_, CURLOPT_WRITEFUNCTION, WriteMemoryCallback);
+	   curl_easy_setopt(s_curl_, CURLOPT_WRITEDATA, &chunk);
+	   curl_easy_setopt(s_curl_, CURLOPT_SSL_VERIFYPEER, 0);
+	   ret = curl_easy_perform(s_curl_);
+	   if (ret != CURLE_OK) {
+		   cerr << "curl_easy_perform() failed." << curl_easy_strerror(ret) << endl;
+		   free(chunk.memory);
+		   return false;
+	   }
+
+	   //the brick may be one of several packed in the file
+	   char *zdata = chunk.memory;
+	   size_t zsize = chunk.size;
+	   if (finfo->datasize > 0 && finfo->offset >= 0 &&
+		   (size_t)finfo->offset + finfo->datasize <= chunk.size)
+	   {
+		   zdata += finfo->offset;
+		   zsize = finfo->datasize;
+	   }
+
+	   //same codec switch as local bricks
+	   bool result = decompress_brick(data, zdata, size, zsize, finfo->type, finfo->filter);
+	   free(chunk.memory);
+
+	   return result;
+   }
+
+   void TextureBrick::add_state_listener(BrickStateListener* l)
+   {
+	   wxMutexLocker lock(listener_lock_);
+	   for (size_t i = 0; i < listeners_.size(); i++)
+		   if (listeners_[i] == l)
+			   return;
+	   listeners_.push_back(l);
+   }
+
+   void TextureBrick::remove_state_listener(BrickStateListener* l)
+   {
+	   wxMutexLocker lock(listener_lock_);
+	   for (size_t i = 0; i < listeners_.size(); i++)
+	   {
+		   if (listeners_[i] == l)
+		   {
+			   listeners_.erase(listeners_.begin() + i);
+			   return;
+		   }
+	   }
+   }
+
+   void TextureBrick::notify_state()
+   {
+	   //a leaf lock: the listeners take no other lock while it is held,
+	   //so it is safe under the lock of any loader
+	   wxMutexLocker lock(listener_lock_);
+	   for (size_t i = 0; i < listeners_.size(); i++)
+		   listeners_[i]->brick_state_changed(this);
    }
 
    void TextureBrick::freeBrkData()
    {
-	   if (brkdata_) delete [] brkdata_;
+	   //an upload may still be copying the data
+	   if (brkdata_)
+		   TextureUploader::wait_source(brkdata_,
+			   (size_t)nx_*(size_t)ny_*(size_t)nz_*(size_t)tex_type_size(tex_type(0)));
+	   if (brkmap_)
+		   BrickFileCache::unmap_brick(brkmap_);
+	   else if (brkdata_)
+		   delete [] brkdata_;
 	   brkdata_ = NULL;
+	   brkmap_ = NULL;
    }
 } // end namespace FLIVR
@@ -44,6 +44,7 @@
 #include <stdint.h>
 #include <map>
 #include <curl/curl.h>
+#include "BrickFileCache.h"
 
 namespace FLIVR {
 
@@ -65,6 +66,13 @@ namespace FLIVR {
 #define BRICK_FILE_TYPE_RAW		1
 #define BRICK_FILE_TYPE_JPEG	2
 #define BRICK_FILE_TYPE_ZLIB	3
+#define BRICK_FILE_TYPE_ZSTD	4
+#define BRICK_FILE_TYPE_LZ4		5
+
+	//reversible pre-filters on 16-bit words, applied before compression
+#define BRICK_FILE_FILTER_NONE		0
+#define BRICK_FILE_FILTER_SHUFFLE	1	//low bytes first, then high bytes
+#define BRICK_FILE_FILTER_DELTA		2	//difference to the previous word
 
 	
 	class FileLocInfo {
@@ -75,16 +83,18 @@ namespace FLIVR {
 			offset = 0;
 			datasize = 0;
 			type = 0;
+			filter = BRICK_FILE_FILTER_NONE;
 			isurl = false;
 			cached = false;
 			cache_filename = L"";
 		}
-		FileLocInfo(std::wstring filename_, int offset_, int datasize_, int type_, bool isurl_)
+		FileLocInfo(std::wstring filename_, int offset_, int datasize_, int type_, bool isurl_, int filter_ = BRICK_FILE_FILTER_NONE)
 		{
 			filename = filename_;
 			offset = offset_;
 			datasize = datasize_;
 			type = type_;
+			filter = filter_;
 			isurl = isurl_;
 			cached = false;
 			cache_filename = L"";
@@ -95,6 +105,7 @@ namespace FLIVR {
 			offset = copy.offset;
 			datasize = copy.datasize;
 			type = copy.type;
+			filter = copy.filter;
 			isurl = copy.isurl;
 			cached = copy.cached;
 			cache_filename = copy.cache_filename;
@@ -103,12 +114,25 @@ namespace FLIVR {
 		std::wstring filename;
 		int offset;
 		int datasize;
-		int type; //1-raw; 2-jpeg; 3-zlib;
+		int type; //1-raw; 2-jpeg; 3-zlib; 4-zstd; 5-lz4
+		int filter; //BRICK_FILE_FILTER_* flags
 		bool isurl;
 		bool cached;
 		std::wstring cache_filename;
 	};
 
+	class TextureBrick;
+
+	//told when a brick is drawn, shown, hidden or done loading
+	//called on the thread that changed the brick, which may hold the lock
+	//of a loader, so a listener only notes the brick under a lock of its own
+	class BrickStateListener
+	{
+	public:
+		virtual ~BrickStateListener() {}
+		virtual void brick_state_changed(TextureBrick* brick) = 0;
+	};
+
 	class TextureBrick
 	{
 	public:
@@ -168,9 +192,23 @@ namespace FLIVR {
 		virtual int sz();
 
 		inline void set_drawn(int mode, bool val)
-		{ if (mode>=0 && mode<TEXTURE_RENDER_MODES) drawn_[mode] = val; }
+		{
+			if (mode>=0 && mode<TEXTURE_RENDER_MODES && drawn_[mode] != val)
+			{
+				drawn_[mode] = val;
+				notify_state();
+			}
+		}
 		inline void set_drawn(bool val)
-		{ for (int i=0; i<TEXTURE_RENDER_MODES; i++) drawn_[i] = val; }
+		{
+			bool changed = false;
+			for (int i=0; i<TEXTURE_RENDER_MODES; i++)
+			{
+				changed = changed || drawn_[i] != val;
+				drawn_[i] = val;
+			}
+			if (changed) notify_state();
+		}
 		inline bool drawn(int mode)
 		{ if (mode>=0 && mode<TEXTURE_RENDER_MODES) return drawn_[mode]; else return false;}
 
@@ -221,6 +259,8 @@ namespace FLIVR {
 		{ return b1->d_ > b2->d_; }
 		static bool sort_dsc(const TextureBrick* b1, const TextureBrick* b2)
 		{ return b2->d_ > b1->d_; }
+		static double sort_key(const TextureBrick* b)
+		{ return b->d_; }
 
 		double get_d() {return d_;}
 
@@ -236,7 +276,8 @@ namespace FLIVR {
 		void freeBrkData();
 		bool isLoaded() {return brkdata_ ? true : false;};
 		bool isLoading() {return loading_;}
-		void set_loading_state(bool val) {loading_ = val;}
+		void set_loading_state(bool val)
+		{ if (loading_ != val) {loading_ = val; notify_state();} }
 		void set_id_in_loadedbrks(int id) {id_in_loadedbrks = id;};
 		int get_id_in_loadedbrks() {return id_in_loadedbrks;}
 		int getID() {return findex_;}
@@ -259,7 +300,13 @@ namespace FLIVR {
 		std::vector<uint32_t> *get_index_list() {return &index_;}
 		std::vector<int> *get_v_size_list() {return &size_v_;}
 
-		void set_disp(bool disp) {disp_ = disp;}
+		void set_disp(bool disp)
+		{ if (disp_ != disp) {disp_ = disp; notify_state();} }
+
+		//the caches of all loaders that hold the data
+		void add_state_listener(BrickStateListener* l);
+		void remove_state_listener(BrickStateListener* l);
+		void notify_state();
 		bool get_disp() {return disp_;}
         
         static void setCURL(CURL *c) {s_curl_ = c;}
@@ -269,10 +316,22 @@ namespace FLIVR {
 		GLenum tex_type_aux(Nrrd* n);
 		bool read_brick(char* data, size_t size, const FileLocInfo* finfo);
 		void set_brkdata(void *brkdata) {brkdata_ = brkdata;}
+		//brick data that points into a mapped file (read-only, released with the mapping)
+		void set_brkdata_mapped(const void *brkdata, MappedFile *file) {brkdata_ = (void *)brkdata; brkmap_ = file;}
+		bool isMapped() {return brkmap_ ? true : false;}
 		static bool read_brick_without_decomp(char* &data, size_t &readsize, FileLocInfo* finfo, wxThread *th=NULL);
-		static bool decompress_brick(char *out, char* in, size_t out_size, size_t in_size, int type);
+		static bool decompress_brick(char *out, char* in, size_t out_size, size_t in_size, int type, int filter = BRICK_FILE_FILTER_NONE);
+		//encode a brick for the zlib, zstd and lz4 file types; level < 0 uses the codec default
+		static bool compress_brick(std::vector<char> &out, const char* in, size_t in_size, int type, int filter = BRICK_FILE_FILTER_NONE, int level = -1);
+		static bool codec_available(int type);
 		static bool jpeg_decompressor(char *out, char* in, size_t out_size, size_t in_size);
 		static bool zlib_decompressor(char *out, char* in, size_t out_size, size_t in_size);
+		//inflate implementation selected at build time (FLIVR_USE_LIBDEFLATE)
+		static const char* zlib_backend();
+		static bool zstd_decompressor(char *out, char* in, size_t out_size, size_t in_size);
+		static bool lz4_decompressor(char *out, char* in, size_t out_size, size_t in_size);
+		static void apply_filter(char *out, const char *in, size_t size, int filter);
+		static void remove_filter(char *out, const char *in, size_t size, int filter);
 		static void delete_all_cache_files();
 
 		void prevent_tex_deletion(bool val) {prevent_tex_deletion_ = val;}
@@ -283,10 +342,10 @@ namespace FLIVR {
 		
 		bool raw_brick_reader(char* data, size_t size, const FileLocInfo* finfo);
 		bool jpeg_brick_reader(char* data, size_t size, const FileLocInfo* finfo);
-		bool zlib_brick_reader(char* data, size_t size, const FileLocInfo* finfo);
+		bool compressed_brick_reader(char* data, size_t size, const FileLocInfo* finfo);
 		bool raw_brick_reader_url(char* data, size_t size, const FileLocInfo* finfo);
 		bool jpeg_brick_reader_url(char* data, size_t size, const FileLocInfo* finfo);
-		bool zlib_brick_reader_url(char* data, size_t size, const FileLocInfo* finfo);
+		bool compressed_brick_reader_url(char* data, size_t size, const FileLocInfo* finfo);
 
 		static size_t WriteMemoryCallback(void *contents, size_t size, size_t nmemb, void *userp);
 		static size_t WriteFileCallback(void *contents, size_t size, size_t nmemb, void *userp);
@@ -329,6 +388,7 @@ namespace FLIVR {
 		long long offset_;
 		long long fsize_;
 		void *brkdata_;
+		MappedFile *brkmap_;
 		bool loading_;
 		int id_in_loadedbrks;
 
@@ -349,6 +409,8 @@ namespace FLIVR {
 		vector<int> size_integ_i_;
 
 		bool disp_;
+		vector<BrickStateListener*> listeners_;
+		static wxMutex listener_lock_;
         
         static CURL *s_curl_;
 		static CURLM *s_curlm_;
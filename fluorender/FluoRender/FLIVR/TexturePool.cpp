@@ -0,0 +1,228 @@
+//
+//  For more information, please see: http://software.sci.utah.edu
+//
+//  The MIT License
+//
+//  Copyright (c) 2004 Scientific Computing and Imaging Institute,
+//  University of Utah.
+//
+//
+//  Permission is hereby granted, free of charge, to any person obtaining a
+//  copy of this software and associated documentation files (the "Software"),
+//  to deal in the Software without restriction, including without limitation
+//  the rights to use, copy, modify, merge, publish, distribute, sublicense,
+//  and/or sell copies of the Software, and to permit persons to whom the
+//  Software is furnished to do so, subject to the following conditions:
+//
+//  The above copyright notice and this permission notice shall be included
+//  in all copies or substantial portions of the Software.
+//
+//  THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS
+//  OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+//  FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL
+//  THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+//  LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+//  FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER
+//  DEALINGS IN THE SOFTWARE.
+//
+
+#include <FLIVR/TexturePool.h>
+#include <boost/chrono.hpp>
+
+namespace FLIVR
+{
+	TexturePool::TexturePool() :
+		clock_(0)
+	{
+	}
+
+	int TexturePool::find(TextureBrick* brick, int comp) const
+	{
+		Key key = {brick, comp};
+		std::unordered_map<Key, int, KeyHash>::const_iterator it = index_.find(key);
+		return it == index_.end() ? -1 : it->second;
+	}
+
+	int TexturePool::add(const TexParam &param)
+	{
+		int slot = find(param.brick, param.comp);
+		if (slot < 0)
+		{
+			if (free_.empty())
+			{
+				slot = (int)slots_.size();
+				slots_.push_back(param);
+			}
+			else
+			{
+				slot = free_.back();
+				free_.pop_back();
+			}
+			Key key = {param.brick, param.comp};
+			index_[key] = slot;
+		}
+		slots_[slot] = param;
+		touch(slot);
+		return slot;
+	}
+
+	void TexturePool::remove(int slot)
+	{
+		if (slot < 0 || slot >= (int)slots_.size() || !used(slot))
+			return;
+		Key key = {slots_[slot].brick, slots_[slot].comp};
+		index_.erase(key);
+		slots_[slot] = TexParam();
+		free_.push_back(slot);
+	}
+
+	void TexturePool::clear()
+	{
+		slots_.clear();
+		free_.clear();
+		index_.clear();
+	}
+
+	void TexturePool::benchmark(int pool_size, int lookups,
+		double &hash_ns, double &scan_ns)
+	{
+		typedef boost::chrono::high_resolution_clock BenchClock;
+
+		hash_ns = scan_ns = 0.0;
+		if (pool_size <= 0 || lookups <= 0)
+			return;
+
+		//stand-ins for bricks: only their addresses are used
+		std::vector<char> bricks(pool_size);
+		TexturePool pool;
+		std::vector<TexParam> scan_pool;
+		for (int i = 0; i < pool_size; i++)
+		{
+			TexParam param(0, 256, 256, 64, 1, GL_UNSIGNED_BYTE, i+1);
+			param.brick = (TextureBrick*)&bricks[i];
+			pool.add(param);
+			scan_pool.push_back(param);
+		}
+
+		//the same pseudo random order of bricks for both
+		std::vector<TextureBrick*> keys(lookups);
+		unsigned int seed = 12345;
+		for (int i = 0; i < lookups; i++)
+		{
+			seed = seed * 1103515245u + 12345u;
+			keys[i] = (TextureBrick*)&bricks[(seed >> 8) % pool_size];
+		}
+
+		long long found = 0;
+		BenchClock::time_point t0 = BenchClock::now();
+		for (int i = 0; i < lookups; i++)
+			found += pool.find(keys[i], 0);
+		BenchClock::time_point t1 = BenchClock::now();
+		for (int i = 0; i < lookups; i++)
+		{
+			int idx = -1;
+			for (unsigned int j = 0; j < scan_pool.size() && idx < 0; j++)
+			{
+				if (scan_pool[j].id != 0
+					&& scan_pool[j].brick == keys[i]
+					&& scan_pool[j].comp == 0
+					&& scan_pool[j].nx == 256
+					&& scan_pool[j].ny == 256
+					&& scan_pool[j].nz == 64
+					&& scan_pool[j].nb == 1
+					&& scan_pool[j].textype == GL_UNSIGNED_BYTE)
+					idx = j;
+			}
+			found -= idx;
+		}
+		BenchClock::time_point t2 = BenchClock::now();
+
+		//both searches find the same slots
+		if (found != 0)
+			return;
+		hash_ns = boost::chrono::duration<double, boost::nano>(t1 - t0).count() / lookups;
+		scan_ns = boost::chrono::duration<double, boost::nano>(t2 - t1).count() / lookups;
+	}
+
+	TextureRecycler::TextureRecycler() :
+		bytes_(0),
+		max_bytes_(0),
+		hits_(0),
+		misses_(0)
+	{
+	}
+
+	void TextureRecycler::put(unsigned int id, int nx, int ny, int nz, GLint internal_format,
+		std::size_t bytes, std::vector<unsigned int> &evicted)
+	{
+		if (!id)
+			return;
+		if (bytes > max_bytes_)
+		{
+			evicted.push_back(id);
+			return;
+		}
+
+		Idle idle;
+		idle.id = id;
+		idle.key.nx = nx;
+		idle.key.ny = ny;
+		idle.key.nz = nz;
+		idle.key.internal_format = internal_format;
+		idle.bytes = bytes;
+		idle_.push_front(idle);
+		buckets_[idle.key].push_back(idle_.begin());
+		bytes_ += bytes;
+		trim(max_bytes_, evicted);
+	}
+
+	unsigned int TextureRecycler::get(int nx, int ny, int nz, GLint internal_format)
+	{
+		Key key = {nx, ny, nz, internal_format};
+		std::map<Key, std::vector<IdleIter> >::iterator it = buckets_.find(key);
+		if (it == buckets_.end())
+		{
+			misses_++;
+			return 0;
+		}
+
+		//the most recently released one
+		IdleIter idle = it->second.back();
+		it->second.pop_back();
+		if (it->second.empty())
+			buckets_.erase(it);
+		unsigned int id = idle->id;
+		bytes_ -= idle->bytes;
+		idle_.erase(idle);
+		hits_++;
+		return id;
+	}
+
+	void TextureRecycler::trim(std::size_t bytes, std::vector<unsigned int> &evicted)
+	{
+		while (bytes_ > bytes && !idle_.empty())
+		{
+			IdleIter oldest = --idle_.end();
+			std::map<Key, std::vector<IdleIter> >::iterator it = buckets_.find(oldest->key);
+			if (it != buckets_.end())
+			{
+				//the oldest of a bucket is its first
+				std::vector<IdleIter> &bucket = it->second;
+				for (std::size_t i = 0; i < bucket.size(); i++)
+				{
+					if (bucket[i] == oldest)
+					{
+						bucket.erase(bucket.begin() + i);
+						break;
+					}
+				}
+				if (bucket.empty())
+					buckets_.erase(it);
+			}
+			evicted.push_back(oldest->id);
+			bytes_ -= oldest->bytes;
+			idle_.erase(oldest);
+		}
+	}
+
+} // namespace FLIVR
@@ -0,0 +1,203 @@
+//
+//  For more information, please see: http://software.sci.utah.edu
+//
+//  The MIT License
+//
+//  Copyright (c) 2004 Scientific Computing and Imaging Institute,
+//  University of Utah.
+//
+//
+//  Permission is hereby granted, free of charge, to any person obtaining a
+//  copy of this software and associated documentation files (the "Software"),
+//  to deal in the Software without restriction, including without limitation
+//  the rights to use, copy, modify, merge, publish, distribute, sublicense,
+//  and/or sell copies of the Software, and to permit persons to whom the
+//  Software is furnished to do so, subject to the following conditions:
+//
+//  The above copyright notice and this permission notice shall be included
+//  in all copies or substantial portions of the Software.
+//
+//  THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS
+//  OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+//  FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL
+//  THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+//  LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+//  FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER
+//  DEALINGS IN THE SOFTWARE.
+//
+
+#ifndef SLIVR_TexturePool_h
+#define SLIVR_TexturePool_h
+
+#include <GL/glew.h>
+
+#include <cstddef>
+#include <functional>
+#include <vector>
+#include <list>
+#include <map>
+#include <unordered_map>
+
+namespace FLIVR
+{
+	class TextureBrick;
+
+	struct TexParam
+	{
+		int nx, ny, nz, nb;
+		unsigned int id;
+		TextureBrick *brick;
+		int comp;
+		GLenum textype;
+		bool delayed_del;
+		unsigned long long last_use;	//TexturePool clock at the last lookup
+		GLint internal_format;			//format of the storage
+		bool allocated;					//the storage exists
+		TexParam() :
+			nx(0), ny(0), nz(0), nb(0),
+			id(0), brick(0), comp(0),
+			textype(GL_UNSIGNED_BYTE),
+			delayed_del(false),
+			last_use(0),
+			internal_format(0),
+			allocated(false)
+		{}
+		TexParam(int c, int x,
+			int y, int z,
+			int b, GLenum f,
+			unsigned int i) :
+			nx(x), ny(y),
+			nz(z), nb(b), id(i),
+			brick(0), comp(c), textype(f),
+			delayed_del(false),
+			last_use(0),
+			internal_format(0),
+			allocated(false)
+		{}
+	};
+
+	//the resident gl textures of bricks
+	//entries live in slots that keep their index until they are removed,
+	//and removed slots are reused. a hash from brick and component finds
+	//the slot of a brick; mask and label textures are components of their
+	//own (TextureBrick::nmask(), nlabel()), so they have keys of their own.
+	//no gl calls are made here: the owner creates and deletes the textures
+	class TexturePool
+	{
+	public:
+		TexturePool();
+
+		//slot of component comp of brick, -1 if it is not resident
+		int find(TextureBrick* brick, int comp) const;
+		//add an entry for param.brick and param.comp and return its slot
+		//an entry already there for them is replaced
+		int add(const TexParam &param);
+		//free a slot
+		void remove(int slot);
+		//remove all entries
+		void clear();
+
+		//record a use of a slot for least recently used ordering
+		void touch(int slot) {slots_[slot].last_use = ++clock_;}
+
+		//slots, free ones included; iterate with used()
+		int size() const {return (int)slots_.size();}
+		bool used(int slot) const {return slots_[slot].brick != 0;}
+		//entries in use
+		int count() const {return (int)index_.size();}
+		TexParam &operator[](int slot) {return slots_[slot];}
+		const TexParam &operator[](int slot) const {return slots_[slot];}
+
+		//time finding pool_size resident entries, by the hash and
+		//by scanning all entries the way the pool used to be searched
+		//returns nanoseconds per lookup
+		static void benchmark(int pool_size, int lookups,
+			double &hash_ns, double &scan_ns);
+
+	private:
+		struct Key
+		{
+			TextureBrick* brick;
+			int comp;
+			bool operator==(const Key &k) const
+			{return brick == k.brick && comp == k.comp;}
+		};
+		struct KeyHash
+		{
+			std::size_t operator()(const Key &k) const
+			{
+				return std::hash<const void*>()(k.brick) * 31 + (std::size_t)k.comp;
+			}
+		};
+
+		std::vector<TexParam> slots_;
+		std::vector<int> free_;
+		std::unordered_map<Key, int, KeyHash> index_;
+		unsigned long long clock_;
+	};
+
+	//texture objects released from the pool, kept for new bricks of the
+	//same size and internal format. a new brick then only uploads its data
+	//into the storage that is already there, and the driver does not have
+	//to allocate it again. the oldest textures are let go when the idle
+	//ones take more than the cap. no gl calls are made here either:
+	//textures let go are returned to the owner for deletion
+	class TextureRecycler
+	{
+	public:
+		TextureRecycler();
+
+		//bytes of idle textures kept at most, 0 keeps none
+		void set_max_bytes(std::size_t bytes) {max_bytes_ = bytes;}
+		std::size_t get_max_bytes() const {return max_bytes_;}
+		//bytes of idle textures kept now
+		std::size_t get_bytes() const {return bytes_;}
+		bool empty() const {return idle_.empty();}
+
+		//keep a texture with storage of the size and format
+		//textures over the cap are added to evicted, possibly this one
+		void put(unsigned int id, int nx, int ny, int nz, GLint internal_format,
+			std::size_t bytes, std::vector<unsigned int> &evicted);
+		//take a texture of the size and format, 0 if none is idle
+		unsigned int get(int nx, int ny, int nz, GLint internal_format);
+		//let go the oldest textures until the idle ones take no more than bytes
+		void trim(std::size_t bytes, std::vector<unsigned int> &evicted);
+
+		//textures taken and textures asked for but not idle
+		unsigned long long get_hits() const {return hits_;}
+		unsigned long long get_misses() const {return misses_;}
+
+	private:
+		struct Key
+		{
+			int nx, ny, nz;
+			GLint internal_format;
+			bool operator<(const Key &k) const
+			{
+				if (nx != k.nx) return nx < k.nx;
+				if (ny != k.ny) return ny < k.ny;
+				if (nz != k.nz) return nz < k.nz;
+				return internal_format < k.internal_format;
+			}
+		};
+		struct Idle
+		{
+			unsigned int id;
+			Key key;
+			std::size_t bytes;
+		};
+		typedef std::list<Idle>::iterator IdleIter;
+
+		//idle textures, the most recently released first
+		std::list<Idle> idle_;
+		//idle textures of each size and format, the most recent last
+		std::map<Key, std::vector<IdleIter> > buckets_;
+		std::size_t bytes_;
+		std::size_t max_bytes_;
+		unsigned long long hits_;
+		unsigned long long misses_;
+	};
+
+} // namespace FLIVR
+
+#endif // SLIVR_TexturePool_h
@@ -59,7 +59,9 @@ namespace FLIVR
 	double TextureRenderer::available_mainmem_buf_size_ = 0.0;
 	double TextureRenderer::large_data_size_ = 0.0;
 	int TextureRenderer::force_brick_size_ = 0;
-	vector<TexParam> TextureRenderer::tex_pool_;
+	TexturePool TextureRenderer::tex_pool_;
+	TextureRecycler TextureRenderer::tex_recycler_;
+	TextureUploader TextureRenderer::tex_uploader_;
 	bool TextureRenderer::start_update_loop_ = false;
 	bool TextureRenderer::done_update_loop_ = true;
 	bool TextureRenderer::done_current_chan_ = true;
@@ -76,6 +78,8 @@ namespace FLIVR
 	bool TextureRenderer::interactive_ = false;
 	int TextureRenderer::finished_bricks_ = 0;
 	BrickQueue TextureRenderer::brick_queue_(15);
+	double TextureRenderer::upload_budget_ = 0.0;
+	double TextureRenderer::uploaded_size_ = 0.0;
 	int TextureRenderer::quota_bricks_ = 0;
 	Point TextureRenderer::quota_center_;
 	int TextureRenderer::update_order_ = 0;
@@ -1241,16 +1245,14 @@ namespace FLIVR
 	// when a texture is deleted
 	void TextureRenderer::clear_tex_pool() 
 	{
-		for(unsigned int i = 0; i < tex_pool_.size(); i++)
+		for(int i = 0; i < tex_pool_.size(); i++)
 		{
-			// delete tex object.
-			if(glIsTexture(tex_pool_[i].id))
-			{
-				glDeleteTextures(1, (GLuint*)&tex_pool_[i].id);
-				tex_pool_[i].id = 0;
-			}
+			// delete or recycle tex object.
+			if(tex_pool_.used(i))
+				delete_tex_pool(i);
 		}
 		tex_pool_.clear();
+		tex_uploader_.release();
 		clear_pool_ = false;
 		available_mem_ = mem_limit_;
 	}
@@ -1262,19 +1264,17 @@ namespace FLIVR
 		vector<TextureBrick*>* bricks = tex_->get_bricks();
 		TextureBrick* brick = 0;
 		double est_avlb_mem = available_mem_;
-		for (int i = tex_pool_.size() - 1; i >= 0; --i)
+		for (size_t j = 0; j < bricks->size(); ++j)
 		{
-			for (size_t j = 0; j < bricks->size(); ++j)
+			brick = (*bricks)[j];
+			for (int c = 0; c < TEXTURE_MAX_COMPONENTS; ++c)
 			{
-				brick = (*bricks)[j];
-				if (tex_pool_[i].brick == brick)
-				{
-					if (tex_pool_[i].comp >= 0 && tex_pool_[i].comp < TEXTURE_MAX_COMPONENTS && brick->nb(tex_pool_[i].comp) > 0)
-						est_avlb_mem += brick->nx()*brick->ny()*brick->nz()*brick->nb(tex_pool_[i].comp)/1.04e6;
-					glDeleteTextures(1, (GLuint*)&tex_pool_[i].id);
-					tex_pool_.erase(tex_pool_.begin() + i);
-					break;
-				}
+				int idx = tex_pool_.find(brick, c);
+				if (idx < 0)
+					continue;
+				if (brick->nb(c) > 0)
+					est_avlb_mem += brick->nx()*brick->ny()*brick->nz()*brick->nb(c)/1.04e6;
+				delete_tex_pool(idx);
 			}
 		}
 		if (use_mem_limit_)
@@ -1441,6 +1441,61 @@ namespace FLIVR
 			return int(result);
 	}
 
+	double TextureRenderer::get_upload_budget()
+	{
+		if (upload_budget_ > 0.0)
+			return upload_budget_;
+		//what can be uploaded in the time of a frame at the measured rate
+		return get_upload_rate() * get_up_time();
+	}
+
+	bool TextureRenderer::check_upload_budget(TextureBrick* brick, int c,
+		bool mask, bool label)
+	{
+		if (uploaded_size_ <= 0.0)
+			return true;
+		double budget = get_upload_budget();
+		if (budget <= 0.0)
+			return true;
+		//the components of the brick without a texture
+		int comps[3] = {c, mask?brick->nmask():-1, label?brick->nlabel():-1};
+		double size = 0.0;
+		for (int i = 0; i < 3; ++i)
+		{
+			if (comps[i] < 0 || tex_pool_.find(brick, comps[i]) >= 0)
+				continue;
+			size += brick->nx()*brick->ny()*brick->nz()*brick->nb(comps[i])/1.04e6;
+		}
+		return size <= 0.0 || uploaded_size_ + size <= budget;
+	}
+
+	void TextureRenderer::prefetch_bricks(vector<TextureBrick*> *bricks, int bindex,
+		GLint filter, bool compression, int mode)
+	{
+		//the data of bricks read on this thread are freed right after the upload
+		if (!tex_ || (tex_->isBrxml() && load_on_main_thread_) || !use_mem_limit_)
+			return;
+		for (size_t j = bindex + 1; j < bricks->size(); ++j)
+		{
+			if (!tex_uploader_.has_room())
+				break;
+			TextureBrick* b = (*bricks)[j];
+			if (!b->get_disp() || b->get_priority() > 0 ||
+				tex_pool_.find(b, 0) >= 0)
+				continue;
+			if (start_update_loop_ && !done_update_loop_ && b->drawn(mode))
+				continue;
+			//bricks still being read are waited for when they are drawn
+			if (tex_->isBrxml() && !b->isLoaded())
+				break;
+			//a prefetch never swaps out other textures
+			double size = b->nx()*b->ny()*b->nz()*b->nb(0)/1.04e6;
+			if (available_mem_ < size || !check_upload_budget(b, 0))
+				break;
+			load_brick(0, 0, bricks, (int)j, filter, compression, mode, false, true);
+		}
+	}
+
 	Ray TextureRenderer::compute_view()
 	{
 		Transform *field_trans = tex_->transform();
@@ -1612,7 +1667,7 @@ namespace FLIVR
 	
 	GLint TextureRenderer::load_brick(int unit, int c,
 		vector<TextureBrick*> *bricks, int bindex,
-		GLint filter, bool compression, int mode, bool set_drawn)
+		GLint filter, bool compression, int mode, bool set_drawn, bool async)
 	{
 		GLint result = -1;
 
@@ -1634,23 +1689,7 @@ namespace FLIVR
 		GLenum textype = brick->tex_type(c);
 
 		//! Try to find the existing texture in tex_pool_, for this brick.
-		idx = -1;
-		for(unsigned int i = 0; i < tex_pool_.size() && idx < 0; i++)
-		{
-			if(tex_pool_[i].id != 0
-				&& tex_pool_[i].brick == brick
-				&& tex_pool_[i].comp == c
-				&& nx == tex_pool_[i].nx
-				&& ny == tex_pool_[i].ny
-				&& nz == tex_pool_[i].nz
-				&& nb == tex_pool_[i].nb
-				&& textype == tex_pool_[i].textype
-				&& glIsTexture(tex_pool_[i].id))
-			{
-				//found!
-				idx = i;
-			}
-		}
+		idx = find_tex_pool(brick, c, nx, ny, nz, nb, textype);
 
 		if(idx != -1) 
 		{
@@ -1658,6 +1697,9 @@ namespace FLIVR
 			// bind texture object
 			glBindTexture(GL_TEXTURE_3D, tex_pool_[idx].id);
 			result = tex_pool_[idx].id;
+			//a texture prefetched earlier in the frame is filled now
+			if (!async && tex_uploader_.pending(result))
+				tex_uploader_.finish(result);
 			// set interpolation method
 			glTexParameteri(GL_TEXTURE_3D, GL_TEXTURE_MIN_FILTER, filter);
 			glTexParameteri(GL_TEXTURE_3D, GL_TEXTURE_MAG_FILTER, filter);
@@ -1668,16 +1710,33 @@ namespace FLIVR
 			if (mem_swap_)
 				check_swap_memory(brick, c);
 
-			// allocate new object
-			unsigned int tex_id;
-			glGenTextures(1, (GLuint*)&tex_id);
-
-			// create new entry
-			tex_pool_.push_back(TexParam(c, nx, ny, nz, nb, textype, tex_id));
-			idx = int(tex_pool_.size())-1;
+			GLenum format;
+			GLint internal_format;
+			if (nb < 3)
+			{
+				if (compression && GLEW_ARB_texture_compression_rgtc &&
+					brick->ntype(c)==TextureBrick::TYPE_INT && (brick->tex_type(c)==GL_BYTE||brick->tex_type(c)==GL_UNSIGNED_BYTE))
+					internal_format = GL_COMPRESSED_RED;
+				else
+					internal_format = (brick->tex_type(c)==GL_SHORT||
+						brick->tex_type(c)==GL_UNSIGNED_SHORT)?
+						GL_R16:GL_R8;
+				format = GL_RED;
+			}
+			else
+			{
+				if (compression && GLEW_ARB_texture_compression_rgtc &&
+					brick->ntype(c)==TextureBrick::TYPE_INT && (brick->tex_type(c)==GL_BYTE||brick->tex_type(c)==GL_UNSIGNED_BYTE))
+					internal_format = GL_COMPRESSED_RED;
+				else
+					internal_format = (brick->tex_type(c)==GL_SHORT||
+						brick->tex_type(c)==GL_UNSIGNED_SHORT)?
+						GL_RGBA16UI:GL_RGBA8UI;
+				format = GL_RGBA;
+			}
 
-			tex_pool_[idx].brick = brick;
-			tex_pool_[idx].comp = c;
+			// allocate new object or reuse an idle one
+			idx = add_tex_pool(brick, c, nx, ny, nz, nb, textype, internal_format);
 			// bind texture object
 			glBindTexture(GL_TEXTURE_3D, tex_pool_[idx].id);
 			result = tex_pool_[idx].id;
@@ -1707,33 +1766,9 @@ namespace FLIVR
 #endif
 			glPixelStorei(GL_UNPACK_ALIGNMENT, 1);
 
+			size_t tex_bytes = (size_t)nx*ny*nz*nb;
 			if (ShaderProgram::shaders_supported())
 			{
-				GLenum format;
-				GLint internal_format;
-				if (nb < 3)
-				{
-					if (compression && GLEW_ARB_texture_compression_rgtc &&
-						brick->ntype(c)==TextureBrick::TYPE_INT && (brick->tex_type(c)==GL_BYTE||brick->tex_type(c)==GL_UNSIGNED_BYTE))
-						internal_format = GL_COMPRESSED_RED;
-					else
-						internal_format = (brick->tex_type(c)==GL_SHORT||
-							brick->tex_type(c)==GL_UNSIGNED_SHORT)?
-							GL_R16:GL_R8;
-					format = GL_RED;
-				}
-				else
-				{
-					if (compression && GLEW_ARB_texture_compression_rgtc &&
-						brick->ntype(c)==TextureBrick::TYPE_INT && (brick->tex_type(c)==GL_BYTE||brick->tex_type(c)==GL_UNSIGNED_BYTE))
-						internal_format = GL_COMPRESSED_RED;
-					else
-						internal_format = (brick->tex_type(c)==GL_SHORT||
-							brick->tex_type(c)==GL_UNSIGNED_SHORT)?
-							GL_RGBA16UI:GL_RGBA8UI;
-					format = GL_RGBA;
-				}
-
 				if (glTexImage3D)
 				{
 					if(tex_->isBrxml())
@@ -1775,13 +1810,18 @@ namespace FLIVR
 							void *texdata = brick->tex_data_brk(c, finfo);
 							if (texdata)
 							{
-								glTexImage3D(GL_TEXTURE_3D, 0, internal_format, nx, ny, nz, 0, format, brick->tex_type(c), 0);
-								glTexSubImage3D(GL_TEXTURE_3D, 0, 0, 0, 0, nx, ny, nz, format, brick->tex_type(c), texdata);
+								alloc_tex_pool(idx, format, brick->tex_type(c));
+								if (!tex_uploader_.upload(result, nx, ny, nz, nb, nx, ny,
+									format, brick->tex_type(c), texdata))
+								{
+									GLuint query = tex_uploader_.begin_timer();
+									glTexSubImage3D(GL_TEXTURE_3D, 0, 0, 0, 0, nx, ny, nz, format, brick->tex_type(c), texdata);
+									tex_uploader_.end_timer(query, tex_bytes);
+								}
 							}
 							else 
 							{
-								glDeleteTextures(1, (GLuint*)&tex_pool_[idx].id);
-								tex_pool_.erase(tex_pool_.begin()+idx);
+								delete_tex_pool(idx);
 								brkerror = true;
 								result = -1;
 							}
@@ -1823,13 +1863,18 @@ namespace FLIVR
 								void *texdata = brick->tex_data_brk(c, NULL);
 								if (texdata)
 								{
-									glTexImage3D(GL_TEXTURE_3D, 0, internal_format, nx, ny, nz, 0, format, brick->tex_type(c), 0);
-									glTexSubImage3D(GL_TEXTURE_3D, 0, 0, 0, 0, nx, ny, nz, format, brick->tex_type(c), texdata);
+									alloc_tex_pool(idx, format, brick->tex_type(c));
+									if (!tex_uploader_.upload(result, nx, ny, nz, nb, nx, ny,
+										format, brick->tex_type(c), texdata, async))
+									{
+										GLuint query = tex_uploader_.begin_timer();
+										glTexSubImage3D(GL_TEXTURE_3D, 0, 0, 0, 0, nx, ny, nz, format, brick->tex_type(c), texdata);
+										tex_uploader_.end_timer(query, tex_bytes);
+									}
 								}
 								else 
 								{
-									glDeleteTextures(1, (GLuint*)&tex_pool_[idx].id);
-									tex_pool_.erase(tex_pool_.begin()+idx);
+									delete_tex_pool(idx);
 									brkerror = true;
 									result = -1;
 								}
@@ -1845,74 +1890,81 @@ namespace FLIVR
 									t = up_time_ - elapsed;
 									if (t > 0) wxMilliSleep(t);
 								} while (elapsed <= up_time_);
-								
 								if (brick->isLoaded())
 								{
 									bool brkerror = false;
 									void *texdata = brick->tex_data_brk(c, NULL);
 									if (texdata)
 									{
-										glTexImage3D(GL_TEXTURE_3D, 0, internal_format, nx, ny, nz, 0, format, brick->tex_type(c), 0);
-										glTexSubImage3D(GL_TEXTURE_3D, 0, 0, 0, 0, nx, ny, nz, format, brick->tex_type(c), texdata);
+										alloc_tex_pool(idx, format, brick->tex_type(c));
+										if (!tex_uploader_.upload(result, nx, ny, nz, nb, nx, ny,
+											format, brick->tex_type(c), texdata))
+										{
+											GLuint query = tex_uploader_.begin_timer();
+											glTexSubImage3D(GL_TEXTURE_3D, 0, 0, 0, 0, nx, ny, nz, format, brick->tex_type(c), texdata);
+											tex_uploader_.end_timer(query, tex_bytes);
+										}
 									}
 									else 
 									{
-										glDeleteTextures(1, (GLuint*)&tex_pool_[idx].id);
-										tex_pool_.erase(tex_pool_.begin()+idx);
+										delete_tex_pool(idx);
 										brkerror = true;
 										result = -1;
 									}
 								}
 								else
 								{
-									glDeleteTextures(1, (GLuint*)&tex_pool_[idx].id);
-									tex_pool_.erase(tex_pool_.begin()+idx);
+									delete_tex_pool(idx);
 									result = -1;
 								}
 							}
 							else
 							{
-								glDeleteTextures(1, (GLuint*)&tex_pool_[idx].id);
-								tex_pool_.erase(tex_pool_.begin()+idx);
+								delete_tex_pool(idx);
 								result = -1;
 							}
 						}
 					}
 					else
 					{
-						glTexImage3D(GL_TEXTURE_3D, 0, internal_format, nx, ny, nz, 0, format,
-							brick->tex_type(c), 0);
+						alloc_tex_pool(idx, format, brick->tex_type(c));
+						if (!tex_uploader_.upload(result, nx, ny, nz, nb, brick->sx(), brick->sy(),
+							format, brick->tex_type(c), brick->tex_data(c), async))
+						{
+							GLuint query = tex_uploader_.begin_timer();
 #ifdef _WIN32
-						glTexSubImage3D(GL_TEXTURE_3D, 0, 0, 0, 0, nx, ny, nz, format,
-							brick->tex_type(c), brick->tex_data(c));
+							glTexSubImage3D(GL_TEXTURE_3D, 0, 0, 0, 0, nx, ny, nz, format,
+								brick->tex_type(c), brick->tex_data(c));
 #else
 //						if (bricks->size() > 1)
-						{
-							unsigned long long mem_size = (unsigned long long)nx*
-								(unsigned long long)ny*(unsigned long long)nz*nb;
-							unsigned char* temp = new unsigned char[mem_size];
-							unsigned char* tempp = temp;
-							unsigned char* tp = (unsigned char*)(brick->tex_data(c));
-							unsigned char* tp2;
-							for (unsigned int k = 0; k < nz; ++k)
 							{
-								tp2 = tp;
-								for (unsigned int j = 0; j < ny; ++j)
+								unsigned long long mem_size = (unsigned long long)nx*
+									(unsigned long long)ny*(unsigned long long)nz*nb;
+								unsigned char* temp = new unsigned char[mem_size];
+								unsigned char* tempp = temp;
+								unsigned char* tp = (unsigned char*)(brick->tex_data(c));
+								unsigned char* tp2;
+								for (unsigned int k = 0; k < nz; ++k)
 								{
-									memcpy(tempp, tp2, nx*nb);
-									tempp += nx*nb;
-									tp2 += brick->sx()*nb;
+									tp2 = tp;
+									for (unsigned int j = 0; j < ny; ++j)
+									{
+										memcpy(tempp, tp2, nx*nb);
+										tempp += nx*nb;
+										tp2 += brick->sx()*nb;
+									}
+									tp += brick->sx()*brick->sy()*nb;
 								}
-								tp += brick->sx()*brick->sy()*nb;
+								glTexSubImage3D(GL_TEXTURE_3D, 0, 0, 0, 0, nx, ny, nz, format,
+									brick->tex_type(c), (GLvoid*)temp);
+								delete[]temp;
 							}
-							glTexSubImage3D(GL_TEXTURE_3D, 0, 0, 0, 0, nx, ny, nz, format,
-								brick->tex_type(c), (GLvoid*)temp);
-							delete[]temp;
-						}
 //						else
 //							glTexSubImage3D(GL_TEXTURE_3D, 0, 0, 0, 0, nx, ny, nz, format,
 //							brick->tex_type(c), brick->tex_data(c));
 #endif
+							tex_uploader_.end_timer(query, tex_bytes);
+						}
 					}
 
 					if (mem_swap_ && result >= 0)
@@ -1921,6 +1973,9 @@ namespace FLIVR
 						available_mem_ -= new_mem;
 					}
 
+					if (result >= 0)
+						count_upload(brick->nx()*brick->ny()*brick->nz()*brick->nb(c)/1.04e6);
+
 				}
 			}
 
@@ -1966,23 +2021,7 @@ namespace FLIVR
 		GLenum textype = brick->tex_type(c);
 
 		//! Try to find the existing texture in tex_pool_, for this brick.
-		int idx = -1;
-		for(unsigned int i = 0; i < tex_pool_.size() && idx < 0; i++)
-		{
-			if(tex_pool_[i].id != 0
-				&& tex_pool_[i].brick == brick
-				&& tex_pool_[i].comp == c
-				&& nx == tex_pool_[i].nx
-				&& ny == tex_pool_[i].ny
-				&& nz == tex_pool_[i].nz
-				&& nb == tex_pool_[i].nb
-				&& textype == tex_pool_[i].textype
-				&& glIsTexture(tex_pool_[i].id))
-			{
-				//found!
-				idx = i;
-			}
-		}
+		int idx = find_tex_pool(brick, c, nx, ny, nz, nb, textype);
 
 		if(idx != -1) 
 		{
@@ -1996,15 +2035,8 @@ namespace FLIVR
 		} 
 		else //idx == -1
 		{
-			////! try again to find the matching texture object
-			unsigned int tex_id;
-			glGenTextures(1, (GLuint*)&tex_id);
-
-			tex_pool_.push_back(TexParam(c, nx, ny, nz, nb, textype, tex_id));
-			idx = int(tex_pool_.size())-1;
-
-			tex_pool_[idx].brick = brick;
-			tex_pool_[idx].comp = c;
+			GLint internal_format = GL_R8;
+			idx = add_tex_pool(brick, c, nx, ny, nz, nb, textype, internal_format);
 			// bind texture object
 			glBindTexture(GL_TEXTURE_3D, tex_pool_[idx].id);
 			result = tex_pool_[idx].id;
@@ -2029,43 +2061,49 @@ namespace FLIVR
 
 			if (ShaderProgram::shaders_supported())
 			{
-				GLint internal_format = GL_R8;
 				GLenum format = (nb == 1 ? GL_RED : GL_RGBA);
 				if (glTexImage3D)
 				{
-					glTexImage3D(GL_TEXTURE_3D, 0, internal_format, nx, ny, nz, 0, format,
-					brick->tex_type(c), 0);
+					alloc_tex_pool(idx, format, brick->tex_type(c));
+					size_t tex_bytes = (size_t)nx*ny*nz*nb;
+					if (!tex_uploader_.upload(result, nx, ny, nz, nb, brick->sx(), brick->sy(),
+						format, brick->tex_type(c), brick->tex_data(c)))
+					{
+						GLuint query = tex_uploader_.begin_timer();
 #ifdef _WIN32
-					glTexSubImage3D(GL_TEXTURE_3D, 0, 0, 0, 0, nx, ny, nz, format,
-					brick->tex_type(c), brick->tex_data(c));
+						glTexSubImage3D(GL_TEXTURE_3D, 0, 0, 0, 0, nx, ny, nz, format,
+						brick->tex_type(c), brick->tex_data(c));
 #else
 //					if (bricks->size() > 1)
-					{
-						unsigned long long mem_size = (unsigned long long)nx*
-							(unsigned long long)ny*(unsigned long long)nz*nb;
-						unsigned char* temp = new unsigned char[mem_size];
-						unsigned char* tempp = temp;
-						unsigned char* tp = (unsigned char*)(brick->tex_data(c));
-						unsigned char* tp2;
-						for (unsigned int k = 0; k < nz; ++k)
 						{
-							tp2 = tp;
-							for (unsigned int j = 0; j < ny; ++j)
+							unsigned long long mem_size = (unsigned long long)nx*
+								(unsigned long long)ny*(unsigned long long)nz*nb;
+							unsigned char* temp = new unsigned char[mem_size];
+							unsigned char* tempp = temp;
+							unsigned char* tp = (unsigned char*)(brick->tex_data(c));
+							unsigned char* tp2;
+							for (unsigned int k = 0; k < nz; ++k)
 							{
-								memcpy(tempp, tp2, nx*nb);
-								tempp += nx*nb;
-								tp2 += brick->sx()*nb;
-				}
-							tp += brick->sx()*brick->sy()*nb;
-						}
-						glTexSubImage3D(GL_TEXTURE_3D, 0, 0, 0, 0, nx, ny, nz, format,
-							brick->tex_type(c), (GLvoid*)temp);
-						delete[]temp;
+								tp2 = tp;
+								for (unsigned int j = 0; j < ny; ++j)
+								{
+									memcpy(tempp, tp2, nx*nb);
+									tempp += nx*nb;
+									tp2 += brick->sx()*nb;
 					}
+								tp += brick->sx()*brick->sy()*nb;
+							}
+							glTexSubImage3D(GL_TEXTURE_3D, 0, 0, 0, 0, nx, ny, nz, format,
+								brick->tex_type(c), (GLvoid*)temp);
+							delete[]temp;
+						}
 //					else
 //						glTexSubImage3D(GL_TEXTURE_3D, 0, 0, 0, 0, nx, ny, nz, format,
 //							brick->tex_type(c), brick->tex_data(c));
 #endif
+						tex_uploader_.end_timer(query, tex_bytes);
+					}
+					count_upload(tex_bytes/1.04e6);
 			}
 			}
 
@@ -2110,23 +2148,7 @@ namespace FLIVR
 		GLenum textype = brick->tex_type(c);
 		
 		//! Try to find the existing texture in tex_pool_, for this brick.
-		int idx = -1;
-		for(unsigned int i = 0; i < tex_pool_.size() && idx < 0; i++)
-		{
-			if(tex_pool_[i].id != 0
-				&& tex_pool_[i].brick == brick
-				&& tex_pool_[i].comp == c
-				&& nx == tex_pool_[i].nx
-				&& ny == tex_pool_[i].ny
-				&& nz == tex_pool_[i].nz
-				&& nb == tex_pool_[i].nb
-				&& textype == tex_pool_[i].textype
-				&& glIsTexture(tex_pool_[i].id))
-			{
-				//found!
-				idx = i;
-			}
-		}
+		int idx = find_tex_pool(brick, c, nx, ny, nz, nb, textype);
 
 		if(idx != -1) 
 		{
@@ -2140,13 +2162,8 @@ namespace FLIVR
 		} 
 		else //idx == -1
 		{
-			unsigned int tex_id;
-			glGenTextures(1, (GLuint*)&tex_id);
-			tex_pool_.push_back(TexParam(c, nx, ny, nz, nb, textype, tex_id));
-			idx = int(tex_pool_.size())-1;
-
-			tex_pool_[idx].brick = brick;
-			tex_pool_[idx].comp = c;
+			GLint internal_format = GL_R32UI;
+			idx = add_tex_pool(brick, c, nx, ny, nz, nb, textype, internal_format);
 			// bind texture object
 			glBindTexture(GL_TEXTURE_3D, tex_pool_[idx].id);
 			result = tex_pool_[idx].id;
@@ -2172,42 +2189,48 @@ namespace FLIVR
 			if (ShaderProgram::shaders_supported())
 			{
 				GLenum format = GL_RED_INTEGER;
-				GLint internal_format = GL_R32UI;
 				if (glTexImage3D)
 				{
-					glTexImage3D(GL_TEXTURE_3D, 0, internal_format, nx, ny, nz, 0, format,
-						brick->tex_type(c), NULL);
+					alloc_tex_pool(idx, format, brick->tex_type(c));
+					size_t tex_bytes = (size_t)nx*ny*nz*nb;
+					if (!tex_uploader_.upload(result, nx, ny, nz, nb, brick->sx(), brick->sy(),
+						format, brick->tex_type(c), brick->tex_data(c)))
+					{
+						GLuint query = tex_uploader_.begin_timer();
 #ifdef _WIN32
-					glTexSubImage3D(GL_TEXTURE_3D, 0, 0, 0, 0, nx, ny, nz, format,
-					brick->tex_type(c), brick->tex_data(c));
+						glTexSubImage3D(GL_TEXTURE_3D, 0, 0, 0, 0, nx, ny, nz, format,
+						brick->tex_type(c), brick->tex_data(c));
 #else
 //					if (bricks->size() > 1)
-					{
-						unsigned long long mem_size = (unsigned long long)nx*
-							(unsigned long long)ny*(unsigned long long)nz*nb;
-						unsigned char* temp = new unsigned char[mem_size];
-						unsigned char* tempp = temp;
-						unsigned char* tp = (unsigned char*)(brick->tex_data(c));
-						unsigned char* tp2;
-						for (unsigned int k = 0; k < nz; ++k)
 						{
-							tp2 = tp;
-							for (unsigned int j = 0; j < ny; ++j)
+							unsigned long long mem_size = (unsigned long long)nx*
+								(unsigned long long)ny*(unsigned long long)nz*nb;
+							unsigned char* temp = new unsigned char[mem_size];
+							unsigned char* tempp = temp;
+							unsigned char* tp = (unsigned char*)(brick->tex_data(c));
+							unsigned char* tp2;
+							for (unsigned int k = 0; k < nz; ++k)
 							{
-								memcpy(tempp, tp2, nx*nb);
-								tempp += nx*nb;
-								tp2 += brick->sx()*nb;
+								tp2 = tp;
+								for (unsigned int j = 0; j < ny; ++j)
+								{
+									memcpy(tempp, tp2, nx*nb);
+									tempp += nx*nb;
+									tp2 += brick->sx()*nb;
+								}
+								tp += brick->sx()*brick->sy()*nb;
 							}
-							tp += brick->sx()*brick->sy()*nb;
+							glTexSubImage3D(GL_TEXTURE_3D, 0, 0, 0, 0, nx, ny, nz, format,
+								brick->tex_type(c), (GLvoid*)temp);
+							delete[]temp;
 						}
-						glTexSubImage3D(GL_TEXTURE_3D, 0, 0, 0, 0, nx, ny, nz, format,
-							brick->tex_type(c), (GLvoid*)temp);
-						delete[]temp;
-					}
 //					else
 //						glTexSubImage3D(GL_TEXTURE_3D, 0, 0, 0, 0, nx, ny, nz, format,
 //					brick->tex_type(c), brick->tex_data(c));
 #endif
+						tex_uploader_.end_timer(query, tex_bytes);
+					}
+					count_upload(tex_bytes/1.04e6);
 				}
 			}
 
@@ -2237,9 +2260,94 @@ namespace FLIVR
 
 	bool TextureRenderer::brick_sort(const BrickDist& bd1, const BrickDist& bd2)
 	{
+		//least recently used first among bricks as far away
+		if (bd1.dist == bd2.dist)
+			return bd1.last_use < bd2.last_use;
 		return bd1.dist > bd2.dist;
 	}
 
+	int TextureRenderer::find_tex_pool(TextureBrick* brick, int c, int nx, int ny, int nz,
+		int nb, GLenum textype)
+	{
+		int idx = tex_pool_.find(brick, c);
+		if (idx < 0)
+			return -1;
+
+		TexParam &param = tex_pool_[idx];
+		if (param.id != 0
+			&& nx == param.nx
+			&& ny == param.ny
+			&& nz == param.nz
+			&& nb == param.nb
+			&& textype == param.textype
+			&& glIsTexture(param.id))
+		{
+			tex_pool_.touch(idx);
+			return idx;
+		}
+
+		//the brick has changed since its texture was made
+		delete_tex_pool(idx);
+		return -1;
+	}
+
+	int TextureRenderer::add_tex_pool(TextureBrick* brick, int c, int nx, int ny, int nz,
+		int nb, GLenum textype, GLint internal_format)
+	{
+		unsigned int tex_id;
+		bool recycled = false;
+		while ((tex_id = tex_recycler_.get(nx, ny, nz, internal_format)) != 0)
+		{
+			if (glIsTexture(tex_id))
+			{
+				recycled = true;
+				break;
+			}
+		}
+		if (!recycled)
+			glGenTextures(1, (GLuint*)&tex_id);
+
+		TexParam param(c, nx, ny, nz, nb, textype, tex_id);
+		param.brick = brick;
+		param.internal_format = internal_format;
+		param.allocated = recycled;
+		return tex_pool_.add(param);
+	}
+
+	void TextureRenderer::alloc_tex_pool(int idx, GLenum format, GLenum type)
+	{
+		TexParam &param = tex_pool_[idx];
+		if (param.allocated)
+			return;
+		param.allocated = true;
+		glTexImage3D(GL_TEXTURE_3D, 0, param.internal_format,
+			param.nx, param.ny, param.nz, 0, format, type, NULL);
+	}
+
+	void TextureRenderer::delete_tex_pool(int idx)
+	{
+		TexParam &param = tex_pool_[idx];
+		tex_uploader_.cancel(param.id);
+		vector<unsigned int> ids;
+		if (param.allocated)
+			tex_recycler_.put(param.id, param.nx, param.ny, param.nz,
+				param.internal_format,
+				(size_t)param.nx*param.ny*param.nz*param.nb, ids);
+		else
+			ids.push_back(param.id);
+		tex_pool_.remove(idx);
+		if (!ids.empty())
+			glDeleteTextures((GLsizei)ids.size(), (GLuint*)&ids[0]);
+	}
+
+	void TextureRenderer::clear_tex_recycler(double size)
+	{
+		vector<unsigned int> ids;
+		tex_recycler_.trim(size > 0.0 ? (size_t)(size*1.04e6) : 0, ids);
+		if (!ids.empty())
+			glDeleteTextures((GLsizei)ids.size(), (GLuint*)&ids[0]);
+	}
+
 	void TextureRenderer::check_swap_memory(TextureBrick* brick, int c)
 	{
 		unsigned int i;
@@ -2268,15 +2376,26 @@ namespace FLIVR
 			available_mem_ = mem_info[0]/1024.0;
 			if (available_mem_ >= new_mem)
 				return;
+			//idle textures go before the textures of bricks
+			if (!tex_recycler_.empty())
+			{
+				available_mem_ += tex_recycler_.get_bytes()/1.04e6;
+				clear_tex_recycler();
+				if (available_mem_ >= new_mem)
+					return;
+			}
 		}
 
 		vector<BrickDist> bd_list;
 		BrickDist bd;
 		//generate a list of bricks and their distances to the new brick
-		for (i=0; i<tex_pool_.size(); i++)
+		for (i=0; i<(unsigned int)tex_pool_.size(); i++)
 		{
+			if (!tex_pool_.used(i))
+				continue;
 			bd.index = i;
 			bd.brick = tex_pool_[i].brick;
+			bd.last_use = tex_pool_[i].last_use;
 			//calculate the distance
 			bd.dist = brick->bbox().distance(bd.brick->bbox());
 			bd_list.push_back(bd);
@@ -2340,14 +2459,11 @@ namespace FLIVR
 			}
 
 			//delete from pool
-			for (int j=int(tex_pool_.size()-1); j>=0; j--)
+			for (int j=0; j<tex_pool_.size(); j++)
 			{
-				if (tex_pool_[j].delayed_del &&
-					glIsTexture(tex_pool_[j].id))
-				{
-					glDeleteTextures(1, (GLuint*)&tex_pool_[j].id);
-					tex_pool_.erase(tex_pool_.begin()+j);
-				}
+				if (tex_pool_.used(j) &&
+					tex_pool_[j].delayed_del)
+					delete_tex_pool(j);
 			}
 
 			if (use_mem_limit_)
@@ -32,6 +32,8 @@
 #include <nrrd.h>
 #include "TextureBrick.h"
 #include "Texture.h"
+#include "TexturePool.h"
+#include "TextureUploader.h"
 #include <stdint.h>
 #include <glm/glm.hpp>
 #include <unordered_set>
@@ -104,31 +106,6 @@ namespace FLIVR
    class VolCalShaderFactory;
    class VolKernelFactory;
 
-   struct TexParam
-   {
-      int nx, ny, nz, nb;
-      unsigned int id;
-      TextureBrick *brick;
-      int comp;
-      GLenum textype;
-      bool delayed_del;
-      TexParam() :
-         nx(0), ny(0), nz(0), nb(0),
-         id(0), brick(0), comp(0),
-         textype(GL_UNSIGNED_BYTE),
-         delayed_del(false)
-      {}
-      TexParam(int c, int x,
-            int y, int z,
-            int b, GLenum f,
-            unsigned int i) :
-          nx(x), ny(y),
-         nz(z), nb(b), id(i),
-         brick(0), comp(c), textype(f),
-         delayed_del(false)
-      {}
-   };
-
 #define PALETTE_W 256
 #define PALETTE_H 256
 #define PALETTE_SIZE (PALETTE_W*PALETTE_H)
@@ -244,6 +221,11 @@ namespace FLIVR
          //available memory
          static void set_available_mem(double val) {available_mem_ = val;}
          static double get_available_mem() {return available_mem_;}
+         //graphics memory kept in released textures for reuse by new bricks
+         //it is outside the memory limit; a smaller size takes effect at the next release
+         static void set_tex_recycle_size(double val)
+         {tex_recycler_.set_max_bytes(val > 0.0 ? (size_t)(val*1.04e6) : 0);}
+         static double get_tex_recycle_size() {return tex_recycler_.get_max_bytes()/1.04e6;}
 		 //main(cpu) memory limit
          static void set_mainmem_buf_size(double val) {mainmem_buf_size_ = val;}
          static double get_mainmem_buf_size() {return mainmem_buf_size_;}
@@ -277,8 +259,8 @@ namespace FLIVR
                static void reset_save_final_buffer() {save_final_buffer_ = false;}
                static bool get_save_final_buffer() {return save_final_buffer_;}
 			   static void set_save_final_buffer() {save_final_buffer_ = true;}
-               //set start time
-               static void set_st_time(unsigned long time) {st_time_ = time;}
+               //set start time, which starts the upload budget of a frame over
+               static void set_st_time(unsigned long time) {st_time_ = time; uploaded_size_ = 0.0;}
                static unsigned long get_st_time() {return st_time_;}
                static void set_up_time(unsigned long time) {up_time_ = time;}
                static unsigned long get_up_time();
@@ -297,6 +279,23 @@ namespace FLIVR
                static int get_finished_bricks_max();
                static int get_est_bricks(int mode);
                static int get_queue_last() {return brick_queue_.GetLast();}
+               //brick data uploaded to textures in a frame at most, in MB
+               //0 estimates it from the measured upload rate and the up time
+               static void set_upload_budget(double val) {upload_budget_ = val;}
+               static double get_upload_budget();
+               static double get_uploaded_size() {return uploaded_size_;}
+               //MB/ms, measured on the gpu
+               static double get_upload_rate() {return tex_uploader_.get_rate()/1.04e6;}
+               //upload the next brick in this frame, always for the first upload
+               //the mask and label textures count too when they are drawn
+               static bool check_upload_budget(TextureBrick* brick, int c,
+                     bool mask=false, bool label=false);
+               //stream brick data through pixel buffer objects
+               static void set_upload_stream(bool val) {tex_uploader_.set_enable(val);}
+               static bool get_upload_stream() {return tex_uploader_.get_enable();}
+               //number of pixel buffers and the size of each in MB
+               static void set_upload_ring(int num, double size)
+               {tex_uploader_.set_ring(num, (size_t)(size*1048576.0));}
                //quota bricks in interactive mode
                static void set_quota_bricks(int quota) {quota_bricks_ = quota;}
                static int get_quota_bricks() {return quota_bricks_;}
@@ -321,6 +320,7 @@ namespace FLIVR
                   unsigned int index;    //index of the brick in current tex pool
                   TextureBrick* brick;  //a brick
                   double dist;      //distance to another brick
+                  unsigned long long last_use;  //last use of the texture
                };
                Texture *tex_;
                RenderMode mode_;
@@ -389,7 +389,9 @@ namespace FLIVR
 			   static double available_mainmem_buf_size_;
                static double large_data_size_;
                static int force_brick_size_;
-               static vector<TexParam> tex_pool_;
+               static TexturePool tex_pool_;
+               static TextureRecycler tex_recycler_;
+               static TextureUploader tex_uploader_;
                static bool start_update_loop_;
                static bool done_update_loop_;
                static bool done_current_chan_;
@@ -409,6 +411,9 @@ namespace FLIVR
                //number of rendered blocks before time is up
                static int finished_bricks_;
                static BrickQueue brick_queue_;
+               //upload budget and uploaded size in this frame (MB)
+               static double upload_budget_;
+               static double uploaded_size_;
                //quota in interactive mode
                static int quota_bricks_;
                int quota_bricks_chan_;//for current channel
@@ -442,9 +447,30 @@ namespace FLIVR
                static bool brick_sort(const BrickDist& bd1, const BrickDist& bd2);
                //check and swap memory
                void check_swap_memory(TextureBrick* brick, int c);
+               //slot of the texture of a brick in the texture pool, -1 if none
+               //a texture that no longer matches the brick is deleted
+               static int find_tex_pool(TextureBrick* brick, int c, int nx, int ny, int nz,
+                     int nb, GLenum textype);
+               //add a texture for a brick to the texture pool and return its slot
+               //an idle texture of the same size and format is reused
+               static int add_tex_pool(TextureBrick* brick, int c, int nx, int ny, int nz,
+                     int nb, GLenum textype, GLint internal_format);
+               //allocate the storage of the texture in a slot, bound to GL_TEXTURE_3D,
+               //unless it was reused with its storage
+               static void alloc_tex_pool(int idx, GLenum format, GLenum type);
+               //release the texture in a slot to the recycler and free the slot
+               static void delete_tex_pool(int idx);
+               //delete idle textures until they take no more than size MB
+               static void clear_tex_recycler(double size=0.0);
+               //add an upload of size MB to the budget
+               static void count_upload(double size) {uploaded_size_ += size;}
                //load texture bricks for drawing
                //unit:assigned unit, c:channel
-               GLint load_brick(int unit, int c, vector<TextureBrick*> *b, int i, GLint filter=GL_LINEAR, bool compression=false, int mode=0, bool set_drawn=true);
+               //async:return once the upload is started; the texture may be pending
+               GLint load_brick(int unit, int c, vector<TextureBrick*> *b, int i, GLint filter=GL_LINEAR, bool compression=false, int mode=0, bool set_drawn=true, bool async=false);
+               //start uploading the bricks after bindex that fit in the budget,
+               //while the uploader has room, to be drawn later in the frame
+               void prefetch_bricks(vector<TextureBrick*> *b, int bindex, GLint filter, bool compression, int mode);
                //load the texture for volume mask into texture pool
                GLint load_brick_mask(vector<TextureBrick*> *b, int i, GLint filter=GL_NEAREST, bool compression=false, int unit=0);
                //load the texture for volume labeling into texture pool
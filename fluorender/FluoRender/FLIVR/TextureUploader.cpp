@@ -0,0 +1,518 @@
+//
+//  For more information, please see: http://software.sci.utah.edu
+//
+//  The MIT License
+//
+//  Copyright (c) 2004 Scientific Computing and Imaging Institute,
+//  University of Utah.
+//
+//
+//  Permission is hereby granted, free of charge, to any person obtaining a
+//  copy of this software and associated documentation files (the "Software"),
+//  to deal in the Software without restriction, including without limitation
+//  the rights to use, copy, modify, merge, publish, distribute, sublicense,
+//  and/or sell copies of the Software, and to permit persons to whom the
+//  Software is furnished to do so, subject to the following conditions:
+//
+//  The above copyright notice and this permission notice shall be included
+//  in all copies or substantial portions of the Software.
+//
+//  THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS
+//  OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+//  FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL
+//  THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+//  LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+//  FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER
+//  DEALINGS IN THE SOFTWARE.
+//
+
+
+#include <FLIVR/TextureUploader.h>
+#include <FLIVR/ThreadPool.h>
+#include <cstring>
+
+//data are copied in slabs of about this size
+#define UPLOAD_COPY_CHUNK 4194304
+//waiting for a buffer gives up after this
+#define UPLOAD_WAIT_NS 10000000
+#define UPLOAD_WAIT_TIMES 100
+//timer queries waiting for their results at most
+#define UPLOAD_TIMER_NUM 16
+//uploads shorter than this (ns) are not counted in the rate
+#define UPLOAD_TIMER_MIN 50000
+
+namespace FLIVR
+{
+	std::vector<TextureUploader::Source> TextureUploader::sources_;
+	wxMutex TextureUploader::source_lock_;
+	wxCondition TextureUploader::source_cond_(TextureUploader::source_lock_);
+
+	//copies slices [z0, z1) of a brick into a mapped buffer
+	class UploadCopyTask : public ThreadPoolTask
+	{
+	public:
+		UploadCopyTask(unsigned char* dst, const unsigned char* src,
+			int ny, int z0, int z1, std::size_t row_bytes,
+			std::size_t row_pitch, std::size_t slice_pitch) :
+			dst_(dst), src_(src), ny_(ny), z0_(z0), z1_(z1),
+			row_bytes_(row_bytes), row_pitch_(row_pitch), slice_pitch_(slice_pitch)
+		{}
+		virtual void run()
+		{
+			for (int k = z0_; k < z1_; ++k)
+			{
+				unsigned char* dst = dst_ + (std::size_t)k*ny_*row_bytes_;
+				const unsigned char* src = src_ + k*slice_pitch_;
+				if (row_pitch_ == row_bytes_)
+					memcpy(dst, src, ny_*row_bytes_);
+				else
+				{
+					for (int j = 0; j < ny_; ++j)
+					{
+						memcpy(dst, src, row_bytes_);
+						dst += row_bytes_;
+						src += row_pitch_;
+					}
+				}
+			}
+			TextureUploader::release_source(src_);
+		}
+		virtual void cancel()
+		{
+			TextureUploader::release_source(src_);
+		}
+	private:
+		unsigned char* dst_;
+		const unsigned char* src_;
+		int ny_, z0_, z1_;
+		std::size_t row_bytes_, row_pitch_, slice_pitch_;
+	};
+
+	TextureUploader::TextureUploader() :
+		next_(0),
+		ring_num_(3),
+		max_bytes_(64*1024*1024),
+		enable_(true),
+		persistent_(false),
+		rate_(0.0),
+		bytes_(0),
+		fallbacks_(0)
+	{
+	}
+
+	TextureUploader::~TextureUploader()
+	{
+		//the buffers and queries go with the gl context
+		for (std::size_t i = 0; i < ring_.size(); ++i)
+			delete ring_[i].copy;
+	}
+
+	void TextureUploader::set_ring(int num, std::size_t max_bytes)
+	{
+		ring_num_ = num < 1 ? 1 : num;
+		max_bytes_ = max_bytes;
+	}
+
+	bool TextureUploader::supported()
+	{
+		return glBindBuffer && glMapBufferRange && glUnmapBuffer &&
+			glFenceSync && glClientWaitSync && glDeleteSync;
+	}
+
+	bool TextureUploader::timer_supported()
+	{
+		return (GLEW_ARB_timer_query || GLEW_VERSION_3_3) &&
+			glGenQueries && glBeginQuery && glEndQuery &&
+			glGetQueryObjectiv && glGetQueryObjectui64v;
+	}
+
+	bool TextureUploader::wait(Slot &slot)
+	{
+		if (!slot.fence)
+			return true;
+		for (int i = 0; i < UPLOAD_WAIT_TIMES; ++i)
+		{
+			GLenum status = glClientWaitSync(slot.fence,
+				GL_SYNC_FLUSH_COMMANDS_BIT, UPLOAD_WAIT_NS);
+			if (status == GL_TIMEOUT_EXPIRED)
+				continue;
+			if (status == GL_WAIT_FAILED)
+				glFinish();
+			glDeleteSync(slot.fence);
+			slot.fence = 0;
+			return true;
+		}
+		return false;
+	}
+
+	bool TextureUploader::reserve(Slot &slot, std::size_t bytes)
+	{
+		if (slot.pbo && slot.size >= bytes)
+		{
+			glBindBuffer(GL_PIXEL_UNPACK_BUFFER, slot.pbo);
+			return true;
+		}
+
+		free_slot(slot);
+		//grow in steps of a megabyte up to the cap
+		std::size_t size = (bytes + 0xFFFFF) & ~(std::size_t)0xFFFFF;
+		if (size > max_bytes_)
+			size = bytes;
+		glGenBuffers(1, &slot.pbo);
+		if (!slot.pbo)
+			return false;
+		glBindBuffer(GL_PIXEL_UNPACK_BUFFER, slot.pbo);
+		if (persistent_)
+		{
+			GLbitfield flags = GL_MAP_WRITE_BIT |
+				GL_MAP_PERSISTENT_BIT | GL_MAP_COHERENT_BIT;
+			glBufferStorage(GL_PIXEL_UNPACK_BUFFER, size, 0, flags);
+			slot.ptr = glMapBufferRange(GL_PIXEL_UNPACK_BUFFER, 0, size, flags);
+			if (!slot.ptr)
+			{
+				glBindBuffer(GL_PIXEL_UNPACK_BUFFER, 0);
+				free_slot(slot);
+				return false;
+			}
+		}
+		else
+			glBufferData(GL_PIXEL_UNPACK_BUFFER, size, 0, GL_STREAM_DRAW);
+		slot.size = size;
+		return true;
+	}
+
+	void TextureUploader::free_slot(Slot &slot)
+	{
+		if (slot.fence)
+			glDeleteSync(slot.fence);
+		if (slot.pbo)
+		{
+			if (slot.ptr)
+			{
+				glBindBuffer(GL_PIXEL_UNPACK_BUFFER, slot.pbo);
+				glUnmapBuffer(GL_PIXEL_UNPACK_BUFFER);
+				glBindBuffer(GL_PIXEL_UNPACK_BUFFER, 0);
+			}
+			glDeleteBuffers(1, &slot.pbo);
+		}
+		slot.pbo = 0;
+		slot.fence = 0;
+		slot.ptr = 0;
+		slot.size = 0;
+	}
+
+	bool TextureUploader::fill(Slot &slot, bool bind)
+	{
+		if (!slot.copy)
+			return true;
+		slot.copy->wait();
+		delete slot.copy;
+		slot.copy = 0;
+
+		glBindBuffer(GL_PIXEL_UNPACK_BUFFER, slot.pbo);
+		if (!slot.ptr && glUnmapBuffer(GL_PIXEL_UNPACK_BUFFER) == GL_FALSE)
+		{
+			//the buffer was lost while mapped (a display mode change)
+			//a pending texture is left unfilled
+			glBindBuffer(GL_PIXEL_UNPACK_BUFFER, 0);
+			slot.tex = 0;
+			fallbacks_++;
+			return false;
+		}
+
+		GLint binding = 0;
+		if (bind)
+		{
+			glGetIntegerv(GL_TEXTURE_BINDING_3D, &binding);
+			glBindTexture(GL_TEXTURE_3D, slot.tex);
+		}
+		//the buffer holds packed data
+		GLint row_length, image_height, alignment;
+		glGetIntegerv(GL_UNPACK_ROW_LENGTH, &row_length);
+		glGetIntegerv(GL_UNPACK_IMAGE_HEIGHT, &image_height);
+		glGetIntegerv(GL_UNPACK_ALIGNMENT, &alignment);
+		glPixelStorei(GL_UNPACK_ROW_LENGTH, 0);
+		glPixelStorei(GL_UNPACK_IMAGE_HEIGHT, 0);
+		glPixelStorei(GL_UNPACK_ALIGNMENT, 1);
+		GLuint query = begin_timer();
+		glTexSubImage3D(GL_TEXTURE_3D, 0, 0, 0, 0, slot.nx, slot.ny, slot.nz,
+			slot.format, slot.type, 0);
+		end_timer(query, slot.bytes);
+		glPixelStorei(GL_UNPACK_ROW_LENGTH, row_length);
+		glPixelStorei(GL_UNPACK_IMAGE_HEIGHT, image_height);
+		glPixelStorei(GL_UNPACK_ALIGNMENT, alignment);
+		slot.fence = glFenceSync(GL_SYNC_GPU_COMMANDS_COMPLETE, 0);
+		glBindBuffer(GL_PIXEL_UNPACK_BUFFER, 0);
+		if (bind)
+			glBindTexture(GL_TEXTURE_3D, binding);
+
+		slot.tex = 0;
+		bytes_ += slot.bytes;
+		return true;
+	}
+
+	void TextureUploader::drop(Slot &slot)
+	{
+		if (!slot.copy)
+			return;
+		slot.copy->wait();
+		delete slot.copy;
+		slot.copy = 0;
+		if (!slot.ptr)
+		{
+			glBindBuffer(GL_PIXEL_UNPACK_BUFFER, slot.pbo);
+			glUnmapBuffer(GL_PIXEL_UNPACK_BUFFER);
+			glBindBuffer(GL_PIXEL_UNPACK_BUFFER, 0);
+		}
+		slot.tex = 0;
+	}
+
+	bool TextureUploader::upload(GLuint tex, int nx, int ny, int nz, int nb,
+		std::size_t row_pitch, std::size_t slice_rows,
+		GLenum format, GLenum type, const void* data, bool async)
+	{
+		if (!enable_ || !data || nx <= 0 || ny <= 0 || nz <= 0 || nb <= 0)
+			return false;
+		std::size_t row_bytes = (std::size_t)nx*nb;
+		std::size_t bytes = row_bytes*ny*nz;
+		if (bytes > max_bytes_ || !supported())
+		{
+			fallbacks_++;
+			return false;
+		}
+
+		if (!ring_.empty() && (int)ring_.size() != ring_num_)
+			release();
+		if (ring_.empty())
+		{
+			ring_.assign(ring_num_, Slot());
+			next_ = 0;
+			persistent_ = GLEW_ARB_buffer_storage && glBufferStorage;
+		}
+
+		//the oldest upload is next in the ring
+		Slot &slot = ring_[next_];
+		fill(slot, true);
+		if (!wait(slot) || !reserve(slot, bytes))
+		{
+			fallbacks_++;
+			return false;
+		}
+		unsigned char* dst = (unsigned char*)slot.ptr;
+		if (!dst)
+			dst = (unsigned char*)glMapBufferRange(GL_PIXEL_UNPACK_BUFFER, 0, bytes,
+				GL_MAP_WRITE_BIT | GL_MAP_INVALIDATE_BUFFER_BIT | GL_MAP_UNSYNCHRONIZED_BIT);
+		glBindBuffer(GL_PIXEL_UNPACK_BUFFER, 0);
+		if (!dst)
+		{
+			fallbacks_++;
+			return false;
+		}
+
+		//copy in slabs of about a chunk each
+		const unsigned char* src = (const unsigned char*)data;
+		std::size_t pitch = row_pitch*nb;
+		std::size_t slice_pitch = row_pitch*slice_rows*nb;
+		int slabs = int(bytes / UPLOAD_COPY_CHUNK);
+		if (slabs < 1) slabs = 1;
+		if (slabs > nz) slabs = nz;
+		Source source = {src, src + (nz-1)*slice_pitch + (ny-1)*pitch + row_bytes, slabs};
+		source_lock_.Lock();
+		sources_.push_back(source);
+		source_lock_.Unlock();
+		//a single slab waited for right away is copied on this thread
+		slot.copy = new ThreadPoolGroup(async || slabs > 1 ?
+			ThreadPool::shared() : 0);
+		for (int i = 0; i < slabs; ++i)
+		{
+			int z0 = int((long long)nz*i/slabs);
+			int z1 = int((long long)nz*(i+1)/slabs);
+			slot.copy->submit(new UploadCopyTask(dst, src, ny, z0, z1,
+				row_bytes, pitch, slice_pitch));
+		}
+		slot.tex = tex;
+		slot.nx = nx;
+		slot.ny = ny;
+		slot.nz = nz;
+		slot.format = format;
+		slot.type = type;
+		slot.bytes = bytes;
+		next_ = (next_ + 1) % (int)ring_.size();
+
+		if (async)
+			return true;
+		return fill(slot, false);
+	}
+
+	void TextureUploader::update()
+	{
+		poll_timers();
+		for (std::size_t i = 0; i < ring_.size(); ++i)
+		{
+			if (ring_[i].copy && !ring_[i].copy->busy())
+				fill(ring_[i], true);
+		}
+	}
+
+	bool TextureUploader::has_room()
+	{
+		if (!enable_ || !supported())
+			return false;
+		update();
+		if (ring_.empty())
+			return true;
+		Slot &slot = ring_[next_];
+		if (slot.copy)
+			return false;
+		if (!slot.fence)
+			return true;
+		GLenum status = glClientWaitSync(slot.fence, 0, 0);
+		return status == GL_ALREADY_SIGNALED ||
+			status == GL_CONDITION_SATISFIED;
+	}
+
+	bool TextureUploader::pending(GLuint tex)
+	{
+		for (std::size_t i = 0; i < ring_.size(); ++i)
+		{
+			if (ring_[i].copy && ring_[i].tex == tex)
+				return true;
+		}
+		return false;
+	}
+
+	void TextureUploader::finish(GLuint tex)
+	{
+		for (std::size_t i = 0; i < ring_.size(); ++i)
+		{
+			if (ring_[i].copy && ring_[i].tex == tex)
+				fill(ring_[i], true);
+		}
+	}
+
+	void TextureUploader::finish_all()
+	{
+		for (std::size_t i = 0; i < ring_.size(); ++i)
+			fill(ring_[i], true);
+	}
+
+	void TextureUploader::cancel(GLuint tex)
+	{
+		for (std::size_t i = 0; i < ring_.size(); ++i)
+		{
+			if (ring_[i].copy && ring_[i].tex == tex)
+				drop(ring_[i]);
+		}
+	}
+
+	void TextureUploader::release()
+	{
+		for (std::size_t i = 0; i < ring_.size(); ++i)
+		{
+			drop(ring_[i]);
+			wait(ring_[i]);
+			free_slot(ring_[i]);
+		}
+		ring_.clear();
+		next_ = 0;
+
+		for (std::size_t i = 0; i < timers_.size(); ++i)
+			free_queries_.push_back(timers_[i].query);
+		timers_.clear();
+		if (!free_queries_.empty())
+			glDeleteQueries((GLsizei)free_queries_.size(), &free_queries_[0]);
+		free_queries_.clear();
+	}
+
+	GLuint TextureUploader::begin_timer()
+	{
+		if (!timer_supported())
+			return 0;
+		poll_timers();
+		if (timers_.size() >= UPLOAD_TIMER_NUM)
+			return 0;
+		GLuint query = 0;
+		if (free_queries_.empty())
+			glGenQueries(1, &query);
+		else
+		{
+			query = free_queries_.back();
+			free_queries_.pop_back();
+		}
+		if (query)
+			glBeginQuery(GL_TIME_ELAPSED, query);
+		return query;
+	}
+
+	void TextureUploader::end_timer(GLuint query, std::size_t bytes)
+	{
+		if (!query)
+			return;
+		glEndQuery(GL_TIME_ELAPSED);
+		Timer timer = {query, bytes};
+		timers_.push_back(timer);
+	}
+
+	void TextureUploader::poll_timers()
+	{
+		//queries finish in the order they were issued
+		std::size_t i = 0;
+		for (; i < timers_.size(); ++i)
+		{
+			GLint available = 0;
+			glGetQueryObjectiv(timers_[i].query, GL_QUERY_RESULT_AVAILABLE, &available);
+			if (!available)
+				break;
+			GLuint64 ns = 0;
+			glGetQueryObjectui64v(timers_[i].query, GL_QUERY_RESULT, &ns);
+			free_queries_.push_back(timers_[i].query);
+			//too short to be measured
+			if (ns < UPLOAD_TIMER_MIN)
+				continue;
+			double rate = timers_[i].bytes * 1e6 / ns;
+			rate_ = rate_ > 0.0 ? rate_*0.8 + rate*0.2 : rate;
+		}
+		timers_.erase(timers_.begin(), timers_.begin() + i);
+	}
+
+	void TextureUploader::wait_source(const void* ptr, std::size_t size)
+	{
+		if (!ptr || !size)
+			return;
+		const unsigned char* begin = (const unsigned char*)ptr;
+		const unsigned char* end = begin + size;
+		wxMutexLocker lock(source_lock_);
+		bool busy = true;
+		while (busy)
+		{
+			busy = false;
+			for (std::size_t i = 0; i < sources_.size(); ++i)
+			{
+				if (sources_[i].begin < end && begin < sources_[i].end)
+				{
+					busy = true;
+					break;
+				}
+			}
+			if (busy)
+				source_cond_.Wait();
+		}
+	}
+
+	void TextureUploader::release_source(const void* ptr)
+	{
+		wxMutexLocker lock(source_lock_);
+		for (std::size_t i = 0; i < sources_.size(); ++i)
+		{
+			if (sources_[i].begin != ptr)
+				continue;
+			if (--sources_[i].tasks <= 0)
+			{
+				sources_.erase(sources_.begin() + i);
+				source_cond_.Broadcast();
+			}
+			return;
+		}
+	}
+
+} // namespace FLIVR
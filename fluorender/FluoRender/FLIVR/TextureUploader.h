@@ -0,0 +1,172 @@
+//
+//  For more information, please see: http://software.sci.utah.edu
+//
+//  The MIT License
+//
+//  Copyright (c) 2004 Scientific Computing and Imaging Institute,
+//  University of Utah.
+//
+//
+//  Permission is hereby granted, free of charge, to any person obtaining a
+//  copy of this software and associated documentation files (the "Software"),
+//  to deal in the Software without restriction, including without limitation
+//  the rights to use, copy, modify, merge, publish, distribute, sublicense,
+//  and/or sell copies of the Software, and to permit persons to whom the
+//  Software is furnished to do so, subject to the following conditions:
+//
+//  The above copyright notice and this permission notice shall be included
+//  in all copies or substantial portions of the Software.
+//
+//  THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS
+//  OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+//  FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL
+//  THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+//  LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+//  FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER
+//  DEALINGS IN THE SOFTWARE.
+//
+
+
+#ifndef SLIVR_TextureUploader_h
+#define SLIVR_TextureUploader_h
+
+#include <GL/glew.h>
+#include <wx/thread.h>
+
+#include <cstddef>
+#include <vector>
+
+namespace FLIVR
+{
+	class ThreadPoolGroup;
+
+	//streams brick data to 3d textures through a ring of pixel buffer objects
+	//the data are copied into a mapped buffer by the shared thread pool and the
+	//texture is filled from the buffer, so the driver transfers it without
+	//another copy on the render thread. an upload can return before its copy
+	//is done; the texture is then pending until update() or finish() fills it.
+	//a fence after each fill tells when its buffer can be written again, and
+	//a timer query around it measures the upload rate on the gpu.
+	//the buffers are mapped once and kept mapped when persistent mapping
+	//(ARB_buffer_storage) is supported.
+	//all gl calls are made on the thread of the gl context
+	class TextureUploader
+	{
+	public:
+		TextureUploader();
+		~TextureUploader();
+
+		//number of buffers in the ring and the bytes of each at most
+		//bricks larger than a buffer are not streamed; a new number of
+		//buffers rebuilds the ring at the next upload
+		void set_ring(int num, std::size_t max_bytes);
+		int get_ring_num() const {return ring_num_;}
+		std::size_t get_ring_bytes() const {return max_bytes_;}
+		//streaming can be turned off to upload directly
+		void set_enable(bool val) {enable_ = val;}
+		bool get_enable() const {return enable_;}
+
+		//fill texture tex, bound to GL_TEXTURE_3D, with nx*ny*nz texels of nb bytes
+		//rows of data are row_pitch texels apart and slices slice_rows rows apart
+		//when async, it returns once the copy is started; whoever frees the
+		//data first waits for the copy with wait_source()
+		//returns false when the data cannot be streamed and nothing was done
+		bool upload(GLuint tex, int nx, int ny, int nz, int nb,
+			std::size_t row_pitch, std::size_t slice_rows,
+			GLenum format, GLenum type, const void* data, bool async=false);
+		//fill the pending textures whose copies are done
+		void update();
+		//whether an upload can start without waiting for another
+		bool has_room();
+		//whether the texture waits for its copy to be filled
+		bool pending(GLuint tex);
+		//wait for the copy of a pending texture and fill it
+		void finish(GLuint tex);
+		void finish_all();
+		//drop the upload of a texture that is being deleted
+		void cancel(GLuint tex);
+		//wait for the uploads and delete the buffers
+		void release();
+
+		//time an upload made without the ring, around glTexSubImage3D
+		//begin_timer() returns 0 when it cannot be timed
+		GLuint begin_timer();
+		void end_timer(GLuint query, std::size_t bytes);
+		//bytes uploaded per millisecond on the gpu, 0 until measured
+		double get_rate() const {return rate_;}
+
+		//bytes streamed and uploads that could not be streamed
+		unsigned long long get_bytes() const {return bytes_;}
+		unsigned long long get_fallbacks() const {return fallbacks_;}
+
+		//block until no copy reads from [ptr, ptr+size)
+		//called from any thread before brick data are freed
+		static void wait_source(const void* ptr, std::size_t size);
+		//a copy task is done with the data starting at ptr
+		static void release_source(const void* ptr);
+
+	private:
+		struct Slot
+		{
+			Slot() : pbo(0), fence(0), ptr(0), size(0),
+				copy(0), tex(0), nx(0), ny(0), nz(0),
+				format(0), type(0), bytes(0) {}
+			GLuint pbo;
+			GLsync fence;
+			void* ptr;			//persistent mapping, 0 if mapped for each upload
+			std::size_t size;
+			//the copy in flight, until the texture is filled
+			ThreadPoolGroup* copy;
+			GLuint tex;
+			int nx, ny, nz;
+			GLenum format, type;
+			std::size_t bytes;
+		};
+		struct Timer
+		{
+			GLuint query;
+			std::size_t bytes;
+		};
+		struct Source
+		{
+			const unsigned char* begin;
+			const unsigned char* end;
+			int tasks;
+		};
+
+		bool supported();
+		bool timer_supported();
+		//wait until the slot is no longer read by the gl
+		bool wait(Slot &slot);
+		//make the buffer of the slot hold bytes
+		bool reserve(Slot &slot, std::size_t bytes);
+		void free_slot(Slot &slot);
+		//wait for the copy of the slot and fill its texture
+		//bind: the texture is not bound and its binding is restored after
+		bool fill(Slot &slot, bool bind);
+		//drop the copy of the slot without filling
+		void drop(Slot &slot);
+		//read the timers that are done into the rate
+		void poll_timers();
+
+		std::vector<Slot> ring_;
+		int next_;
+		int ring_num_;
+		std::size_t max_bytes_;
+		bool enable_;
+		bool persistent_;
+		std::vector<Timer> timers_;
+		std::vector<GLuint> free_queries_;
+		double rate_;
+		unsigned long long bytes_;
+		unsigned long long fallbacks_;
+
+		//data read by copies in flight
+		static std::vector<Source> sources_;
+		static wxMutex source_lock_;
+		static wxCondition source_cond_;
+	};
+
+} // namespace FLIVR
+
+#endif // SLIVR_TextureUploader_h
@@ -0,0 +1,347 @@
+//
+//  For more information, please see: http://software.sci.utah.edu
+//
+//  The MIT License
+//
+//  Copyright (c) 2004 Scientific Computing and Imaging Institute,
+//  University of Utah.
+//
+//
+//  Permission is hereby granted, free of charge, to any person obtaining a
+//  copy of this software and associated documentation files (the "Software"),
+//  to deal in the Software without restriction, including without limitation
+//  the rights to use, copy, modify, merge, publish, distribute, sublicense,
+//  and/or sell copies of the Software, and to permit persons to whom the
+//  Software is furnished to do so, subject to the following conditions:
+//
+//  The above copyright notice and this permission notice shall be included
+//  in all copies or substantial portions of the Software.
+//
+//  THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS
+//  OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+//  FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL
+//  THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+//  LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+//  FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER
+//  DEALINGS IN THE SOFTWARE.
+//
+
+#include <FLIVR/ThreadPool.h>
+
+namespace FLIVR
+{
+	ThreadPool* ThreadPool::shared_ = NULL;
+	wxMutex ThreadPool::shared_lock_;
+
+	ThreadPoolWorker::ThreadPoolWorker(ThreadPool *pool, int id)
+		: wxThread(wxTHREAD_JOINABLE), m_pool(pool), m_id(id)
+	{
+	}
+
+	ThreadPoolWorker::~ThreadPoolWorker()
+	{
+	}
+
+	wxThread::ExitCode ThreadPoolWorker::Entry()
+	{
+		ThreadPoolTask *task = NULL;
+		while (m_pool->acquire(m_id, task))
+		{
+			task->run();
+			delete task;
+			m_pool->release();
+		}
+		return (wxThread::ExitCode)0;
+	}
+
+	ThreadPool::ThreadPool(int num_threads)
+		: pending_(0),
+		running_(0),
+		sleeping_(0),
+		next_(0),
+		exit_(0),
+		work_cond_(state_lock_),
+		idle_cond_(state_lock_)
+	{
+		if (num_threads <= 0)
+			num_threads = wxThread::GetCPUCount();
+		if (num_threads <= 0)
+			num_threads = 1;
+
+		for (int i = 0; i < num_threads; i++)
+			queues_.push_back(new WorkQueue);
+
+		for (int i = 0; i < num_threads; i++)
+		{
+			ThreadPoolWorker *worker = new ThreadPoolWorker(this, i);
+			if (worker->Create() != wxTHREAD_NO_ERROR)
+			{
+				delete worker;
+				continue;
+			}
+			workers_.push_back(worker);
+			worker->Run();
+		}
+	}
+
+	ThreadPool::~ThreadPool()
+	{
+		state_lock_.Lock();
+		wxAtomicInc(exit_);
+		work_cond_.Broadcast();
+		state_lock_.Unlock();
+
+		for (size_t i = 0; i < workers_.size(); i++)
+		{
+			workers_[i]->Wait();
+			delete workers_[i];
+		}
+		workers_.clear();
+
+		cancel_pending();
+
+		for (size_t i = 0; i < queues_.size(); i++)
+			delete queues_[i];
+		queues_.clear();
+	}
+
+	void ThreadPool::submit(ThreadPoolTask *task)
+	{
+		if (!task)
+			return;
+
+		if (workers_.empty())
+		{
+			//no worker could be started; run it on the caller
+			task->run();
+			delete task;
+			return;
+		}
+
+		//a worker keeps what it submits, the others steal it
+		WorkQueue *q = 0;
+		ThreadPoolWorker *worker = dynamic_cast<ThreadPoolWorker*>(wxThread::This());
+		if (worker && worker->m_pool == this)
+			q = queues_[worker->m_id % queues_.size()];
+		else
+		{
+			wxAtomicInc(next_);
+			q = queues_[(unsigned int)next_ % queues_.size()];
+		}
+		q->lock.Lock();
+		q->tasks.push_back(task);
+		q->lock.Unlock();
+		wxAtomicInc(pending_);
+
+		//a worker going to sleep either sees the task or is counted here
+		if (sleeping_ > 0)
+		{
+			wxMutexLocker lock(state_lock_);
+			work_cond_.Signal();
+		}
+	}
+
+	void ThreadPool::cancel_pending()
+	{
+		std::vector<ThreadPoolTask*> dropped;
+
+		for (size_t i = 0; i < queues_.size(); i++)
+		{
+			WorkQueue *q = queues_[i];
+			q->lock.Lock();
+			for (size_t j = 0; j < q->tasks.size(); j++)
+			{
+				dropped.push_back(q->tasks[j]);
+				wxAtomicDec(pending_);
+			}
+			q->tasks.clear();
+			q->lock.Unlock();
+		}
+		check_idle();
+
+		for (size_t i = 0; i < dropped.size(); i++)
+		{
+			dropped[i]->cancel();
+			delete dropped[i];
+		}
+	}
+
+	void ThreadPool::wait_idle()
+	{
+		wxMutexLocker lock(state_lock_);
+		while (pending_ > 0 || running_ > 0)
+			idle_cond_.Wait();
+	}
+
+	int ThreadPool::get_running_num()
+	{
+		return running_;
+	}
+
+	int ThreadPool::get_pending_num()
+	{
+		return pending_;
+	}
+
+	bool ThreadPool::is_worker()
+	{
+		ThreadPoolWorker *worker = dynamic_cast<ThreadPoolWorker*>(wxThread::This());
+		return worker && worker->m_pool == this;
+	}
+
+	ThreadPool* ThreadPool::shared()
+	{
+		wxMutexLocker lock(shared_lock_);
+		if (!shared_)
+			shared_ = new ThreadPool(0);
+		return shared_;
+	}
+
+	void ThreadPool::release_shared()
+	{
+		wxMutexLocker lock(shared_lock_);
+		if (shared_)
+			delete shared_;
+		shared_ = NULL;
+	}
+
+	bool ThreadPool::acquire(int id, ThreadPoolTask* &task)
+	{
+		task = NULL;
+		while (!exit_)
+		{
+			//counted before it is taken so that the pool never looks idle
+			//while a task is between its deque and the worker
+			wxAtomicInc(running_);
+			task = pop_or_steal(id);
+			if (task)
+			{
+				wxAtomicDec(pending_);
+				return true;
+			}
+			release();
+
+			//nothing to take: sleep until a task is submitted
+			state_lock_.Lock();
+			wxAtomicInc(sleeping_);
+			while (!exit_ && pending_ <= 0)
+				work_cond_.Wait();
+			wxAtomicDec(sleeping_);
+			state_lock_.Unlock();
+		}
+		return false;
+	}
+
+	void ThreadPool::release()
+	{
+		if (wxAtomicDec(running_) == 0)
+			check_idle();
+	}
+
+	void ThreadPool::check_idle()
+	{
+		if (pending_ > 0 || running_ > 0)
+			return;
+		wxMutexLocker lock(state_lock_);
+		idle_cond_.Broadcast();
+	}
+
+	ThreadPoolTask* ThreadPool::pop_or_steal(int id)
+	{
+		ThreadPoolTask *task = NULL;
+		size_t qnum = queues_.size();
+
+		//own deque first, oldest task first
+		WorkQueue *own = queues_[id % qnum];
+		own->lock.Lock();
+		if (!own->tasks.empty())
+		{
+			task = own->tasks.front();
+			own->tasks.pop_front();
+		}
+		own->lock.Unlock();
+		if (task)
+			return task;
+
+		//steal the newest task of a sibling under its lock
+		for (size_t i = 1; i < qnum; i++)
+		{
+			WorkQueue *q = queues_[(id + i) % qnum];
+			q->lock.Lock();
+			if (!q->tasks.empty())
+			{
+				task = q->tasks.back();
+				q->tasks.pop_back();
+			}
+			q->lock.Unlock();
+			if (task)
+				return task;
+		}
+
+		return NULL;
+	}
+
+	ThreadPoolGroup::ThreadPoolGroup(ThreadPool *pool)
+		: pool_(pool),
+		inline_(!pool || pool->get_thread_num() == 0 || pool->is_worker()),
+		count_(0),
+		cond_(lock_)
+	{
+	}
+
+	ThreadPoolGroup::~ThreadPoolGroup()
+	{
+		wait();
+	}
+
+	void ThreadPoolGroup::submit(ThreadPoolTask *task)
+	{
+		if (!task)
+			return;
+		if (inline_)
+		{
+			task->run();
+			delete task;
+			return;
+		}
+		lock_.Lock();
+		count_++;
+		lock_.Unlock();
+		pool_->submit(new GroupTask(this, task));
+	}
+
+	void ThreadPoolGroup::wait()
+	{
+		wxMutexLocker lock(lock_);
+		while (count_ > 0)
+			cond_.Wait();
+	}
+
+	bool ThreadPoolGroup::busy()
+	{
+		wxMutexLocker lock(lock_);
+		return count_ > 0;
+	}
+
+	void ThreadPoolGroup::done()
+	{
+		wxMutexLocker lock(lock_);
+		if (--count_ <= 0)
+			cond_.Broadcast();
+	}
+
+	void ThreadPoolGroup::GroupTask::run()
+	{
+		task_->run();
+		delete task_;
+		group_->done();
+	}
+
+	void ThreadPoolGroup::GroupTask::cancel()
+	{
+		task_->cancel();
+		delete task_;
+		group_->done();
+	}
+
+} // namespace FLIVR
@@ -0,0 +1,178 @@
+//
+//  For more information, please see: http://software.sci.utah.edu
+//
+//  The MIT License
+//
+//  Copyright (c) 2004 Scientific Computing and Imaging Institute,
+//  University of Utah.
+//
+//
+//  Permission is hereby granted, free of charge, to any person obtaining a
+//  copy of this software and associated documentation files (the "Software"),
+//  to deal in the Software without restriction, including without limitation
+//  the rights to use, copy, modify, merge, publish, distribute, sublicense,
+//  and/or sell copies of the Software, and to permit persons to whom the
+//  Software is furnished to do so, subject to the following conditions:
+//
+//  The above copyright notice and this permission notice shall be included
+//  in all copies or substantial portions of the Software.
+//
+//  THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS
+//  OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+//  FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL
+//  THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+//  LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+//  FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER
+//  DEALINGS IN THE SOFTWARE.
+//
+
+#ifndef SLIVR_ThreadPool_h
+#define SLIVR_ThreadPool_h
+
+#include <wx/thread.h>
+#include <wx/atomic.h>
+
+#include <vector>
+#include <deque>
+
+namespace FLIVR
+{
+	//a unit of work executed by a ThreadPool worker
+	//the pool takes ownership and deletes the task after run() or cancel()
+	class ThreadPoolTask
+	{
+	public:
+		ThreadPoolTask() {}
+		virtual ~ThreadPoolTask() {}
+
+		virtual void run() = 0;
+		//called instead of run() when a queued task is dropped
+		virtual void cancel() {}
+	};
+
+	class ThreadPool;
+
+	class ThreadPoolWorker : public wxThread
+	{
+	public:
+		ThreadPoolWorker(ThreadPool *pool, int id);
+		~ThreadPoolWorker();
+	protected:
+		virtual ExitCode Entry();
+		friend class ThreadPool;
+		ThreadPool *m_pool;
+		int m_id;
+	};
+
+	//long-lived worker threads with one task deque per worker
+	//a worker takes tasks from the front of its own deque and
+	//steals from the back of the others when it runs dry.
+	//each deque has its own lock and the counts are atomic; the pool
+	//lock is only taken by workers going to sleep and to wake them
+	class ThreadPool
+	{
+	public:
+		//num_threads <= 0: one worker per cpu core
+		ThreadPool(int num_threads = 0);
+		~ThreadPool();
+
+		//queue a task; tasks submitted in order are started roughly in order
+		//tasks submitted by a worker go to its own deque, others are spread
+		void submit(ThreadPoolTask *task);
+		//drop all tasks that have not started yet
+		void cancel_pending();
+		//block until no task is queued or running
+		void wait_idle();
+
+		int get_thread_num() { return (int)workers_.size(); }
+		int get_running_num();
+		int get_pending_num();
+		//whether the calling thread is a worker of this pool
+		bool is_worker();
+
+		//process-wide pool with one worker per cpu core, started on first use,
+		//for data-parallel jobs like decoding a frame; callers wait for their
+		//own tasks with a ThreadPoolGroup, never with wait_idle()
+		static ThreadPool* shared();
+		//stop the shared pool, at exit
+		static void release_shared();
+
+		friend class ThreadPoolWorker;
+
+	private:
+		struct WorkQueue
+		{
+			wxMutex lock;
+			std::deque<ThreadPoolTask*> tasks;
+		};
+
+		//wait for a task; returns false when the pool is shutting down
+		bool acquire(int id, ThreadPoolTask* &task);
+		void release();
+		ThreadPoolTask* pop_or_steal(int id);
+		//wake threads waiting in wait_idle() if nothing is left
+		void check_idle();
+
+		std::vector<WorkQueue*> queues_;
+		std::vector<ThreadPoolWorker*> workers_;
+
+		//tasks queued, tasks taken by workers
+		//a task is counted as running before it leaves its deque
+		wxAtomicInt pending_;
+		wxAtomicInt running_;
+		//workers asleep on work_cond_
+		wxAtomicInt sleeping_;
+		wxAtomicInt next_;
+		wxAtomicInt exit_;
+		//for sleeping and waking only
+		wxMutex state_lock_;
+		wxCondition work_cond_;
+		wxCondition idle_cond_;
+
+		static ThreadPool* shared_;
+		static wxMutex shared_lock_;
+	};
+
+	//the tasks one caller submits to a pool that others use too
+	//wait() returns when these tasks are done, whatever else the pool runs.
+	//tasks submitted from a worker of the same pool run right away on it,
+	//so that the worker does not wait for a slot it holds itself
+	class ThreadPoolGroup
+	{
+	public:
+		ThreadPoolGroup(ThreadPool *pool);
+		//waits for the tasks still running
+		~ThreadPoolGroup();
+
+		void submit(ThreadPoolTask *task);
+		void wait();
+		//whether some of the tasks have not finished, without waiting
+		bool busy();
+
+		int get_thread_num() { return pool_ ? pool_->get_thread_num() : 0; }
+
+	private:
+		class GroupTask : public ThreadPoolTask
+		{
+		public:
+			GroupTask(ThreadPoolGroup *group, ThreadPoolTask *task)
+				: group_(group), task_(task) {}
+			virtual void run();
+			virtual void cancel();
+		private:
+			ThreadPoolGroup *group_;
+			ThreadPoolTask *task_;
+		};
+
+		void done();
+
+		ThreadPool *pool_;
+		bool inline_;
+		int count_;
+		wxMutex lock_;
+		wxCondition cond_;
+	};
+
+} // namespace FLIVR
+
+#endif // SLIVR_ThreadPool_h
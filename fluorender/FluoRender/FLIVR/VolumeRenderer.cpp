@@ -580,33 +580,11 @@ namespace FLIVR
 		return dt;
 	}
 
-	bool VolumeRenderer::test_against_view_clip(const BBox &bbox, const BBox &tbox, const BBox &dbox, bool persp)
+	bool VolumeRenderer::get_clip_corners(Point pp[8])
 	{
-		if (!test_against_view(bbox, persp))
+		if (planes_.size() < 6)
 			return false;
 
-		Transform *tform = tex_->transform();
-		if (!tform)
-			return true;
-		
-		Vector b_u[3];
-		b_u[0] = Vector(1.0, 0.0, 0.0);
-		b_u[1] = Vector(0.0, 1.0, 0.0);
-		b_u[2] = Vector(0.0, 0.0, 1.0);
-		
-		Point bmax = bbox.max();
-		Point bmin = bbox.min();
-
-		bmax = tform->transform(bmax);
-		bmin = tform->transform(bmin);
-
-		float b_e[3];
-		b_e[0] = abs(bmax.x() - bmin.x()) * 0.5f;
-		b_e[1] = abs(bmax.y() - bmin.y()) * 0.5f;
-		b_e[2] = abs(bmax.z() - bmin.z()) * 0.5f;
-
-		Vector b_c = (bmax + bmin) * 0.5f;
-		
 		Plane* px1 = planes_[0];
 		Plane* px2 = planes_[1];
 		Plane* py1 = planes_[2];
@@ -619,43 +597,91 @@ namespace FLIVR
 		Point lp_x1z1, lp_x1z2, lp_x2z1, lp_x2z2;
 		//x1z1
 		if (!px1->Intersect(*pz1, lp_x1z1, lv_x1z1))
-			return true;
+			return false;
 		//x1z2
 		if (!px1->Intersect(*pz2, lp_x1z2, lv_x1z2))
-			return true;
+			return false;
 		//x2z1
 		if (!px2->Intersect(*pz1, lp_x2z1, lv_x2z1))
-			return true;
+			return false;
 		//x2z2
 		if (!px2->Intersect(*pz2, lp_x2z2, lv_x2z2))
-			return true;
+			return false;
 
 		//calculate 8 points
-		Point pp[8];
 		//p0 = l_x1z1 * py1
 		if (!py1->Intersect(lp_x1z1, lv_x1z1, pp[0]))
-			return true;
+			return false;
 		//p1 = l_x1z2 * py1
 		if (!py1->Intersect(lp_x1z2, lv_x1z2, pp[1]))
-			return true;
+			return false;
 		//p2 = l_x2z1 *py1
 		if (!py1->Intersect(lp_x2z1, lv_x2z1, pp[2]))
-			return true;
+			return false;
 		//p3 = l_x2z2 * py1
 		if (!py1->Intersect(lp_x2z2, lv_x2z2, pp[3]))
-			return true;
+			return false;
 		//p4 = l_x1z1 * py2
 		if (!py2->Intersect(lp_x1z1, lv_x1z1, pp[4]))
-			return true;
+			return false;
 		//p5 = l_x1z2 * py2
 		if (!py2->Intersect(lp_x1z2, lv_x1z2, pp[5]))
-			return true;
+			return false;
 		//p6 = l_x2z1 * py2
 		if (!py2->Intersect(lp_x2z1, lv_x2z1, pp[6]))
-			return true;
+			return false;
 		//p7 = l_x2z2 * py2
 		if (!py2->Intersect(lp_x2z2, lv_x2z2, pp[7]))
+			return false;
+
+		return true;
+	}
+
+	bool VolumeRenderer::get_clip_box(BBox &box)
+	{
+		box.reset();
+		Point pp[8];
+		if (!get_clip_corners(pp))
+			return false;
+		for (int i = 0; i < 8; i++)
+			box.extend(pp[i]);
+		return true;
+	}
+
+	bool VolumeRenderer::test_against_view_clip(const BBox &bbox, const BBox &tbox, const BBox &dbox, bool persp)
+	{
+		if (!test_against_view(bbox, persp))
+			return false;
+
+		Transform *tform = tex_->transform();
+		if (!tform)
 			return true;
+		
+		Vector b_u[3];
+		b_u[0] = Vector(1.0, 0.0, 0.0);
+		b_u[1] = Vector(0.0, 1.0, 0.0);
+		b_u[2] = Vector(0.0, 0.0, 1.0);
+		
+		Point bmax = bbox.max();
+		Point bmin = bbox.min();
+
+		bmax = tform->transform(bmax);
+		bmin = tform->transform(bmin);
+
+		float b_e[3];
+		b_e[0] = abs(bmax.x() - bmin.x()) * 0.5f;
+		b_e[1] = abs(bmax.y() - bmin.y()) * 0.5f;
+		b_e[2] = abs(bmax.z() - bmin.z()) * 0.5f;
+
+		Vector b_c = (bmax + bmin) * 0.5f;
+		
+		//corners of the clipping box
+		Point pp[8];
+		if (!get_clip_corners(pp))
+			return true;
+		Plane* px1 = planes_[0];
+		Plane* py1 = planes_[2];
+		Plane* pz1 = planes_[4];
 
 		for (int i = 0; i < 8; i++)
 			pp[i] = tform->transform(pp[i]);
@@ -1265,6 +1291,9 @@ namespace FLIVR
 			else
 				filter = GL_NEAREST;
 
+			//leave the bricks over the upload budget to the next frame
+			if (mem_swap_ && !check_upload_budget(b, 0, mask_, label_))
+				break;
 			if (!load_brick(0, 0, bricks, i, filter, compression_, mode))
 				continue;
 			if (mask_)
@@ -1307,6 +1336,8 @@ namespace FLIVR
 			if (mem_swap_){
 				finished_bricks_++;
 				glFinish();//Added by takashi
+				//copy the next bricks to be drawn while this thread goes on
+				prefetch_bricks(bricks, i, filter, compression_, bmode);
 			}
 
 			//takashi_debug
@@ -1327,6 +1358,8 @@ namespace FLIVR
 			//		break;
 			//}
 		}
+		//fill what was prefetched but not drawn, before the data can change
+		tex_uploader_.finish_all();
 
 		if (mem_swap_ &&
 			cur_brick_num_ == total_brick_num_)
@@ -211,11 +211,17 @@ namespace FLIVR
 		{ m_use_fog = use_fog; m_fog_intensity = fog_intensity; m_fog_start = fog_start; m_fog_end = fog_end; }
 
 		bool test_against_view_clip(const BBox &bbox, const BBox &tbox, const BBox &dbox, bool persp);
+		//bounding box of the clipping planes in the normalized coordinates of the volume
+		//false if the planes do not enclose a box
+		bool get_clip_box(BBox &box);
 		void set_clip_quaternion(Quaternion q){ m_q_cl = q; }
 
 		friend class MultiVolumeRenderer;
 
 	protected:
+		//corners of the box enclosed by the clipping planes
+		bool get_clip_corners(Point pp[8]);
+
 		double scalar_scale_;
 		double gm_scale_;
 		//transfer function properties
@@ -50,6 +50,9 @@ DEALINGS IN THE SOFTWARE.
  */
 
 #include "base_reader.h"
+#include <string.h>
+#include <algorithm>
+#include <new>
 
 int BaseReader::LZWDecode(tidata_t tif, tidata_t op0, tsize_t occ0)
 {
@@ -273,6 +276,25 @@ Nrrd* BaseReader::Convert(bool get_max) { return Convert(0,get_max); }
 
 Nrrd* BaseReader::Convert(int c, bool get_max) { return Convert(0,c,get_max); }
 
+//readers that store channels apart convert them one by one
+int BaseReader::ConvertChannels(int t, const vector<int> &chans, bool get_max,
+	vector<Nrrd*> &data, vector<double> &max_values, vector<double> &scalar_scales)
+{
+	int result = 0;
+	data.assign(chans.size(), (Nrrd*)0);
+	max_values.assign(chans.size(), 0.0);
+	scalar_scales.assign(chans.size(), 1.0);
+	for (size_t i=0; i<chans.size(); i++)
+	{
+		data[i] = Convert(t, chans[i], get_max);
+		max_values[i] = GetMaxValue();
+		scalar_scales[i] = GetScalarScale();
+		if (data[i])
+			result++;
+	}
+	return result;
+}
+
 int BaseReader::LoadOffset(int offset)
 {
    if (m_batch_list.size() <=1) return -1; 
@@ -283,4 +305,80 @@ int BaseReader::LoadOffset(int offset)
    return result;
 }
 
-int BaseReader::GetOffset() { return m_cur_batch; }
\ No newline at end of file
+int BaseReader::GetOffset() { return m_cur_batch; }
+
+//readers that cannot read part of a file convert all and crop
+Nrrd* BaseReader::ConvertRegion(int t, int c, const VoxelBox &box, int level)
+{
+	if (level != 0)
+		return 0;
+	Nrrd* data = Convert(t, c, false);
+	if (!data)
+		return 0;
+	Nrrd* region = CropRegion(data, box);
+	delete []data->data;
+	nrrdNix(data);
+	return region;
+}
+
+bool BaseReader::ClipRegion(VoxelBox &box, int nx, int ny, int nz)
+{
+	box.x0 = max(box.x0, 0);
+	box.y0 = max(box.y0, 0);
+	box.z0 = max(box.z0, 0);
+	box.x1 = min(box.x1, nx);
+	box.y1 = min(box.y1, ny);
+	box.z1 = min(box.z1, nz);
+	return !box.empty();
+}
+
+Nrrd* BaseReader::NewRegion(const VoxelBox &box, int type,
+	double xspc, double yspc, double zspc)
+{
+	if (type <= nrrdTypeUnknown || type >= nrrdTypeBlock)
+		return 0;
+	size_t bytes = nrrdTypeSize[type];
+	size_t voxels = (size_t)box.nx()*(size_t)box.ny()*(size_t)box.nz();
+	unsigned char* val = new (std::nothrow) unsigned char[voxels*bytes];
+	if (!val)
+		return 0;
+
+	Nrrd* data = nrrdNew();
+	nrrdWrap(data, val, type, 3, (size_t)box.nx(), (size_t)box.ny(), (size_t)box.nz());
+	nrrdAxisInfoSet(data, nrrdAxisInfoSpacing, xspc, yspc, zspc);
+	nrrdAxisInfoSet(data, nrrdAxisInfoMin, xspc*box.x0, yspc*box.y0, zspc*box.z0);
+	nrrdAxisInfoSet(data, nrrdAxisInfoMax, xspc*box.x1, yspc*box.y1, zspc*box.z1);
+	nrrdAxisInfoSet(data, nrrdAxisInfoSize, (size_t)box.nx(),
+		(size_t)box.ny(), (size_t)box.nz());
+	return data;
+}
+
+Nrrd* BaseReader::CropRegion(Nrrd* data, const VoxelBox &box)
+{
+	if (!data || !data->data || data->dim < 2 || data->dim > 3)
+		return 0;
+	int nx = (int)data->axis[0].size;
+	int ny = (int)data->axis[1].size;
+	int nz = data->dim == 3 ? (int)data->axis[2].size : 1;
+	VoxelBox region = box;
+	if (!ClipRegion(region, nx, ny, nz))
+		return 0;
+
+	double zspc = data->dim == 3 ? data->axis[2].spacing : 1.0;
+	Nrrd* result = NewRegion(region, data->type,
+		data->axis[0].spacing, data->axis[1].spacing, zspc);
+	if (!result)
+		return 0;
+
+	size_t bytes = nrrdElementSize(data);
+	size_t row = (size_t)region.nx()*bytes;
+	const unsigned char* src = (const unsigned char*)data->data;
+	unsigned char* dst = (unsigned char*)result->data;
+	for (int k=region.z0; k<region.z1; k++)
+		for (int j=region.y0; j<region.y1; j++)
+		{
+			memcpy(dst, src + (((size_t)k*ny + j)*nx + region.x0)*bytes, row);
+			dst += row;
+		}
+	return result;
+}
@@ -39,6 +39,21 @@ using namespace std;
 	#define nrrdAxisInfoSet nrrdAxisInfoSet_va
 #endif
 
+//a block of voxels [x0, x1) x [y0, y1) x [z0, z1)
+struct VoxelBox
+{
+	int x0, y0, z0;
+	int x1, y1, z1;
+
+	VoxelBox() : x0(0), y0(0), z0(0), x1(0), y1(0), z1(0) {}
+	VoxelBox(int _x0, int _y0, int _z0, int _x1, int _y1, int _z1) :
+		x0(_x0), y0(_y0), z0(_z0), x1(_x1), y1(_y1), z1(_z1) {}
+	int nx() const {return x1-x0;}
+	int ny() const {return y1-y0;}
+	int nz() const {return z1-z0;}
+	bool empty() const {return x1<=x0 || y1<=y0 || z1<=z0;}
+};
+
 class BaseReader
 {
 public:
@@ -62,12 +77,28 @@ public:
 	virtual Nrrd* Convert(bool get_max);			//Convert the data to nrrd
 	virtual Nrrd* Convert(int c, bool get_max);		//convert the specified channel to nrrd
 	virtual Nrrd* Convert(int t, int c, bool get_max) = 0;//convert the specified channel and time point to nrrd
+	//convert several channels of one time point in a single pass over the file
+	//data, max_values and scalar_scales receive one entry per channel in chans
+	//returns the number of channels converted
+	virtual int ConvertChannels(int t, const vector<int> &chans, bool get_max,
+		vector<Nrrd*> &data, vector<double> &max_values, vector<double> &scalar_scales);
+	//convert only the voxels in box of the specified channel and time point
+	//box is in voxels of the pyramid level and is clipped to the volume
+	//the min of the nrrd is the position of the clipped box
+	//readers that cannot read part of a file convert all and crop
+	//reader API only: the analysis tools still work on loaded volumes
+	virtual Nrrd* ConvertRegion(int t, int c, const VoxelBox &box, int level=0);
+	virtual int GetLevelNum() {return 1;}	//pyramid levels; 0 is the full resolution
+	//threads decoding pages in Convert, 1 decodes in page order on the calling thread
+	//and <= 0 uses every core; readers that decode on one thread ignore it
+	virtual void SetDecodeThreads(int num) {}
 	virtual wstring GetCurName(int t, int c) = 0;//for a 4d sequence, get the file name for specified time and channel
 
 	virtual wstring GetPathName() = 0;
 	virtual wstring GetDataName() = 0;
 	virtual int GetTimeNum() = 0;
 	virtual int GetCurTime() = 0;
+	virtual void SetCurTime(int t) = 0;	//time point reported by GetCurTime
 	virtual int GetChanNum() = 0;
 	virtual double GetExcitationWavelength(int chan) = 0;
 	virtual int GetSliceNum() = 0;
@@ -219,6 +250,14 @@ protected:
 		case 0:  ;			\
 	}
 
+	//clip box to a volume of nx*ny*nz voxels; false if nothing is left
+	static bool ClipRegion(VoxelBox &box, int nx, int ny, int nz);
+	//allocate a nrrd for box, placed in the volume by the spacings
+	static Nrrd* NewRegion(const VoxelBox &box, int type,
+		double xspc, double yspc, double zspc);
+	//copy box out of a converted volume
+	static Nrrd* CropRegion(Nrrd* data, const VoxelBox &box);
+
 	int LZWDecode(tidata_t tif, tidata_t op0, tsize_t occ0);
 	void DecodeAcc8(tidata_t cp0, tsize_t cc, tsize_t stride);
 	void DecodeAcc16(tidata_t cp0, tsize_t cc, tsize_t stride);
@@ -338,6 +338,9 @@ void BRKXMLReader::ReadLevel(tinyxml2::XMLElement* lvNode, LevelInfo &lvinfo)
 		strValue = lvNode->Attribute("FileType");
 		if (strValue == "RAW") lvinfo.file_type = BRICK_FILE_TYPE_RAW;
 		else if (strValue == "JPEG") lvinfo.file_type = BRICK_FILE_TYPE_JPEG;
+		else if (strValue == "ZLIB") lvinfo.file_type = BRICK_FILE_TYPE_ZLIB;
+		else if (strValue == "ZSTD") lvinfo.file_type = BRICK_FILE_TYPE_ZSTD;
+		else if (strValue == "LZ4") lvinfo.file_type = BRICK_FILE_TYPE_LZ4;
 	}
 	else lvinfo.file_type = BRICK_FILE_TYPE_NONE;
 
@@ -359,6 +362,30 @@ void BRKXMLReader::ReadLevel(tinyxml2::XMLElement* lvNode, LevelInfo &lvinfo)
 		}
 		child = child->NextSiblingElement();
 	}
+
+	IndexBricks(lvinfo);
+}
+
+void BRKXMLReader::IndexBricks(LevelInfo &lvinfo)
+{
+	vector<FLIVR::BrickIndex::Box> boxes(lvinfo.bricks.size());
+	for (size_t i=0; i<lvinfo.bricks.size(); i++)
+	{
+		//ids missing from the file leave empty boxes
+		FLIVR::BrickIndex::Box box = {0, 0, 0, 0, 0, 0};
+		BrickInfo *binfo = lvinfo.bricks[i];
+		if (binfo)
+		{
+			box.x0 = binfo->x_start;
+			box.y0 = binfo->y_start;
+			box.z0 = binfo->z_start;
+			box.x1 = binfo->x_start+binfo->x_size;
+			box.y1 = binfo->y_start+binfo->y_size;
+			box.z1 = binfo->z_start+binfo->z_size;
+		}
+		boxes[i] = box;
+	}
+	lvinfo.brick_index.build(boxes);
 }
 
 void BRKXMLReader::ReadPackedBricks(tinyxml2::XMLElement* packNode, vector<BrickInfo *> &brks)
@@ -523,6 +550,8 @@ void BRKXMLReader::ReadFilenames(tinyxml2::XMLElement* fileRootNode, vector<vect
 					if (str == "RAW") filename[frame][channel][id]->type = BRICK_FILE_TYPE_RAW;
 					else if (str == "JPEG") filename[frame][channel][id]->type = BRICK_FILE_TYPE_JPEG;
 					else if (str == "ZLIB") filename[frame][channel][id]->type = BRICK_FILE_TYPE_ZLIB;
+					else if (str == "ZSTD") filename[frame][channel][id]->type = BRICK_FILE_TYPE_ZSTD;
+					else if (str == "LZ4") filename[frame][channel][id]->type = BRICK_FILE_TYPE_LZ4;
 				}
 				else
 				{
@@ -537,8 +566,23 @@ void BRKXMLReader::ReadFilenames(tinyxml2::XMLElement* fileRootNode, vector<vect
 							filename[frame][channel][id]->type = BRICK_FILE_TYPE_JPEG;
 						else if (ext == L"zlib")
 							filename[frame][channel][id]->type = BRICK_FILE_TYPE_ZLIB;
+						else if (ext == L"zst" || ext == L"zstd")
+							filename[frame][channel][id]->type = BRICK_FILE_TYPE_ZSTD;
+						else if (ext == L"lz4")
+							filename[frame][channel][id]->type = BRICK_FILE_TYPE_LZ4;
 					}
 				}
+
+				//pre-filter of 16-bit compressed bricks, e.g. filter="DELTA,SHUFFLE"
+				filename[frame][channel][id]->filter = BRICK_FILE_FILTER_NONE;
+				if (child->Attribute("filter"))
+				{
+					str = child->Attribute("filter");
+					if (str.find("SHUFFLE") != string::npos)
+						filename[frame][channel][id]->filter |= BRICK_FILE_FILTER_SHUFFLE;
+					if (str.find("DELTA") != string::npos)
+						filename[frame][channel][id]->filter |= BRICK_FILE_FILTER_DELTA;
+				}
 			}
 		}
 		child = child->NextSiblingElement();
@@ -901,6 +945,90 @@ Nrrd *BRKXMLReader::Convert(int t, int c, bool get_max)
 	return data;
 }
 
+Nrrd* BRKXMLReader::ConvertRegion(int t, int c, const VoxelBox &box, int level)
+{
+	if (t<0 || t>=m_time_num ||
+		c<0 || c>=m_chan_num ||
+		level<0 || level>=m_level_num)
+		return 0;
+
+	LevelInfo &lvinfo = m_pyramid[level];
+	int type, bytes;
+	if (lvinfo.bit_depth == 8) {type = nrrdTypeUChar; bytes = 1;}
+	else if (lvinfo.bit_depth == 16) {type = nrrdTypeUShort; bytes = 2;}
+	else if (lvinfo.bit_depth == 32) {type = nrrdTypeFloat; bytes = 4;}
+	else return 0;
+	if (t >= (int)lvinfo.filename.size() || c >= (int)lvinfo.filename[t].size())
+		return 0;
+
+	VoxelBox region = box;
+	if (!ClipRegion(region, lvinfo.imageW, lvinfo.imageH, lvinfo.imageD))
+		return 0;
+	Nrrd* data = NewRegion(region, type, lvinfo.xspc, lvinfo.yspc, lvinfo.zspc);
+	if (!data)
+		return 0;
+	unsigned char* dst = (unsigned char*)data->data;
+	//missing or broken bricks stay empty
+	memset(dst, 0, (size_t)region.nx()*region.ny()*region.nz()*bytes);
+
+	vector<char> buf;
+	vector<int> ids;
+	FLIVR::BrickIndex::Box rbox = {region.x0, region.y0, region.z0,
+		region.x1, region.y1, region.z1};
+	lvinfo.brick_index.find(rbox, ids);
+	for (size_t i=0; i<ids.size(); i++)
+	{
+		BrickInfo *binfo = lvinfo.bricks[ids[i]];
+		VoxelBox part(
+			max(region.x0, binfo->x_start),
+			max(region.y0, binfo->y_start),
+			max(region.z0, binfo->z_start),
+			min(region.x1, binfo->x_start+binfo->x_size),
+			min(region.y1, binfo->y_start+binfo->y_size),
+			min(region.z1, binfo->z_start+binfo->z_size));
+		if (part.empty() ||
+			binfo->id < 0 || binfo->id >= (int)lvinfo.filename[t][c].size())
+			continue;
+
+		FLIVR::FileLocInfo *finfo = lvinfo.filename[t][c][binfo->id];
+		char *raw = 0;
+		size_t raw_size = 0;
+		if (!FLIVR::TextureBrick::read_brick_without_decomp(raw, raw_size, finfo))
+			continue;
+		size_t brick_size = (size_t)binfo->x_size*binfo->y_size*binfo->z_size*bytes;
+		const char *src = 0;
+		if (finfo->type == BRICK_FILE_TYPE_RAW)
+		{
+			if (raw_size >= brick_size)
+				src = raw;
+		}
+		else
+		{
+			buf.resize(brick_size);
+			if (FLIVR::TextureBrick::decompress_brick(&buf[0], raw, brick_size,
+				raw_size, finfo->type, finfo->filter))
+				src = &buf[0];
+		}
+
+		if (src)
+		{
+			size_t row = (size_t)part.nx()*bytes;
+			for (int k=part.z0; k<part.z1; k++)
+				for (int j=part.y0; j<part.y1; j++)
+				{
+					size_t si = ((size_t)(k-binfo->z_start)*binfo->y_size +
+						(j-binfo->y_start))*binfo->x_size + (part.x0-binfo->x_start);
+					size_t di = ((size_t)(k-region.z0)*region.ny() +
+						(j-region.y0))*region.nx() + (part.x0-region.x0);
+					memcpy(dst+di*bytes, src+si*bytes, row);
+				}
+		}
+		delete []raw;
+	}
+
+	return data;
+}
+
 wstring BRKXMLReader::GetCurName(int t, int c)
 {
    return wstring(L"");
@@ -4,6 +4,7 @@
 #include <vector>
 #include <base_reader.h>
 #include <FLIVR/TextureBrick.h>
+#include <FLIVR/BrickIndex.h>
 #include <tinyxml2.h>
 
 using namespace std;
@@ -31,6 +32,8 @@ public:
 	int LoadBatch(int index);
 	int LoadOffset(int offset);
 	Nrrd* Convert(int t, int c, bool get_max);
+	//read and decode only the bricks of a level that intersect box
+	Nrrd* ConvertRegion(int t, int c, const VoxelBox &box, int level=0);
 	wstring GetCurName(int t, int c);
 
 	wstring GetPathName() {return m_path_name;}
@@ -61,6 +64,7 @@ public:
 	int GetFileType(int lv = -1);
 
 	int GetLevelNum() {return m_level_num;}
+	int GetBrickNum(int lv) {return (lv >= 0 && lv < m_level_num) ? (int)m_pyramid[lv].bricks.size() : 0;}
 	void SetLevel(int lv);
 	int GetCopyableLevel() {return m_copy_lv;}
 
@@ -124,6 +128,8 @@ private:
 		int file_type;
 		vector<vector<vector<FLIVR::FileLocInfo *>>> filename;//Frame->Channel->BrickID->Filename
 		vector<BrickInfo *> bricks;
+		//spatial index of bricks, for region reads
+		FLIVR::BrickIndex brick_index;
 	};
 	vector<LevelInfo> m_pyramid;
 
@@ -186,6 +192,7 @@ private:
 	void ReadLevel(tinyxml2::XMLElement* lvNode, LevelInfo &lvinfo);
 	void ReadFilenames(tinyxml2::XMLElement* fileRootNode, vector<vector<vector<FLIVR::FileLocInfo *>>> &filename);
 	void ReadPackedBricks(tinyxml2::XMLElement* packNode, vector<BrickInfo *> &brks);
+	void IndexBricks(LevelInfo &lvinfo);
 	void Readbox(tinyxml2::XMLElement *boxNode, double &x0, double &y0, double &z0, double &x1, double &y1, double &z1);
 	void ReadPyramid(tinyxml2::XMLElement *lvRootNode, vector<LevelInfo> &pylamid);
 
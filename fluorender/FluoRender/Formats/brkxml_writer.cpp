@@ -5,9 +5,114 @@
 #include <string>
 #include <sstream>
 #include <stack>
+#include <climits>
+#include <FLIVR/Utils.h>
+
+//averages 2x2x2 (or 2x2x1 for anisotropic data) blocks of a slab of output slices
+template<class T>
+class LevelDownsampleTask : public FLIVR::ThreadPoolTask
+{
+public:
+	LevelDownsampleTask(const T *src, int snx, int sny, int snz,
+		T *dst, int dnx, int dny, int z0, int z1,
+		int fx, int fy, int fz) :
+		m_src(src), m_snx(snx), m_sny(sny), m_snz(snz),
+		m_dst(dst), m_dnx(dnx), m_dny(dny), m_z0(z0), m_z1(z1),
+		m_fx(fx), m_fy(fy), m_fz(fz)
+	{
+	}
+
+	virtual void run()
+	{
+		size_t sxy = (size_t)m_snx * m_sny;
+		for (int k = m_z0; k < m_z1; k++)
+		for (int j = 0; j < m_dny; j++)
+		{
+			T *out = m_dst + ((size_t)k*m_dny + j)*m_dnx;
+			for (int i = 0; i < m_dnx; i++)
+			{
+				unsigned int sum = 0;
+				unsigned int num = 0;
+				for (int kk = k*m_fz; kk < (k+1)*m_fz && kk < m_snz; kk++)
+				for (int jj = j*m_fy; jj < (j+1)*m_fy && jj < m_sny; jj++)
+				for (int ii = i*m_fx; ii < (i+1)*m_fx && ii < m_snx; ii++)
+				{
+					sum += m_src[sxy*kk + (size_t)m_snx*jj + ii];
+					num++;
+				}
+				out[i] = num ? T((sum + num/2) / num) : 0;
+			}
+		}
+	}
+
+private:
+	const T *m_src;
+	int m_snx, m_sny, m_snz;
+	T *m_dst;
+	int m_dnx, m_dny;
+	int m_z0, m_z1;
+	int m_fx, m_fy, m_fz;
+};
+
+//copies one brick out of a level and compresses it
+class BrickEncodeTask : public FLIVR::ThreadPoolTask
+{
+public:
+	BrickEncodeTask(const unsigned char *src, int nx, int ny, int bytes,
+		int x, int y, int z, int w, int h, int d,
+		int type, int filter, vector<char> *out, bool *ok) :
+		m_src(src), m_nx(nx), m_ny(ny), m_bytes(bytes),
+		m_x(x), m_y(y), m_z(z), m_w(w), m_h(h), m_d(d),
+		m_type(type), m_filter(filter), m_out(out), m_ok(ok)
+	{
+	}
+
+	virtual void run()
+	{
+		size_t row = (size_t)m_w * m_bytes;
+		size_t size = row * m_h * m_d;
+		vector<char> brick(size);
+		char *dst = size ? &brick[0] : NULL;
+		for (int k = 0; k < m_d; k++)
+		for (int j = 0; j < m_h; j++)
+		{
+			size_t index = ((size_t)(m_z+k)*m_ny + m_y+j)*m_nx + m_x;
+			memcpy(dst, m_src + index*m_bytes, row);
+			dst += row;
+		}
+
+		if (m_type == BRICK_FILE_TYPE_RAW)
+		{
+			m_out->swap(brick);
+			*m_ok = true;
+		}
+		else
+			*m_ok = FLIVR::TextureBrick::compress_brick(
+				*m_out, size ? &brick[0] : NULL, size, m_type, m_filter);
+	}
+
+private:
+	const unsigned char *m_src;
+	int m_nx, m_ny, m_bytes;
+	int m_x, m_y, m_z, m_w, m_h, m_d;
+	int m_type, m_filter;
+	vector<char> *m_out;
+	bool *m_ok;
+};
 
 BRKXMLWriter::BRKXMLWriter()
 {
+	m_data = 0;
+	m_spcx = 0.0;
+	m_spcy = 0.0;
+	m_spcz = 0.0;
+	m_use_spacings = false;
+	m_brick_size = 256;
+	m_thread_num = 0;
+	m_compression = false;
+	m_brick_type = BRICK_FILE_TYPE_RAW;
+	m_brick_filter = BRICK_FILE_FILTER_NONE;
+
 	tinyxml2::XMLDeclaration* decl = m_md_doc.NewDeclaration();
 
 	m_md_doc.InsertEndChild(decl);
@@ -22,18 +127,403 @@ BRKXMLWriter::~BRKXMLWriter()
 
 void BRKXMLWriter::SetData(Nrrd* data)
 {
+	m_data = data;
 }
 
 void BRKXMLWriter::SetSpacings(double spcx, double spcy, double spcz)
 {
+	m_spcx = spcx;
+	m_spcy = spcy;
+	m_spcz = spcz;
+	m_use_spacings = true;
+}
+
+void BRKXMLWriter::SetBrickSize(int size)
+{
+	if (size < 16)
+		size = 16;
+	m_brick_size = FLIVR::Pow2((unsigned int)size);
+	if (m_brick_size > size)
+		m_brick_size /= 2;
 }
 
 void BRKXMLWriter::SetCompression(bool value)
 {
+	m_compression = value;
+	if (!value)
+		m_brick_type = BRICK_FILE_TYPE_RAW;
+	else if (m_brick_type == BRICK_FILE_TYPE_RAW)
+		m_brick_type = BRICK_FILE_TYPE_ZLIB;
+}
+
+void BRKXMLWriter::SetBrickCodec(int type, int filter)
+{
+	//fall back to zlib when the codec was not built in
+	if (!FLIVR::TextureBrick::codec_available(type))
+		type = BRICK_FILE_TYPE_ZLIB;
+	m_brick_type = type;
+	m_brick_filter = filter;
+	m_compression = type != BRICK_FILE_TYPE_RAW;
+}
+
+string BRKXMLWriter::GetFileTypeName(int type)
+{
+	switch (type)
+	{
+	case BRICK_FILE_TYPE_RAW: return "RAW";
+	case BRICK_FILE_TYPE_JPEG: return "JPEG";
+	case BRICK_FILE_TYPE_ZLIB: return "ZLIB";
+	case BRICK_FILE_TYPE_ZSTD: return "ZSTD";
+	case BRICK_FILE_TYPE_LZ4: return "LZ4";
+	}
+	return "";
+}
+
+string BRKXMLWriter::GetFilterName(int filter)
+{
+	string name;
+	if (filter & BRICK_FILE_FILTER_DELTA)
+		name = "DELTA";
+	if (filter & BRICK_FILE_FILTER_SHUFFLE)
+		name += name.empty() ? "SHUFFLE" : ",SHUFFLE";
+	return name;
 }
 
 void BRKXMLWriter::Save(wstring filename, int mode)
 {
+	if (!m_data || !m_data->data || m_data->dim!=3)
+		return;
+
+	int bytes = 0;
+	if (m_data->type == nrrdTypeUChar)
+		bytes = 1;
+	else if (m_data->type == nrrdTypeUShort)
+		bytes = 2;
+	else
+		return;
+
+	int type = m_compression ? m_brick_type : BRICK_FILE_TYPE_RAW;
+	//bricks are never written as jpeg
+	if (type == BRICK_FILE_TYPE_JPEG || !FLIVR::TextureBrick::codec_available(type))
+		type = BRICK_FILE_TYPE_ZLIB;
+	int filter = (bytes == 2 && type != BRICK_FILE_TYPE_RAW) ?
+		m_brick_filter : BRICK_FILE_FILTER_NONE;
+
+#ifdef _WIN32
+	wchar_t slash = L'\\';
+#else
+	wchar_t slash = L'/';
+#endif
+	//separate path and name
+	size_t pos = filename.find_last_of(slash);
+	wstring dir = filename.substr(0, pos+1);
+	wstring name = filename.substr(pos+1);
+	pos = name.find_last_of(L'.');
+	if (pos != wstring::npos)
+		name = name.substr(0, pos);
+
+	//level dimensions; halve an axis only while it is not coarser than the others
+	vector<LevelData> levels;
+	LevelData lv0;
+	lv0.nx = int(m_data->axis[0].size);
+	lv0.ny = int(m_data->axis[1].size);
+	lv0.nz = int(m_data->axis[2].size);
+	lv0.spcx = m_use_spacings ? m_spcx : 1.0;
+	lv0.spcy = m_use_spacings ? m_spcy : 1.0;
+	lv0.spcz = m_use_spacings ? m_spcz : 1.0;
+	if (lv0.spcx <= 0.0) lv0.spcx = 1.0;
+	if (lv0.spcy <= 0.0) lv0.spcy = 1.0;
+	if (lv0.spcz <= 0.0) lv0.spcz = 1.0;
+	lv0.data = (unsigned char*)m_data->data;
+	levels.push_back(lv0);
+	while (levels.size() < 16)
+	{
+		LevelData lv = levels.back();
+		if (lv.nx <= m_brick_size && lv.ny <= m_brick_size && lv.nz <= m_brick_size)
+			break;
+		double min_spc = FLIVR::Min(lv.spcx, FLIVR::Min(lv.spcy, lv.spcz));
+		LevelData next = lv;
+		if (lv.nx > 1 && lv.spcx <= min_spc*1.5)
+		{
+			next.nx = (lv.nx+1)/2;
+			next.spcx = lv.spcx * lv.nx / next.nx;
+		}
+		if (lv.ny > 1 && lv.spcy <= min_spc*1.5)
+		{
+			next.ny = (lv.ny+1)/2;
+			next.spcy = lv.spcy * lv.ny / next.ny;
+		}
+		if (lv.nz > 1 && lv.spcz <= min_spc*1.5)
+		{
+			next.nz = (lv.nz+1)/2;
+			next.spcz = lv.spcz * lv.nz / next.nz;
+		}
+		if (next.nx == lv.nx && next.ny == lv.ny && next.nz == lv.nz)
+			break;
+		next.data = 0;
+		levels.push_back(next);
+	}
+
+	m_doc.Clear();
+	m_doc.InsertEndChild(m_doc.NewDeclaration());
+	tinyxml2::XMLElement *root = m_doc.NewElement("BRK");
+	root->SetAttribute("nChannel", 1);
+	root->SetAttribute("nFrame", 1);
+	root->SetAttribute("nLevel", (int)levels.size());
+	m_doc.InsertEndChild(root);
+
+	FLIVR::ThreadPool pool(m_thread_num);
+
+	bool result = true;
+	for (size_t i = 0; i < levels.size() && result; i++)
+	{
+		//each level is made from the previous one, which is released right after
+		if (i > 0)
+		{
+			size_t size = (size_t)levels[i].nx * levels[i].ny * levels[i].nz * bytes;
+			levels[i].data = new (std::nothrow) unsigned char[size];
+			if (!levels[i].data)
+			{
+				result = false;
+				break;
+			}
+			buildLevel(pool, levels[i-1], levels[i], bytes);
+			if (i > 1)
+			{
+				delete [] levels[i-1].data;
+				levels[i-1].data = 0;
+			}
+		}
+		result = writeLevel(pool, levels[i], (int)i, bytes, type, filter, dir, name, root);
+	}
+	for (size_t i = 1; i < levels.size(); i++)
+		delete [] levels[i].data;
+
+	if (!result)
+	{
+		cerr << "BRKXMLWriter::Save(wstring filename, int mode): failed to write " << ws2s(filename) << endl;
+		return;
+	}
+
+	SaveVVDXML_Metadata(filename, &m_doc);
+}
+
+void BRKXMLWriter::buildLevel(FLIVR::ThreadPool &pool, const LevelData &src, LevelData &dst, int bytes)
+{
+	int fx = src.nx == dst.nx ? 1 : 2;
+	int fy = src.ny == dst.ny ? 1 : 2;
+	int fz = src.nz == dst.nz ? 1 : 2;
+
+	//a few slabs per worker so that stealing can balance the load
+	int slab_num = FLIVR::Min(dst.nz, FLIVR::Max(1, pool.get_thread_num()*4));
+	for (int s = 0; s < slab_num; s++)
+	{
+		int z0 = (int)((long long)dst.nz * s / slab_num);
+		int z1 = (int)((long long)dst.nz * (s+1) / slab_num);
+		if (z0 == z1)
+			continue;
+		if (bytes == 1)
+			pool.submit(new LevelDownsampleTask<unsigned char>(
+				src.data, src.nx, src.ny, src.nz,
+				dst.data, dst.nx, dst.ny, z0, z1, fx, fy, fz));
+		else
+			pool.submit(new LevelDownsampleTask<unsigned short>(
+				(const unsigned short*)src.data, src.nx, src.ny, src.nz,
+				(unsigned short*)dst.data, dst.nx, dst.ny, z0, z1, fx, fy, fz));
+	}
+	pool.wait_idle();
+}
+
+void BRKXMLWriter::buildBrickBoxes(const LevelData &lv, vector<BrickBox> &boxes, int &bw, int &bh, int &bd)
+{
+	bw = FLIVR::Min(int(FLIVR::Pow2(lv.nx)), m_brick_size);
+	bh = FLIVR::Min(int(FLIVR::Pow2(lv.ny)), m_brick_size);
+	bd = FLIVR::Min(int(FLIVR::Pow2(lv.nz)), m_brick_size);
+
+	boxes.clear();
+	for (int k = 0; k < lv.nz; k += bd)
+	{
+		if (k) k--;
+		for (int j = 0; j < lv.ny; j += bh)
+		{
+			if (j) j--;
+			for (int i = 0; i < lv.nx; i += bw)
+			{
+				if (i) i--;
+				BrickBox b;
+				b.x = i;
+				b.y = j;
+				b.z = k;
+				b.w = FLIVR::Min(bw, lv.nx - i);
+				b.h = FLIVR::Min(bh, lv.ny - j);
+				b.d = FLIVR::Min(bd, lv.nz - k);
+
+				b.tx0 = i ? 0.5 / b.w : 0.0;
+				b.ty0 = j ? 0.5 / b.h : 0.0;
+				b.tz0 = k ? 0.5 / b.d : 0.0;
+				b.tx1 = (b.w < bw || lv.nx - i == bw) ? 1.0 : 1.0 - 0.5 / b.w;
+				b.ty1 = (b.h < bh || lv.ny - j == bh) ? 1.0 : 1.0 - 0.5 / b.h;
+				b.tz1 = (b.d < bd || lv.nz - k == bd) ? 1.0 : 1.0 - 0.5 / b.d;
+
+				b.bx0 = i ? (i + 0.5) / (double)lv.nx : 0.0;
+				b.by0 = j ? (j + 0.5) / (double)lv.ny : 0.0;
+				b.bz0 = k ? (k + 0.5) / (double)lv.nz : 0.0;
+				b.bx1 = lv.nx - i == bw ? 1.0 : FLIVR::Min((i + bw - 0.5) / (double)lv.nx, 1.0);
+				b.by1 = lv.ny - j == bh ? 1.0 : FLIVR::Min((j + bh - 0.5) / (double)lv.ny, 1.0);
+				b.bz1 = lv.nz - k == bd ? 1.0 : FLIVR::Min((k + bd - 0.5) / (double)lv.nz, 1.0);
+
+				boxes.push_back(b);
+			}
+		}
+	}
+}
+
+bool BRKXMLWriter::writeLevel(FLIVR::ThreadPool &pool, const LevelData &lv, int level, int bytes,
+	int type, int filter, const wstring &dir, const wstring &name, tinyxml2::XMLElement *root)
+{
+	vector<BrickBox> boxes;
+	int bw, bh, bd;
+	buildBrickBoxes(lv, boxes, bw, bh, bd);
+
+	string type_name = GetFileTypeName(type);
+	string filter_name = GetFilterName(filter);
+
+	tinyxml2::XMLElement *lv_node = m_doc.NewElement("Level");
+	lv_node->SetAttribute("lv", level);
+	lv_node->SetAttribute("imageW", lv.nx);
+	lv_node->SetAttribute("imageH", lv.ny);
+	lv_node->SetAttribute("imageD", lv.nz);
+	lv_node->SetAttribute("xspc", lv.spcx);
+	lv_node->SetAttribute("yspc", lv.spcy);
+	lv_node->SetAttribute("zspc", lv.spcz);
+	lv_node->SetAttribute("bitDepth", bytes*8);
+	lv_node->SetAttribute("FileType", type_name.c_str());
+	root->InsertEndChild(lv_node);
+
+	tinyxml2::XMLElement *bricks_node = m_doc.NewElement("Bricks");
+	bricks_node->SetAttribute("brick_baseW", bw);
+	bricks_node->SetAttribute("brick_baseH", bh);
+	bricks_node->SetAttribute("brick_baseD", bd);
+	lv_node->InsertEndChild(bricks_node);
+
+	tinyxml2::XMLElement *files_node = m_doc.NewElement("Files");
+	lv_node->InsertEndChild(files_node);
+
+	//bricks are encoded in batches and appended in id order; the offsets in a vvd file
+	//are 32-bit, so a new data file is started before one grows past 2GB
+	int part = 0;
+	wstring part_name;
+	FILE *fp = NULL;
+	long long offset = 0;
+
+	size_t batch = FLIVR::Max(1, pool.get_thread_num()) * 4;
+	vector<vector<char> > outs(batch);
+	bool *oks = new bool[batch];
+	bool result = true;
+
+	for (size_t b0 = 0; b0 < boxes.size() && result; b0 += batch)
+	{
+		size_t b1 = b0 + batch;
+		if (b1 > boxes.size())
+			b1 = boxes.size();
+		for (size_t n = b0; n < b1; n++)
+		{
+			const BrickBox &b = boxes[n];
+			oks[n-b0] = false;
+			pool.submit(new BrickEncodeTask(lv.data, lv.nx, lv.ny, bytes,
+				b.x, b.y, b.z, b.w, b.h, b.d, type, filter, &outs[n-b0], &oks[n-b0]));
+		}
+		pool.wait_idle();
+
+		for (size_t n = b0; n < b1; n++)
+		{
+			vector<char> &out = outs[n-b0];
+			if (!oks[n-b0] || out.size() > (size_t)INT_MAX)
+			{
+				result = false;
+				break;
+			}
+
+			if (!fp || offset + (long long)out.size() > (long long)INT_MAX)
+			{
+				if (fp)
+				{
+					fclose(fp);
+					part++;
+				}
+				wostringstream wos;
+				wos << name << L"_Lv" << level << L"_Ch0_Fr0";
+				if (part)
+					wos << L"_" << part;
+				wos << L".brk";
+				part_name = wos.str();
+				fp = NULL;
+				WFOPEN(&fp, (dir + part_name).c_str(), L"wb");
+				if (!fp)
+				{
+					result = false;
+					break;
+				}
+				offset = 0;
+			}
+
+			if (!out.empty() && fwrite(&out[0], 1, out.size(), fp) != out.size())
+			{
+				result = false;
+				break;
+			}
+
+			const BrickBox &b = boxes[n];
+			tinyxml2::XMLElement *brick_node = m_doc.NewElement("Brick");
+			brick_node->SetAttribute("id", (int)n);
+			brick_node->SetAttribute("width", b.w);
+			brick_node->SetAttribute("height", b.h);
+			brick_node->SetAttribute("depth", b.d);
+			brick_node->SetAttribute("st_x", b.x);
+			brick_node->SetAttribute("st_y", b.y);
+			brick_node->SetAttribute("st_z", b.z);
+			brick_node->SetAttribute("offset", (int)offset);
+			brick_node->SetAttribute("size", (int)out.size());
+			tinyxml2::XMLElement *tbox = m_doc.NewElement("tbox");
+			tbox->SetAttribute("x0", b.tx0);
+			tbox->SetAttribute("y0", b.ty0);
+			tbox->SetAttribute("z0", b.tz0);
+			tbox->SetAttribute("x1", b.tx1);
+			tbox->SetAttribute("y1", b.ty1);
+			tbox->SetAttribute("z1", b.tz1);
+			brick_node->InsertEndChild(tbox);
+			tinyxml2::XMLElement *bbox = m_doc.NewElement("bbox");
+			bbox->SetAttribute("x0", b.bx0);
+			bbox->SetAttribute("y0", b.by0);
+			bbox->SetAttribute("z0", b.bz0);
+			bbox->SetAttribute("x1", b.bx1);
+			bbox->SetAttribute("y1", b.by1);
+			bbox->SetAttribute("z1", b.bz1);
+			brick_node->InsertEndChild(bbox);
+			bricks_node->InsertEndChild(brick_node);
+
+			tinyxml2::XMLElement *file_node = m_doc.NewElement("File");
+			file_node->SetAttribute("frame", 0);
+			file_node->SetAttribute("channel", 0);
+			file_node->SetAttribute("brickID", (int)n);
+			file_node->SetAttribute("filepath", ws2s(part_name).c_str());
+			file_node->SetAttribute("offset", (int)offset);
+			file_node->SetAttribute("datasize", (int)out.size());
+			file_node->SetAttribute("filetype", type_name.c_str());
+			if (!filter_name.empty())
+				file_node->SetAttribute("filter", filter_name.c_str());
+			files_node->InsertEndChild(file_node);
+
+			offset += out.size();
+			vector<char>().swap(out);
+		}
+	}
+
+	if (fp)
+		fclose(fp);
+	delete [] oks;
+
+	return result;
 }
 
 class MyXMLVisitor: public tinyxml2::XMLVisitor
@@ -3,6 +3,8 @@
 
 #include <vector>
 #include <base_writer.h>
+#include <FLIVR/TextureBrick.h>
+#include <FLIVR/ThreadPool.h>
 #include <tinyxml2.h>
 #include <boost/property_tree/ptree.hpp>
 #include <boost/optional.hpp>
@@ -17,6 +19,18 @@ public:
 	void SetData(Nrrd* data);
 	void SetSpacings(double spcx, double spcy, double spcz);
 	void SetCompression(bool value);
+	//brick codec (BRICK_FILE_TYPE_*) and pre-filter (BRICK_FILE_FILTER_*) of the bricks;
+	//the filter only applies to 16-bit data
+	void SetBrickCodec(int type, int filter = BRICK_FILE_FILTER_NONE);
+	//names used by the filetype and filter attributes of a .vvd file
+	static string GetFileTypeName(int type);
+	static string GetFilterName(int filter);
+	//largest brick edge in voxels; rounded down to a power of two
+	void SetBrickSize(int size);
+	//workers used to downsample and compress (<= 0: one per cpu core)
+	void SetThreadNum(int num) { m_thread_num = num; }
+	//build all pyramid levels of the data and write them as a vvd file
+	//the bricks of each level are packed into one or more data files next to it
 	void Save(wstring filename, int mode);
 	//save only a vvd_xml file with metadata
 	void SaveVVDXML_Metadata(wstring filepath, tinyxml2::XMLDocument *vvd, tinyxml2::XMLDocument *metadata=NULL);
@@ -27,12 +41,38 @@ public:
 
 private:
 
+	struct LevelData
+	{
+		int nx, ny, nz;
+		double spcx, spcy, spcz;
+		unsigned char *data;
+	};
+
+	struct BrickBox
+	{
+		int x, y, z;
+		int w, h, d;
+		double tx0, ty0, tz0, tx1, ty1, tz1;
+		double bx0, by0, bz0, bx1, by1, bz1;
+	};
+
+	//downsample src into dst (dimensions already set) on the thread pool
+	void buildLevel(FLIVR::ThreadPool &pool, const LevelData &src, LevelData &dst, int bytes);
+	//same tiling as Texture::build_bricks
+	void buildBrickBoxes(const LevelData &lv, vector<BrickBox> &boxes, int &bw, int &bh, int &bd);
+	bool writeLevel(FLIVR::ThreadPool &pool, const LevelData &lv, int level, int bytes,
+		int type, int filter, const wstring &dir, const wstring &name, tinyxml2::XMLElement *root);
+
 	void buildROITreeXML(const boost::property_tree::wptree& tree, const map<int,vector<int>>& palette, const wstring& parent=wstring(), tinyxml2::XMLElement *lvNode=NULL);
 
 	Nrrd* m_data;
 	double m_spcx, m_spcy, m_spcz;
 	bool m_use_spacings;
 	bool m_compression;
+	int m_brick_type;
+	int m_brick_filter;
+	int m_brick_size;
+	int m_thread_num;
 	
 	tinyxml2::XMLDocument m_doc;
 	tinyxml2::XMLDocument m_md_doc;
@@ -0,0 +1,262 @@
+/*
+For more information, please see: http://software.sci.utah.edu
+
+The MIT License
+
+Copyright (c) 2014 Scientific Computing and Imaging Institute,
+University of Utah.
+
+
+Permission is hereby granted, free of charge, to any person obtaining a
+copy of this software and associated documentation files (the "Software"),
+to deal in the Software without restriction, including without limitation
+the rights to use, copy, modify, merge, publish, distribute, sublicense,
+and/or sell copies of the Software, and to permit persons to whom the
+Software is furnished to do so, subject to the following conditions:
+
+The above copyright notice and this permission notice shall be included
+in all copies or substantial portions of the Software.
+
+THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS
+OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL
+THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER
+DEALINGS IN THE SOFTWARE.
+*/
+#include "frame_cache.h"
+#include <string.h>
+#include <new>
+
+#define FRAME_CACHE_BUDGET	((size_t)512<<20)
+
+bool FrameCache::FrameKey::operator<(const FrameKey &k) const
+{
+	if (t != k.t) return t < k.t;
+	if (c != k.c) return c < k.c;
+	if (resize != k.resize) return resize < k.resize;
+	if (resample != k.resample) return resample < k.resample;
+	if (alignment != k.alignment) return alignment < k.alignment;
+	return path < k.path;
+}
+
+FrameCache::FrameCache() :
+	m_budget(FRAME_CACHE_BUDGET),
+	m_bytes(0),
+	m_hits(0),
+	m_misses(0)
+{
+}
+
+FrameCache::~FrameCache()
+{
+	for (map<FrameKey, Frame>::iterator it = m_frames.begin();
+		it != m_frames.end(); ++it)
+	{
+		if (it->second.data)
+			Free(it->second.data);
+	}
+	m_frames.clear();
+	m_keys.clear();
+	m_lru.clear();
+}
+
+void FrameCache::SetBudget(size_t bytes)
+{
+	wxMutexLocker lock(m_lock);
+	m_budget = bytes;
+	Shrink(m_budget);
+}
+
+bool FrameCache::Fits(Nrrd* data)
+{
+	if (!data || !data->data)
+		return false;
+	size_t bytes = nrrdElementNumber(data) * nrrdElementSize(data);
+	wxMutexLocker lock(m_lock);
+	return bytes <= m_budget;
+}
+
+Nrrd* FrameCache::Acquire(BaseReader* reader, int t, int c)
+{
+	double max_value, scalar_scale;
+	return Acquire(reader, t, c, false, max_value, scalar_scale);
+}
+
+Nrrd* FrameCache::Acquire(BaseReader* reader, int t, int c, bool get_max,
+	double &max_value, double &scalar_scale)
+{
+	if (!reader)
+		return 0;
+
+	FrameKey key = GetKey(reader, t, c);
+	wxMutexLocker lock(m_lock);
+	map<FrameKey, Frame>::iterator it = m_frames.find(key);
+	if (it == m_frames.end() ||
+		(get_max && !it->second.get_max))
+	{
+		m_misses++;
+		return 0;
+	}
+
+	m_hits++;
+	max_value = it->second.max_value;
+	scalar_scale = it->second.scalar_scale;
+	return Use(it->second);
+}
+
+bool FrameCache::Contains(BaseReader* reader, int t, int c)
+{
+	if (!reader)
+		return false;
+
+	FrameKey key = GetKey(reader, t, c);
+	wxMutexLocker lock(m_lock);
+	return m_frames.find(key) != m_frames.end();
+}
+
+Nrrd* FrameCache::Insert(BaseReader* reader, int t, int c, Nrrd* data,
+	bool get_max, double max_value, double scalar_scale)
+{
+	if (!reader || !data)
+		return 0;
+
+	FrameKey key = GetKey(reader, t, c);
+	wxMutexLocker lock(m_lock);
+	map<FrameKey, Frame>::iterator it = m_frames.find(key);
+	if (it != m_frames.end())
+	{
+		//decoded twice; keep the frame others may be using
+		Free(data);
+		if (get_max && !it->second.get_max)
+		{
+			it->second.get_max = true;
+			it->second.max_value = max_value;
+			it->second.scalar_scale = scalar_scale;
+		}
+		return Use(it->second);
+	}
+
+	Frame frame;
+	frame.data = data;
+	frame.bytes = data->data ?
+		nrrdElementNumber(data) * nrrdElementSize(data) : 0;
+	frame.refs = 0;
+	frame.get_max = get_max;
+	frame.max_value = max_value;
+	frame.scalar_scale = scalar_scale;
+	m_lru.push_front(data);
+	frame.lru = m_lru.begin();
+	m_keys[data] = key;
+	m_bytes += frame.bytes;
+	Nrrd* result = Use(m_frames[key] = frame);
+	//the new frame is in use and survives
+	Shrink(m_budget);
+	return result;
+}
+
+Nrrd* FrameCache::Convert(BaseReader* reader, int t, int c, wxMutex* reader_lock)
+{
+	Nrrd* data = Acquire(reader, t, c);
+	if (data || !reader)
+		return data;
+
+	if (reader_lock)
+		reader_lock->Lock();
+	data = reader->Convert(t, c, true);
+	double max_value = reader->GetMaxValue();
+	double scalar_scale = reader->GetScalarScale();
+	if (reader_lock)
+		reader_lock->Unlock();
+
+	return Insert(reader, t, c, data, true, max_value, scalar_scale);
+}
+
+void FrameCache::Release(Nrrd* data)
+{
+	if (!data)
+		return;
+
+	wxMutexLocker lock(m_lock);
+	map<Nrrd*, FrameKey>::iterator kit = m_keys.find(data);
+	if (kit == m_keys.end())
+		return;
+	map<FrameKey, Frame>::iterator it = m_frames.find(kit->second);
+	if (it == m_frames.end())
+		return;
+	if (it->second.refs > 0)
+		it->second.refs--;
+	Shrink(m_budget);
+}
+
+void FrameCache::Clear()
+{
+	wxMutexLocker lock(m_lock);
+	Shrink(0);
+}
+
+Nrrd* FrameCache::Copy(Nrrd* data)
+{
+	if (!data || !data->data)
+		return 0;
+
+	size_t bytes = nrrdElementNumber(data) * nrrdElementSize(data);
+	unsigned char* val = new (std::nothrow) unsigned char[bytes];
+	if (!val)
+		return 0;
+	memcpy(val, data->data, bytes);
+
+	size_t size[NRRD_DIM_MAX];
+	nrrdAxisInfoGet_nva(data, nrrdAxisInfoSize, size);
+	Nrrd* copy = nrrdNew();
+	nrrdWrap_nva(copy, val, data->type, data->dim, size);
+	nrrdAxisInfoCopy(copy, data, NULL, NRRD_AXIS_INFO_NONE);
+	return copy;
+}
+
+void FrameCache::Free(Nrrd* data)
+{
+	if (!data)
+		return;
+	delete [] (char*)data->data;
+	nrrdNix(data);
+}
+
+FrameCache::FrameKey FrameCache::GetKey(BaseReader* reader, int t, int c)
+{
+	FrameKey key;
+	key.path = reader->GetPathName();
+	key.t = t;
+	key.c = c;
+	key.resize = reader->GetResize();
+	key.resample = reader->GetResample();
+	key.alignment = reader->GetAlignment();
+	return key;
+}
+
+Nrrd* FrameCache::Use(Frame &frame)
+{
+	m_lru.splice(m_lru.begin(), m_lru, frame.lru);
+	frame.refs++;
+	return frame.data;
+}
+
+void FrameCache::Shrink(size_t budget)
+{
+	list<Nrrd*>::iterator it = m_lru.end();
+	while (m_bytes > budget && it != m_lru.begin())
+	{
+		--it;
+		map<Nrrd*, FrameKey>::iterator kit = m_keys.find(*it);
+		map<FrameKey, Frame>::iterator fit = m_frames.find(kit->second);
+		if (fit->second.refs > 0)
+			continue;
+
+		m_bytes -= fit->second.bytes;
+		Free(fit->second.data);
+		m_frames.erase(fit);
+		m_keys.erase(kit);
+		it = m_lru.erase(it);
+	}
+}
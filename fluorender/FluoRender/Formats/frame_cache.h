@@ -0,0 +1,129 @@
+/*
+For more information, please see: http://software.sci.utah.edu
+
+The MIT License
+
+Copyright (c) 2014 Scientific Computing and Imaging Institute,
+University of Utah.
+
+
+Permission is hereby granted, free of charge, to any person obtaining a
+copy of this software and associated documentation files (the "Software"),
+to deal in the Software without restriction, including without limitation
+the rights to use, copy, modify, merge, publish, distribute, sublicense,
+and/or sell copies of the Software, and to permit persons to whom the
+Software is furnished to do so, subject to the following conditions:
+
+The above copyright notice and this permission notice shall be included
+in all copies or substantial portions of the Software.
+
+THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS
+OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL
+THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER
+DEALINGS IN THE SOFTWARE.
+*/
+#ifndef _FRAME_CACHE_H_
+#define _FRAME_CACHE_H_
+
+#include <base_reader.h>
+#include <map>
+#include <list>
+#include <wx/thread.h>
+
+using namespace std;
+
+//decoded frames shared by all volumes, views and tools reading the same
+//file. frames are keyed by the path of the reader, the time point, the
+//channel and the resizing options of the reader. a cached frame is read
+//only and reference counted: Acquire() and Insert() add a reference that
+//Release() removes. frames without references are dropped least recently
+//used first when the cache is over its byte budget.
+//textures own and edit their frames, so they take copies; frames are only
+//copied in when another volume shows the same channel, tools that just
+//read (e.g. tracking) use the cached frames without copying
+class FrameCache
+{
+public:
+	FrameCache();
+	~FrameCache();
+
+	void SetBudget(size_t bytes);
+	size_t GetBudget() {return m_budget;}
+	size_t GetBytes() {return m_bytes;}
+	//whether a frame is small enough to be cached at all;
+	//check before making a copy to insert
+	bool Fits(Nrrd* data);
+
+	//get frame t of channel c; NULL when it is not cached
+	//with get_max, only frames converted with get_max are returned
+	//and max_value and scalar_scale are set
+	Nrrd* Acquire(BaseReader* reader, int t, int c);
+	Nrrd* Acquire(BaseReader* reader, int t, int c, bool get_max,
+		double &max_value, double &scalar_scale);
+	bool Contains(BaseReader* reader, int t, int c);
+	//take ownership of a decoded frame and return the cached one
+	//if the frame is cached already, data is deleted
+	Nrrd* Insert(BaseReader* reader, int t, int c, Nrrd* data,
+		bool get_max=false, double max_value=0.0, double scalar_scale=1.0);
+	//acquire the frame or decode it under reader_lock and insert it
+	Nrrd* Convert(BaseReader* reader, int t, int c, wxMutex* reader_lock=0);
+	void Release(Nrrd* data);
+	//drop all frames not in use
+	void Clear();
+
+	//copy of a frame that the caller owns, e.g. to build a texture
+	static Nrrd* Copy(Nrrd* data);
+	//free a frame from a reader; the readers allocate the data with new[]
+	static void Free(Nrrd* data);
+
+	//statistics
+	long long GetHits() {return m_hits;}
+	long long GetMisses() {return m_misses;}
+
+private:
+	struct FrameKey
+	{
+		wstring path;
+		int t;
+		int c;
+		int resize;
+		int resample;
+		int alignment;
+
+		bool operator<(const FrameKey &k) const;
+	};
+	struct Frame
+	{
+		Nrrd* data;
+		size_t bytes;
+		int refs;
+		bool get_max;		//max_value and scalar_scale are valid
+		double max_value;
+		double scalar_scale;
+		list<Nrrd*>::iterator lru;
+	};
+
+	size_t m_budget;
+
+	//guards everything below
+	wxMutex m_lock;
+	map<FrameKey, Frame> m_frames;
+	map<Nrrd*, FrameKey> m_keys;	//cached frame to its key
+	list<Nrrd*> m_lru;				//most recently used first
+	size_t m_bytes;
+
+	long long m_hits;
+	long long m_misses;
+
+private:
+	static FrameKey GetKey(BaseReader* reader, int t, int c);
+	//move to the front of the lru list and add a reference
+	Nrrd* Use(Frame &frame);
+	//drop unused frames until the cache fits the budget
+	void Shrink(size_t budget);
+};
+
+#endif//_FRAME_CACHE_H_
@@ -0,0 +1,418 @@
+/*
+For more information, please see: http://software.sci.utah.edu
+
+The MIT License
+
+Copyright (c) 2014 Scientific Computing and Imaging Institute,
+University of Utah.
+
+
+Permission is hereby granted, free of charge, to any person obtaining a
+copy of this software and associated documentation files (the "Software"),
+to deal in the Software without restriction, including without limitation
+the rights to use, copy, modify, merge, publish, distribute, sublicense,
+and/or sell copies of the Software, and to permit persons to whom the
+Software is furnished to do so, subject to the following conditions:
+
+The above copyright notice and this permission notice shall be included
+in all copies or substantial portions of the Software.
+
+THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS
+OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL
+THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER
+DEALINGS IN THE SOFTWARE.
+*/
+#include "frame_prefetcher.h"
+#include <stdlib.h>
+#include <limits.h>
+#include <vector>
+#include <FLIVR/ThreadPool.h>
+
+//readers decode on their own pools, so a few threads keep several
+//datasets busy
+#define PREFETCH_THREADS	2
+#define PREFETCH_BUDGET		((size_t)1<<30)
+#define PREFETCH_DEPTH		4
+
+//decodes one predicted frame for FramePrefetcher
+class PrefetchTask : public FLIVR::ThreadPoolTask
+{
+public:
+	PrefetchTask(FramePrefetcher *prefetcher, const FramePrefetcher::FrameKey &key) :
+		m_prefetcher(prefetcher), m_key(key)
+	{
+	}
+
+	virtual void run()
+	{
+		Nrrd* data = m_prefetcher->Decode(m_key.reader, m_key.t, m_key.c, true);
+		m_prefetcher->FinishFrame(m_key, data);
+	}
+	virtual void cancel()
+	{
+		m_prefetcher->DropFrame(m_key);
+	}
+
+private:
+	FramePrefetcher *m_prefetcher;
+	FramePrefetcher::FrameKey m_key;
+};
+
+FramePrefetcher::FramePrefetcher() :
+	m_threads(PREFETCH_THREADS),
+	m_budget(PREFETCH_BUDGET),
+	m_depth(PREFETCH_DEPTH),
+	m_pool(0),
+	m_cache(0),
+	m_cond(m_lock),
+	m_bytes(0),
+	m_hits(0),
+	m_waits(0),
+	m_misses(0)
+{
+}
+
+FramePrefetcher::~FramePrefetcher()
+{
+	Cancel();
+	//running decodes still hand their frames back
+	if (m_pool)
+		delete m_pool;
+	m_pool = 0;
+
+	for (map<BaseReader*, wxMutex*>::iterator it = m_reader_locks.begin();
+		it != m_reader_locks.end(); ++it)
+		delete it->second;
+	m_reader_locks.clear();
+}
+
+void FramePrefetcher::SetThreads(int num)
+{
+	if (num == m_threads)
+		return;
+	Cancel();
+	//the pool is rebuilt with the new size on the next Prefetch()
+	if (m_pool)
+		delete m_pool;
+	m_pool = 0;
+	m_threads = num;
+}
+
+void FramePrefetcher::SetBudget(size_t bytes)
+{
+	wxMutexLocker lock(m_lock);
+	m_budget = bytes;
+}
+
+void FramePrefetcher::SetDepth(int depth)
+{
+	wxMutexLocker lock(m_lock);
+	m_depth = depth;
+}
+
+Nrrd* FramePrefetcher::Get(BaseReader* reader, int t, int c, bool shared)
+{
+	if (!reader)
+		return 0;
+
+	FrameKey key = {reader, c, t};
+	bool seek = false;
+
+	m_lock.Lock();
+	Stream &stream = GetStream(reader, c);
+	if (stream.t >= 0 && t != stream.t)
+	{
+		int step = t - stream.t;
+		if (step != stream.step)
+		{
+			seek = true;
+			//a short step is a new playback speed or direction
+			//after a long jump the previous step is kept
+			if (abs(step) <= m_depth)
+				stream.step = step;
+		}
+	}
+	stream.t = t;
+	if (seek && m_pool)
+	{
+		//cancelled tasks take the lock to remove their frames
+		m_lock.Unlock();
+		m_pool->cancel_pending();
+		m_lock.Lock();
+	}
+
+	Nrrd* data = 0;
+	bool waited = false;
+	map<FrameKey, Frame>::iterator it;
+	while ((it = m_frames.find(key)) != m_frames.end())
+	{
+		if (it->second.ready)
+		{
+			data = it->second.data;
+			m_bytes -= it->second.bytes;
+			m_frames.erase(it);
+			break;
+		}
+		//the frame is being decoded
+		waited = true;
+		m_cond.Wait();
+	}
+	bool prefetched = data != 0;
+	m_lock.Unlock();
+
+	//frames decoded for another view or channel
+	bool cached = false;
+	if (!data && m_cache)
+	{
+		Nrrd* shared = m_cache->Acquire(reader, t, c);
+		if (shared)
+		{
+			data = FrameCache::Copy(shared);
+			m_cache->Release(shared);
+			cached = data != 0;
+		}
+	}
+
+	if (data)
+	{
+		wxMutexLocker lock(*GetReaderLock(reader));
+		reader->SetCurTime(t);
+	}
+	else
+		data = Decode(reader, t, c, false);
+
+	//the texture takes the frame, the cache keeps a copy for the other volumes
+	if (shared && !cached && m_cache && m_cache->Fits(data))
+		m_cache->Release(m_cache->Insert(reader, t, c, FrameCache::Copy(data)));
+
+	wxMutexLocker lock(m_lock);
+	if (prefetched && waited)
+		m_waits++;
+	else if (prefetched || cached)
+		m_hits++;
+	else
+	{
+		m_misses++;
+		if (data)
+			GetStream(reader, c).frame_bytes = GetNrrdBytes(data);
+	}
+
+	return data;
+}
+
+void FramePrefetcher::Prefetch(BaseReader* reader, int t, int c, int start, int end)
+{
+	if (!reader)
+		return;
+
+	vector<PrefetchTask*> tasks;
+	m_lock.Lock();
+	if (m_depth > 0 && m_budget > 0)
+	{
+		Stream &stream = GetStream(reader, c);
+		int step = stream.step;
+		int first = t + step;
+		int last = t + step * m_depth;
+		Evict(reader, c, first<last?first:last, first<last?last:first);
+
+		for (int i = 1; i <= m_depth; i++)
+		{
+			int ft = t + step * i;
+			if (ft < start || ft > end)
+				break;
+			FrameKey key = {reader, c, ft};
+			if (m_frames.find(key) != m_frames.end() ||
+				(m_cache && m_cache->Contains(reader, ft, c)))
+				continue;
+			//the size of the last frame stands in until this one is decoded
+			if (m_bytes + stream.frame_bytes > m_budget)
+				break;
+			Frame frame = {0, stream.frame_bytes, false};
+			m_frames[key] = frame;
+			m_bytes += frame.bytes;
+			tasks.push_back(new PrefetchTask(this, key));
+		}
+
+		if (!tasks.empty() && !m_pool)
+			m_pool = new FLIVR::ThreadPool(m_threads);
+	}
+	m_lock.Unlock();
+
+	//submitted outside the lock, the tasks take it to hand their frames back
+	for (size_t i = 0; i < tasks.size(); i++)
+		m_pool->submit(tasks[i]);
+}
+
+void FramePrefetcher::Cancel()
+{
+	if (m_pool)
+		m_pool->cancel_pending();
+
+	wxMutexLocker lock(m_lock);
+	for (map<FrameKey, Frame>::iterator it = m_frames.begin();
+		it != m_frames.end(); ++it)
+	{
+		if (it->second.data)
+			FrameCache::Free(it->second.data);
+	}
+	m_frames.clear();
+	m_bytes = 0;
+	//playback starts over
+	for (map<StreamKey, Stream>::iterator it = m_streams.begin();
+		it != m_streams.end(); ++it)
+		it->second.t = -1;
+	m_cond.Broadcast();
+}
+
+void FramePrefetcher::Clear()
+{
+	Cancel();
+	if (m_pool)
+		m_pool->wait_idle();
+
+	wxMutexLocker lock(m_lock);
+	//decodes that were running have discarded their frames
+	for (map<FrameKey, Frame>::iterator it = m_frames.begin();
+		it != m_frames.end(); ++it)
+	{
+		if (it->second.data)
+			FrameCache::Free(it->second.data);
+	}
+	m_frames.clear();
+	m_bytes = 0;
+	m_streams.clear();
+	for (map<BaseReader*, wxMutex*>::iterator it = m_reader_locks.begin();
+		it != m_reader_locks.end(); ++it)
+		delete it->second;
+	m_reader_locks.clear();
+}
+
+wxMutex* FramePrefetcher::GetReaderLock(BaseReader* reader)
+{
+	wxMutexLocker lock(m_lock);
+	map<BaseReader*, wxMutex*>::iterator it = m_reader_locks.find(reader);
+	if (it != m_reader_locks.end())
+		return it->second;
+	wxMutex* reader_lock = new wxMutex();
+	m_reader_locks[reader] = reader_lock;
+	return reader_lock;
+}
+
+double FramePrefetcher::GetHitRate()
+{
+	wxMutexLocker lock(m_lock);
+	long long total = m_hits + m_waits + m_misses;
+	if (total <= 0)
+		return 0.0;
+	return double(m_hits + m_waits) / double(total);
+}
+
+void FramePrefetcher::ResetStats()
+{
+	wxMutexLocker lock(m_lock);
+	m_hits = 0;
+	m_waits = 0;
+	m_misses = 0;
+}
+
+FramePrefetcher::Stream &FramePrefetcher::GetStream(BaseReader* reader, int c)
+{
+	StreamKey key(reader, c);
+	map<StreamKey, Stream>::iterator it = m_streams.find(key);
+	if (it != m_streams.end())
+		return it->second;
+	Stream stream = {-1, 1, 0};
+	return m_streams[key] = stream;
+}
+
+void FramePrefetcher::Evict(BaseReader* reader, int c, int lo, int hi)
+{
+	FrameKey key = {reader, c, INT_MIN};
+	map<FrameKey, Frame>::iterator it = m_frames.lower_bound(key);
+	while (it != m_frames.end() &&
+		it->first.reader == reader &&
+		it->first.c == c)
+	{
+		if (it->second.ready &&
+			(it->first.t < lo || it->first.t > hi))
+		{
+			if (it->second.data)
+				FrameCache::Free(it->second.data);
+			m_bytes -= it->second.bytes;
+			m_frames.erase(it++);
+		}
+		else
+			++it;
+	}
+}
+
+Nrrd* FramePrefetcher::Decode(BaseReader* reader, int t, int c, bool keep_time)
+{
+	if (keep_time)
+	{
+		//skip frames that were dropped while the task was queued
+		wxMutexLocker lock(m_lock);
+		FrameKey key = {reader, c, t};
+		map<FrameKey, Frame>::iterator it = m_frames.find(key);
+		if (it == m_frames.end() || it->second.ready)
+			return 0;
+	}
+
+	wxMutexLocker lock(*GetReaderLock(reader));
+	int cur_time = reader->GetCurTime();
+	Nrrd* data = reader->Convert(t, c, false);
+	if (keep_time)
+		reader->SetCurTime(cur_time);
+	return data;
+}
+
+void FramePrefetcher::FinishFrame(const FrameKey &key, Nrrd* data)
+{
+	wxMutexLocker lock(m_lock);
+	map<FrameKey, Frame>::iterator it = m_frames.find(key);
+	if (it != m_frames.end() && !it->second.ready)
+	{
+		if (data)
+		{
+			size_t bytes = GetNrrdBytes(data);
+			m_bytes = m_bytes - it->second.bytes + bytes;
+			it->second.data = data;
+			it->second.bytes = bytes;
+			it->second.ready = true;
+			GetStream(key.reader, key.c).frame_bytes = bytes;
+			data = 0;
+		}
+		else
+		{
+			//requests for it decode the frame themselves
+			m_bytes -= it->second.bytes;
+			m_frames.erase(it);
+		}
+	}
+	//cancelled while decoding
+	if (data)
+		FrameCache::Free(data);
+	m_cond.Broadcast();
+}
+
+void FramePrefetcher::DropFrame(const FrameKey &key)
+{
+	wxMutexLocker lock(m_lock);
+	map<FrameKey, Frame>::iterator it = m_frames.find(key);
+	if (it != m_frames.end() && !it->second.ready)
+	{
+		m_bytes -= it->second.bytes;
+		m_frames.erase(it);
+	}
+	m_cond.Broadcast();
+}
+
+size_t FramePrefetcher::GetNrrdBytes(Nrrd* data)
+{
+	if (!data || !data->data)
+		return 0;
+	return nrrdElementNumber(data) * nrrdElementSize(data);
+}
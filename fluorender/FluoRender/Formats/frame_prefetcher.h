@@ -0,0 +1,159 @@
+/*
+For more information, please see: http://software.sci.utah.edu
+
+The MIT License
+
+Copyright (c) 2014 Scientific Computing and Imaging Institute,
+University of Utah.
+
+
+Permission is hereby granted, free of charge, to any person obtaining a
+copy of this software and associated documentation files (the "Software"),
+to deal in the Software without restriction, including without limitation
+the rights to use, copy, modify, merge, publish, distribute, sublicense,
+and/or sell copies of the Software, and to permit persons to whom the
+Software is furnished to do so, subject to the following conditions:
+
+The above copyright notice and this permission notice shall be included
+in all copies or substantial portions of the Software.
+
+THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS
+OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL
+THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER
+DEALINGS IN THE SOFTWARE.
+*/
+#ifndef _FRAME_PREFETCHER_H_
+#define _FRAME_PREFETCHER_H_
+
+#include <base_reader.h>
+#include <frame_cache.h>
+#include <map>
+#include <utility>
+#include <wx/thread.h>
+
+using namespace std;
+
+namespace FLIVR
+{
+	class ThreadPool;
+}
+
+//decodes the frames of a time sequence that playback is about to show
+//on background threads. the next frames are predicted from the step
+//between the frames requested for a channel, and the decoded frames are
+//kept in a ring bounded by a byte budget until they are requested.
+//readers are not thread safe, so every conversion of a reader that may
+//be prefetched has to hold the lock returned by GetReaderLock()
+class FramePrefetcher
+{
+public:
+	FramePrefetcher();
+	~FramePrefetcher();
+
+	//background decoding threads; <= 0 uses one per cpu core
+	void SetThreads(int num);
+	int GetThreads() {return m_threads;}
+	//bytes of decoded frames held ahead of playback, in flight included
+	void SetBudget(size_t bytes);
+	size_t GetBudget() {return m_budget;}
+	//frames predicted ahead of the current one for each channel
+	void SetDepth(int depth);
+	int GetDepth() {return m_depth;}
+	//frames found in the cache are not decoded again and
+	//shared frames decoded on request are added to it
+	void SetCache(FrameCache* cache) {m_cache = cache;}
+	FrameCache* GetCache() {return m_cache;}
+
+	//get frame t of channel c, the caller owns the returned data
+	//a prefetched frame is handed over, otherwise it is decoded now
+	//a request that does not follow the step of the previous one is a seek
+	//and drops the frames still waiting to be decoded
+	//only with shared, when other volumes show the same channel, is a copy
+	//of the frame added to the cache for them
+	Nrrd* Get(BaseReader* reader, int t, int c, bool shared=false);
+	//queue the frames predicted after t for channel c
+	//frames outside [start, end] are never prefetched
+	void Prefetch(BaseReader* reader, int t, int c, int start, int end);
+	//drop queued and ready frames; running decodes are discarded when done
+	void Cancel();
+	//cancel and wait for running decodes, then forget all readers
+	//call before deleting readers
+	void Clear();
+
+	//lock serializing conversions of a reader
+	wxMutex* GetReaderLock(BaseReader* reader);
+
+	//statistics
+	//hits: the frame was ready or cached; waits: the frame was still decoding
+	//misses: the frame was decoded on request
+	long long GetHits() {return m_hits;}
+	long long GetWaits() {return m_waits;}
+	long long GetMisses() {return m_misses;}
+	double GetHitRate();
+	void ResetStats();
+
+	friend class PrefetchTask;
+
+private:
+	typedef pair<BaseReader*, int> StreamKey;	//reader and channel
+	struct FrameKey
+	{
+		BaseReader* reader;
+		int c;
+		int t;
+
+		bool operator<(const FrameKey &k) const
+		{
+			if (reader != k.reader) return reader < k.reader;
+			if (c != k.c) return c < k.c;
+			return t < k.t;
+		}
+	};
+	struct Frame
+	{
+		Nrrd* data;		//NULL until decoded
+		size_t bytes;	//decoded size, estimated while in flight
+		bool ready;
+	};
+	//playback state of one channel
+	struct Stream
+	{
+		int t;				//last requested frame; -1 before the first request
+		int step;			//frames advanced per request
+		size_t frame_bytes;	//size of the last decoded frame
+	};
+
+	int m_threads;
+	size_t m_budget;
+	int m_depth;
+	FLIVR::ThreadPool *m_pool;
+	FrameCache *m_cache;
+
+	//guards everything below
+	wxMutex m_lock;
+	wxCondition m_cond;
+	map<FrameKey, Frame> m_frames;
+	map<StreamKey, Stream> m_streams;
+	map<BaseReader*, wxMutex*> m_reader_locks;
+	size_t m_bytes;
+
+	long long m_hits;
+	long long m_waits;
+	long long m_misses;
+
+private:
+	Stream &GetStream(BaseReader* reader, int c);
+	//remove ready frames of a channel outside [lo, hi]
+	void Evict(BaseReader* reader, int c, int lo, int hi);
+	//decode one frame under the reader lock and keep the current time of the reader
+	Nrrd* Decode(BaseReader* reader, int t, int c, bool keep_time);
+	void FinishFrame(const FrameKey &key, Nrrd* data);
+	void DropFrame(const FrameKey &key);
+
+	static size_t GetNrrdBytes(Nrrd* data);
+};
+
+#endif//_FRAME_PREFETCHER_H_
@@ -26,6 +26,7 @@ FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER
 DEALINGS IN THE SOFTWARE.
 */
 #include "lbl_reader.h"
+#include "nrrd_data.h"
 #include "../compatibility.h"
 #include <sstream>
 #include <inttypes.h>
@@ -113,15 +114,15 @@ Nrrd* LBLReader::Convert(int t, int c, bool get_max)
 	nrrdIoStateSet(nio, nrrdIoStateSkipData, AIR_TRUE);
 	if (nrrdRead(output, lbl_file, nio))
 	{
+		nrrdIoStateNix(nio);
 		fclose(lbl_file);
 		return 0;
 	}
-	nio = nrrdIoStateNix(nio);
-	rewind(lbl_file);
 	if (output->dim != 3 ||
 		(output->type != nrrdTypeInt &&
 		output->type != nrrdTypeUInt))
 	{
+		nrrdIoStateNix(nio);
 		delete []output->data;
 		nrrdNix(output);
 		fclose(lbl_file);
@@ -133,12 +134,19 @@ Nrrd* LBLReader::Convert(int t, int c, bool get_max)
 	int data_size = slice_num * x_size * y_size;
 	output->data = new unsigned int[data_size];
 
-	if (nrrdRead(output, lbl_file, NULL))
+	bool read = NRRDData::Read(str_name, lbl_file, nio, output,
+		(size_t)data_size * sizeof(unsigned int));
+	nio = nrrdIoStateNix(nio);
+	if (!read)
 	{
-		delete []output->data;
-		nrrdNix(output);
-		fclose(lbl_file);
-		return 0;
+		rewind(lbl_file);
+		if (nrrdRead(output, lbl_file, NULL))
+		{
+			delete []output->data;
+			nrrdNix(output);
+			fclose(lbl_file);
+			return 0;
+		}
 	}
 
 	fclose(lbl_file);
@@ -56,6 +56,7 @@ public:
 	wstring GetDataName() {return L"";}
 	int GetTimeNum() {return 0;}
 	int GetCurTime() {return 0;}
+	void SetCurTime(int t) {}
 	int GetChanNum() {return 0;}
 	double GetExcitationWavelength(int chan) {return 0.0;}
 	int GetSliceNum() {return 0;}
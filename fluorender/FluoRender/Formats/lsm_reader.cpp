@@ -29,11 +29,45 @@ DEALINGS IN THE SOFTWARE.
 #include "../compatibility.h"
 #include "lsm_reader.h"
 #include <sstream>
+#include <algorithm>
+#include <FLIVR/ThreadPool.h>
 
 //#include <fstream>
 //#include <bitset>
 
-LSMReader::LSMReader()
+//compressed strips are read in runs of up to this many bytes
+#define LSM_RUN_SIZE	(16<<20)
+//gaps up to this size between strips are read through
+#define LSM_RUN_GAP		(64<<10)
+//runs waiting for or in decoding
+#define LSM_RUNS_AHEAD	4
+
+//decodes one strip of a run read by LSMReader::ConvertChannels
+class LsmDecodeTask : public FLIVR::ThreadPoolTask
+{
+public:
+   LsmDecodeTask(LSMReader *reader, LSMReader::LsmRun *run, size_t index) :
+      m_reader(reader), m_run(run), m_index(index)
+   {
+   }
+   ~LsmDecodeTask()
+   {
+      m_reader->FinishLsmRun(m_run);
+   }
+
+   virtual void run()
+   {
+      m_reader->DecodeLsmStrip(*m_run, m_index);
+   }
+
+private:
+   LSMReader *m_reader;
+   LSMReader::LsmRun *m_run;
+   size_t m_index;
+};
+
+LSMReader::LSMReader() :
+   m_run_cond(m_run_lock)
 {
    m_time_num = 0;
    m_cur_time = -1;
@@ -58,6 +92,9 @@ LSMReader::LSMReader()
    m_version = 0;
    m_datatype = 0;
    m_l4gb = false;
+
+   m_decode_threads = 0;
+   m_run_bytes = 0;
 }
 
 LSMReader::~LSMReader()
@@ -684,120 +721,335 @@ double LSMReader::GetExcitationWavelength(int chan)
 
 Nrrd* LSMReader::Convert(int t, int c, bool get_max)
 {
-   Nrrd *data = 0;
+   vector<int> chans(1, c);
+   vector<Nrrd*> data;
+   vector<double> max_values, scalar_scales;
+   ConvertChannels(t, chans, get_max, data, max_values, scalar_scales);
+   return data.empty()?0:data[0];
+}
+
+int LSMReader::ConvertChannels(int t, const vector<int> &chans, bool get_max,
+      vector<Nrrd*> &data, vector<double> &max_values, vector<double> &scalar_scales)
+{
+   //the range is fixed by the lsm header
+   data.assign(chans.size(), (Nrrd*)0);
+   max_values.assign(chans.size(), m_max_value);
+   scalar_scales.assign(chans.size(), m_scalar_scale);
+
+   if (t<0 || t>=m_time_num ||
+         m_slice_num <= 0 ||
+         m_x_size <= 0 ||
+         m_y_size <= 0 ||
+         t>=(int)m_lsm_info.size())
+      return 0;
+   bool eight_bit;
+   switch (m_datatype)
+   {
+   case 1://8-bit
+      eight_bit = true;
+      break;
+   case 2://16-bit
+   case 3:
+      eight_bit = false;
+      break;
+   default:
+      return 0;
+   }
+
    FILE* pfile = 0;
    if (!WFOPEN(&pfile, m_path_name.c_str(), L"rb"))
       return 0;
 
-   int i, j;
+   int i;
+   size_t k;
+   unsigned long long mem_size = (unsigned long long)m_x_size*
+      (unsigned long long)m_y_size*(unsigned long long)m_slice_num;
+   size_t slice_size = (size_t)m_x_size*(size_t)m_y_size*(eight_bit?1:2);
 
-   if (t>=0 && t<m_time_num &&
-         c>=0 && c<m_chan_num &&
-         m_slice_num > 0 &&
-         m_x_size > 0 &&
-         m_y_size > 0 &&
-         t<(int)m_lsm_info.size() &&
-         c<(int)m_lsm_info[t].size())
+   //allocate memory for nrrd and list the strips to read
+   vector<unsigned char*> vals(chans.size(), (unsigned char*)0);
+   vector<LsmStrip> strips;
+   for (k=0; k<chans.size(); k++)
    {
-      //allocate memory for nrrd
-      switch (m_datatype)
+      int c = chans[k];
+      if (c<0 || c>=m_chan_num || c>=(int)m_lsm_info[t].size())
+         continue;
+      if (eight_bit)
+         vals[k] = new (std::nothrow) unsigned char[mem_size];
+      else
+         vals[k] = (unsigned char*)(new (std::nothrow) unsigned short[mem_size]);
+      if (!vals[k])
+         continue;
+      ChannelInfo *cinfo = &m_lsm_info[t][c];
+      for (i=0; i<m_slice_num; i++)
       {
-      case 1://8-bit
+         unsigned char *dst = vals[k] + slice_size*i;
+         if (i >= (int)cinfo->size() || !(*cinfo)[i].size)
          {
-            unsigned long long mem_size = (unsigned long long)m_x_size*
-               (unsigned long long)m_y_size*(unsigned long long)m_slice_num;
-            unsigned char *val = new (std::nothrow) unsigned char[mem_size];
-            ChannelInfo *cinfo = &m_lsm_info[t][c];
-            for (i=0; i<(int)cinfo->size(); i++)
-            {
-               if (m_l4gb?  
-                     FSEEK64(pfile, ((uint64_t((*cinfo)[i].offset_high))<<32)+(*cinfo)[i].offset, SEEK_SET)==0:
-                     fseek(pfile, (*cinfo)[i].offset, SEEK_SET)==0)
-               {
-                  unsigned int val_pos = m_x_size*m_y_size*i;
-                  if (m_compression==1)
-                     fread(val+val_pos, sizeof(unsigned char), (*cinfo)[i].size, pfile);
-                  else if (m_compression==5)
-                  {
-                     unsigned char* tif = new (std::nothrow) unsigned char[(*cinfo)[i].size];
-                     fread(tif, sizeof(unsigned char), (*cinfo)[i].size, pfile);
-                     LZWDecode(tif, val+val_pos, (*cinfo)[i].size);
-                     for (j=0; j<m_y_size; j++)
-                        DecodeAcc8(val+val_pos+j*m_x_size, m_x_size,1);
-                     delete []tif;
-                  }
-               }
-            }
-            //create nrrd
-            data = nrrdNew();
-            nrrdWrap(data, val, nrrdTypeUChar, 3, (size_t)m_x_size, (size_t)m_y_size, (size_t)m_slice_num);
-            nrrdAxisInfoSet(data, nrrdAxisInfoSpacing, m_xspc, m_yspc, m_zspc);
-            nrrdAxisInfoSet(data, nrrdAxisInfoMax, m_xspc*m_x_size, m_yspc*m_y_size, m_zspc*m_slice_num);
-            nrrdAxisInfoSet(data, nrrdAxisInfoMin, 0.0, 0.0, 0.0);
-            nrrdAxisInfoSet(data, nrrdAxisInfoSize, (size_t)m_x_size, (size_t)m_y_size, (size_t)m_slice_num);
+            memset(dst, 0, slice_size);
+            continue;
          }
-         break;
-      case 2://16-bit
-      case 3:
+         LsmStrip strip;
+         strip.offset = (uint64_t((*cinfo)[i].offset_high)<<32) + (*cinfo)[i].offset;
+         strip.size = (*cinfo)[i].size;
+         strip.pos = 0;
+         strip.dst = dst;
+         strips.push_back(strip);
+      }
+   }
+   //the strips of a time point are mostly back to back on disk
+   sort(strips.begin(), strips.end(), lsm_strip_sort);
+
+   if (m_compression == 5)
+   {
+      //the calling thread reads runs of strips and the pool decodes them
+      int thread_num = m_decode_threads;
+      if (thread_num <= 0)
+         thread_num = wxThread::GetCPUCount();
+      FLIVR::ThreadPoolGroup *pool = 0;
+      if (thread_num > 1)
+         pool = new FLIVR::ThreadPoolGroup(FLIVR::ThreadPool::shared());
+      m_run_bytes = 0;
+
+      size_t first = 0;
+      while (first < strips.size())
+      {
+         LsmRun *run = ReadLsmRun(pfile, strips, first);
+         if (!pool)
          {
-            unsigned long long mem_size = (unsigned long long)m_x_size*
-               (unsigned long long)m_y_size*(unsigned long long)m_slice_num;
-            unsigned short *val = new (std::nothrow) unsigned short[mem_size];
-            ChannelInfo *cinfo = &m_lsm_info[t][c];
-            for (i=0; i<(int)cinfo->size(); i++)
-            {
-               if (m_l4gb?
-                     FSEEK64(pfile, ((uint64_t((*cinfo)[i].offset_high))<<32)+(*cinfo)[i].offset, SEEK_SET)==0:
-                     fseek(pfile, (*cinfo)[i].offset, SEEK_SET)==0)
-               {
-                  unsigned int val_pos = m_x_size*m_y_size*i;
-                  if (m_compression==1)
-                     fread(val+val_pos, sizeof(unsigned char), (*cinfo)[i].size, pfile);
-                  else if (m_compression==5)
-                  {
-                     unsigned char* tif = new (std::nothrow) unsigned char[(*cinfo)[i].size];
-					 fread(tif, sizeof(unsigned char), (*cinfo)[i].size, pfile);
+            for (k=0; k<run->strips.size(); k++)
+               DecodeLsmStrip(*run, k);
+            delete run;
+            continue;
+         }
+         m_run_lock.Lock();
+         while (m_run_bytes > 0 &&
+               m_run_bytes + run->raw.size() > (size_t)LSM_RUN_SIZE*LSM_RUNS_AHEAD)
+            m_run_cond.Wait();
+         m_run_bytes += run->raw.size();
+         run->refs = (int)run->strips.size();
+         m_run_lock.Unlock();
+         for (k=0; k<run->strips.size(); k++)
+            pool->submit(new LsmDecodeTask(this, run, k));
+      }
 
-					 LZWDecode(tif, (tidata_t)(val+val_pos), (*cinfo)[i].size);
-/*
-					 ofstream ofs("lsm_c.txt");
-					 for (int k = 0; k < m_x_size; k++){
-						 ofs << ' ' << static_cast<std::bitset<8>>((val+val_pos)[k]);
-						 if (k % 16 == 15) ofs << '\n';
-					 }
-					 ofs.close();
-*/
-					 for (j=0; j<m_y_size; j++)
-                        DecodeAcc16((tidata_t)(val+val_pos+j*m_x_size), m_x_size*2,1);
-/*
-					 ofs.open("lsm_dec.txt");
-					 for (int k = 0; k < m_x_size; k++){
-						 ofs << ' ' << static_cast<std::bitset<8>>((val+val_pos)[k]);
-						 if (k % 16 == 15) ofs << '\n';
-					 }
-					 ofs.close();
-*/
-                     delete []tif;
-                  }
-               }
+      if (pool)
+      {
+         pool->wait();
+         delete pool;
+      }
+   }
+   else if (m_compression == 1)
+   {
+      //uncompressed strips are read straight into the volume,
+      //seeking only where they are not contiguous
+      uint64_t pos = 0;
+      bool seek = true;
+      for (k=0; k<strips.size(); k++)
+      {
+         LsmStrip &strip = strips[k];
+         if (seek || strip.offset != pos)
+         {
+            if (m_l4gb?
+                  FSEEK64(pfile, strip.offset, SEEK_SET)!=0:
+                  fseek(pfile, (long)strip.offset, SEEK_SET)!=0)
+            {
+               memset(strip.dst, 0, slice_size);
+               seek = true;
+               continue;
             }
-            //create nrrd
-            data = nrrdNew();
-            nrrdWrap(data, val, nrrdTypeUShort, 3, (size_t)m_x_size, (size_t)m_y_size, (size_t)m_slice_num);
-            nrrdAxisInfoSet(data, nrrdAxisInfoSpacing, m_xspc, m_yspc, m_zspc);
-            nrrdAxisInfoSet(data, nrrdAxisInfoMax, m_xspc*m_x_size, m_yspc*m_y_size, m_zspc*m_slice_num);
-            nrrdAxisInfoSet(data, nrrdAxisInfoMin, 0.0, 0.0, 0.0);
-            nrrdAxisInfoSet(data, nrrdAxisInfoSize, (size_t)m_x_size, (size_t)m_y_size, (size_t)m_slice_num);
          }
-         break;
+         size_t size = min((size_t)strip.size, slice_size);
+         size_t read = fread(strip.dst, sizeof(unsigned char), size, pfile);
+         if (read < slice_size)
+            memset(strip.dst+read, 0, slice_size-read);
+         pos = strip.offset + read;
+         seek = read < size;
       }
    }
+   else
+   {
+      for (k=0; k<strips.size(); k++)
+         memset(strips[k].dst, 0, slice_size);
+   }
 
    fclose(pfile);
 
+   //create nrrd
+   int result = 0;
+   for (k=0; k<chans.size(); k++)
+   {
+      if (!vals[k])
+         continue;
+      data[k] = nrrdNew();
+      nrrdWrap(data[k], vals[k], eight_bit?nrrdTypeUChar:nrrdTypeUShort, 3,
+         (size_t)m_x_size, (size_t)m_y_size, (size_t)m_slice_num);
+      nrrdAxisInfoSet(data[k], nrrdAxisInfoSpacing, m_xspc, m_yspc, m_zspc);
+      nrrdAxisInfoSet(data[k], nrrdAxisInfoMax, m_xspc*m_x_size, m_yspc*m_y_size, m_zspc*m_slice_num);
+      nrrdAxisInfoSet(data[k], nrrdAxisInfoMin, 0.0, 0.0, 0.0);
+      nrrdAxisInfoSet(data[k], nrrdAxisInfoSize, (size_t)m_x_size, (size_t)m_y_size, (size_t)m_slice_num);
+      result++;
+   }
+
+   return result;
+}
+
+Nrrd* LSMReader::ConvertRegion(int t, int c, const VoxelBox &box, int level)
+{
+   if (level != 0 ||
+         t<0 || t>=m_time_num || t>=(int)m_lsm_info.size() ||
+         c<0 || c>=m_chan_num || c>=(int)m_lsm_info[t].size())
+      return 0;
+   bool eight_bit;
+   switch (m_datatype)
+   {
+   case 1://8-bit
+      eight_bit = true;
+      break;
+   case 2://16-bit
+   case 3:
+      eight_bit = false;
+      break;
+   default:
+      return 0;
+   }
+   if (m_compression != 1 && m_compression != 5)
+      return 0;
+
+   VoxelBox region = box;
+   if (!ClipRegion(region, m_x_size, m_y_size, m_slice_num))
+      return 0;
+   FILE* pfile = 0;
+   if (!WFOPEN(&pfile, m_path_name.c_str(), L"rb"))
+      return 0;
+   Nrrd *data = NewRegion(region, eight_bit?nrrdTypeUChar:nrrdTypeUShort,
+         m_xspc, m_yspc, m_zspc);
+   if (!data)
+   {
+      fclose(pfile);
+      return 0;
+   }
+
+   size_t bytes = eight_bit?1:2;
+   size_t row_size = (size_t)m_x_size*bytes;
+   size_t region_row = (size_t)region.nx()*bytes;
+   size_t region_slice = region_row*(size_t)region.ny();
+   ChannelInfo *cinfo = &m_lsm_info[t][c];
+   vector<unsigned char> raw;
+   vector<unsigned char> rows;
+   for (int i=region.z0; i<region.z1; i++)
+   {
+      unsigned char *dst = (unsigned char*)data->data + region_slice*(i-region.z0);
+      //missing or short slices stay empty
+      memset(dst, 0, region_slice);
+      if (i >= (int)cinfo->size() || !(*cinfo)[i].size)
+         continue;
+      uint64_t offset = (uint64_t((*cinfo)[i].offset_high)<<32) + (*cinfo)[i].offset;
+      size_t size = (*cinfo)[i].size;
+
+      unsigned char *src = 0;
+      if (m_compression == 1)
+      {
+         //only the rows of the region
+         size_t start = row_size*region.y0;
+         if (start >= size)
+            continue;
+         rows.assign(row_size*region.ny(), 0);
+         if (m_l4gb?
+               FSEEK64(pfile, offset+start, SEEK_SET)!=0:
+               fseek(pfile, (long)(offset+start), SEEK_SET)!=0)
+            continue;
+         fread(&rows[0], sizeof(unsigned char), min(rows.size(), size-start), pfile);
+         src = &rows[0];
+      }
+      else
+      {
+         //the strip is decoded up to the last row of the region
+         //the lzw decoder may look a few bytes past the end of a strip
+         raw.assign(size + 8, 0);
+         if (m_l4gb?
+               FSEEK64(pfile, offset, SEEK_SET)!=0:
+               fseek(pfile, (long)offset, SEEK_SET)!=0)
+            continue;
+         fread(&raw[0], sizeof(unsigned char), size, pfile);
+         rows.assign(row_size*region.y1, 0);
+         LZWDecode(&raw[0], &rows[0], (tsize_t)rows.size());
+         for (int j=region.y0; j<region.y1; j++)
+            if (eight_bit)
+               DecodeAcc8(&rows[row_size*j], m_x_size, 1);
+            else
+               DecodeAcc16(&rows[row_size*j], m_x_size*2, 1);
+         src = &rows[row_size*region.y0];
+      }
+
+      for (int j=0; j<region.ny(); j++)
+         memcpy(dst + region_row*j, src + row_size*j + bytes*region.x0, region_row);
+   }
+
+   fclose(pfile);
    return data;
 }
 
+LSMReader::LsmRun* LSMReader::ReadLsmRun(FILE* pfile, vector<LsmStrip> &strips, size_t &first)
+{
+   LsmRun *run = new LsmRun;
+   run->refs = 0;
+   uint64_t start = strips[first].offset;
+   uint64_t end = start + strips[first].size;
+   size_t last = first + 1;
+   while (last < strips.size() &&
+         strips[last].offset <= end + LSM_RUN_GAP &&
+         strips[last].offset + strips[last].size - start <= LSM_RUN_SIZE)
+   {
+      end = max(end, strips[last].offset + strips[last].size);
+      last++;
+   }
+   run->strips.assign(strips.begin()+first, strips.begin()+last);
+   for (size_t i=0; i<run->strips.size(); i++)
+      run->strips[i].pos = (size_t)(run->strips[i].offset - start);
+   first = last;
+
+   //the lzw decoder may look a few bytes past the end of a strip
+   run->raw.assign((size_t)(end - start) + 8, 0);
+   if (m_l4gb?
+         FSEEK64(pfile, start, SEEK_SET)==0:
+         fseek(pfile, (long)start, SEEK_SET)==0)
+      fread(&run->raw[0], sizeof(unsigned char), (size_t)(end - start), pfile);
+   return run;
+}
+
+void LSMReader::DecodeLsmStrip(LsmRun &run, size_t index)
+{
+   LsmStrip &strip = run.strips[index];
+   bool eight_bit = m_datatype == 1;
+   size_t slice_size = (size_t)m_x_size*(size_t)m_y_size*(eight_bit?1:2);
+   //a short or damaged strip leaves the rest of the slice empty
+   memset(strip.dst, 0, slice_size);
+   LZWDecode(&run.raw[strip.pos], strip.dst, slice_size);
+   if (eight_bit)
+      for (int j=0; j<m_y_size; j++)
+         DecodeAcc8(strip.dst+j*m_x_size, m_x_size,1);
+   else
+      for (int j=0; j<m_y_size; j++)
+         DecodeAcc16((tidata_t)(strip.dst+j*m_x_size*2), m_x_size*2,1);
+}
+
+void LSMReader::FinishLsmRun(LsmRun *run)
+{
+   wxMutexLocker lock(m_run_lock);
+   if (--run->refs == 0)
+   {
+      m_run_bytes -= run->raw.size();
+      m_run_cond.Signal();
+      delete run;
+   }
+}
+
+bool LSMReader::lsm_strip_sort(const LsmStrip &s1, const LsmStrip &s2)
+{
+   return s1.offset < s2.offset;
+}
+
 wstring LSMReader::GetCurName(int t, int c)
 {
    return wstring(L"");
@@ -30,6 +30,8 @@ DEALINGS IN THE SOFTWARE.
 
 #include <base_reader.h>
 #include <vector>
+#include <stdint.h>
+#include <wx/thread.h>
 
 using namespace std;
 
@@ -50,13 +52,23 @@ public:
 	void Preprocess();
 	void SetBatch(bool batch);
 	int LoadBatch(int index);
+	//1 decodes compressed slices on the calling thread;
+	//other values decode them on the shared pool
+	void SetDecodeThreads(int num) { m_decode_threads = num; }
+	int GetDecodeThreads() { return m_decode_threads; }
 	Nrrd* Convert(int t, int c, bool get_max);
+	int ConvertChannels(int t, const vector<int> &chans, bool get_max,
+		vector<Nrrd*> &data, vector<double> &max_values, vector<double> &scalar_scales);
+	//read only the slices of box; uncompressed slices only the rows of box
+	//and compressed ones are decoded up to the last row of box
+	Nrrd* ConvertRegion(int t, int c, const VoxelBox &box, int level=0);
 	wstring GetCurName(int t, int c);
 
 	wstring GetPathName() {return m_path_name;}
 	wstring GetDataName() {return m_data_name;}
 	int GetTimeNum() {return m_time_num;}
 	int GetCurTime() {return m_cur_time;}
+	void SetCurTime(int t) {m_cur_time = t;}
 	int GetChanNum() {return m_chan_num;}
 	double GetExcitationWavelength(int chan);
 	int GetSliceNum() {return m_slice_num;}
@@ -115,8 +127,38 @@ private:
 	};
 	vector<WavelengthInfo> m_excitation_wavelength_list;
 
+	//one compressed slice of a channel and where it is decoded to
+	struct LsmStrip
+	{
+		uint64_t offset;		//offset in lsm file
+		unsigned int size;		//size in lsm file
+		size_t pos;				//position in the run buffer
+		unsigned char* dst;		//slice in the output volume
+	};
+	//strips read from the file with one fread
+	struct LsmRun
+	{
+		vector<unsigned char> raw;
+		vector<LsmStrip> strips;
+		int refs;				//decode tasks still using the run
+	};
+	friend class LsmDecodeTask;
+
+	int m_decode_threads;
+	//bounds the bytes read ahead of the decode workers
+	wxMutex m_run_lock;
+	wxCondition m_run_cond;
+	size_t m_run_bytes;
+
 private:
 	void ReadLsmInfo(FILE* pfile, unsigned char* pdata, unsigned int size);
+	static bool lsm_strip_sort(const LsmStrip &s1, const LsmStrip &s2);
+	//read the strips from first on of a list sorted by offset, as long as
+	//they are nearly contiguous, with one fread; first moves past them
+	LsmRun* ReadLsmRun(FILE* pfile, vector<LsmStrip> &strips, size_t &first);
+	//lzw decode and de-predict one strip of a run
+	void DecodeLsmStrip(LsmRun &run, size_t index);
+	void FinishLsmRun(LsmRun *run);
 
 };
 
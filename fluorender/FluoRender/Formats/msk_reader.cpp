@@ -26,6 +26,7 @@ FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER
 DEALINGS IN THE SOFTWARE.
 */
 #include "msk_reader.h"
+#include "nrrd_data.h"
 #include "../compatibility.h"
 #include <sstream>
 #include <inttypes.h>
@@ -113,15 +114,15 @@ Nrrd* MSKReader::Convert(int t, int c, bool get_max)
 	nrrdIoStateSet(nio, nrrdIoStateSkipData, AIR_TRUE);
 	if (nrrdRead(output, msk_file, nio))
 	{
+		nrrdIoStateNix(nio);
 		fclose(msk_file);
 		return 0;
 	}
-	nio = nrrdIoStateNix(nio);
-	rewind(msk_file);
 	if (output->dim != 3 ||
 		(output->type != nrrdTypeChar &&
 		output->type != nrrdTypeUChar))
 	{
+		nrrdIoStateNix(nio);
 		delete []output->data;
 		nrrdNix(output);
 		fclose(msk_file);
@@ -133,12 +134,19 @@ Nrrd* MSKReader::Convert(int t, int c, bool get_max)
 	int data_size = slice_num * x_size * y_size;
 	output->data = new unsigned char[data_size];
 
-	if (nrrdRead(output, msk_file, NULL))
+	bool read = NRRDData::Read(str_name, msk_file, nio, output,
+		(size_t)data_size * sizeof(unsigned char));
+	nio = nrrdIoStateNix(nio);
+	if (!read)
 	{
-		delete []output->data;
-		nrrdNix(output);
-		fclose(msk_file);
-		return 0;
+		rewind(msk_file);
+		if (nrrdRead(output, msk_file, NULL))
+		{
+			delete []output->data;
+			nrrdNix(output);
+			fclose(msk_file);
+			return 0;
+		}
 	}
 
 	fclose(msk_file);
@@ -0,0 +1,556 @@
+/*
+For more information, please see: http://software.sci.utah.edu
+
+The MIT License
+
+Copyright (c) 2014 Scientific Computing and Imaging Institute,
+University of Utah.
+
+
+Permission is hereby granted, free of charge, to any person obtaining a
+copy of this software and associated documentation files (the "Software"),
+to deal in the Software without restriction, including without limitation
+the rights to use, copy, modify, merge, publish, distribute, sublicense,
+and/or sell copies of the Software, and to permit persons to whom the
+Software is furnished to do so, subject to the following conditions:
+
+The above copyright notice and this permission notice shall be included
+in all copies or substantial portions of the Software.
+
+THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS
+OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL
+THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER
+DEALINGS IN THE SOFTWARE.
+*/
+#include "nrrd_data.h"
+#include <FLIVR/BrickFileCache.h>
+#include <FLIVR/ThreadPool.h>
+#include <zlib.h>
+#include <string.h>
+#include <vector>
+#include <algorithm>
+
+//raw data is copied in chunks of this size
+#define NRRD_COPY_CHUNK		((size_t)16<<20)
+//uncompressed size of one written gzip member
+#define NRRD_GZIP_BLOCK		((size_t)4<<20)
+//gzip header with one extra subfield of compressed and uncompressed sizes
+#define NRRD_GZIP_HEADER	24
+#define NRRD_GZIP_TRAILER	8
+
+int NRRDData::m_threads = 0;
+
+class NrrdCopyTask : public FLIVR::ThreadPoolTask
+{
+public:
+	NrrdCopyTask(unsigned char* dst, const unsigned char* src, size_t size, int swap) :
+		m_dst(dst), m_src(src), m_size(size), m_swap(swap)
+	{
+	}
+
+	virtual void run()
+	{
+		NRRDData::CopyData(m_dst, m_src, m_size, m_swap);
+	}
+
+private:
+	unsigned char* m_dst;
+	const unsigned char* m_src;
+	size_t m_size;
+	int m_swap;
+};
+
+class NrrdInflateTask : public FLIVR::ThreadPoolTask
+{
+public:
+	NrrdInflateTask(NRRDData::Block* block, int swap) :
+		m_block(block), m_swap(swap)
+	{
+	}
+
+	virtual void run()
+	{
+		NRRDData::InflateBlock(*m_block);
+		if (m_block->ok && m_swap > 1)
+			NRRDData::CopyData(m_block->dst, m_block->dst, m_block->dst_size, m_swap);
+	}
+
+private:
+	NRRDData::Block* m_block;
+	int m_swap;
+};
+
+class NrrdDeflateTask : public FLIVR::ThreadPoolTask
+{
+public:
+	NrrdDeflateTask(const unsigned char* src, size_t size, int level, string* dst) :
+		m_src(src), m_size(size), m_level(level), m_dst(dst)
+	{
+	}
+
+	virtual void run()
+	{
+		NRRDData::DeflateBlock(m_src, m_size, m_level, *m_dst);
+	}
+
+private:
+	const unsigned char* m_src;
+	size_t m_size;
+	int m_level;
+	string* m_dst;
+};
+
+//inflates a gzip member into its own buffer and copies the voxels of a region
+class NrrdRegionTask : public FLIVR::ThreadPoolTask
+{
+public:
+	NrrdRegionTask(NRRDData::Block* block, const NRRDData::Region* region) :
+		m_block(block), m_region(region)
+	{
+	}
+
+	virtual void run()
+	{
+		m_buf.resize(m_block->dst_size);
+		m_block->dst = m_buf.empty() ? 0 : &m_buf[0];
+		NRRDData::InflateBlock(*m_block);
+		if (m_block->ok)
+			NRRDData::CopyRegion(m_block->dst, m_block->pos, m_block->dst_size, *m_region);
+		m_block->dst = 0;
+	}
+
+private:
+	NRRDData::Block* m_block;
+	const NRRDData::Region* m_region;
+	vector<unsigned char> m_buf;
+};
+
+static unsigned int GetUInt16(const unsigned char* p)
+{
+	return (unsigned int)p[0] | ((unsigned int)p[1]<<8);
+}
+
+static unsigned int GetUInt32(const unsigned char* p)
+{
+	return (unsigned int)p[0] | ((unsigned int)p[1]<<8) |
+		((unsigned int)p[2]<<16) | ((unsigned int)p[3]<<24);
+}
+
+static void PutUInt16(unsigned char* p, unsigned int v)
+{
+	p[0] = (unsigned char)(v & 0xff);
+	p[1] = (unsigned char)((v>>8) & 0xff);
+}
+
+static void PutUInt32(unsigned char* p, unsigned int v)
+{
+	p[0] = (unsigned char)(v & 0xff);
+	p[1] = (unsigned char)((v>>8) & 0xff);
+	p[2] = (unsigned char)((v>>16) & 0xff);
+	p[3] = (unsigned char)((v>>24) & 0xff);
+}
+
+bool NRRDData::Read(const wstring &filename, FILE* file, NrrdIoState* nio,
+	Nrrd* nrrd, size_t bytes)
+{
+	if (!nrrd || !nrrd->data ||
+		bytes != nrrdElementNumber(nrrd) * nrrdElementSize(nrrd))
+		return false;
+
+	FLIVR::MappedFile map;
+	size_t size;
+	int swap;
+	const unsigned char* src = MapData(filename, file, nio, nrrd, map, size, swap);
+	if (!src)
+		return false;
+	map.will_need((uint64_t)(src - (const unsigned char*)map.data()), (uint64_t)size);
+
+	if (nio->encoding == nrrdEncodingRaw)
+		return ReadRaw(src, size, swap, nrrd);
+	else
+		return ReadGzip(src, size, swap, nrrd);
+}
+
+bool NRRDData::ReadRegion(const wstring &filename, FILE* file, NrrdIoState* nio,
+	Nrrd* header, const VoxelBox &region, void* dst)
+{
+	if (!header || !dst || region.empty() ||
+		header->dim < 2 || header->dim > 3)
+		return false;
+
+	FLIVR::MappedFile map;
+	size_t size;
+	int swap;
+	const unsigned char* src = MapData(filename, file, nio, header, map, size, swap);
+	if (!src)
+		return false;
+
+	Region r;
+	r.dst = (unsigned char*)dst;
+	r.nx = header->axis[0].size;
+	r.ny = header->axis[1].size;
+	r.elem_size = nrrdElementSize(header);
+	r.box = region;
+	size_t nz = header->dim == 3 ? header->axis[2].size : 1;
+	if (region.x0 < 0 || region.y0 < 0 || region.z0 < 0 ||
+		(size_t)region.x1 > r.nx || (size_t)region.y1 > r.ny || (size_t)region.z1 > nz)
+		return false;
+	size_t bytes = nrrdElementNumber(header) * r.elem_size;
+	size_t region_bytes = (size_t)region.nx()*region.ny()*region.nz()*r.elem_size;
+
+	if (nio->encoding == nrrdEncodingRaw)
+	{
+		//only the pages holding the rows of the region are read
+		if (size < bytes)
+			return false;
+		CopyRegion(src, 0, bytes, r);
+	}
+	else
+	{
+		vector<Block> blocks;
+		if (!GetBlocks(src, size, bytes, blocks))
+			return false;
+		vector<Block> used;
+		for (size_t i = 0; i < blocks.size(); ++i)
+		{
+			if (CopyRegion(0, blocks[i].pos, blocks[i].dst_size, r))
+				used.push_back(blocks[i]);
+		}
+
+		FLIVR::ThreadPoolGroup *pool = 0;
+		if (used.size() > 1 && m_threads != 1)
+			pool = new FLIVR::ThreadPoolGroup(FLIVR::ThreadPool::shared());
+		for (size_t i = 0; i < used.size(); ++i)
+		{
+			NrrdRegionTask* task = new NrrdRegionTask(&used[i], &r);
+			if (pool)
+				pool->submit(task);
+			else
+			{
+				task->run();
+				delete task;
+			}
+		}
+		if (pool)
+		{
+			pool->wait();
+			delete pool;
+		}
+		for (size_t i = 0; i < used.size(); ++i)
+		{
+			if (!used[i].ok)
+				return false;
+		}
+	}
+
+	if (swap > 1)
+		CopyData(r.dst, r.dst, region_bytes, swap);
+	return true;
+}
+
+const unsigned char* NRRDData::MapData(const wstring &filename, FILE* file,
+	NrrdIoState* nio, Nrrd* nrrd, FLIVR::MappedFile &map, size_t &size, int &swap)
+{
+	if (!file || !nio || !nrrd)
+		return 0;
+	//only data following the header in the same file
+	if (nio->dataFNFormat || nio->dataFNArr->len > 0 ||
+		nio->lineSkip != 0 || nio->byteSkip != 0)
+		return 0;
+	if (nio->encoding != nrrdEncodingRaw &&
+		nio->encoding != nrrdEncodingGzip)
+		return 0;
+	size_t elem_size = nrrdElementSize(nrrd);
+	if (!elem_size || elem_size > 8)
+		return 0;
+	long offset = ftell(file);
+	if (offset < 0)
+		return 0;
+
+	swap = 0;
+	if (elem_size > 1 && nio->endian != airEndianUnknown &&
+		nio->endian != airMyEndian)
+		swap = int(elem_size);
+
+	if (!map.open(filename))
+		return 0;
+	if ((uint64_t)offset >= map.size())
+		return 0;
+	size = size_t(map.size() - (uint64_t)offset);
+	return (const unsigned char*)map.data() + offset;
+}
+
+bool NRRDData::ReadRaw(const unsigned char* src, size_t size, int swap, Nrrd* nrrd)
+{
+	size_t bytes = nrrdElementNumber(nrrd) * nrrdElementSize(nrrd);
+	if (size < bytes)
+		return false;
+
+	unsigned char* dst = (unsigned char*)nrrd->data;
+	if (bytes <= NRRD_COPY_CHUNK || m_threads == 1)
+	{
+		CopyData(dst, src, bytes, swap);
+		return true;
+	}
+
+	FLIVR::ThreadPoolGroup pool(FLIVR::ThreadPool::shared());
+	for (size_t pos = 0; pos < bytes; pos += NRRD_COPY_CHUNK)
+	{
+		//the chunk size is a multiple of every element size
+		size_t len = bytes - pos < NRRD_COPY_CHUNK ? bytes - pos : NRRD_COPY_CHUNK;
+		pool.submit(new NrrdCopyTask(dst + pos, src + pos, len, swap));
+	}
+	pool.wait();
+	return true;
+}
+
+bool NRRDData::ReadGzip(const unsigned char* src, size_t size, int swap, Nrrd* nrrd)
+{
+	size_t bytes = nrrdElementNumber(nrrd) * nrrdElementSize(nrrd);
+	vector<Block> blocks;
+	if (!GetBlocks(src, size, bytes, blocks))
+		return false;
+	for (size_t i = 0; i < blocks.size(); ++i)
+		blocks[i].dst = (unsigned char*)nrrd->data + blocks[i].pos;
+
+	if (blocks.size() == 1 || m_threads == 1)
+	{
+		for (size_t i = 0; i < blocks.size(); ++i)
+		{
+			InflateBlock(blocks[i]);
+			if (!blocks[i].ok)
+				return false;
+			if (swap > 1)
+				CopyData(blocks[i].dst, blocks[i].dst, blocks[i].dst_size, swap);
+		}
+		return true;
+	}
+
+	FLIVR::ThreadPoolGroup pool(FLIVR::ThreadPool::shared());
+	for (size_t i = 0; i < blocks.size(); ++i)
+		pool.submit(new NrrdInflateTask(&blocks[i], swap));
+	pool.wait();
+
+	for (size_t i = 0; i < blocks.size(); ++i)
+	{
+		if (!blocks[i].ok)
+			return false;
+	}
+	return true;
+}
+
+bool NRRDData::GetBlocks(const unsigned char* src, size_t size, size_t bytes,
+	vector<Block> &blocks)
+{
+	//find the members and their sizes without touching the data
+	blocks.clear();
+	size_t pos = 0;
+	size_t total = 0;
+	while (pos < size)
+	{
+		const unsigned char* p = src + pos;
+		if (size - pos < NRRD_GZIP_HEADER + NRRD_GZIP_TRAILER)
+			return false;
+		if (p[0] != 0x1f || p[1] != 0x8b || p[2] != 8 ||
+			p[3] != 4/*FEXTRA only*/ ||
+			GetUInt16(p+10) != 12 ||
+			p[12] != 'F' || p[13] != 'R' ||
+			GetUInt16(p+14) != 8)
+			return false;
+		Block block;
+		block.src_size = GetUInt32(p+16);
+		block.dst_size = GetUInt32(p+20);
+		if (block.src_size > size - pos - NRRD_GZIP_HEADER - NRRD_GZIP_TRAILER ||
+			block.dst_size > bytes - total)
+			return false;
+		block.pos = total;
+		block.src = p + NRRD_GZIP_HEADER;
+		block.dst = 0;
+		block.crc = GetUInt32(block.src + block.src_size);
+		if (GetUInt32(block.src + block.src_size + 4) != (unsigned int)block.dst_size)
+			return false;
+		block.ok = false;
+		blocks.push_back(block);
+		total += block.dst_size;
+		pos += NRRD_GZIP_HEADER + block.src_size + NRRD_GZIP_TRAILER;
+	}
+	return !blocks.empty() && total == bytes;
+}
+
+bool NRRDData::CopyRegion(const unsigned char* data, size_t pos, size_t size,
+	const Region &region)
+{
+	if (!size)
+		return false;
+	const VoxelBox &box = region.box;
+	size_t row_bytes = region.nx * region.elem_size;
+	size_t slice_bytes = region.ny * row_bytes;
+	size_t copy_bytes = (size_t)box.nx() * region.elem_size;
+	size_t end = pos + size;
+
+	bool found = false;
+	size_t z0 = max((size_t)box.z0, pos / slice_bytes);
+	size_t z1 = min((size_t)box.z1, (end - 1) / slice_bytes + 1);
+	for (size_t z = z0; z < z1; ++z)
+	{
+		size_t base = z * slice_bytes;
+		size_t y0 = max((size_t)box.y0, pos > base ? (pos - base) / row_bytes : 0);
+		size_t y1 = min((size_t)box.y1, (end - 1 - base) / row_bytes + 1);
+		for (size_t y = y0; y < y1; ++y)
+		{
+			size_t s = base + y * row_bytes + box.x0 * region.elem_size;
+			size_t a = max(s, pos);
+			size_t b = min(s + copy_bytes, end);
+			if (a >= b)
+				continue;
+			if (!data)
+				return true;
+			found = true;
+			size_t d = ((z - box.z0) * box.ny() + (y - box.y0)) * copy_bytes + (a - s);
+			memcpy(region.dst + d, data + (a - pos), b - a);
+		}
+	}
+	return found;
+}
+
+bool NRRDData::WriteGzip(FILE* file, Nrrd* nrrd, int level)
+{
+	if (!file || !nrrd || !nrrd->data)
+		return false;
+
+	const unsigned char* src = (const unsigned char*)nrrd->data;
+	size_t bytes = nrrdElementNumber(nrrd) * nrrdElementSize(nrrd);
+	size_t block_num = (bytes + NRRD_GZIP_BLOCK - 1) / NRRD_GZIP_BLOCK;
+	if (!block_num)
+		return false;
+
+	FLIVR::ThreadPoolGroup *pool = 0;
+	size_t batch = 1;
+	if (block_num > 1 && m_threads != 1)
+	{
+		pool = new FLIVR::ThreadPoolGroup(FLIVR::ThreadPool::shared());
+		//a few blocks per thread are compressed before they are written
+		batch = (size_t)(pool->get_thread_num() > 0 ? pool->get_thread_num() : 1) * 4;
+	}
+
+	bool result = true;
+	vector<string> out(batch);
+	for (size_t first = 0; first < block_num && result; first += batch)
+	{
+		size_t last = first + batch < block_num ? first + batch : block_num;
+		for (size_t i = first; i < last; ++i)
+		{
+			size_t pos = i * NRRD_GZIP_BLOCK;
+			size_t len = bytes - pos < NRRD_GZIP_BLOCK ? bytes - pos : NRRD_GZIP_BLOCK;
+			if (pool)
+				pool->submit(new NrrdDeflateTask(src + pos, len, level, &out[i - first]));
+			else
+				DeflateBlock(src + pos, len, level, out[i - first]);
+		}
+		if (pool)
+			pool->wait();
+
+		for (size_t i = first; i < last && result; ++i)
+		{
+			string &s = out[i - first];
+			if (s.empty() || fwrite(s.data(), 1, s.size(), file) != s.size())
+				result = false;
+			s.clear();
+		}
+	}
+
+	if (pool)
+		delete pool;
+	return result;
+}
+
+void NRRDData::CopyData(unsigned char* dst, const unsigned char* src, size_t size, int swap)
+{
+	if (swap <= 1)
+	{
+		if (dst != src)
+			memcpy(dst, src, size);
+		return;
+	}
+
+	unsigned char elem[8];
+	for (size_t i = 0; i + swap <= size; i += swap)
+	{
+		for (int j = 0; j < swap; ++j)
+			elem[j] = src[i + swap - 1 - j];
+		memcpy(dst + i, elem, swap);
+	}
+}
+
+void NRRDData::InflateBlock(Block &block)
+{
+	block.ok = false;
+	z_stream zs;
+	memset(&zs, 0, sizeof(zs));
+	//raw deflate, the gzip header and trailer are checked here
+	if (inflateInit2(&zs, -MAX_WBITS) != Z_OK)
+		return;
+	zs.next_in = (Bytef*)block.src;
+	zs.avail_in = (uInt)block.src_size;
+	zs.next_out = (Bytef*)block.dst;
+	zs.avail_out = (uInt)block.dst_size;
+	int err = inflate(&zs, Z_FINISH);
+	size_t out_size = zs.total_out;
+	inflateEnd(&zs);
+	if (err != Z_STREAM_END || out_size != block.dst_size)
+		return;
+
+	uLong crc = crc32(0L, Z_NULL, 0);
+	crc = crc32(crc, (const Bytef*)block.dst, (uInt)block.dst_size);
+	block.ok = (unsigned int)crc == block.crc;
+}
+
+void NRRDData::DeflateBlock(const unsigned char* src, size_t size, int level, string &dst)
+{
+	dst.clear();
+	z_stream zs;
+	memset(&zs, 0, sizeof(zs));
+	if (deflateInit2(&zs, level < 0 ? Z_DEFAULT_COMPRESSION : level,
+		Z_DEFLATED, -MAX_WBITS, 8, Z_DEFAULT_STRATEGY) != Z_OK)
+		return;
+
+	size_t bound = deflateBound(&zs, (uLong)size);
+	dst.resize(NRRD_GZIP_HEADER + bound + NRRD_GZIP_TRAILER);
+	unsigned char* p = (unsigned char*)&dst[0];
+	zs.next_in = (Bytef*)src;
+	zs.avail_in = (uInt)size;
+	zs.next_out = (Bytef*)(p + NRRD_GZIP_HEADER);
+	zs.avail_out = (uInt)bound;
+	int err = deflate(&zs, Z_FINISH);
+	size_t comp_size = zs.total_out;
+	deflateEnd(&zs);
+	if (err != Z_STREAM_END)
+	{
+		dst.clear();
+		return;
+	}
+
+	//gzip header with the sizes in an extra subfield
+	p[0] = 0x1f;
+	p[1] = 0x8b;
+	p[2] = 8;		//deflate
+	p[3] = 4;		//FEXTRA
+	PutUInt32(p+4, 0);	//no time stamp
+	p[8] = 0;
+	p[9] = 255;		//unknown os
+	PutUInt16(p+10, 12);
+	p[12] = 'F';
+	p[13] = 'R';
+	PutUInt16(p+14, 8);
+	PutUInt32(p+16, (unsigned int)comp_size);
+	PutUInt32(p+20, (unsigned int)size);
+
+	uLong crc = crc32(0L, Z_NULL, 0);
+	crc = crc32(crc, (const Bytef*)src, (uInt)size);
+	PutUInt32(p+NRRD_GZIP_HEADER+comp_size, (unsigned int)crc);
+	PutUInt32(p+NRRD_GZIP_HEADER+comp_size+4, (unsigned int)size);
+	dst.resize(NRRD_GZIP_HEADER + comp_size + NRRD_GZIP_TRAILER);
+}
@@ -0,0 +1,118 @@
+/*
+For more information, please see: http://software.sci.utah.edu
+
+The MIT License
+
+Copyright (c) 2014 Scientific Computing and Imaging Institute,
+University of Utah.
+
+
+Permission is hereby granted, free of charge, to any person obtaining a
+copy of this software and associated documentation files (the "Software"),
+to deal in the Software without restriction, including without limitation
+the rights to use, copy, modify, merge, publish, distribute, sublicense,
+and/or sell copies of the Software, and to permit persons to whom the
+Software is furnished to do so, subject to the following conditions:
+
+The above copyright notice and this permission notice shall be included
+in all copies or substantial portions of the Software.
+
+THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS
+OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL
+THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER
+DEALINGS IN THE SOFTWARE.
+*/
+#ifndef _NRRD_DATA_H_
+#define _NRRD_DATA_H_
+
+#include <base_reader.h>
+#include <stdio.h>
+#include <string>
+#include <vector>
+
+using namespace std;
+
+namespace FLIVR
+{
+	class MappedFile;
+}
+
+//reads and writes the data section of attached .nrrd, .lbl and .msk files
+//on several threads. raw data is copied out of a mapping of the file.
+//gzip data is written as a series of gzip members of fixed size, each
+//tagged with its compressed and uncompressed size in an extra field.
+//the result is an ordinary gzip stream for other tools, and the members
+//are inflated independently when read. everything else is left to teem
+class NRRDData
+{
+public:
+	//read the data of a nrrd into nrrd->data, bytes allocated by the caller
+	//the header must have been read from file with nrrdIoStateSkipData
+	//and nio, so that the file is positioned at the data
+	//returns false if teem has to read the data
+	static bool Read(const wstring &filename, FILE* file, NrrdIoState* nio,
+		Nrrd* nrrd, size_t bytes);
+	//read the voxels of region into dst, sized for region
+	//header is the nrrd read with nrrdIoStateSkipData and nio
+	//only the gzip members holding voxels of region are inflated
+	static bool ReadRegion(const wstring &filename, FILE* file, NrrdIoState* nio,
+		Nrrd* header, const VoxelBox &region, void* dst);
+	//append the data of a nrrd to file as gzip members
+	//the header must have been written with nrrdIoStateSkipData and gzip encoding
+	//level is the zlib level, -1 for the default
+	static bool WriteGzip(FILE* file, Nrrd* nrrd, int level);
+
+	//1 works on the calling thread; other values use the shared pool
+	static void SetThreads(int num) { m_threads = num; }
+	static int GetThreads() { return m_threads; }
+
+	friend class NrrdCopyTask;
+	friend class NrrdInflateTask;
+	friend class NrrdDeflateTask;
+	friend class NrrdRegionTask;
+
+private:
+	static int m_threads;
+
+	//one gzip member
+	struct Block
+	{
+		size_t pos;					//uncompressed position
+		const unsigned char* src;	//deflate stream
+		size_t src_size;
+		unsigned char* dst;			//uncompressed data
+		size_t dst_size;
+		unsigned int crc;
+		bool ok;
+	};
+	//voxels of a region in a volume of nx*ny slices
+	struct Region
+	{
+		unsigned char* dst;
+		size_t nx, ny;
+		size_t elem_size;
+		VoxelBox box;
+	};
+
+	//map the data following the header; NULL if teem has to read it
+	static const unsigned char* MapData(const wstring &filename, FILE* file,
+		NrrdIoState* nio, Nrrd* nrrd, FLIVR::MappedFile &map, size_t &size, int &swap);
+	static bool ReadRaw(const unsigned char* src, size_t size, int swap, Nrrd* nrrd);
+	static bool ReadGzip(const unsigned char* src, size_t size, int swap, Nrrd* nrrd);
+	//list the members of data written by WriteGzip holding bytes
+	static bool GetBlocks(const unsigned char* src, size_t size, size_t bytes,
+		vector<Block> &blocks);
+	//copy the bytes of region in [pos, pos+size) of the volume
+	//with data NULL, only tell if there are any
+	static bool CopyRegion(const unsigned char* data, size_t pos, size_t size,
+		const Region &region);
+	//copy with the byte order swapped for elements of swap bytes
+	static void CopyData(unsigned char* dst, const unsigned char* src, size_t size, int swap);
+	static void InflateBlock(Block &block);
+	static void DeflateBlock(const unsigned char* src, size_t size, int level, string &dst);
+};
+
+#endif//_NRRD_DATA_H_
@@ -26,6 +26,7 @@ FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER
 DEALINGS IN THE SOFTWARE.
 */
 #include "nrrd_reader.h"
+#include "nrrd_data.h"
 #include "../compatibility.h"
 #include <algorithm>
 #include <sstream>
@@ -233,13 +234,13 @@ Nrrd* NRRDReader::Convert(int t, int c, bool get_max)
 	nrrdIoStateSet(nio, nrrdIoStateSkipData, AIR_TRUE);
 	if (nrrdRead(output, nrrd_file, nio))
 	{
+		nrrdIoStateNix(nio);
 		fclose(nrrd_file);
 		return 0;
 	}
-	nio = nrrdIoStateNix(nio);
-	rewind(nrrd_file);
 	if (!(output->dim == 3 || output->dim == 2))
 	{
+		nrrdIoStateNix(nio);
 		delete []output->data;
 		nrrdNix(output);
 		fclose(nrrd_file);
@@ -306,12 +307,19 @@ Nrrd* NRRDReader::Convert(int t, int c, bool get_max)
 	//if (data_size >= 1073741824UL)
 	//	get_max = false;
 
-	if (nrrdRead(output, nrrd_file, NULL))
+	//attached raw and block compressed data are read in parallel
+	bool read = NRRDData::Read(str_name, nrrd_file, nio, output, data_size);
+	nio = nrrdIoStateNix(nio);
+	if (!read)
 	{
-		delete [] output->data;
-		nrrdNix(output);
-		fclose(nrrd_file);
-		return 0;
+		rewind(nrrd_file);
+		if (nrrdRead(output, nrrd_file, NULL))
+		{
+			delete [] output->data;
+			nrrdNix(output);
+			fclose(nrrd_file);
+			return 0;
+		}
 	}
 	
 	if (output->dim == 2)
@@ -399,6 +407,64 @@ Nrrd* NRRDReader::Convert(int t, int c, bool get_max)
 	return output;
 }
 
+Nrrd* NRRDReader::ConvertRegion(int t, int c, const VoxelBox &box, int level)
+{
+	if (level != 0 || t<0 || t>=m_time_num)
+		return 0;
+
+	wstring str_name = m_4d_seq[t].filename;
+	FILE* nrrd_file = 0;
+	if (!WFOPEN(&nrrd_file, str_name.c_str(), L"rb"))
+		return 0;
+
+	Nrrd *header = nrrdNew();
+	NrrdIoState *nio = nrrdIoStateNew();
+	nrrdIoStateSet(nio, nrrdIoStateSkipData, AIR_TRUE);
+	Nrrd *output = 0;
+	if (!nrrdRead(header, nrrd_file, nio) &&
+		(header->dim == 3 || header->dim == 2) &&
+		(header->type == nrrdTypeUChar ||
+		header->type == nrrdTypeChar ||
+		header->type == nrrdTypeUShort))
+	{
+		VoxelBox region = box;
+		if (!ClipRegion(region, int(header->axis[0].size), int(header->axis[1].size),
+			header->dim == 3 ? int(header->axis[2].size) : 1))
+		{
+			nrrdIoStateNix(nio);
+			nrrdNix(header);
+			fclose(nrrd_file);
+			return 0;
+		}
+		output = NewRegion(region,
+			header->type == nrrdTypeUShort ? nrrdTypeUShort : nrrdTypeUChar,
+			m_xspc, m_yspc, m_zspc);
+		if (output &&
+			!NRRDData::ReadRegion(str_name, nrrd_file, nio, header, region, output->data))
+		{
+			delete []output->data;
+			nrrdNix(output);
+			output = 0;
+		}
+		// turn signed into unsigned
+		if (output && header->type == nrrdTypeChar)
+		{
+			size_t voxelnum = (size_t)region.nx()*region.ny()*region.nz();
+			unsigned char* val = (unsigned char*)output->data;
+			for (size_t i=0; i<voxelnum; i++)
+				val[i] = (unsigned char)(char(val[i]) + 128);
+		}
+	}
+	nrrdIoStateNix(nio);
+	nrrdNix(header);
+	fclose(nrrd_file);
+
+	//other encodings and types are converted whole
+	if (!output)
+		return BaseReader::ConvertRegion(t, c, box, level);
+	return output;
+}
+
 bool NRRDReader::nrrd_sort(const TimeDataInfo& info1, const TimeDataInfo& info2)
 {
 	return info1.filenumber < info2.filenumber;
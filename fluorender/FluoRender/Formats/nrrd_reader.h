@@ -53,12 +53,15 @@ public:
 	void SetBatch(bool batch);
 	int LoadBatch(int index);
 	Nrrd* Convert(int t, int c, bool get_max);
+	//raw and block compressed 8 and 16 bit data are read in part
+	Nrrd* ConvertRegion(int t, int c, const VoxelBox &box, int level=0);
 	wstring GetCurName(int t, int c);
 
 	wstring GetPathName() {return m_path_name;}
 	wstring GetDataName() {return m_data_name;}
 	int GetTimeNum() {return m_time_num;}
 	int GetCurTime() {return m_cur_time;}
+	void SetCurTime(int t) {m_cur_time = t;}
 	int GetChanNum() {return m_chan_num;}
 	double GetExcitationWavelength(int chan) {return 0.0;}
 	int GetSliceNum() {return m_slice_num;}
@@ -26,6 +26,10 @@ FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER
 DEALINGS IN THE SOFTWARE.
 */
 #include "nrrd_writer.h"
+#include "nrrd_data.h"
+#include "../compatibility.h"
+#include <algorithm>
+#include <cwctype>
 
 NRRDWriter::NRRDWriter()
 {
@@ -93,6 +97,28 @@ void NRRDWriter::Save(wstring filename, int mode)
 			m_spcz*m_data->axis[2].size);
 	}
 
+	//compressed data with an attached header is written in parallel blocks
+	//that teem reads as one gzip stream
+	wstring suffix = filename.length()>5?filename.substr(filename.length()-5):L"";
+	transform(suffix.begin(), suffix.end(), suffix.begin(), ::towlower);
+	if (m_compression && m_data->data && suffix == L".nrrd")
+	{
+		FILE* nrrd_file = 0;
+		if (WFOPEN(&nrrd_file, filename.c_str(), L"wb"))
+		{
+			nrrdIoStateSet(nio, nrrdIoStateSkipData, AIR_TRUE);
+			bool saved = !nrrdWrite(nrrd_file, m_data, nio) &&
+				NRRDData::WriteGzip(nrrd_file, m_data, nio->zlibLevel);
+			fclose(nrrd_file);
+			if (saved)
+			{
+				nrrdIoStateNix(nio);
+				return;
+			}
+			nrrdIoStateSet(nio, nrrdIoStateSkipData, AIR_FALSE);
+		}
+	}
+
 	string str;
 	str.assign(filename.length(), 0);
 	for (int i=0; i<(int)filename.length(); i++)
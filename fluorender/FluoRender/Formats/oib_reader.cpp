@@ -29,8 +29,38 @@ DEALINGS IN THE SOFTWARE.
 #include "../compatibility.h"
 #include <algorithm>
 #include <sstream>
+#include <set>
+#include <FLIVR/ThreadPool.h>
 
-OIBReader::OIBReader()
+//slice streams read ahead of the decode workers, in bytes
+#define OIB_READ_AHEAD	(64<<20)
+
+//decodes one slice stream read by OIBReader::ConvertChannels
+class OibDecodeTask : public FLIVR::ThreadPoolTask
+{
+public:
+   OibDecodeTask(OIBReader *reader, OIBReader::OibSliceJob *job) :
+      m_reader(reader), m_job(job), m_max_value(0.0)
+   {
+   }
+   ~OibDecodeTask()
+   {
+      m_reader->FinishOibJob(m_job, m_max_value);
+   }
+
+   virtual void run()
+   {
+      m_max_value = m_reader->ReadTiff(&m_job->data[0], m_job->val, m_job->z);
+   }
+
+private:
+   OIBReader *m_reader;
+   OIBReader::OibSliceJob *m_job;
+   double m_max_value;
+};
+
+OIBReader::OIBReader() :
+   m_job_cond(m_job_lock)
 {
    m_time_num = 0;
    m_cur_time = -1;
@@ -53,10 +83,15 @@ OIBReader::OIBReader()
    m_time_id = L"_T";
    m_type = 0;
    m_oib_t = 0;
+
+   m_storage = 0;
+   m_decode_threads = 0;
+   m_job_bytes = 0;
 }
 
 OIBReader::~OIBReader()
 {
+   CloseStorage();
 }
 
 void OIBReader::SetFile(string &file)
@@ -81,6 +116,7 @@ void OIBReader::Preprocess()
 {
    m_type = 0;
    m_oib_info.clear();
+   CloseStorage();
 
    //separate path and name
    int64_t pos = m_path_name.find_last_of(GETSLASH());
@@ -175,6 +211,8 @@ void OIBReader::ReadSingleOib()
 			ReadStream(pStg,st);
 		  }
 	  }
+	  for (int i=0; i<(int)m_oib_info.size(); i++)
+		  MapStreams(pStg, i);
    }
    //release
    pStg.close();
@@ -190,7 +228,7 @@ void OIBReader::ReadSequenceOib()
          m_cur_time = i;
 	  
 	   //storage
-	   POLE::Storage pStg("temp_storage.txt"); 
+	   POLE::Storage pStg(ws2s(path_name).c_str());
 	   //open
 	   if (pStg.open()) {
 		  //enumerate
@@ -204,6 +242,7 @@ void OIBReader::ReadSequenceOib()
 				  ReadStream(pStg,st);
 			  }
 		  }
+		  MapStreams(pStg, i);
 	   }
 	   //release
 	   pStg.close();
@@ -300,6 +339,68 @@ void OIBReader::ReadStream(POLE::Storage &pStg, wstring &stream_name)
 		delete[] pbyData;
 }
 
+void OIBReader::MapStreams(POLE::Storage &pStg, int t)
+{
+	if (t<0 || t>=(int)m_oib_info.size())
+		return;
+	DatasetInfo &dataset = m_oib_info[t].dataset;
+	//a slice is mapped to the directory that holds its stream
+	std::list<std::string> entries = pStg.entries();
+	for(std::list<std::string>::iterator it = entries.begin();
+		it != entries.end(); ++it) {
+		if (!pStg.isDirectory(*it))
+			continue;
+		//stream names relative to the directory
+		std::set<std::string> streams;
+		std::list<std::string> paths = pStg.GetAllStreams(*it);
+		for (std::list<std::string>::iterator pit = paths.begin();
+			pit != paths.end(); ++pit) {
+			std::string name = *pit;
+			if (name.compare(0, it->size(), *it) == 0)
+				name = name.substr(it->size());
+			if (!name.empty() && name[0] == '/')
+				name = name.substr(1);
+			streams.insert(name);
+		}
+		if (streams.empty())
+			continue;
+		for (size_t c=0; c<dataset.size(); c++) {
+			ChannelInfo &cinfo = dataset[c];
+			for (size_t z=0; z<cinfo.size(); z++)
+				if (cinfo[z].stream_path.empty() &&
+					streams.find(ws2s(cinfo[z].stream_name)) != streams.end())
+					cinfo[z].stream_path = (*it) + std::string("/") + ws2s(cinfo[z].stream_name);
+		}
+	}
+}
+
+POLE::Storage* OIBReader::OpenStorage(const wstring &path_name)
+{
+	if (m_storage && m_storage_name == path_name)
+		return m_storage;
+	CloseStorage();
+	m_storage = new POLE::Storage(ws2s(path_name).c_str());
+	if (!m_storage->open())
+	{
+		delete m_storage;
+		m_storage = 0;
+		return 0;
+	}
+	m_storage_name = path_name;
+	return m_storage;
+}
+
+void OIBReader::CloseStorage()
+{
+	if (m_storage)
+	{
+		m_storage->close();
+		delete m_storage;
+		m_storage = 0;
+	}
+	m_storage_name.clear();
+}
+
 void OIBReader::ReadOibInfo(unsigned char* pbyData, size_t size)
 {
 	if (!pbyData || !size)
@@ -694,98 +795,136 @@ double OIBReader::GetExcitationWavelength(int chan)
 
 Nrrd *OIBReader::Convert(int t, int c, bool get_max)
 {
-   Nrrd *data = 0;
-   int sl_num = 0;
+   vector<int> chans(1, c);
+   vector<Nrrd*> data;
+   vector<double> max_values, scalar_scales;
+   ConvertChannels(t, chans, get_max, data, max_values, scalar_scales);
+   return data.empty()?0:data[0];
+}
+
+int OIBReader::ConvertChannels(int t, const vector<int> &chans, bool get_max,
+      vector<Nrrd*> &data, vector<double> &max_values, vector<double> &scalar_scales)
+{
+   int result = 0;
+   data.assign(chans.size(), (Nrrd*)0);
    if (t>=0 && t<m_time_num &&
-         c>=0 && c<m_chan_num &&
          m_slice_num > 0 &&
          m_x_size > 0 &&
          m_y_size > 0)
    {
-	   unsigned char *pbyData = 0;
        wstring path_name = m_type==0?m_path_name:m_oib_info[t].filename;
-	   //storage
-	   POLE::Storage pStg(ws2s(path_name).c_str());
-	   //open
-	   if (pStg.open()) {
+	   //storage; kept open for the next time point
+	   POLE::Storage *pStg = OpenStorage(path_name);
+	   if (pStg) {
 		  //allocate memory for nrrd
 		  unsigned long long mem_size = (unsigned long long)m_x_size*
 			  (unsigned long long)m_y_size*(unsigned long long)m_slice_num;
-		  unsigned short *val = new (std::nothrow) unsigned short[mem_size];
-		  //enumerate
-		  std::list<std::string> entries = 
-			  pStg.entries();
-		  for(std::list<std::string>::iterator it = entries.begin();
-			  it != entries.end(); ++it) {
-			if (pStg.isDirectory(*it)) {
-				std::list<std::string> streams =  pStg.GetAllStreams(*it);
-				size_t num = 0;
-				ChannelInfo *cinfo = &m_oib_info[t].dataset[c];
-				for(std::list<std::string>::iterator its = streams.begin();
-						its != streams.end(); ++its) {
-					if (num >= cinfo->size()) break;
-					//fix the stream name
-					std::string str_name = ws2s((*cinfo)[num].stream_name);
-					std::string name = (*it) + std::string("/") + str_name;
-					  
-					POLE::Stream pStm(&pStg,name);
-
-					//open
-					if (!pStm.eof() && !pStm.fail())
-					{
-						//get stream size
-						size_t sz = pStm.size();
-						//allocate 
-						pbyData = new unsigned char[sz];
-						if (!pbyData) 
-							return NULL;
-						//read
-						if (pStm.read(pbyData,sz)) {
-									
-							//copy tiff to val
-							ReadTiff(pbyData, val, num);
-
-							//increase
-							sl_num++;
-						}
-					}
-
-					//release
-					if (pbyData)
-						delete[] pbyData;
-					num++;
-				 }
+		  vector<unsigned short*> vals(chans.size(), (unsigned short*)0);
+		  vector<int> sl_nums(chans.size(), 0);
+		  for (size_t k=0; k<chans.size(); k++)
+			  if (chans[k]>=0 && chans[k]<m_chan_num &&
+				  chans[k]<(int)m_oib_info[t].dataset.size())
+				  vals[k] = new (std::nothrow) unsigned short[mem_size];
+
+		  //the calling thread reads the slice streams and the pool decodes them
+		  int thread_num = m_decode_threads;
+		  if (thread_num <= 0)
+			  thread_num = wxThread::GetCPUCount();
+		  FLIVR::ThreadPoolGroup *pool = 0;
+		  if (thread_num > 1)
+			  pool = new FLIVR::ThreadPoolGroup(FLIVR::ThreadPool::shared());
+		  m_job_bytes = 0;
+
+		  for (size_t k=0; k<chans.size(); k++) {
+			  if (!vals[k]) continue;
+			  ChannelInfo *cinfo = &m_oib_info[t].dataset[chans[k]];
+			  for (size_t num=0; num<cinfo->size(); num++) {
+				  if ((*cinfo)[num].stream_path.empty())
+					  continue;
+				  POLE::Stream pStm(pStg, (*cinfo)[num].stream_path);
+				  //open
+				  if (pStm.eof() || pStm.fail())
+					  continue;
+				  //get stream size
+				  size_t sz = pStm.size();
+				  OibSliceJob *job = new OibSliceJob;
+				  job->val = vals[k];
+				  job->z = (int)num;
+				  //the lzw decoder may look a few bytes past the end of a strip
+				  job->data.assign(sz + 8, 0);
+				  //read
+				  if (!sz || !pStm.read(&job->data[0],sz)) {
+					  delete job;
+					  continue;
+				  }
+				  //increase
+				  sl_nums[k]++;
+
+				  //copy tiff to val
+				  if (!pool) {
+					  double value = ReadTiff(&job->data[0], job->val, job->z);
+					  if (value > m_max_value)
+						  m_max_value = value;
+					  delete job;
+					  continue;
+				  }
+				  m_job_lock.Lock();
+				  while (m_job_bytes > 0 && m_job_bytes + job->data.size() > OIB_READ_AHEAD)
+					  m_job_cond.Wait();
+				  m_job_bytes += job->data.size();
+				  m_job_lock.Unlock();
+				  pool->submit(new OibDecodeTask(this, job));
 			  }
-		   }
+		  }
 
-			//create nrrd
-			if (val && sl_num == m_slice_num)
-			{
-				//ok
-				data = nrrdNew();
-				nrrdWrap(data, val, nrrdTypeUShort, 3, (size_t)m_x_size, (size_t)m_y_size, 
-					(size_t)m_slice_num);
-				nrrdAxisInfoSet(data, nrrdAxisInfoSpacing, m_xspc, m_yspc, m_zspc);
-				nrrdAxisInfoSet(data, nrrdAxisInfoMax, m_xspc*m_x_size, m_yspc*m_y_size, 
-					m_zspc*m_slice_num);
-				nrrdAxisInfoSet(data, nrrdAxisInfoMin, 0.0, 0.0, 0.0);
-				nrrdAxisInfoSet(data, nrrdAxisInfoSize, (size_t)m_x_size,
-					(size_t)m_y_size, (size_t)m_slice_num);
-			} else {
-				//something is wrong
-				if (val)
-					delete []val;
+		  if (pool) {
+			  pool->wait();
+			  delete pool;
+		  }
+
+			for (size_t k=0; k<chans.size(); k++) {
+				//create nrrd
+				if (vals[k] && sl_nums[k] == m_slice_num)
+				{
+					//ok
+					data[k] = nrrdNew();
+					nrrdWrap(data[k], vals[k], nrrdTypeUShort, 3, (size_t)m_x_size, (size_t)m_y_size, 
+						(size_t)m_slice_num);
+					nrrdAxisInfoSet(data[k], nrrdAxisInfoSpacing, m_xspc, m_yspc, m_zspc);
+					nrrdAxisInfoSet(data[k], nrrdAxisInfoMax, m_xspc*m_x_size, m_yspc*m_y_size, 
+						m_zspc*m_slice_num);
+					nrrdAxisInfoSet(data[k], nrrdAxisInfoMin, 0.0, 0.0, 0.0);
+					nrrdAxisInfoSet(data[k], nrrdAxisInfoSize, (size_t)m_x_size,
+						(size_t)m_y_size, (size_t)m_slice_num);
+					result++;
+				} else {
+					//something is wrong
+					if (vals[k])
+						delete []vals[k];
+				}
 			}
-			//release
-			pStg.close();
 	  }
     }
 
 	if (m_max_value > 0.0)
 		m_scalar_scale = 65535.0 / m_max_value;
 
+	//the max sample value is shared by all channels of the file
+	max_values.assign(chans.size(), m_max_value);
+	scalar_scales.assign(chans.size(), m_scalar_scale);
+
 	m_cur_time = t;
-	return data;
+	return result;
+}
+
+void OIBReader::FinishOibJob(OibSliceJob *job, double max_value)
+{
+	wxMutexLocker lock(m_job_lock);
+	if (max_value > m_max_value)
+		m_max_value = max_value;
+	m_job_bytes -= job->data.size();
+	m_job_cond.Signal();
+	delete job;
 }
 
 wstring OIBReader::GetCurName(int t, int c)
@@ -793,10 +932,11 @@ wstring OIBReader::GetCurName(int t, int c)
    return m_type==0?wstring(L""):m_oib_info[t].filename;
 }
 
-void OIBReader::ReadTiff(unsigned char *pbyData, unsigned short *val, int z)
+double OIBReader::ReadTiff(unsigned char *pbyData, unsigned short *val, int z)
 {
+	double max_value = 0.0;
 	if (*((unsigned int*)pbyData) != 0x002A4949)
-		return;
+		return max_value;
 
 	int compression = 0;
 	unsigned int offset = 0;
@@ -901,8 +1041,8 @@ void OIBReader::ReadTiff(unsigned char *pbyData, unsigned short *val, int z)
 			{
 				unsigned short value;
 				value = *((unsigned short*)(pbyData+offset+2+12*i+8));
-				if ((double)value > m_max_value)
-					m_max_value = (double)value;
+				if ((double)value > max_value)
+					max_value = (double)value;
 			}
 			break;
 		}
@@ -926,6 +1066,7 @@ void OIBReader::ReadTiff(unsigned char *pbyData, unsigned short *val, int z)
 			val_pos += rows*m_x_size;
 		}
 	}
+	return max_value;
 }
 
 void OIBReader::SetInfo()
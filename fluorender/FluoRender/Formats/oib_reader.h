@@ -33,6 +33,7 @@ DEALINGS IN THE SOFTWARE.
 #include <vector>
 #include "pole/pole.h"
 #include "base_reader.h"
+#include <wx/thread.h>
 
 using namespace std;
 
@@ -53,13 +54,20 @@ class OIBReader : public BaseReader
       void Preprocess();
       void SetBatch(bool batch);
 	  int LoadBatch(int index);
+      //1 decodes slices on the calling thread;
+      //other values decode them on the shared pool
+      void SetDecodeThreads(int num) { m_decode_threads = num; }
+      int GetDecodeThreads() { return m_decode_threads; }
       Nrrd* Convert(int t, int c, bool get_max);
+      int ConvertChannels(int t, const vector<int> &chans, bool get_max,
+         vector<Nrrd*> &data, vector<double> &max_values, vector<double> &scalar_scales);
       wstring GetCurName(int t, int c);
 
       wstring GetPathName() {return m_path_name;}
       wstring GetDataName() {return m_data_name;}
       int GetTimeNum() {return m_time_num;}
       int GetCurTime() {return m_cur_time;}
+      void SetCurTime(int t) {m_cur_time = t;}
       int GetChanNum() {return m_chan_num;}
       double GetExcitationWavelength(int chan);
       int GetSliceNum() {return m_slice_num;}
@@ -87,6 +95,7 @@ class OIBReader : public BaseReader
       {
          wstring stream_name;
          wstring file_name;
+         string stream_path;	//full name in the storage, set in Preprocess
       };
       typedef vector<SliceInfo> ChannelInfo;    //slices form a channel
       typedef vector<ChannelInfo> DatasetInfo;  //channels form a dataset
@@ -122,14 +131,39 @@ class OIBReader : public BaseReader
       //time sequence id
       wstring m_time_id;
 
+      //the storage read last stays open for the next frame
+      POLE::Storage *m_storage;
+      wstring m_storage_name;
+
+      //one slice stream read from the storage and waiting to be decoded
+      struct OibSliceJob
+      {
+         vector<unsigned char> data;
+         unsigned short *val;
+         int z;
+      };
+      friend class OibDecodeTask;
+
+      int m_decode_threads;
+      //bounds the bytes read ahead of the decode workers
+      wxMutex m_job_lock;
+      wxCondition m_job_cond;
+      size_t m_job_bytes;
+
    private:
       static bool oib_sort(const TimeDataInfo& info1, const TimeDataInfo& info2);
       void ReadSingleOib();
       void ReadSequenceOib();
 	void ReadStream(POLE::Storage &pStg, wstring &stream_name);
+	//resolve the stream of every slice of time point t in an open storage
+	void MapStreams(POLE::Storage &pStg, int t);
+	POLE::Storage* OpenStorage(const wstring &path_name);
+	void CloseStorage();
+	void FinishOibJob(OibSliceJob *job, double max_value);
 	void ReadOibInfo(unsigned char* pbyData, size_t size);
 	void ReadOif(unsigned char* pbyData, size_t size);
-	void ReadTiff(unsigned char* pbyData, unsigned short *val, int z);
+	//returns the max sample value in the tags or 0
+	double ReadTiff(unsigned char* pbyData, unsigned short *val, int z);
 };
 
 #endif//_OIB_READER_H_
@@ -61,6 +61,7 @@ public:
 	wstring GetDataName() {return m_data_name;}
 	int GetTimeNum() {return m_time_num;}
 	int GetCurTime() {return m_cur_time;}
+	void SetCurTime(int t) {m_cur_time = t;}
 	int GetChanNum() {return m_chan_num;}
 	double GetExcitationWavelength(int chan);
 	int GetSliceNum() {return m_slice_num;}
@@ -59,6 +59,7 @@ public:
 	wstring GetDataName() {return m_data_name;}
 	int GetTimeNum() {return m_time_num;}
 	int GetCurTime() {return m_cur_time;}
+	void SetCurTime(int t) {m_cur_time = t;}
 	int GetChanNum()
 	{if (m_sep_seq) return m_group_num; else return m_chan_num;}
 	double GetExcitationWavelength(int chan);
@@ -28,8 +28,51 @@ DEALINGS IN THE SOFTWARE.
 #include "tif_reader.h"
 #include "../compatibility.h"
 #include <sstream>
+#include <FLIVR/ThreadPool.h>
+#include <zlib.h>
+#include <wx/filefn.h>
 
-TIFReader::TIFReader()
+//files whose parsed IFDs are kept
+#define TIFF_INDEX_NUM	64
+
+//decodes strips or tiles of one page read by TIFReader::ReadTiff
+class TiffDecodeTask : public FLIVR::ThreadPoolTask
+{
+public:
+   TiffDecodeTask(TIFReader *reader, TIFReader::TiffPageJob *job,
+         const vector<int> &chans, const vector<void*> &vals,
+         bool eight_bit, bool get_max, size_t first, size_t last) :
+      m_reader(reader), m_job(job), m_chans(chans), m_vals(vals),
+      m_eight_bit(eight_bit), m_get_max(get_max),
+      m_first(first), m_last(last), m_max_values(chans.size(), 0)
+   {
+   }
+   ~TiffDecodeTask()
+   {
+      m_reader->FinishTiffJob(m_job, m_max_values);
+   }
+
+   virtual void run()
+   {
+      m_reader->DecodeTiffPage(*m_job, m_chans, m_vals,
+            m_eight_bit, m_get_max, m_max_values, m_first, m_last);
+   }
+
+private:
+   TIFReader *m_reader;
+   TIFReader::TiffPageJob *m_job;
+   //owned by ReadTiff, which waits for all tasks
+   const vector<int> &m_chans;
+   const vector<void*> &m_vals;
+   bool m_eight_bit;
+   bool m_get_max;
+   size_t m_first;
+   size_t m_last;
+   vector<int> m_max_values;
+};
+
+TIFReader::TIFReader() :
+   m_job_cond(m_job_lock)
 {
    m_resize_type = 0;
    m_resample_type = 0;
@@ -59,6 +102,13 @@ TIFReader::TIFReader()
    current_page_ = current_offset_ = 0;
    swap_ = false;
    isBig_ = false;
+   cur_index_ = 0;
+   cur_ifd_ = 0;
+   m_tiff_clock = 0;
+
+   m_decode_threads = 0;
+   m_jobs_in_flight = 0;
+   m_jobs_max.clear();
 }
 
 TIFReader::~TIFReader()
@@ -77,12 +127,14 @@ void TIFReader::SetFile(string &file)
       copy(file.begin(), file.end(), m_path_name.begin());
    }
    m_id_string = m_path_name;
+   ClearTiffIndex();
 }
 
 void TIFReader::SetFile(wstring &file)
 {
    m_path_name = file;
    m_id_string = m_path_name;
+   ClearTiffIndex();
 }
 
 void TIFReader::Preprocess()
@@ -244,163 +296,300 @@ uint64_t TIFReader::GetTiffField(
 {
    if (!tiff_stream.is_open())
       throw std::runtime_error( "TIFF File not open for reading." );
-   //go to the current IFD block/page
-   tiff_stream.seekg(current_offset_,tiff_stream.beg);
+   //look the tag up in the parsed IFD of the current page
+   const TiffIFD *ifd = GetCurTiffIFD();
+   if (!ifd)
+      return 0;
+   //if we simply want the next page offset, get that and return.
+   if (in_tag == kNextPageOffsetTag)
+      return ifd->next_offset;
+   unordered_map<uint16_t, TiffTag>::const_iterator it =
+      ifd->tags.find(static_cast<uint16_t>(in_tag));
+   if (it == ifd->tags.end())
+      return 0;
+   const TiffTag &tag = it->second;
+   if (!buf && size == kType) return static_cast<uint64_t>(tag.type);
+   if (!buf && size == kCount) return tag.count;
+   if (size == kValueAddress) return tag.addr;
+   //now get the value (different for different types.)
+   uint64_t answer = 0;
+   if (tag.type == kByte) {
+      answer = static_cast<uint64_t>((uint8_t)tag.field[0]);
+   } else if (tag.type == kASCII) {
+      if (!buf)
+         return 0;
+      uint64_t len = min(size,tag.count);
+      if (tag.count > (isBig_?8:4)) {
+         tiff_stream.seekg(GetTiffTagOffset(tag),tiff_stream.beg);
+         tiff_stream.read((char*)buf,len);
+      } else
+         memcpy(buf,tag.field,(size_t)len);
+   } else if (tag.type == kShort || tag.type == kLong ||
+         tag.type == kLong8 || tag.type == kIFD8) {
+      if (size == kOffset)
+         return GetTiffTagOffset(tag);
+      answer = GetTiffTagElement(tag, 0);
+   } else if (tag.type == kRational) {
+      //get the two values in the data to make a float.
+      uint32_t num = 0, den = 0;
+      if (isBig_) {
+         memcpy(&num,tag.field,sizeof(uint32_t));
+         memcpy(&den,tag.field+4,sizeof(uint32_t));
+      } else {
+         tiff_stream.seekg(GetTiffTagOffset(tag),tiff_stream.beg);
+         tiff_stream.read((char*)&num,sizeof(uint32_t));
+         tiff_stream.read((char*)&den,sizeof(uint32_t));
+      }
+      if (swap_) { num = SwapWord(num); den = SwapWord(den); }
+      float rat = static_cast<float>(num) /
+         static_cast<float>(den);
+      if (buf)
+         memcpy(buf,&rat,min((size_t)size,sizeof(float)));
+      return 0;
+   } else {
+      std::cerr << "Unhandled TIFF Tag type" << std::endl;
+   }
+   return answer;
+}
+
+uint64_t TIFReader::GetTiffTagOffset(const TiffTag &tag)
+{
+   if (isBig_) {
+      uint64_t value = 0;
+      memcpy(&value,tag.field,sizeof(uint64_t));
+      return swap_?SwapLong(value):value;
+   } else {
+      uint32_t value = 0;
+      memcpy(&value,tag.field,sizeof(uint32_t));
+      return static_cast<uint64_t>(swap_?SwapWord(value):value);
+   }
+}
+
+uint64_t TIFReader::GetTiffTagElement(const TiffTag &tag, uint64_t index)
+{
+   if (index >= tag.count)
+      return 0;
+   uint64_t type_size = 2;
+   if (tag.type == kLong)
+      type_size = 4;
+   else if (tag.type == kLong8 || tag.type == kIFD8)
+      type_size = 8;
+   char data[8];
+   // if the values do not fit into the tag data, jump to them
+   if (tag.count * type_size > (isBig_?8:4)) {
+      tiff_stream.seekg(GetTiffTagOffset(tag)+type_size*index,tiff_stream.beg);
+      tiff_stream.read(data,type_size);
+   } else
+      memcpy(data,tag.field+type_size*index,(size_t)type_size);
+   if (type_size == 8) {
+      uint64_t value = 0;
+      memcpy(&value,data,sizeof(uint64_t));
+      return swap_?SwapLong(value):value;
+   } else if (type_size == 4) {
+      uint32_t value = 0;
+      memcpy(&value,data,sizeof(uint32_t));
+      return static_cast<uint64_t>(swap_?SwapWord(value):value);
+   } else {
+      uint16_t value = 0;
+      memcpy(&value,data,sizeof(uint16_t));
+      return static_cast<uint64_t>(swap_?SwapShort(value):value);
+   }
+}
+
+void TIFReader::ReadTiffTagArray(const TiffTag &tag, vector<uint64_t> &values)
+{
+   uint64_t type_size = 2;
+   if (tag.type == kLong)
+      type_size = 4;
+   else if (tag.type == kLong8 || tag.type == kIFD8)
+      type_size = 8;
+   values.resize((size_t)tag.count);
+   if (values.empty())
+      return;
+   //one read for the whole array
+   vector<char> data((size_t)(tag.count * type_size));
+   if (tag.count * type_size > (isBig_?8:4)) {
+      tiff_stream.seekg(GetTiffTagOffset(tag),tiff_stream.beg);
+      tiff_stream.read(&data[0],data.size());
+      if (!tiff_stream) {
+         tiff_stream.clear();
+         values.clear();
+         return;
+      }
+   } else
+      memcpy(&data[0],tag.field,data.size());
+   for (size_t i = 0; i < values.size(); i++) {
+      const char *p = &data[0] + i*type_size;
+      if (type_size == 8) {
+         uint64_t value = 0;
+         memcpy(&value,p,sizeof(uint64_t));
+         values[i] = swap_?SwapLong(value):value;
+      } else if (type_size == 4) {
+         uint32_t value = 0;
+         memcpy(&value,p,sizeof(uint32_t));
+         values[i] = static_cast<uint64_t>(swap_?SwapWord(value):value);
+      } else {
+         uint16_t value = 0;
+         memcpy(&value,p,sizeof(uint16_t));
+         values[i] = static_cast<uint64_t>(swap_?SwapShort(value):value);
+      }
+   }
+}
+
+bool TIFReader::ReadTiffIFD(uint64_t offset, TiffIFD &ifd)
+{
+   ifd.offset = offset;
+   ifd.next_offset = 0;
+   tiff_stream.seekg(offset,tiff_stream.beg);
    uint64_t num_entries=0;
    //how many entries are there?
    if (isBig_) {
-	  tiff_stream.read((char*)&num_entries,sizeof(uint64_t));
-	  if (swap_) num_entries = SwapLong(num_entries);
+      tiff_stream.read((char*)&num_entries,sizeof(uint64_t));
+      if (swap_) num_entries = SwapLong(num_entries);
    } else {
-	  uint16_t temp;
-	  tiff_stream.read((char*)&temp,sizeof(uint16_t));
-	  if (swap_) temp = SwapShort(temp);
-	  num_entries = static_cast<uint64_t>(temp);
+      uint16_t temp = 0;
+      tiff_stream.read((char*)&temp,sizeof(uint16_t));
+      if (swap_) temp = SwapShort(temp);
+      num_entries = static_cast<uint64_t>(temp);
    }
-   //if we simply want the next page offset, get that and return.
-   char start_off = 2, multiplier = 12;
-   if (isBig_) { start_off = 8; multiplier = 20; }
-   tiff_stream.seekg(current_offset_+start_off+multiplier*num_entries,tiff_stream.beg);
-   if (in_tag == kNextPageOffsetTag) {
-	   if (isBig_) {
-		  uint64_t next_offset = 0;
-		  tiff_stream.read((char*)&next_offset,sizeof(uint64_t));
-		  return swap_?SwapLong(next_offset):next_offset;
-	   } else {
-		  uint32_t next_offset = 0;
-		  tiff_stream.read((char*)&next_offset,sizeof(uint32_t));
-		  return static_cast<uint64_t>(swap_?SwapWord(next_offset):next_offset);
-	   }
-   }
-   //go through all of the entries to find the one we want
-   for(size_t i = 0; i < num_entries; i++) {
-      tiff_stream.seekg(current_offset_+start_off+multiplier*i,tiff_stream.beg);
-      uint16_t tag=0;
-      //get the tag of entry
-      tiff_stream.read((char*)&tag,sizeof(uint16_t));
-      if (swap_) tag = SwapShort(tag);
-      // This is the correct tag, grab and go.
-      if (tag == in_tag) {
-         //find the type
-         tiff_stream.seekg(current_offset_+start_off+multiplier*i+2,tiff_stream.beg);
-         uint16_t type=0;
-         tiff_stream.read((char*)&type,sizeof(uint16_t));
-         if (swap_) type = SwapShort(type);
-         if (!buf && size == kType) return static_cast<uint64_t>(type);
-         //find the count
-         tiff_stream.seekg(current_offset_+start_off+multiplier*i+4,tiff_stream.beg);
-         uint64_t cnt = 0;
-		 if(isBig_) {
-			 tiff_stream.read((char*)&cnt,sizeof(uint64_t));
-			 if (swap_) cnt = SwapLong(cnt);
-		 } else {
-			 uint32_t tmp = 0;
-			 tiff_stream.read((char*)&tmp,sizeof(uint32_t));
-			 if (swap_) tmp = SwapWord(tmp);
-			 cnt = static_cast<uint64_t>(tmp);
-		 }
-         if (!buf && size == kCount) return cnt;
-         //now get the value (different for different types.)
-		 char off2 = isBig_?12:8;
-		 uint64_t addr = current_offset_+start_off+multiplier*i+off2;
-		 if ( size == kValueAddress) return addr;
-         tiff_stream.seekg(addr,tiff_stream.beg);
-         uint64_t answer=0;
-         if (type == kByte) {
-            uint8_t value=0;
-            tiff_stream.read((char*)&value,sizeof(uint8_t));
-            answer = static_cast<uint64_t>(value);
-         } else if (type == kASCII) {
-            if (cnt > 1) {
-				if(isBig_) {
-				   tiff_stream.read((char*)&answer,sizeof(uint64_t));
-				   answer = swap_?SwapLong(answer):answer;
-				} else {
-				   uint32_t tmp;
-				   tiff_stream.read((char*)&tmp,sizeof(uint32_t));
-				   answer = static_cast<uint64_t>(swap_?SwapWord(tmp):tmp);
-				}
-				tiff_stream.seekg(answer,tiff_stream.beg);
-            }
-            //read the the string
-            tiff_stream.read((char*)buf,min(size,cnt));
-         } else if (type == kLong) {
-            uint32_t value=0;
-            if (cnt > (isBig_?2:1) && size != kOffset) {
-			   if (isBig_) {
-				  tiff_stream.read((char*)&answer,sizeof(uint64_t));
-                  if (swap_) answer = SwapLong(answer);
-                  tiff_stream.seekg(answer,tiff_stream.beg);
-                  tiff_stream.read((char*)&value,sizeof(uint32_t));
-                  if (swap_) value = SwapWord(value);
-			   } else {
-                  tiff_stream.read((char*)&value,sizeof(uint32_t));
-                  if (swap_) value = SwapWord(value);
-                  tiff_stream.seekg(value,tiff_stream.beg);
-                  tiff_stream.read((char*)&value,sizeof(uint32_t));
-                  if (swap_) value = SwapWord(value);
-			   }
-            } else {
-               tiff_stream.read((char*)&value,sizeof(uint32_t));
-               if (swap_) value = SwapWord(value);
-			}
-            answer = static_cast<uint64_t>(value);
-		 } else if (type == kLong8) {
-            if (cnt > 1 && size != kOffset) {
-               tiff_stream.read((char*)&answer,sizeof(uint64_t));
-               if (swap_) answer = SwapLong(answer);
-               tiff_stream.seekg(answer,tiff_stream.beg);
-               tiff_stream.read((char*)&answer,sizeof(uint64_t));
-               if (swap_) answer = SwapLong(answer);
-               return answer;
-            }
-            tiff_stream.read((char*)&answer,sizeof(uint64_t));
-            if (swap_) answer = SwapLong(answer);
-         } else if (type == kShort) {
-            uint16_t value=0;
-			uint32_t value2=0;
-            if (cnt > (isBig_?4:2) && size != kOffset) {
-			   if (isBig_) {
-				  tiff_stream.read((char*)&answer,sizeof(uint64_t));
-                  if (swap_) answer = SwapLong(answer);
-                  tiff_stream.seekg(answer,tiff_stream.beg);
-                  tiff_stream.read((char*)&value,sizeof(uint16_t));
-                  if (swap_) value = SwapShort(value);
-			   } else {
-                  tiff_stream.read((char*)&value2,sizeof(uint32_t));
-                  if (swap_) value2 = SwapWord(value2);
-                  tiff_stream.seekg(value2,tiff_stream.beg);
-                  tiff_stream.read((char*)&value,sizeof(uint16_t));
-                  if (swap_) value = SwapShort(value);
-			   }
-               return static_cast<uint64_t>(value);
-            }
-            tiff_stream.read((char*)&value,sizeof(uint16_t));
-            if (swap_) value = SwapShort(value);
-            answer = static_cast<uint64_t>(value);
-         } else if (type == kRational) {
-            //get the two values in the data to make a float.
-            uint32_t value=0;
-            tiff_stream.read((char*)&value,sizeof(uint32_t));
-            if (swap_) value = SwapWord(value);
-            tiff_stream.seekg(value,tiff_stream.beg);
-            uint32_t num = 0, den = 0;
-            tiff_stream.read((char*)&num,sizeof(uint32_t));
-            if (swap_) num = SwapWord(num);
-            tiff_stream.seekg(value+sizeof(uint32_t),tiff_stream.beg);
-            tiff_stream.read((char*)&den,sizeof(uint32_t));
-            if (swap_) den = SwapWord(den);
-            float rat = static_cast<float>(num) /
-               static_cast<float>(den);
-            memcpy(buf,&rat,min((size_t)size,sizeof(float)));
-            return 0;
-		 } else {
-            std::cerr << "Unhandled TIFF Tag type" << std::endl;
-         }
-         return answer;
+   if (!tiff_stream || num_entries == 0 || num_entries > 0xFFFF) {
+      tiff_stream.clear();
+      return false;
+   }
+   //read all entries and the next page offset at once
+   uint64_t start_off = isBig_?8:2;
+   uint64_t multiplier = isBig_?20:12;
+   uint64_t field_off = isBig_?12:8;
+   vector<char> block((size_t)(multiplier*num_entries + (isBig_?8:4)));
+   tiff_stream.read(&block[0],block.size());
+   if (!tiff_stream) {
+      tiff_stream.clear();
+      return false;
+   }
+   for (uint64_t i = 0; i < num_entries; i++) {
+      const char *entry = &block[0] + multiplier*i;
+      uint16_t tag_id = 0;
+      memcpy(&tag_id,entry,sizeof(uint16_t));
+      if (swap_) tag_id = SwapShort(tag_id);
+      TiffTag tag;
+      memcpy(&tag.type,entry+2,sizeof(uint16_t));
+      if (swap_) tag.type = SwapShort(tag.type);
+      if (isBig_) {
+         memcpy(&tag.count,entry+4,sizeof(uint64_t));
+         if (swap_) tag.count = SwapLong(tag.count);
+      } else {
+         uint32_t tmp = 0;
+         memcpy(&tmp,entry+4,sizeof(uint32_t));
+         if (swap_) tmp = SwapWord(tmp);
+         tag.count = static_cast<uint64_t>(tmp);
+      }
+      memset(tag.field,0,sizeof(tag.field));
+      memcpy(tag.field,entry+field_off,isBig_?8:4);
+      tag.addr = offset+start_off+multiplier*i+field_off;
+      ifd.tags[tag_id] = tag;
+   }
+   const char *next = &block[0] + multiplier*num_entries;
+   if (isBig_) {
+      memcpy(&ifd.next_offset,next,sizeof(uint64_t));
+      if (swap_) ifd.next_offset = SwapLong(ifd.next_offset);
+   } else {
+      uint32_t tmp = 0;
+      memcpy(&tmp,next,sizeof(uint32_t));
+      if (swap_) tmp = SwapWord(tmp);
+      ifd.next_offset = static_cast<uint64_t>(tmp);
+   }
+   //strip offsets and counts are needed for every strip; load them now
+   //tiled pages keep their tile offsets and counts in the same arrays
+   ifd.tiled = ifd.tags.find(static_cast<uint16_t>(kTileOffsetsTag)) != ifd.tags.end();
+   unordered_map<uint16_t, TiffTag>::const_iterator it;
+   it = ifd.tags.find(static_cast<uint16_t>(ifd.tiled?kTileOffsetsTag:kStripOffsetsTag));
+   if (it != ifd.tags.end())
+      ReadTiffTagArray(it->second, ifd.strip_offsets);
+   it = ifd.tags.find(static_cast<uint16_t>(ifd.tiled?kTileBytesCountTag:kStripBytesCountTag));
+   if (it != ifd.tags.end())
+      ReadTiffTagArray(it->second, ifd.strip_counts);
+   return true;
+}
+
+void TIFReader::BuildTiffIndex(TiffIndex &index)
+{
+   index.ifds.clear();
+   index.pages.clear();
+   index.offsets.clear();
+   tiff_stream.seekg(0,tiff_stream.end);
+   index.file_size = static_cast<uint64_t>(tiff_stream.tellg());
+
+   uint64_t offset = current_offset_;
+   while (offset != 0 && offset < index.file_size) {
+      //stop on a loop in the chain
+      if (index.offsets.find(offset) != index.offsets.end())
+         break;
+      TiffIFD ifd;
+      if (!ReadTiffIFD(offset, ifd))
+         break;
+      index.offsets[offset] = index.ifds.size();
+      index.ifds.push_back(ifd);
+      offset = ifd.next_offset;
+   }
+
+   for (size_t i = 0; i < index.ifds.size(); i++) {
+      // count it if it's not a thumbnail
+      unordered_map<uint16_t, TiffTag>::const_iterator it =
+         index.ifds[i].tags.find(static_cast<uint16_t>(kSubFileTypeTag));
+      uint64_t type = 0;
+      if (it != index.ifds[i].tags.end())
+         type = GetTiffTagElement(it->second, 0);
+      if (type != 1)
+         index.pages.push_back(i);
+   }
+}
+
+const TIFReader::TiffIFD* TIFReader::GetCurTiffIFD()
+{
+   if (cur_ifd_ && cur_ifd_->offset == current_offset_)
+      return cur_ifd_;
+   cur_ifd_ = 0;
+   if (!cur_index_)
+      return 0;
+   unordered_map<uint64_t, size_t>::const_iterator it =
+      cur_index_->offsets.find(current_offset_);
+   if (it != cur_index_->offsets.end())
+      cur_ifd_ = &cur_index_->ifds[it->second];
+   return cur_ifd_;
+}
+
+bool TIFReader::GoToTiffPage(uint64_t page)
+{
+   if (!cur_index_ || page >= cur_index_->pages.size())
+      return false;
+   current_offset_ = cur_index_->ifds[cur_index_->pages[(size_t)page]].offset;
+   current_page_ = page;
+   return true;
+}
+
+void TIFReader::TrimTiffIndex()
+{
+   while (m_tiff_index.size() >= TIFF_INDEX_NUM) {
+      map<wstring, TiffIndex>::iterator victim = m_tiff_index.begin();
+      for (map<wstring, TiffIndex>::iterator it = m_tiff_index.begin();
+         it != m_tiff_index.end(); ++it)
+         if (it->second.last_use < victim->second.last_use)
+            victim = it;
+      if (cur_index_ == &victim->second) {
+         cur_index_ = 0;
+         cur_ifd_ = 0;
       }
+      m_tiff_index.erase(victim);
    }
-   return 0;
+}
+
+void TIFReader::ClearTiffIndex()
+{
+   if (tiff_stream.is_open())
+      CloseTiff();
+   m_tiff_index.clear();
+   cur_index_ = 0;
+   cur_ifd_ = 0;
 }
 
 uint16_t TIFReader::SwapShort(uint16_t num) {
@@ -554,19 +743,190 @@ int TIFReader::LoadBatch(int index)
 
 Nrrd* TIFReader::Convert(int t, int c, bool get_max)
 {
-   if (t<0 || t>=m_time_num ||
-         c<0 || c>=m_chan_num)
+   vector<int> chans(1, c);
+   vector<Nrrd*> data;
+   vector<double> max_values, scalar_scales;
+   ConvertChannels(t, chans, get_max, data, max_values, scalar_scales);
+   return data.empty()?0:data[0];
+}
+
+int TIFReader::ConvertChannels(int t, const vector<int> &chans, bool get_max,
+      vector<Nrrd*> &data, vector<double> &max_values, vector<double> &scalar_scales)
+{
+   data.assign(chans.size(), (Nrrd*)0);
+   max_values.assign(chans.size(), m_max_value);
+   scalar_scales.assign(chans.size(), m_scalar_scale);
+   if (t<0 || t>=m_time_num)
+      return 0;
+
+   //channels out of range are left empty
+   vector<int> valid;
+   vector<size_t> valid_index;
+   for (size_t i=0; i<chans.size(); i++)
+      if (chans[i]>=0 && chans[i]<m_chan_num) {
+         valid.push_back(chans[i]);
+         valid_index.push_back(i);
+      }
+   if (valid.empty())
       return 0;
 
-   Nrrd* data = 0;
    TimeDataInfo chan_info = m_4d_seq[t];
    m_data_name = chan_info.slices[0].slice.substr(
          chan_info.slices[0].slice.find_last_of(GETSLASH())+1);
-   data = ReadTiff(chan_info.slices, c, get_max);
+   vector<Nrrd*> valid_data;
+   vector<double> valid_max, valid_scale;
+   int result = ReadTiff(chan_info.slices, valid, get_max,
+         valid_data, valid_max, valid_scale);
+   for (size_t i=0; i<valid_index.size() && i<valid_data.size(); i++) {
+      data[valid_index[i]] = valid_data[i];
+      max_values[valid_index[i]] = valid_max[i];
+      scalar_scales[valid_index[i]] = valid_scale[i];
+   }
    m_cur_time = t;
+   return result;
+}
+
+Nrrd* TIFReader::ConvertRegion(int t, int c, const VoxelBox &box, int level)
+{
+   if (level != 0 || t<0 || t>=m_time_num || c<0 || c>=m_chan_num)
+      return 0;
+
+   vector<SliceInfo> &filelist = m_4d_seq[t].slices;
+   if (filelist.empty())
+      return 0;
+   bool sequence = filelist.size() > 1;
+   TiffPageInfo info;
+   uint64_t page_num = 0;
+   try {
+      OpenTiff(filelist[0].slice);
+      if (!GoToTiffPage(0) || !GetTiffPageInfo(info)) {
+         CloseTiff();
+         return 0;
+      }
+      page_num = sequence ? filelist.size() : GetNumTiffPages();
+   } catch (std::exception &) {
+      CloseTiff();
+      return 0;
+   }
+   if (sequence) CloseTiff();
+
+   VoxelBox region = box;
+   if ((info.bits != 8 && info.bits != 16) ||
+         !ClipRegion(region, (int)info.width, (int)info.height, (int)page_num)) {
+      CloseTiff();
+      return 0;
+   }
+   bool eight_bit = info.bits == 8;
+   Nrrd *data = NewRegion(region, eight_bit?nrrdTypeUChar:nrrdTypeUShort,
+         m_xspc, m_yspc, m_zspc);
+   if (!data) {
+      CloseTiff();
+      return 0;
+   }
+   size_t page_size = (size_t)region.nx()*region.ny()*(eight_bit?1:2);
+
+   for (int z = region.z0; z < region.z1; z++) {
+      char *dst = (char*)data->data + (z-region.z0)*page_size;
+      //missing parts of a page stay empty
+      memset(dst, 0, page_size);
+      TiffPageInfo page_info;
+      try {
+         if (sequence)
+            OpenTiff(filelist[z].slice);
+         if (GoToTiffPage(sequence ? 0 : z) &&
+               GetTiffPageInfo(page_info) &&
+               page_info.bits == info.bits)
+            ReadTiffRegion(page_info, c, region, dst);
+      } catch (std::exception &) {
+      }
+      if (sequence) CloseTiff();
+   }
+   if (!sequence) CloseTiff();
+
    return data;
 }
 
+void TIFReader::ReadTiffRegion(const TiffPageInfo &info, int c, const VoxelBox &region, char *dst)
+{
+   if ((uint64_t)c >= info.samples)
+      return;
+   size_t bytes = info.bits == 8 ? 1 : 2;
+   bool planar = info.planar == 2 && info.samples > 1;
+   uint64_t chan_samples = planar ? 1 : info.samples;
+   //a strip is a tile as wide as the page
+   uint64_t chunk_width = info.tile_width ? info.tile_width : info.width;
+   uint64_t chunk_length = info.tile_width ? info.tile_length : info.rows_per_strip;
+   uint64_t chunks_across = (info.width + chunk_width - 1) / chunk_width;
+   uint64_t chunks_down = (info.height + chunk_length - 1) / chunk_length;
+   uint64_t plane_first = planar ? c * chunks_across * chunks_down : 0;
+   uint64_t chan_offset = planar ? 0 : c;
+   size_t row_bytes = (size_t)(chunk_width*chan_samples*bytes);
+   vector<char> buf((size_t)chunk_length*row_bytes);
+   vector<char> raw;
+
+   uint64_t cx0 = region.x0 / chunk_width;
+   uint64_t cx1 = (region.x1 - 1) / chunk_width;
+   uint64_t cy0 = region.y0 / chunk_length;
+   uint64_t cy1 = (region.y1 - 1) / chunk_length;
+   for (uint64_t cy = cy0; cy <= cy1 && cy < chunks_down; cy++)
+   for (uint64_t cx = cx0; cx <= cx1 && cx < chunks_across; cx++) {
+      size_t chunk = (size_t)(plane_first + cy*chunks_across + cx);
+      if (chunk >= info.strip_offsets.size() || !info.strip_counts[chunk])
+         continue;
+      uint64_t x0 = cx * chunk_width;
+      uint64_t y0 = cy * chunk_length;
+      //strips stop at the last row; tiles are always stored whole
+      uint64_t rows = info.tile_width ? chunk_length : min(chunk_length, info.height - y0);
+      size_t size = (size_t)rows*row_bytes;
+
+      //the lzw decoder may look a few bytes past the end of a strip
+      size_t raw_size = (size_t)info.strip_counts[chunk];
+      raw.assign(raw_size + 8, 0);
+      tiff_stream.seekg(info.strip_offsets[chunk], tiff_stream.beg);
+      tiff_stream.read(&raw[0], raw_size);
+      if (!tiff_stream) {
+         tiff_stream.clear();
+         continue;
+      }
+      if (!DecodeTiffChunk(info.compression, &raw[0], raw_size, &buf[0], size))
+         continue;
+
+      if (info.swap && bytes == 2) {
+         uint16_t *temp = reinterpret_cast<uint16_t*>(&buf[0]);
+         for (size_t sh = 0; sh < size / 2; sh++)
+            temp[sh] = SwapShort(temp[sh]);
+      }
+      if (info.prediction == 2 && info.compression != kNoCompression) {
+         for (size_t j=0; j < rows; j++)
+            if (bytes == 1)
+               DecodeAcc8((tidata_t)&buf[0]+j*row_bytes, row_bytes, chan_samples);
+            else
+               DecodeAcc16((tidata_t)&buf[0]+j*row_bytes, row_bytes, chan_samples);
+      }
+
+      //the part of the chunk inside the region
+      uint64_t px0 = max(x0, (uint64_t)region.x0);
+      uint64_t px1 = min(min(x0 + chunk_width, info.width), (uint64_t)region.x1);
+      uint64_t py0 = max(y0, (uint64_t)region.y0);
+      uint64_t py1 = min(min(y0 + rows, info.height), (uint64_t)region.y1);
+      for (uint64_t y = py0; y < py1; y++) {
+         size_t src_index = (size_t)(((y-y0)*chunk_width + (px0-x0))*chan_samples + chan_offset);
+         size_t dst_index = (size_t)((y-region.y0)*region.nx() + (px0-region.x0));
+         if (bytes == 1) {
+            const uint8_t *src = (const uint8_t*)&buf[0] + src_index;
+            uint8_t *out = (uint8_t*)dst + dst_index;
+            for (uint64_t i = 0; i < px1-px0; i++)
+               out[i] = src[i*chan_samples];
+         } else {
+            const uint16_t *src = (const uint16_t*)&buf[0] + src_index;
+            uint16_t *out = (uint16_t*)dst + dst_index;
+            for (uint64_t i = 0; i < px1-px0; i++)
+               out[i] = src[i*chan_samples];
+         }
+      }
+   }
+}
+
 wstring TIFReader::GetCurName(int t, int c)
 {
    if (t>=0 && t<(int64_t)m_4d_seq.size())
@@ -587,34 +947,17 @@ bool TIFReader::tif_slice_sort(const SliceInfo& info1, const SliceInfo& info2)
 
 uint64_t TIFReader::GetNumTiffPages()
 {
-   uint64_t count = 0;
-   uint64_t save_offset = current_offset_;
-   uint64_t save_page = current_page_;
-   ResetTiff();
-   while (true) {
-      // count it if it's not a thumbnail
-      if (GetTiffField(kSubFileTypeTag,NULL,0) != 1) count++;
-      current_offset_ = GetTiffField(kNextPageOffsetTag,NULL,0);
-      if (current_offset_ == 0) break;
-   }
-   current_offset_ = save_offset;
-   current_page_ = save_page;
-   return count;
+   if (!tiff_stream.is_open())
+      throw std::runtime_error( "TIFF file not open for reading." );
+   return cur_index_ ? static_cast<uint64_t>(cur_index_->pages.size()) : 0;
 }
 
 void TIFReader::GetTiffStrip(uint64_t page, uint64_t strip,
       void * data, uint64_t strip_size)
 {
-   //make sure we are on the correct page,
-   //reset if ahead
-   if (current_page_ > page)
-      ResetTiff();
-   // fast forward if we are behind.
-   while (current_page_ < page) {
-      tiff_stream.seekg(current_offset_,tiff_stream.beg);
-      if (GetTiffField(kSubFileTypeTag,NULL,0) != 1) current_page_ ++;
-      current_offset_ = GetTiffField(kNextPageOffsetTag,NULL,0);
-   }
+   //make sure we are on the correct page
+   if (current_page_ != page)
+      GoToTiffPage(page);
    //get the byte count and the strip offset to read data from.
    uint64_t byte_count = GetTiffStripOffsetOrCount(kStripBytesCountTag,strip);
    tiff_stream.seekg(GetTiffStripOffsetOrCount(
@@ -656,47 +999,18 @@ void TIFReader::GetTiffStrip(uint64_t page, uint64_t strip,
 
 uint64_t TIFReader::GetTiffStripOffsetOrCount(uint64_t tag, uint64_t strip)
 {
-   //search for the offset that tells us the byte count for this strip
-   uint64_t type = GetTiffField(tag,NULL,kType);
-   switch (type) {
-   case kLong8:
-	   type = 8;
-	   break;
-   case kLong: 
-	   type = 4;
-	   break;
-   default:
-	   type = 2;
-	   break;
-   }
-   uint64_t offset = GetTiffField(tag, NULL,kOffset);
-   uint64_t address = GetTiffField(tag, NULL,kValueAddress);
-   uint64_t cnt = GetTiffField(tag, NULL, kCount);
-   // if the values do not fit into the tag data, jump to them
-   if (cnt * type > (isBig_?8:4)) {
-      tiff_stream.seekg(offset+type*strip, tiff_stream.beg);
-   } else {
-	  //otherwise, return the value of interest within the tag
-      tiff_stream.seekg(address+type*strip, tiff_stream.beg);
-   }
-   uint64_t value = 0;
-   uint32_t tmp = 0;
-   uint16_t tmp2 = 0;
-   switch (type) {
-   case kLong8:
-      tiff_stream.read((char*)&value,sizeof(uint64_t));
-      value = (swap_)?SwapLong(value):value;
-	  break;
-   case kLong: 
-      tiff_stream.read((char*)&tmp,sizeof(uint32_t));
-      value = static_cast<uint64_t>((swap_)?SwapWord(tmp):tmp);
-	  break;
-   default:
-      tiff_stream.read((char*)&tmp2,sizeof(uint16_t));
-      value = static_cast<uint64_t>((swap_)?SwapShort(tmp2):tmp2);
-	  break;
-   }
-   return value;
+   const TiffIFD *ifd = GetCurTiffIFD();
+   if (!ifd)
+      return 0;
+   //both arrays were loaded when the IFD was parsed
+   const vector<uint64_t> &values = tag == kStripOffsetsTag ?
+      ifd->strip_offsets : ifd->strip_counts;
+   if (tag != kStripOffsetsTag && tag != kStripBytesCountTag) {
+      unordered_map<uint16_t, TiffTag>::const_iterator it =
+         ifd->tags.find(static_cast<uint16_t>(tag));
+      return it != ifd->tags.end() ? GetTiffTagElement(it->second, strip) : 0;
+   }
+   return strip < values.size() ? values[(size_t)strip] : 0;
 }
 
 void TIFReader::ResetTiff()
@@ -740,14 +1054,42 @@ void TIFReader::OpenTiff(std::wstring name)
    } else {
       throw std::runtime_error( "TIFF file formatted incorrectly. Wrong Type." );
    }
+   //parse the IFDs once per file; reuse them while the file is unchanged
+   tiff_stream.seekg(0,tiff_stream.end);
+   uint64_t file_size = static_cast<uint64_t>(tiff_stream.tellg());
+   time_t mtime = wxFileModificationTime(name);
+   map<wstring, TiffIndex>::iterator it = m_tiff_index.find(name);
+   if (it == m_tiff_index.end() ||
+      it->second.file_size != file_size ||
+      it->second.mtime != mtime) {
+      if (it == m_tiff_index.end())
+         TrimTiffIndex();
+      TiffIndex &index = m_tiff_index[name];
+      BuildTiffIndex(index);
+      index.mtime = mtime;
+      cur_index_ = &index;
+   } else
+      cur_index_ = &it->second;
+   cur_index_->last_use = ++m_tiff_clock;
+   cur_ifd_ = 0;
 }
 
-void TIFReader::CloseTiff() { if (tiff_stream.is_open()) tiff_stream.close(); }
+void TIFReader::CloseTiff()
+{
+   if (tiff_stream.is_open()) tiff_stream.close();
+   cur_index_ = 0;
+   cur_ifd_ = 0;
+}
 
-Nrrd* TIFReader::ReadTiff(std::vector<SliceInfo> &filelist,
-      int c, bool get_max) {
+int TIFReader::ReadTiff(std::vector<SliceInfo> &filelist,
+      const vector<int> &chans, bool get_max, vector<Nrrd*> &data,
+      vector<double> &max_values, vector<double> &scalar_scales) {
+   size_t chan_num = chans.size();
+   data.assign(chan_num, (Nrrd*)0);
+   max_values.assign(chan_num, m_max_value);
+   scalar_scales.assign(chan_num, m_scalar_scale);
    uint64_t numPages = static_cast<uint64_t>(filelist.size());
-   if (numPages <= 0)
+   if (numPages <= 0 || chan_num == 0)
       return 0;
    wstring filename = filelist[0].slice;
    OpenTiff(filename.c_str());
@@ -768,8 +1110,6 @@ Nrrd* TIFReader::ReadTiff(std::vector<SliceInfo> &filelist,
    float x_res = 0.0, y_res = 0.0, z_res = 0.0;
    GetTiffField(kXResolutionTag,&x_res,sizeof(float));
    GetTiffField(kYResolutionTag,&y_res,sizeof(float));
-   uint64_t rowsperstrip = GetTiffField(kRowsPerStripTag,NULL,0);
-   uint64_t strip_size = rowsperstrip * width * samples * (bits/8);
 
    char img_desc[256];
    GetTiffField(kImageDescriptionTag, img_desc, 256);
@@ -804,124 +1144,425 @@ Nrrd* TIFReader::ReadTiff(std::vector<SliceInfo> &filelist,
    }
 
    m_slice_num = numPages;
-   int pagepixels = m_x_size*m_y_size;
+   size_t pagepixels = (size_t)m_x_size*(size_t)m_y_size;
 
    if (sequence) CloseTiff();
 
-   Nrrd *nrrdout = nrrdNew();
-
-   //allocate memory
-   void *val = 0;
+   //allocate memory; one volume per channel
+   vector<void*> vals(chan_num, (void*)0);
    bool eight_bit = bits == 8;
 
    unsigned long long total_size = (unsigned long long)m_x_size*
 	   (unsigned long long)m_y_size*(unsigned long long)numPages;
-   //val = malloc(total_size * (eight_bit?1:2));
-   val = eight_bit?(void*)(new unsigned char[total_size]):
-	   (void*)(new unsigned short[total_size]);
-   if (!val)
-      throw std::runtime_error( "Unable to allocate memory to read TIFF." );
-
-   int max_value = 0;
+   for (size_t ci = 0; ci < chan_num; ci++) {
+      //val = malloc(total_size * (eight_bit?1:2));
+      vals[ci] = eight_bit?(void*)(new (std::nothrow) unsigned char[total_size]):
+         (void*)(new (std::nothrow) unsigned short[total_size]);
+      if (!vals[ci]) {
+         for (size_t cj = 0; cj < ci; cj++)
+            if (eight_bit) delete [](unsigned char*)vals[cj];
+            else delete [](unsigned short*)vals[cj];
+         if (!sequence) CloseTiff();
+         throw std::runtime_error( "Unable to allocate memory to read TIFF." );
+      }
+   }
 
-   void* buf = 0;
-   if (samples > 1)
-      buf = malloc(strip_size);
+   //the calling thread reads the pages and the pool decodes them
+   //a few tasks ahead of the workers at most
+   int thread_num = m_decode_threads;
+   if (thread_num <= 0)
+      thread_num = wxThread::GetCPUCount();
+   FLIVR::ThreadPoolGroup *pool = 0;
+   if (thread_num > 1)
+      pool = new FLIVR::ThreadPoolGroup(FLIVR::ThreadPool::shared());
+   int max_jobs = pool ? min(thread_num, max(pool->get_thread_num(), 1))*2 : 0;
+   m_jobs_in_flight = 0;
+   m_jobs_max.assign(chan_num, 0);
+   size_t bytes = eight_bit?1:2;
 
    for (uint64_t pageindex=0; pageindex < numPages; pageindex++)
    {
+      TiffPageJob *job = new TiffPageJob;
+      job->page = pageindex;
+      job->refs = 0;
+      bool read = false;
       if (sequence) {
-         filename = filelist[pageindex].slice;
-         OpenTiff(filename);
+         try {
+            OpenTiff(filelist[pageindex].slice);
+            read = GoToTiffPage(0) && ReadTiffPage(*job, chans);
+         } catch (std::exception &) {
+            read = false;
+         }
+         CloseTiff();
+      } else
+         read = GoToTiffPage(pageindex) && ReadTiffPage(*job, chans);
+
+      //missing parts of a slice stay empty
+      const TiffPageInfo &info = job->info;
+      if (!read || info.bits != bits)
+         job->chans.clear();
+      vector<bool> found(chan_num, false);
+      for (size_t i = 0; i < job->chans.size(); i++)
+         found[job->chans[i]] = true;
+      bool partial = info.width < (uint64_t)m_x_size || info.height < (uint64_t)m_y_size;
+      for (size_t ci = 0; ci < chan_num; ci++)
+         if (!found[ci] || partial)
+            memset((char*)vals[ci] + pageindex*pagepixels*bytes, 0, pagepixels*bytes);
+      if (job->chans.empty()) {
+         delete job;
+         continue;
       }
-      //this is a thumbnail, skip
-      if (GetTiffField(kSubFileTypeTag,NULL,0) == 1) {
-         if (sequence) CloseTiff();
+
+      size_t chunks = job->raw_pos.size();
+      if (!pool) {
+         DecodeTiffPage(*job, chans, vals, eight_bit, get_max, m_jobs_max, 0, chunks);
+         delete job;
          continue;
       }
 
-      uint64_t num_strips = GetTiffField(kStripOffsetsTag, NULL,kCount);
+      //a row of tiles per task; strips are split when there are
+      //fewer pages than workers
+      size_t group = chunks;
+      if (info.tile_width)
+         group = (size_t)((info.width + info.tile_width - 1) / info.tile_width);
+      else if (numPages < (uint64_t)thread_num)
+         group = (chunks + thread_num - 1) / thread_num;
+      else if (job->plane_chunks)
+         group = (size_t)job->plane_chunks;
+      group = max(group, (size_t)1);
+
+      m_job_lock.Lock();
+      job->refs = (int)((chunks + group - 1) / group);
+      m_job_lock.Unlock();
+      for (size_t first = 0; first < chunks; first += group) {
+         m_job_lock.Lock();
+         while (m_jobs_in_flight >= max_jobs)
+            m_job_cond.Wait();
+         m_jobs_in_flight++;
+         m_job_lock.Unlock();
+         pool->submit(new TiffDecodeTask(this, job, chans, vals,
+               eight_bit, get_max, first, min(first+group, chunks)));
+      }
+   }
 
-      //read file
-      for (uint64_t strip=0; strip<num_strips; strip++)
-      {
-         long long valindex;
-         int indexinpage;
-         if (samples > 1) {
-            GetTiffStrip(sequence?0:pageindex, strip, buf,strip_size);
-            int num_pixels = strip_size/samples/(eight_bit?1:2);
-            indexinpage = strip*num_pixels;
-            valindex = pageindex*pagepixels + indexinpage;
-            for (int i=0; i<num_pixels; i++) {
-               if (indexinpage++ >= pagepixels) break;
-               if (eight_bit)
-                  memcpy((uint8_t*)val+valindex,
-                        (uint8_t*)buf+samples*i+c,sizeof(uint8_t));
-               else
-                  memcpy((uint16_t*)val+valindex,
-                        (uint16_t*)buf+samples*i+c,sizeof(uint16_t));
-               if (!eight_bit && get_max &&
-                     *((uint16_t*)val+valindex) > max_value)
-                  max_value = *((uint16_t*)val+valindex);
-               valindex++;
-            }
-         } else {
-            valindex = pageindex*pagepixels +
-               strip*strip_size/(eight_bit?1:2);
-			uint64_t strip_size_used = strip_size;
-			if (valindex+strip_size >= total_size)
-				strip_size_used = total_size-valindex;
-			if (strip_size_used > 0)
-			{
-				if (eight_bit)
-				   GetTiffStrip(sequence?0:pageindex, strip,
-						 (uint8_t*)val+valindex,strip_size_used);
-				else
-				   GetTiffStrip(sequence?0:pageindex, strip,
-						 (uint16_t*)val+valindex,strip_size_used);
-			}
+   if (pool) {
+      pool->wait();
+      delete pool;
+   }
+   if (!sequence) CloseTiff();
+
+   for (size_t ci = 0; ci < chan_num; ci++) {
+      //write to nrrd
+      Nrrd *nrrdout = nrrdNew();
+      if (eight_bit)
+         nrrdWrap(nrrdout, (uint8_t*)vals[ci], nrrdTypeUChar,
+               3, (size_t)m_x_size, (size_t)m_y_size, (size_t)numPages);
+      else
+         nrrdWrap(nrrdout, (uint16_t*)vals[ci], nrrdTypeUShort,
+               3, (size_t)m_x_size, (size_t)m_y_size, (size_t)numPages);
+      nrrdAxisInfoSet(nrrdout, nrrdAxisInfoSpacing, m_xspc, m_yspc, m_zspc);
+      nrrdAxisInfoSet(nrrdout, nrrdAxisInfoMax, m_xspc*m_x_size,
+            m_yspc*m_y_size, m_zspc*numPages);
+      nrrdAxisInfoSet(nrrdout, nrrdAxisInfoMin, 0.0, 0.0, 0.0);
+      nrrdAxisInfoSet(nrrdout, nrrdAxisInfoSize, (size_t)m_x_size,
+            (size_t)m_y_size, (size_t)numPages);
+      data[ci] = nrrdout;
+
+      int max_value = m_jobs_max[ci];
+      if (!eight_bit) {
+         //the max values were collected while decoding
+         if (get_max) {
+            if (samples > 1)
+               m_max_value = max_value;
+            else
+               m_max_value = max(m_max_value, (double)max_value);
          }
+         if (m_max_value > 0.0) m_scalar_scale = 65535.0 / m_max_value;
+         else m_scalar_scale = 1.0;
+      } else m_max_value = 255.0;
+      max_values[ci] = m_max_value;
+      scalar_scales[ci] = m_scalar_scale;
+   }
+
+   SetInfo();
+
+   return (int)chan_num;
+}
+
+bool TIFReader::GetTiffPageInfo(TiffPageInfo &info)
+{
+   const TiffIFD *ifd = GetCurTiffIFD();
+   if (!ifd)
+      return false;
+   info.width = GetTiffField(kImageWidthTag,NULL,0);
+   info.height = GetTiffField(kImageLengthTag,NULL,0);
+   info.bits = GetTiffField(kBitsPerSampleTag,NULL,0);
+   info.samples = GetTiffField(kSamplesPerPixelTag,NULL,0);
+   if (info.samples == 0) info.samples = 1;
+   info.compression = GetTiffField(kCompressionTag,NULL,0);
+   if (info.compression == 0) info.compression = 1;
+   info.prediction = GetTiffField(kPredictionTag,NULL,0);
+   info.planar = GetTiffField(kPlanarConfigurationTag,NULL,0);
+   info.rows_per_strip = GetTiffField(kRowsPerStripTag,NULL,0);
+   if (info.rows_per_strip == 0 || info.rows_per_strip > info.height)
+      info.rows_per_strip = info.height;
+   info.swap = swap_;
+   info.tile_width = 0;
+   info.tile_length = 0;
+   if (ifd->tiled) {
+      info.tile_width = GetTiffField(kTileWidthTag,NULL,0);
+      info.tile_length = GetTiffField(kTileLengthTag,NULL,0);
+      if (info.tile_width == 0 || info.tile_length == 0)
+         return false;
+   }
+   info.strip_offsets = ifd->strip_offsets;
+   info.strip_counts = ifd->strip_counts;
+   return info.width > 0 && info.height > 0 &&
+      !info.strip_offsets.empty() &&
+      info.strip_offsets.size() == info.strip_counts.size();
+}
+
+bool TIFReader::ReadTiffPage(TiffPageJob &job, const vector<int> &chans)
+{
+   job.chans.clear();
+   job.plane_chunks = 0;
+   if (!GetTiffPageInfo(job.info))
+      return false;
+   TiffPageInfo &info = job.info;
+
+   //planar data keeps the strips of each channel together
+   uint64_t strips_per_plane = (info.height + info.rows_per_strip - 1) / info.rows_per_strip;
+   if (info.tile_width)
+      strips_per_plane = ((info.width + info.tile_width - 1) / info.tile_width) *
+         ((info.height + info.tile_length - 1) / info.tile_length);
+   bool planar = info.planar == 2 && info.samples > 1;
+   uint64_t strip_num = info.strip_offsets.size();
+
+   //the strips to read, as (first, num) runs; one run per channel
+   //for planar data and the whole page when interleaved
+   vector<uint64_t> run_first, run_num;
+   for (size_t ci = 0; ci < chans.size(); ci++) {
+      if (chans[ci] < 0 || (uint64_t)chans[ci] >= info.samples)
+         continue;
+      if (planar) {
+         uint64_t first = chans[ci] * strips_per_plane;
+         if (first >= strip_num)
+            continue;
+         run_first.push_back(first);
+         run_num.push_back(min(strips_per_plane, strip_num - first));
+      } else if (run_first.empty()) {
+         run_first.push_back(0);
+         run_num.push_back(strip_num);
+      }
+      job.chans.push_back((int)ci);
+   }
+   if (job.chans.empty())
+      return false;
+   if (planar)
+      job.plane_chunks = strips_per_plane;
+
+   job.raw_pos.clear();
+   job.raw_size.clear();
+   vector<uint64_t> offsets;
+   uint64_t total = 0;
+   for (size_t r = 0; r < run_first.size(); r++) {
+      for (uint64_t i = 0; i < run_num[r]; i++) {
+         size_t strip = (size_t)(run_first[r] + i);
+         job.raw_pos.push_back(total);
+         job.raw_size.push_back(info.strip_counts[strip]);
+         offsets.push_back(info.strip_offsets[strip]);
+         total += info.strip_counts[strip];
+      }
+      //a short last plane still takes a full plane of chunks
+      for (uint64_t i = run_num[r]; planar && i < strips_per_plane; i++) {
+         job.raw_pos.push_back(total);
+         job.raw_size.push_back(0);
+         offsets.push_back(0);
       }
-      if (sequence) CloseTiff();
    }
+   bool contiguous = true;
+   for (size_t i = 1; i < offsets.size() && contiguous; i++)
+      if (offsets[i] != offsets[i-1] + job.raw_size[i-1])
+         contiguous = false;
+   //the lzw decoder may look a few bytes past the end of a strip
+   job.raw.assign((size_t)total + 8, 0);
+   if (total == 0)
+      return true;
 
-   if (samples > 1 && buf)
-      free(buf);
-   if (!sequence) CloseTiff();
+   //strips are usually stored back to back; read those at once
+   if (contiguous) {
+      tiff_stream.seekg(offsets[0],tiff_stream.beg);
+      tiff_stream.read(&job.raw[0],total);
+   } else {
+      for (size_t i = 0; i < offsets.size(); i++) {
+         if (!job.raw_size[i])
+            continue;
+         tiff_stream.seekg(offsets[i],tiff_stream.beg);
+         tiff_stream.read(&job.raw[(size_t)job.raw_pos[i]],job.raw_size[i]);
+      }
+   }
+   if (!tiff_stream)
+      tiff_stream.clear();
+   return true;
+}
 
-   //write to nrrd
-   if (eight_bit)
-      nrrdWrap(nrrdout, (uint8_t*)val, nrrdTypeUChar,
-            3, (size_t)m_x_size, (size_t)m_y_size, (size_t)numPages);
-   else
-      nrrdWrap(nrrdout, (uint16_t*)val, nrrdTypeUShort,
-            3, (size_t)m_x_size, (size_t)m_y_size, (size_t)numPages);
-   nrrdAxisInfoSet(nrrdout, nrrdAxisInfoSpacing, m_xspc, m_yspc, m_zspc);
-   nrrdAxisInfoSet(nrrdout, nrrdAxisInfoMax, m_xspc*m_x_size,
-         m_yspc*m_y_size, m_zspc*numPages);
-   nrrdAxisInfoSet(nrrdout, nrrdAxisInfoMin, 0.0, 0.0, 0.0);
-   nrrdAxisInfoSet(nrrdout, nrrdAxisInfoSize, (size_t)m_x_size,
-         (size_t)m_y_size, (size_t)numPages);
-
-   if (!eight_bit) {
-      if (get_max) {
-         if (samples > 1)
-            m_max_value = max_value;
-         else {
-            double value;
-            for (size_t i=0; i<(size_t)m_slice_num*(size_t)m_x_size*(size_t)m_y_size; i++) {
-               value= ((unsigned short*)nrrdout->data)[i];
-               m_max_value = value>m_max_value ? value : m_max_value;
+void TIFReader::DecodeTiffPage(TiffPageJob &job, const vector<int> &chans,
+      const vector<void*> &vals, bool eight_bit, bool get_max,
+      vector<int> &max_values, size_t first, size_t last)
+{
+   const TiffPageInfo &info = job.info;
+   size_t bytes = eight_bit?1:2;
+   size_t pagepixels = (size_t)m_x_size*(size_t)m_y_size;
+   size_t page_pos = (size_t)job.page*pagepixels*bytes;
+
+   bool planar = job.plane_chunks > 0;
+   uint64_t chan_samples = planar ? 1 : info.samples;
+   //a strip is a tile as wide as the page
+   uint64_t chunk_width = info.tile_width ? info.tile_width : info.width;
+   uint64_t chunk_length = info.tile_width ? info.tile_length : info.rows_per_strip;
+   uint64_t chunks_across = (info.width + chunk_width - 1) / chunk_width;
+   size_t row_bytes = (size_t)(chunk_width*chan_samples*bytes);
+   vector<char> buf((size_t)chunk_length*row_bytes);
+
+   for (size_t chunk = first; chunk < last && chunk < job.raw_pos.size(); chunk++) {
+      //planar chunks are grouped by channel
+      size_t plane = planar ? (size_t)(chunk / job.plane_chunks) : 0;
+      uint64_t spatial = planar ? chunk % job.plane_chunks : chunk;
+      uint64_t x0 = (spatial % chunks_across) * chunk_width;
+      uint64_t y0 = (spatial / chunks_across) * chunk_length;
+      if (y0 >= info.height) {
+         if (planar)
+            continue;
+         break;
+      }
+      //strips stop at the last row; tiles are always stored whole
+      uint64_t rows = info.tile_width ? chunk_length : min(chunk_length, info.height - y0);
+      size_t size = (size_t)rows*row_bytes;
+      char *raw = &job.raw[(size_t)job.raw_pos[chunk]];
+      size_t raw_size = (size_t)job.raw_size[chunk];
+
+      if (!raw_size ||
+            !DecodeTiffChunk(info.compression, raw, raw_size, &buf[0], size))
+         memset(&buf[0], 0, size);
+
+      if (info.swap && !eight_bit) {
+         uint16_t *temp = reinterpret_cast<uint16_t*>(&buf[0]);
+         for (size_t sh = 0; sh < size / 2; sh++)
+            temp[sh] = SwapShort(temp[sh]);
+      }
+      if (info.prediction == 2 && info.compression != kNoCompression) {
+         for (size_t j=0; j < rows; j++)
+            if (eight_bit)
+               DecodeAcc8((tidata_t)&buf[0]+j*row_bytes, row_bytes, chan_samples);
+            else
+               DecodeAcc16((tidata_t)&buf[0]+j*row_bytes, row_bytes, chan_samples);
+      }
+
+      //copy each channel into its slice and find its max in the same pass
+      uint64_t copy_width = min(min(chunk_width, info.width - x0),
+            x0 < (uint64_t)m_x_size ? (uint64_t)m_x_size - x0 : 0);
+      uint64_t copy_rows = min(min(rows, info.height - y0),
+            y0 < (uint64_t)m_y_size ? (uint64_t)m_y_size - y0 : 0);
+      size_t copies = planar ? 1 : job.chans.size();
+      for (size_t k = 0; k < copies; k++) {
+         size_t ci = (size_t)job.chans[planar ? plane : k];
+         uint64_t chan_offset = planar ? 0 : chans[ci];
+         char *dst = (char*)vals[ci] + page_pos;
+         int max_value = max_values[ci];
+         for (uint64_t j = 0; j < copy_rows; j++) {
+            size_t dst_index = (size_t)((y0+j)*m_x_size + x0);
+            if (eight_bit) {
+               const uint8_t *src = (const uint8_t*)&buf[0] + j*chunk_width*chan_samples + chan_offset;
+               uint8_t *out = (uint8_t*)dst + dst_index;
+               for (uint64_t i = 0; i < copy_width; i++)
+                  out[i] = src[i*chan_samples];
+            } else {
+               const uint16_t *src = (const uint16_t*)&buf[0] + j*chunk_width*chan_samples + chan_offset;
+               uint16_t *out = (uint16_t*)dst + dst_index;
+               for (uint64_t i = 0; i < copy_width; i++) {
+                  out[i] = src[i*chan_samples];
+                  if (get_max && out[i] > max_value)
+                     max_value = out[i];
+               }
             }
          }
+         max_values[ci] = max_value;
       }
-      if (m_max_value > 0.0) m_scalar_scale = 65535.0 / m_max_value;
-	  else m_scalar_scale = 1.0;
-   } else m_max_value = 255.0;
+   }
+}
 
-   SetInfo();
+bool TIFReader::DecodeTiffChunk(uint64_t compression, char *raw, size_t raw_size,
+      char *out, size_t out_size)
+{
+   switch (compression)
+   {
+   case kNoCompression:
+      memcpy(out, raw, min(raw_size, out_size));
+      if (raw_size < out_size)
+         memset(out+raw_size, 0, out_size-raw_size);
+      return true;
+   case kLZWCompression:
+      LZWDecode((tidata_t)raw, (tidata_t)out, out_size);
+      return true;
+   case kDeflateCompression:
+   case kZipCompression:
+      {
+         z_stream zs;
+         memset(&zs, 0, sizeof(z_stream));
+         if (inflateInit(&zs) != Z_OK)
+            return false;
+         zs.next_in = (Bytef*)raw;
+         zs.avail_in = (uInt)raw_size;
+         zs.next_out = (Bytef*)out;
+         zs.avail_out = (uInt)out_size;
+         inflate(&zs, Z_FINISH);
+         //a truncated or damaged stream still fills the rows it has
+         size_t len = (size_t)zs.total_out;
+         inflateEnd(&zs);
+         if (len < out_size)
+            memset(out+len, 0, out_size-len);
+      }
+      return true;
+   case kPackBitsCompression:
+      PackBitsDecode(raw, raw_size, out, out_size);
+      return true;
+   }
+   return false;
+}
+
+void TIFReader::PackBitsDecode(const char *raw, size_t raw_size, char *out, size_t out_size)
+{
+   size_t i = 0, o = 0;
+   while (i < raw_size && o < out_size) {
+      int n = (signed char)raw[i++];
+      if (n >= 0) {
+         //copy the next n+1 bytes literally
+         size_t len = min(min((size_t)n+1, raw_size-i), out_size-o);
+         memcpy(out+o, raw+i, len);
+         i += n+1;
+         o += len;
+      } else if (n != -128) {
+         //repeat the next byte 1-n times
+         if (i >= raw_size)
+            break;
+         size_t len = min((size_t)(1-n), out_size-o);
+         memset(out+o, raw[i++], len);
+         o += len;
+      }
+   }
+   if (o < out_size)
+      memset(out+o, 0, out_size-o);
+}
 
-   return nrrdout;
+void TIFReader::FinishTiffJob(TiffPageJob *job, const vector<int> &max_values)
+{
+   wxMutexLocker lock(m_job_lock);
+   for (size_t i = 0; i < max_values.size() && i < m_jobs_max.size(); i++)
+      m_jobs_max[i] = max(m_jobs_max[i], max_values[i]);
+   m_jobs_in_flight--;
+   m_job_cond.Signal();
+   if (--job->refs == 0)
+      delete job;
 }
 
 void TIFReader::SetInfo()
@@ -36,6 +36,9 @@ DEALINGS IN THE SOFTWARE.
 #include <stdexcept>
 #include <algorithm>
 #include <stdint.h>
+#include <map>
+#include <unordered_map>
+#include <wx/thread.h>
 
 using namespace std;
 
@@ -130,14 +133,31 @@ public:
 	 * @return The count or strip offset determined by @strip.
 	 */
 	uint64_t GetTiffStripOffsetOrCount(uint64_t tag, uint64_t strip);
+	/**
+	 * Drops the parsed IFD tables of all files read so far.
+	 */
+	void ClearTiffIndex();
+	/**
+	 * Sets the number of threads decoding pages in Convert.
+	 * @param num 1 reads and decodes every page on the calling thread,
+	 *        in page order; otherwise the pages are decoded by the shared
+	 *        pool, at most num (<= 0: one per cpu core) at a time.
+	 */
+	void SetDecodeThreads(int num) { m_decode_threads = num; }
+	int GetDecodeThreads() { return m_decode_threads; }
 	void SetBatch(bool batch);
 	int LoadBatch(int index);
 	Nrrd* Convert(int t, int c, bool get_max);
+	int ConvertChannels(int t, const vector<int> &chans, bool get_max,
+		vector<Nrrd*> &data, vector<double> &max_values, vector<double> &scalar_scales);
+	//read only the pages of box and the strips or tiles of those pages in box
+	Nrrd* ConvertRegion(int t, int c, const VoxelBox &box, int level=0);
 	wstring GetCurName(int t, int c);
 
 	wstring GetPathName() {return m_path_name;}
 	wstring GetDataName() {return m_data_name;}
 	int GetCurTime() {return m_cur_time;}
+	void SetCurTime(int t) {m_cur_time = t;}
 	int GetTimeNum() {return m_time_num;}
 	int GetChanNum() {return m_chan_num;}
 	double GetExcitationWavelength(int chan) {return 0.0;}
@@ -225,8 +245,26 @@ private:
 	static const uint64_t kXResolutionTag = 282;
 	/** The tiff tag for y resolution */
 	static const uint64_t kYResolutionTag = 283;
+	/** The tiff tag for tile width */
+	static const uint64_t kTileWidthTag = 322;
+	/** The tiff tag for tile length */
+	static const uint64_t kTileLengthTag = 323;
+	/** The tiff tag for tile offsets */
+	static const uint64_t kTileOffsetsTag = 324;
+	/** The tiff tag for tile bytes count */
+	static const uint64_t kTileBytesCountTag = 325;
 	/** The tiff tag number of entries on current page */
 	static const uint64_t kNextPageOffsetTag = 500;
+	/** No compression */
+	static const uint16_t kNoCompression = 1;
+	/** LZW compression */
+	static const uint16_t kLZWCompression = 5;
+	/** Deflate compression (Adobe) */
+	static const uint16_t kDeflateCompression = 8;
+	/** Deflate compression (old code) */
+	static const uint16_t kZipCompression = 32946;
+	/** PackBits compression */
+	static const uint16_t kPackBitsCompression = 32773;
 	/** The BYTE type */
 	static const uint8_t kByte = 1;
 	/** The ASCII type */
@@ -256,14 +294,130 @@ private:
 	/** This is a Big TIF */
 	static const uint8_t kBigTiff = 43;
 
+	/** One IFD entry as it is stored in the file */
+	struct TiffTag
+	{
+		uint16_t type;
+		uint64_t count;
+		/** The value/offset field (4 or 8 bytes), in file byte order */
+		char field[8];
+		/** The file position of the value/offset field */
+		uint64_t addr;
+	};
+	/** One parsed IFD block/page */
+	struct TiffIFD
+	{
+		uint64_t offset;
+		uint64_t next_offset;
+		unordered_map<uint16_t, TiffTag> tags;
+		/** Strip (or tile) offsets and byte counts, loaded with one read each */
+		vector<uint64_t> strip_offsets;
+		vector<uint64_t> strip_counts;
+		bool tiled;
+	};
+	/** All IFDs of one file, parsed once and kept across Convert calls */
+	struct TiffIndex
+	{
+		uint64_t file_size;
+		time_t mtime;
+		/** For dropping the least recently opened files */
+		unsigned long long last_use;
+		vector<TiffIFD> ifds;
+		/** The IFDs that are not thumbnails, in page order */
+		vector<size_t> pages;
+		/** IFD offset -> position in ifds */
+		unordered_map<uint64_t, size_t> offsets;
+	};
+	/** Bounded to TIFF_INDEX_NUM files, e.g. the slices of a sequence */
+	map<wstring, TiffIndex> m_tiff_index;
+	unsigned long long m_tiff_clock;
+	/** The index of the open file */
+	TiffIndex *cur_index_;
+	/** The IFD at current_offset_ */
+	const TiffIFD *cur_ifd_;
+
+	/** What is needed to decode one page without the stream */
+	struct TiffPageInfo
+	{
+		uint64_t width;
+		uint64_t height;
+		uint64_t rows_per_strip;
+		uint64_t bits;
+		uint64_t samples;
+		uint64_t compression;
+		uint64_t prediction;
+		uint64_t planar;
+		bool swap;
+		/** Tiles instead of strips when tile_width > 0 */
+		uint64_t tile_width;
+		uint64_t tile_length;
+		vector<uint64_t> strip_offsets;
+		vector<uint64_t> strip_counts;
+	};
+	/** One page read from the file and waiting to be decoded */
+	struct TiffPageJob
+	{
+		TiffPageInfo info;
+		uint64_t page;
+		/** Indices into the requested channel list found in the page */
+		vector<int> chans;
+		/** Strips or tiles per channel of planar data; 0 when interleaved */
+		uint64_t plane_chunks;
+		/** The strips or tiles used by the channels, packed */
+		vector<char> raw;
+		vector<uint64_t> raw_pos;
+		vector<uint64_t> raw_size;
+		/** Decode tasks still using the job */
+		int refs;
+	};
+	friend class TiffDecodeTask;
+
+	int m_decode_threads;
+	/** Bounds the pages read ahead of the decode workers */
+	wxMutex m_job_lock;
+	wxCondition m_job_cond;
+	int m_jobs_in_flight;
+	vector<int> m_jobs_max;
+
 private:
 	bool IsNewBatchFile(wstring name);
 	bool IsBatchFileIdentical(wstring name1, wstring name2);
 
+	//walk the IFD chain of the open file into index
+	void BuildTiffIndex(TiffIndex &index);
+	/** Drops the least recently opened indices to make room for one more */
+	void TrimTiffIndex();
+	bool ReadTiffIFD(uint64_t offset, TiffIFD &ifd);
+	void ReadTiffTagArray(const TiffTag &tag, vector<uint64_t> &values);
+	const TiffIFD* GetCurTiffIFD();
+	//make a page (thumbnails not counted) of the open file current
+	bool GoToTiffPage(uint64_t page);
+	//the value/offset field read as an offset
+	uint64_t GetTiffTagOffset(const TiffTag &tag);
+	//one element of a SHORT, LONG or LONG8 tag
+	uint64_t GetTiffTagElement(const TiffTag &tag, uint64_t index);
+
 	static bool tif_sort(const TimeDataInfo& info1, const TimeDataInfo& info2);
 	static bool tif_slice_sort(const SliceInfo& info1, const SliceInfo& info2);
-	//read tiff
-	Nrrd* ReadTiff(vector<SliceInfo> &filelist, int c, bool get_max);
+	//read tiff; all channels in chans are decoded from the same pages
+	int ReadTiff(vector<SliceInfo> &filelist, const vector<int> &chans, bool get_max,
+		vector<Nrrd*> &data, vector<double> &max_values, vector<double> &scalar_scales);
+	//page parameters of the current IFD
+	bool GetTiffPageInfo(TiffPageInfo &info);
+	//read the strips of the channels in chans of the current page into job
+	bool ReadTiffPage(TiffPageJob &job, const vector<int> &chans);
+	//decode strips/tiles [first, last) of a page into the slices of vals,
+	//one buffer per entry of chans; raises the max values found
+	void DecodeTiffPage(TiffPageJob &job, const vector<int> &chans, const vector<void*> &vals,
+		bool eight_bit, bool get_max, vector<int> &max_values, size_t first, size_t last);
+	//decompress one strip or tile; false if the compression is not supported
+	bool DecodeTiffChunk(uint64_t compression, char *raw, size_t raw_size,
+		char *out, size_t out_size);
+	static void PackBitsDecode(const char *raw, size_t raw_size, char *out, size_t out_size);
+	void FinishTiffJob(TiffPageJob *job, const vector<int> &max_values);
+	//decode the strips or tiles of the current page that intersect region
+	//and copy channel c of the page inside region into dst
+	void ReadTiffRegion(const TiffPageInfo &info, int c, const VoxelBox &region, char *dst);
 };
 
 #endif//_TIF_READER_H_
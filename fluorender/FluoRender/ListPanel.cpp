@@ -435,7 +435,8 @@ void DataListCtrl::OnSave(wxCommandEvent& event)
                m_frame, "Save Volume Data", "", "",
                "Muti-page Tiff file (*.tif, *.tiff)|*.tif;*.tiff|"\
                "Single-page Tiff sequence (*.tif)|*.tif;*.tiff|"\
-               "Nrrd file (*.nrrd)|*.nrrd",
+               "Nrrd file (*.nrrd)|*.nrrd|"\
+               "VVD pyramid (*.vvd)|*.vvd",
                wxFD_SAVE|wxFD_OVERWRITE_PROMPT);
          fopendlg->SetExtraControlCreator(CreateExtraControl);
 
@@ -529,7 +530,8 @@ void DataListCtrl::OnBake(wxCommandEvent& event)
             m_frame, "Bake Volume Data", "", "",
             "Muti-page Tiff file (*.tif, *.tiff)|*.tif;*.tiff|"\
             "Single-page Tiff sequence (*.tif)|*.tif;*.tiff|"\
-            "Nrrd file (*.nrrd)|*.nrrd",
+            "Nrrd file (*.nrrd)|*.nrrd|"\
+            "VVD pyramid (*.vvd)|*.vvd",
             wxFD_SAVE|wxFD_OVERWRITE_PROMPT);
       fopendlg->SetExtraControlCreator(CreateExtraControl);
 
@@ -36,7 +36,17 @@ DEALINGS IN THE SOFTWARE.
 #include <wx/wfstream.h>
 #include <wx/txtstrm.h>
 #include "VRenderFrame.h"
+#include "Formats/brkxml_reader.h"
+#include "Formats/tif_reader.h"
+#include "Formats/lsm_reader.h"
+#include "Formats/oib_reader.h"
+#include "Formats/nrrd_reader.h"
+#include "FLIVR/AsyncBrickReader.h"
+#include "FLIVR/BrickCodecBenchmark.h"
+#include "FLIVR/TexturePool.h"
+#include "FLIVR/BrickOrder.h"
 #include "compatibility.h"
+#include <boost/chrono.hpp>
 // -- application --
 
 bool m_open_by_web_browser = false;
@@ -45,6 +55,22 @@ IMPLEMENT_APP(VRenderApp)
 
 static const wxCmdLineEntryDesc g_cmdLineDesc [] =
 {
+   { wxCMD_LINE_OPTION, NULL, "bench-io", "read every brick of a .vvd file, report GB/s and exit",
+      wxCMD_LINE_VAL_STRING, wxCMD_LINE_PARAM_OPTIONAL },
+   { wxCMD_LINE_OPTION, NULL, "io-depth", "reads kept in flight by --bench-io (default 32)",
+      wxCMD_LINE_VAL_NUMBER, wxCMD_LINE_PARAM_OPTIONAL },
+   { wxCMD_LINE_OPTION, NULL, "bench-log", "write the report of a --bench-* run to this file instead of the console",
+      wxCMD_LINE_VAL_STRING, wxCMD_LINE_PARAM_OPTIONAL },
+   { wxCMD_LINE_SWITCH, NULL, "bench-decomp", "time brick decompression on synthetic bricks and exit",
+      wxCMD_LINE_VAL_NONE, wxCMD_LINE_PARAM_OPTIONAL },
+   { wxCMD_LINE_SWITCH, NULL, "bench-read", "decode every frame of the given tif/lsm/oib/nrrd files, report MB/s and exit",
+      wxCMD_LINE_VAL_NONE, wxCMD_LINE_PARAM_OPTIONAL },
+   { wxCMD_LINE_OPTION, NULL, "decode-threads", "threads decoding pages in --bench-read, 1 decodes in order on one thread (default 0, all cores)",
+      wxCMD_LINE_VAL_NUMBER, wxCMD_LINE_PARAM_OPTIONAL },
+   { wxCMD_LINE_SWITCH, NULL, "bench-texpool", "time texture pool lookups against pool size and exit",
+      wxCMD_LINE_VAL_NONE, wxCMD_LINE_PARAM_OPTIONAL },
+   { wxCMD_LINE_SWITCH, NULL, "bench-order", "time view ordering of bricks against a full sort and exit",
+      wxCMD_LINE_VAL_NONE, wxCMD_LINE_PARAM_OPTIONAL },
    { wxCMD_LINE_PARAM, NULL, NULL, NULL,
       wxCMD_LINE_VAL_STRING, wxCMD_LINE_PARAM_OPTIONAL|wxCMD_LINE_PARAM_MULTIPLE },
    { wxCMD_LINE_NONE }
@@ -60,6 +86,11 @@ bool VRenderApp::OnInit()
    // call default behaviour (mandatory)
    if (!wxApp::OnInit())
       return false;
+   if (m_bench_mode != BENCH_NONE)
+   {
+      RunBenchmark();
+      return false;
+   }
    //add png handler
    wxImage::AddHandler(new wxPNGHandler);
    //the frame
@@ -154,6 +185,7 @@ bool VRenderApp::OnInit()
 int VRenderApp::OnExit()
 {
 	if (m_server) delete m_server;
+	FLIVR::ThreadPool::release_shared();
 
 	return 0;
 }
@@ -167,6 +199,31 @@ bool VRenderApp::OnCmdLineParsed(wxCmdLineParser& parser)
 {
    int i=0;
    wxString params;
+
+   //benchmark mode: no window, no IPC
+   long depth;
+   if (parser.Found("io-depth", &depth))
+      m_bench_depth = (int)depth;
+   long decode_threads;
+   if (parser.Found("decode-threads", &decode_threads))
+      m_bench_decode_threads = (int)decode_threads;
+   parser.Found("bench-log", &m_bench_log);
+   if (parser.Found("bench-io", &m_bench_file))
+      m_bench_mode = BENCH_IO;
+   else if (parser.Found("bench-decomp"))
+      m_bench_mode = BENCH_DECOMP;
+   else if (parser.Found("bench-texpool"))
+      m_bench_mode = BENCH_TEXPOOL;
+   else if (parser.Found("bench-order"))
+      m_bench_mode = BENCH_ORDER;
+   else if (parser.Found("bench-read"))
+   {
+      m_bench_mode = BENCH_READ;
+      for (i = 0; i < (int)parser.GetParamCount(); i++)
+         m_files.Add(parser.GetParam(i));
+   }
+   if (m_bench_mode != BENCH_NONE)
+      return true;
    for (i = 0; i < (int)parser.GetParamCount(); i++)
    {
       wxString file = parser.GetParam(i);
@@ -226,6 +283,219 @@ bool VRenderApp::OnCmdLineParsed(wxCmdLineParser& parser)
    return true;
 }
 
+//run the benchmark selected on the command line
+//the Windows build is a GUI program without a console, so the report goes
+//to --bench-log, or to the console of the shell it was started from
+void VRenderApp::RunBenchmark()
+{
+   m_bench_out = NULL;
+   if (!m_bench_log.IsEmpty())
+   {
+      WFOPEN(&m_bench_out, m_bench_log.ToStdWstring().c_str(), L"w");
+      if (!m_bench_out)
+         return;
+   }
+   else
+   {
+#ifdef _WIN32
+      if (AttachConsole(ATTACH_PARENT_PROCESS) || AllocConsole())
+         FOPEN(&m_bench_out, "CONOUT$", "w");
+#endif
+      if (!m_bench_out)
+         m_bench_out = stdout;
+   }
+
+   switch (m_bench_mode)
+   {
+   case BENCH_IO:
+      BenchmarkIO();
+      break;
+   case BENCH_DECOMP:
+      BenchmarkDecompression();
+      break;
+   case BENCH_READ:
+      BenchmarkRead();
+      break;
+   case BENCH_TEXPOOL:
+      BenchmarkTexturePool();
+      break;
+   case BENCH_ORDER:
+      BenchmarkBrickOrder();
+      break;
+   }
+
+   fflush(m_bench_out);
+   if (m_bench_out != stdout)
+      fclose(m_bench_out);
+   m_bench_out = NULL;
+}
+
+//read all bricks of all levels, frames and channels of m_bench_file
+//through the asynchronous brick reader and print the throughput
+void VRenderApp::BenchmarkIO()
+{
+   wstring path = m_bench_file.ToStdWstring();
+   BRKXMLReader reader;
+   reader.SetFile(path);
+   reader.Preprocess();
+
+   vector<FLIVR::FileLocInfo*> finfos;
+   for (int lv = 0; lv < reader.GetLevelNum(); lv++)
+      for (int t = 0; t < reader.GetTimeNum(); t++)
+         for (int c = 0; c < reader.GetChanNum(); c++)
+            for (int id = 0; id < reader.GetBrickNum(lv); id++)
+            {
+               FLIVR::FileLocInfo *finfo = reader.GetBrickFilePath(t, c, id, lv);
+               if (finfo) finfos.push_back(finfo);
+            }
+
+   if (finfos.empty())
+   {
+      fprintf(m_bench_out, "bench-io: no bricks found in %s\n", ws2s(path).c_str());
+      return;
+   }
+
+   long long bytes = 0;
+   double seconds = 0.0;
+   bool uring = false;
+   double gbps = FLIVR::AsyncBrickReader::benchmark(finfos, m_bench_depth, &bytes, &seconds, &uring);
+   fprintf(m_bench_out, "bench-io: %s\n", ws2s(path).c_str());
+   fprintf(m_bench_out, "  %d bricks, %.3f GB in %.3f s: %.3f GB/s (%s, depth %d)\n",
+      (int)finfos.size(), (double)bytes/1.0e9, seconds, gbps,
+      uring ? "io_uring" : "threads", m_bench_depth);
+}
+
+//decompress synthetic 256x256x64 bricks with every brick codec
+void VRenderApp::BenchmarkDecompression()
+{
+   vector<FLIVR::BrickCodecResult> results;
+   FLIVR::BrickCodecBenchmark bench(256, 256, 64, 20);
+   bench.run(results);
+
+   fprintf(m_bench_out, "bench-decomp: 256x256x64 bricks, 20 runs each\n");
+   for (size_t i = 0; i < results.size(); i++)
+   {
+      const FLIVR::BrickCodecResult &r = results[i];
+      if (!r.comp_size)
+      {
+         fprintf(m_bench_out, "  %-20s unavailable\n", r.name.c_str());
+         continue;
+      }
+      fprintf(m_bench_out, "  %-20s ratio %5.2f  %8.3f ms  %8.1f MB/s%s\n",
+         r.name.c_str(), (double)r.raw_size/r.comp_size, r.ms, r.mbps,
+         r.ok ? "" : "  (round trip FAILED)");
+   }
+}
+
+//find bricks in texture pools of growing size, by hash and by scanning
+void VRenderApp::BenchmarkTexturePool()
+{
+   const int lookups = 100000;
+   fprintf(m_bench_out, "bench-texpool: %d lookups per pool size\n", lookups);
+   fprintf(m_bench_out, "  %8s %12s %12s\n", "bricks", "hash ns", "scan ns");
+   for (int size = 64; size <= 65536; size *= 4)
+   {
+      //the scan is quadratic, keep its total time in check
+      int n = size > 4096 ? lookups / 16 : lookups;
+      double hash_ns, scan_ns;
+      FLIVR::TexturePool::benchmark(size, n, hash_ns, scan_ns);
+      fprintf(m_bench_out, "  %8d %12.1f %12.1f\n", size, hash_ns, scan_ns);
+   }
+}
+
+//order bricks of growing grids for an orbiting view, by a full sort
+//every frame and by BrickOrder, for small and large view changes
+void VRenderApp::BenchmarkBrickOrder()
+{
+   const int frames = 100;
+   const double degrees[3] = {0.5, 5.0, 45.0};
+   fprintf(m_bench_out, "bench-order: %d frames per grid and view step\n", frames);
+   fprintf(m_bench_out, "  %8s %8s %6s %12s %12s\n", "bricks", "deg", "view", "sort ms", "order ms");
+   for (int grid = 8; grid <= 64; grid *= 2)
+   {
+      for (int i = 0; i < 3; i++)
+      {
+         for (int ortho = 1; ortho >= 0; ortho--)
+         {
+            double sort_ms, order_ms;
+            int mismatch;
+            bool same = FLIVR::BrickOrder::benchmark(grid, frames, degrees[i],
+               ortho != 0, sort_ms, order_ms, mismatch);
+            fprintf(m_bench_out, "  %8d %8.1f %6s %12.3f %12.3f", grid*grid*grid,
+               degrees[i], ortho ? "ortho" : "persp", sort_ms, order_ms);
+            if (same)
+               fprintf(m_bench_out, "\n");
+            else
+               fprintf(m_bench_out, "  MISMATCH at frame %d\n", mismatch);
+         }
+      }
+   }
+}
+
+//decode all channels of every frame of the files in m_files
+//the way they are loaded and print the throughput of each file
+void VRenderApp::BenchmarkRead()
+{
+   typedef boost::chrono::high_resolution_clock BenchClock;
+
+   for (size_t f = 0; f < m_files.GetCount(); f++)
+   {
+      wxString ext = m_files[f].AfterLast('.').Lower();
+      BaseReader *reader = NULL;
+      if (ext == "tif" || ext == "tiff")
+         reader = new TIFReader();
+      else if (ext == "lsm")
+         reader = new LSMReader();
+      else if (ext == "oib")
+         reader = new OIBReader();
+      else if (ext == "nrrd")
+         reader = new NRRDReader();
+      if (!reader)
+      {
+         fprintf(m_bench_out, "bench-read: unsupported file %s\n", m_files[f].ToStdString().c_str());
+         continue;
+      }
+
+      wstring path = m_files[f].ToStdWstring();
+      wstring time_id = L"_T";
+      reader->SetFile(path);
+      reader->SetSliceSeq(false);
+      reader->SetTimeSeq(false);
+      reader->SetTimeId(time_id);
+      reader->SetDecodeThreads(m_bench_decode_threads);
+      reader->Preprocess();
+
+      vector<int> chans;
+      for (int c = 0; c < reader->GetChanNum(); c++)
+         chans.push_back(c);
+      double bytes = 0.0;
+      double seconds = 0.0;
+      for (int t = 0; t < reader->GetTimeNum(); t++)
+      {
+         vector<Nrrd*> data;
+         vector<double> max_values, scalar_scales;
+         BenchClock::time_point t1 = BenchClock::now();
+         reader->ConvertChannels(t, chans, true, data, max_values, scalar_scales);
+         BenchClock::time_point t2 = BenchClock::now();
+         seconds += boost::chrono::duration_cast<boost::chrono::duration<double> >(t2 - t1).count();
+         for (size_t i = 0; i < data.size(); i++)
+         {
+            if (!data[i])
+               continue;
+            bytes += (double)nrrdElementNumber(data[i]) * nrrdElementSize(data[i]);
+            //the readers allocate with new[]
+            delete [] (char*)data[i]->data;
+            nrrdNix(data[i]);
+         }
+      }
+
+      fprintf(m_bench_out, "bench-read: %s (decode threads %d)\n", ws2s(path).c_str(), m_bench_decode_threads);
+      fprintf(m_bench_out, "  %d frames, %d channels, %.1f MB in %.3f s: %.1f MB/s\n",
+         reader->GetTimeNum(), reader->GetChanNum(), bytes/1.0e6, seconds,
+         seconds > 0.0 ? bytes/1.0e6/seconds : 0.0);
+      delete reader;
+   }
+}
 
 #ifdef _DARWIN
 void VRenderApp::MacOpenFiles(const wxArrayString& fileNames)
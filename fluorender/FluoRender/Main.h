@@ -35,7 +35,7 @@ DEALINGS IN THE SOFTWARE.
 class VRenderApp : public wxApp
 {
    public:
-      VRenderApp(void) : wxApp() { m_server = NULL; m_frame = NULL;}
+      VRenderApp(void) : wxApp() { m_server = NULL; m_frame = NULL; m_bench_mode = BENCH_NONE; m_bench_depth = 32; m_bench_decode_threads = 0; m_bench_out = NULL;}
 	  virtual bool OnInit();
 	  virtual int OnExit(); 
       void OnInitCmdLine(wxCmdLineParser& parser);
@@ -54,9 +54,36 @@ class VRenderApp : public wxApp
 #endif
 
    private:
+      //benchmarks run instead of the GUI
+      enum
+      {
+         BENCH_NONE = 0,
+         BENCH_IO,		//--bench-io <file.vvd>
+         BENCH_DECOMP,	//--bench-decomp
+         BENCH_READ,	//--bench-read <files>
+         BENCH_TEXPOOL,	//--bench-texpool
+         BENCH_ORDER	//--bench-order
+      };
+      void RunBenchmark();
+      void BenchmarkIO();
+      void BenchmarkDecompression();
+      void BenchmarkRead();
+      void BenchmarkTexturePool();
+      void BenchmarkBrickOrder();
+
       wxArrayString m_files;
       wxFrame *m_frame;
 	  MyServer *m_server;
+	  int m_bench_mode;
+	  //--bench-io
+	  wxString m_bench_file;
+	  //--io-depth
+	  int m_bench_depth;
+	  //--decode-threads
+	  int m_bench_decode_threads;
+	  //--bench-log, the console when empty
+	  wxString m_bench_log;
+	  FILE *m_bench_out;
 };
 
 DECLARE_APP(VRenderApp)
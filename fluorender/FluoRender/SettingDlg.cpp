@@ -57,6 +57,9 @@ BEGIN_EVENT_TABLE(SettingDlg, wxPanel)
 	EVT_CHECKBOX(ID_RotLinkChk, SettingDlg::OnRotLink)
 	//override vox
 	EVT_CHECKBOX(ID_OverrideVoxChk, SettingDlg::OnOverrideVoxCheck)
+	//decoding threads
+	EVT_COMMAND_SCROLL(ID_DecodeThreadsSldr, SettingDlg::OnDecodeThreadsChange)
+	EVT_TEXT(ID_DecodeThreadsText, SettingDlg::OnDecodeThreadsEdit)
 	//wavelength to color
 	EVT_COMBOBOX(ID_WavColor1Cmb, SettingDlg::OnWavColor1Change)
 	EVT_COMBOBOX(ID_WavColor2Cmb, SettingDlg::OnWavColor2Change)
@@ -66,6 +69,8 @@ BEGIN_EVENT_TABLE(SettingDlg, wxPanel)
 	EVT_CHECKBOX(ID_StreamingChk, SettingDlg::OnStreamingChk)
 	EVT_COMMAND_SCROLL(ID_GraphicsMemSldr, SettingDlg::OnGraphicsMemChange)
 	EVT_TEXT(ID_GraphicsMemText, SettingDlg::OnGraphicsMemEdit)
+	EVT_COMMAND_SCROLL(ID_TexRecycleSldr, SettingDlg::OnTexRecycleChange)
+	EVT_TEXT(ID_TexRecycleText, SettingDlg::OnTexRecycleEdit)
 	EVT_COMMAND_SCROLL(ID_LargeDataSldr, SettingDlg::OnLargeDataChange)
 	EVT_TEXT(ID_LargeDataText, SettingDlg::OnLargeDataEdit)
 	EVT_COMMAND_SCROLL(ID_BlockSizeSldr, SettingDlg::OnBlockSizeChange)
@@ -74,6 +79,14 @@ BEGIN_EVENT_TABLE(SettingDlg, wxPanel)
 	EVT_TEXT(ID_ResponseTimeText, SettingDlg::OnResponseTimeEdit)
 	EVT_COMMAND_SCROLL(ID_MainMemBufSizeSldr, SettingDlg::OnMainMemBufSizeChange)
 	EVT_TEXT(ID_MainMemBufSizeText, SettingDlg::OnMainMemBufSizeEdit)
+	//texture upload
+	EVT_CHECKBOX(ID_UploadStreamChk, SettingDlg::OnUploadStreamChk)
+	EVT_COMMAND_SCROLL(ID_UploadBudgetSldr, SettingDlg::OnUploadBudgetChange)
+	EVT_TEXT(ID_UploadBudgetText, SettingDlg::OnUploadBudgetEdit)
+	EVT_COMMAND_SCROLL(ID_UploadBufNumSldr, SettingDlg::OnUploadBufNumChange)
+	EVT_TEXT(ID_UploadBufNumText, SettingDlg::OnUploadBufNumEdit)
+	EVT_COMMAND_SCROLL(ID_UploadBufSizeSldr, SettingDlg::OnUploadBufSizeChange)
+	EVT_TEXT(ID_UploadBufSizeText, SettingDlg::OnUploadBufSizeEdit)
 	//font
 	EVT_COMBOBOX(ID_FontCmb, SettingDlg::OnFontChange)
 	EVT_COMBOBOX(ID_FontSizeCmb, SettingDlg::OnFontSizeChange)
@@ -363,6 +376,19 @@ wxWindow* SettingDlg::CreatePerformancePage(wxWindow *parent)
 	sizer2_1->Add(m_graphics_mem_sldr, 1, wxEXPAND);
 	sizer2_1->Add(m_graphics_mem_text, 0, wxALIGN_CENTER);
 	sizer2_1->Add(st);
+	wxBoxSizer *sizer2_5 = new wxBoxSizer(wxHORIZONTAL);
+	st = new wxStaticText(page, 0, "Texture Reuse:",
+		wxDefaultPosition, wxSize(110, -1));
+	sizer2_5->Add(st);
+	m_tex_recycle_sldr = new wxSlider(page, ID_TexRecycleSldr, 6, 0, 50,
+		wxDefaultPosition, wxDefaultSize, wxSL_HORIZONTAL);
+	m_tex_recycle_text = new wxTextCtrl(page, ID_TexRecycleText, "6",
+		wxDefaultPosition, wxSize(40, -1), 0, vald_int);
+	st = new wxStaticText(page, 0, "%",
+		wxDefaultPosition, wxSize(20, -1));
+	sizer2_5->Add(m_tex_recycle_sldr, 1, wxEXPAND);
+	sizer2_5->Add(m_tex_recycle_text, 0, wxALIGN_CENTER);
+	sizer2_5->Add(st);
 	wxBoxSizer *sizer2_2 = new wxBoxSizer(wxHORIZONTAL);
 	st = new wxStaticText(page, 0, "Large Data Size:",
 		wxDefaultPosition, wxSize(110, -1));
@@ -407,6 +433,8 @@ wxWindow* SettingDlg::CreatePerformancePage(wxWindow *parent)
 	group2->Add(10, 10);
 	group2->Add(sizer2_1, 0, wxEXPAND);
 	group2->Add(10, 5);
+	group2->Add(sizer2_5, 0, wxEXPAND);
+	group2->Add(10, 5);
 	group2->Add(sizer2_2, 0, wxEXPAND);
 	group2->Add(10, 5);
 	group2->Add(sizer2_3, 0, wxEXPAND);
@@ -440,6 +468,66 @@ wxWindow* SettingDlg::CreatePerformancePage(wxWindow *parent)
 	group3->Add(sizer3_1, 0, wxEXPAND);
 	group3->Add(10, 5);
 
+	//texture upload
+	wxBoxSizer *group4 = new wxStaticBoxSizer(
+		new wxStaticBox(page, wxID_ANY, "Texture Upload"), wxVERTICAL);
+	m_upload_stream_chk = new wxCheckBox(page, ID_UploadStreamChk,
+		"Upload bricks through pixel buffers.");
+	wxBoxSizer *sizer4_1 = new wxBoxSizer(wxHORIZONTAL);
+	st = new wxStaticText(page, 0, "Upload Budget:",
+		wxDefaultPosition, wxSize(110, -1));
+	sizer4_1->Add(st);
+	m_upload_budget_sldr = new wxSlider(page, ID_UploadBudgetSldr, 0, 0, 100,
+		wxDefaultPosition, wxDefaultSize, wxSL_HORIZONTAL);
+	m_upload_budget_text = new wxTextCtrl(page, ID_UploadBudgetText, "0",
+		wxDefaultPosition, wxSize(40, -1), 0, vald_int);
+	st = new wxStaticText(page, 0, "MB",
+		wxDefaultPosition, wxSize(20, -1));
+	sizer4_1->Add(m_upload_budget_sldr, 1, wxEXPAND);
+	sizer4_1->Add(m_upload_budget_text, 0, wxALIGN_CENTER);
+	sizer4_1->Add(st);
+	wxBoxSizer *sizer4_2 = new wxBoxSizer(wxHORIZONTAL);
+	st = new wxStaticText(page, 0, "Buffers:",
+		wxDefaultPosition, wxSize(110, -1));
+	sizer4_2->Add(st);
+	m_upload_buf_num_sldr = new wxSlider(page, ID_UploadBufNumSldr, 3, 1, 8,
+		wxDefaultPosition, wxDefaultSize, wxSL_HORIZONTAL);
+	m_upload_buf_num_text = new wxTextCtrl(page, ID_UploadBufNumText, "3",
+		wxDefaultPosition, wxSize(40, -1), 0, vald_int);
+	st = new wxStaticText(page, 0, "",
+		wxDefaultPosition, wxSize(20, -1));
+	sizer4_2->Add(m_upload_buf_num_sldr, 1, wxEXPAND);
+	sizer4_2->Add(m_upload_buf_num_text, 0, wxALIGN_CENTER);
+	sizer4_2->Add(st);
+	wxBoxSizer *sizer4_3 = new wxBoxSizer(wxHORIZONTAL);
+	st = new wxStaticText(page, 0, "Buffer Size:",
+		wxDefaultPosition, wxSize(110, -1));
+	sizer4_3->Add(st);
+	m_upload_buf_size_sldr = new wxSlider(page, ID_UploadBufSizeSldr, 8, 1, 32,
+		wxDefaultPosition, wxDefaultSize, wxSL_HORIZONTAL);
+	m_upload_buf_size_text = new wxTextCtrl(page, ID_UploadBufSizeText, "64",
+		wxDefaultPosition, wxSize(40, -1), 0, vald_int);
+	st = new wxStaticText(page, 0, "MB",
+		wxDefaultPosition, wxSize(20, -1));
+	sizer4_3->Add(m_upload_buf_size_sldr, 1, wxEXPAND);
+	sizer4_3->Add(m_upload_buf_size_text, 0, wxALIGN_CENTER);
+	sizer4_3->Add(st);
+	group4->Add(10, 5);
+	group4->Add(m_upload_stream_chk);
+	group4->Add(10, 10);
+	group4->Add(sizer4_1, 0, wxEXPAND);
+	group4->Add(10, 5);
+	group4->Add(sizer4_2, 0, wxEXPAND);
+	group4->Add(10, 5);
+	group4->Add(sizer4_3, 0, wxEXPAND);
+	group4->Add(10, 5);
+	st = new wxStaticText(page, 0,
+		"Upload Budget limits the brick data sent to graphics memory in a frame\n"\
+		"when streaming. Set it to 0 to use what the measured upload rate allows\n"\
+		"in the response time.");
+	group4->Add(st);
+	group4->Add(10, 5);
+
 	wxBoxSizer *sizerV = new wxBoxSizer(wxVERTICAL);
 	sizerV->Add(10, 10);
 	sizerV->Add(group1, 0, wxEXPAND);
@@ -447,6 +535,8 @@ wxWindow* SettingDlg::CreatePerformancePage(wxWindow *parent)
 	sizerV->Add(group2, 0, wxEXPAND);
 	sizerV->Add(10, 10);
 	sizerV->Add(group3, 0, wxEXPAND);
+	sizerV->Add(10, 10);
+	sizerV->Add(group4, 0, wxEXPAND);
 
 	page->SetSizer(sizerV);
 	return page;
@@ -549,11 +639,34 @@ wxWindow* SettingDlg::CreateFormatPage(wxWindow *parent)
 	group2->Add(sizer2_2, 0);
 	group2->Add(10, 5);
 
+	//decoding threads
+	wxIntegerValidator<unsigned int> vald_int;
+	wxBoxSizer *group3 = new wxStaticBoxSizer(
+		new wxStaticBox(page, wxID_ANY, "Decoding Threads (for TIFF/OIB/LSM files)"), wxVERTICAL);
+	wxBoxSizer *sizer3_1 = new wxBoxSizer(wxHORIZONTAL);
+	m_decode_threads_sldr = new wxSlider(page, ID_DecodeThreadsSldr, 0, 0, 64,
+		wxDefaultPosition, wxDefaultSize, wxSL_HORIZONTAL);
+	m_decode_threads_text = new wxTextCtrl(page, ID_DecodeThreadsText, "0",
+		wxDefaultPosition, wxSize(40, 20), 0, vald_int);
+	st = new wxStaticText(page, 0,
+		"The number of threads decoding the pages of a file.\n"\
+		"Set 0 to use all processor cores.\n"\
+		"Set 1 to decode the pages in order on one thread.");
+	sizer3_1->Add(m_decode_threads_sldr, 1, wxEXPAND);
+	sizer3_1->Add(m_decode_threads_text, 0, wxALIGN_CENTER);
+	group3->Add(10, 5);
+	group3->Add(sizer3_1, 0, wxEXPAND);
+	group3->Add(10, 5);
+	group3->Add(st);
+	group3->Add(10, 5);
+
 	wxBoxSizer *sizerV = new wxBoxSizer(wxVERTICAL);
 	sizerV->Add(10, 10);
 	sizerV->Add(group1, 0, wxEXPAND);
 	sizerV->Add(10, 10);
 	sizerV->Add(group2, 0, wxEXPAND);
+	sizerV->Add(10, 10);
+	sizerV->Add(group3, 0, wxEXPAND);
 
 	page->SetSizer(sizerV);
 	return page;
@@ -625,6 +738,7 @@ void SettingDlg::GetSettings()
 	m_time_id = "_T";
 	m_grad_bg = false;
 	m_override_vox = true;
+	m_decode_threads = 0;
 	m_soft_threshold = 0.0;
 	m_run_script = false;
 	m_script_file = "";
@@ -633,11 +747,16 @@ void SettingDlg::GetSettings()
 	m_font_file = "";
 	m_mem_swap = false;
 	m_graphics_mem = 1000.0;
+	m_tex_recycle = 6.0;
 	m_main_mem_buf_size = 4000.0;
 	m_large_data_size = 1000.0;
 	m_force_brick_size = 128;
 	m_up_time = 100;
 	m_update_order = 0;
+	m_upload_stream = true;
+	m_upload_budget = 0.0;
+	m_upload_buf_num = 3;
+	m_upload_buf_size = 64.0;
 	m_point_volume_mode = 0;
 	m_ruler_use_transf = false;
 	m_ruler_time_dep = true;
@@ -765,6 +884,12 @@ void SettingDlg::GetSettings()
 		fconfig.SetPath("/override vox");
 		fconfig.Read("value", &m_override_vox);
 	}
+	//decoding threads
+	if (fconfig.Exists("/decode threads"))
+	{
+		fconfig.SetPath("/decode threads");
+		fconfig.Read("value", &m_decode_threads);
+	}
 	//soft threshold
 	if (fconfig.Exists("/soft threshold"))
 	{
@@ -807,6 +932,8 @@ void SettingDlg::GetSettings()
 		fconfig.Read("mem swap", &m_mem_swap);
 		//graphics memory limit
 		fconfig.Read("graphics mem", &m_graphics_mem);
+		//released textures kept for reuse
+		fconfig.Read("tex recycle", &m_tex_recycle);
 		//main memory buffer size
 		fconfig.Read("main memory buffer size", &m_main_mem_buf_size);
 		//large data size
@@ -815,6 +942,11 @@ void SettingDlg::GetSettings()
 		fconfig.Read("force brick size", &m_force_brick_size);
 		//response time
 		fconfig.Read("up time", &m_up_time);
+		//texture upload
+		fconfig.Read("upload stream", &m_upload_stream);
+		fconfig.Read("upload budget", &m_upload_budget);
+		fconfig.Read("upload buffer num", &m_upload_buf_num);
+		fconfig.Read("upload buffer size", &m_upload_buf_size);
 	}
 	EnableStreaming(m_mem_swap);
 	//update order
@@ -918,6 +1050,9 @@ void SettingDlg::UpdateUI()
 	m_grad_bg_chk->SetValue(m_grad_bg);
 	//override vox
 	m_override_vox_chk->SetValue(m_override_vox);
+	//decoding threads
+	m_decode_threads_sldr->SetValue(m_decode_threads);
+	m_decode_threads_text->ChangeValue(wxString::Format("%d", m_decode_threads));
 	//wavelength to color
 	m_wav_color1_cmb->Select(m_wav_color1-1);
 	m_wav_color2_cmb->Select(m_wav_color2-1);
@@ -946,10 +1081,16 @@ void SettingDlg::UpdateUI()
 	m_streaming_chk->SetValue(m_mem_swap);
 	EnableStreaming(m_mem_swap);
 	m_graphics_mem_text->SetValue(wxString::Format("%d", (int)m_graphics_mem));
+	m_tex_recycle_text->SetValue(wxString::Format("%d", (int)m_tex_recycle));
 	m_large_data_text->SetValue(wxString::Format("%d", (int)m_large_data_size));
 	m_block_size_text->SetValue(wxString::Format("%d", m_force_brick_size));
 	m_response_time_text->SetValue(wxString::Format("%d", m_up_time));
 	m_main_mem_buf_text->SetValue(wxString::Format("%d", (int)m_main_mem_buf_size));
+	//texture upload
+	m_upload_stream_chk->SetValue(m_upload_stream);
+	m_upload_budget_text->SetValue(wxString::Format("%d", (int)m_upload_budget));
+	m_upload_buf_num_text->SetValue(wxString::Format("%d", m_upload_buf_num));
+	m_upload_buf_size_text->SetValue(wxString::Format("%d", (int)m_upload_buf_size));
 }
 
 void SettingDlg::SaveSettings()
@@ -1006,6 +1147,9 @@ void SettingDlg::SaveSettings()
 	fconfig.SetPath("/override vox");
 	fconfig.Write("value", m_override_vox);
 
+	fconfig.SetPath("/decode threads");
+	fconfig.Write("value", m_decode_threads);
+
 	fconfig.SetPath("/soft threshold");
 	fconfig.Write("value", m_soft_threshold);
 
@@ -1033,10 +1177,15 @@ void SettingDlg::SaveSettings()
 	fconfig.SetPath("/memory settings");
 	fconfig.Write("mem swap", m_mem_swap);
 	fconfig.Write("graphics mem", m_graphics_mem);
+	fconfig.Write("tex recycle", m_tex_recycle);
 	fconfig.Write("large data size", m_large_data_size);
 	fconfig.Write("force brick size", m_force_brick_size);
 	fconfig.Write("up time", m_up_time);
 	fconfig.Write("main memory buffer size", m_main_mem_buf_size);
+	fconfig.Write("upload stream", m_upload_stream);
+	fconfig.Write("upload budget", m_upload_budget);
+	fconfig.Write("upload buffer num", m_upload_buf_num);
+	fconfig.Write("upload buffer size", m_upload_buf_size);
 	EnableStreaming(m_mem_swap);
 
 	//update order
@@ -1335,6 +1484,8 @@ void SettingDlg::EnableStreaming(bool enable)
 		m_block_size_text->Enable();
 		m_response_time_sldr->Enable();
 		m_response_time_text->Enable();
+		m_upload_budget_sldr->Enable();
+		m_upload_budget_text->Enable();
 	}
 	else
 	{
@@ -1346,6 +1497,8 @@ void SettingDlg::EnableStreaming(bool enable)
 		m_block_size_text->Disable();
 		m_response_time_sldr->Disable();
 		m_response_time_text->Disable();
+		m_upload_budget_sldr->Disable();
+		m_upload_budget_text->Disable();
 	}
 	VRenderFrame* vr_frame = (VRenderFrame*)m_frame;
 	if (vr_frame)
@@ -1418,6 +1571,28 @@ void SettingDlg::OnOverrideVoxCheck(wxCommandEvent &event)
 	}
 }
 
+//decoding threads
+void SettingDlg::OnDecodeThreadsChange(wxScrollEvent &event)
+{
+	int ival = event.GetPosition();
+	wxString str = wxString::Format("%d", ival);
+	m_decode_threads_text->SetValue(str);
+}
+
+void SettingDlg::OnDecodeThreadsEdit(wxCommandEvent &event)
+{
+	wxString str = m_decode_threads_text->GetValue();
+	long ival;
+	if (!str.ToLong(&ival) || ival < 0)
+		return;
+	m_decode_threads_sldr->SetValue(ival);
+	m_decode_threads = ival;
+
+	VRenderFrame* vr_frame = (VRenderFrame*)m_frame;
+	if (vr_frame)
+		vr_frame->GetDataManager()->SetDecodeThreads(m_decode_threads);
+}
+
 //wavelength to color
 int SettingDlg::GetWavelengthColor(int n)
 {
@@ -1528,6 +1703,28 @@ void SettingDlg::OnGraphicsMemEdit(wxCommandEvent &event)
 	m_graphics_mem = val;
 }
 
+void SettingDlg::OnTexRecycleChange(wxScrollEvent &event)
+{
+	int ival = event.GetPosition();
+	wxString str = wxString::Format("%d", ival);
+	m_tex_recycle_text->SetValue(str);
+}
+
+void SettingDlg::OnTexRecycleEdit(wxCommandEvent &event)
+{
+	wxString str = m_tex_recycle_text->GetValue();
+	double val;
+	if (!str.ToDouble(&val) || val<0.0 || val>50.0)
+		return;
+	m_tex_recycle_sldr->SetValue(int(val));
+	m_tex_recycle = val;
+
+	//a smaller cap lets textures go at the next release
+	VRenderFrame* vr_frame = (VRenderFrame*)m_frame;
+	if (vr_frame)
+		vr_frame->SetTextureRendererSettings();
+}
+
 void SettingDlg::OnLargeDataChange(wxScrollEvent &event)
 {
 	int ival = event.GetPosition();
@@ -1599,6 +1796,78 @@ void SettingDlg::OnMainMemBufSizeEdit(wxCommandEvent &event)
 	m_main_mem_buf_sldr->SetValue(int(val/100.0));
 	m_main_mem_buf_size = val;
 }
+
+//texture upload
+void SettingDlg::OnUploadStreamChk(wxCommandEvent &event)
+{
+	m_upload_stream = m_upload_stream_chk->GetValue();
+	VRenderFrame* vr_frame = (VRenderFrame*)m_frame;
+	if (vr_frame)
+		vr_frame->SetTextureUploadSettings();
+}
+
+void SettingDlg::OnUploadBudgetChange(wxScrollEvent &event)
+{
+	int ival = event.GetPosition();
+	wxString str = wxString::Format("%d", ival*10);
+	m_upload_budget_text->SetValue(str);
+}
+
+void SettingDlg::OnUploadBudgetEdit(wxCommandEvent &event)
+{
+	wxString str = m_upload_budget_text->GetValue();
+	double val;
+	str.ToDouble(&val);
+	if (val<0.0)
+		return;
+	m_upload_budget_sldr->SetValue(int(val/10.0));
+	m_upload_budget = val;
+	VRenderFrame* vr_frame = (VRenderFrame*)m_frame;
+	if (vr_frame)
+		vr_frame->SetTextureUploadSettings();
+}
+
+void SettingDlg::OnUploadBufNumChange(wxScrollEvent &event)
+{
+	int ival = event.GetPosition();
+	wxString str = wxString::Format("%d", ival);
+	m_upload_buf_num_text->SetValue(str);
+}
+
+void SettingDlg::OnUploadBufNumEdit(wxCommandEvent &event)
+{
+	wxString str = m_upload_buf_num_text->GetValue();
+	long ival;
+	str.ToLong(&ival);
+	if (ival<1)
+		return;
+	m_upload_buf_num_sldr->SetValue(ival);
+	m_upload_buf_num = ival;
+	VRenderFrame* vr_frame = (VRenderFrame*)m_frame;
+	if (vr_frame)
+		vr_frame->SetTextureUploadSettings();
+}
+
+void SettingDlg::OnUploadBufSizeChange(wxScrollEvent &event)
+{
+	int ival = event.GetPosition();
+	wxString str = wxString::Format("%d", ival*8);
+	m_upload_buf_size_text->SetValue(str);
+}
+
+void SettingDlg::OnUploadBufSizeEdit(wxCommandEvent &event)
+{
+	wxString str = m_upload_buf_size_text->GetValue();
+	double val;
+	str.ToDouble(&val);
+	if (val<=0.0)
+		return;
+	m_upload_buf_size_sldr->SetValue(int(val/8.0));
+	m_upload_buf_size = val;
+	VRenderFrame* vr_frame = (VRenderFrame*)m_frame;
+	if (vr_frame)
+		vr_frame->SetTextureUploadSettings();
+}
 //font
 void SettingDlg::OnFontChange(wxCommandEvent &event)
 {
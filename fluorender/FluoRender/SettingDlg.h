@@ -64,10 +64,15 @@ class SettingDlg : public wxPanel
 		ID_WavColor2Cmb,
 		ID_WavColor3Cmb,
 		ID_WavColor4Cmb,
+		//decoding threads
+		ID_DecodeThreadsSldr,
+		ID_DecodeThreadsText,
 		//memory settings
 		ID_StreamingChk,
 		ID_GraphicsMemSldr,
 		ID_GraphicsMemText,
+		ID_TexRecycleSldr,
+		ID_TexRecycleText,
 		ID_LargeDataSldr,
 		ID_LargeDataText,
 		ID_BlockSizeSldr,
@@ -76,6 +81,14 @@ class SettingDlg : public wxPanel
 		ID_ResponseTimeText,
 		ID_MainMemBufSizeSldr,
 		ID_MainMemBufSizeText,
+		//texture upload
+		ID_UploadStreamChk,
+		ID_UploadBudgetSldr,
+		ID_UploadBudgetText,
+		ID_UploadBufNumSldr,
+		ID_UploadBufNumText,
+		ID_UploadBufSizeSldr,
+		ID_UploadBufSizeText,
 		//font
 		ID_FontCmb,
 		ID_FontSizeCmb,
@@ -124,6 +137,9 @@ public:
 	//override vox
 	bool GetOverrideVox() {return m_override_vox;}
 	void SetOverrideVox(bool val) {m_override_vox = val;}
+	//decoding threads
+	int GetDecodeThreads() {return m_decode_threads;}
+	void SetDecodeThreads(int val) {m_decode_threads = val;}
 	//soft threshold
 	double GetSoftThreshold() {return m_soft_threshold;}
 	void SetSoftThreshold(double val) {m_soft_threshold = val;}
@@ -150,6 +166,8 @@ public:
 	void SetMemSwap(bool val) {m_mem_swap = val;}
 	double GetGraphicsMem() {return m_graphics_mem;}
 	void SetGraphicsMem(double val) {m_graphics_mem = val;}
+	double GetTexRecycle() {return m_tex_recycle;}
+	void SetTexRecycle(double val) {m_tex_recycle = val;}
 	double GetLargeDataSize() {return m_large_data_size;}
 	void SetLargeDataSize(double val) {m_large_data_size = val;}
 	int GetForceBrickSize() {return m_force_brick_size;}
@@ -160,6 +178,11 @@ public:
 	void SetUpdateOrder(int val) {m_update_order = val;}
 	double GetMainMemBufSize() {return m_main_mem_buf_size;}
 	void SetMainMemBufSize(double val) {m_main_mem_buf_size = val;}
+	//texture upload
+	bool GetUploadStream() {return m_upload_stream;}
+	double GetUploadBudget() {return m_upload_budget;}
+	int GetUploadBufNum() {return m_upload_buf_num;}
+	double GetUploadBufSize() {return m_upload_buf_size;}
 	//point volume mode
 	int GetPointVolumeMode() {return m_point_volume_mode;}
 	void SetPointVolumeMode(int mode) {m_point_volume_mode = mode;}
@@ -215,6 +238,7 @@ private:
 	wxString m_time_id;		//identfier for time sequence
 	bool m_grad_bg;
 	bool m_override_vox;
+	int m_decode_threads;	//0 for all cores, 1 for one thread in page order
 	double m_soft_threshold;
 	//script
 	bool m_run_script;
@@ -228,6 +252,7 @@ private:
 	double m_graphics_mem;	//in MB
 							//it's the user setting
 							//final value is determined by both reading from the card and this value
+	double m_tex_recycle;	//released textures kept for reuse, in percent of graphics memory
 	double m_main_mem_buf_size;	//in MB
 	double m_large_data_size;//data size considered as large and needs forced bricking
 	int m_force_brick_size;	//in pixels
@@ -235,6 +260,11 @@ private:
 							//final value is determined by both reading from the card and this value
 	int m_up_time;			//response time in ms
 	int m_update_order;		//0:back-to-front; 1:front-to-back
+	//texture upload
+	bool m_upload_stream;	//upload through pixel buffers
+	double m_upload_budget;	//in MB per frame, 0 from the measured rate
+	int m_upload_buf_num;	//pixel buffers in the ring
+	double m_upload_buf_size;//in MB, each
 	//point volume mode
 	int m_point_volume_mode;
 	//ruler use transfer function
@@ -290,6 +320,9 @@ private:
 	wxCheckBox *m_rot_link_chk;
 	//override vox
 	wxCheckBox *m_override_vox_chk;
+	//decoding threads
+	wxSlider *m_decode_threads_sldr;
+	wxTextCtrl *m_decode_threads_text;
 	//wavelength to color
 	wxComboBox *m_wav_color1_cmb;
 	wxComboBox *m_wav_color2_cmb;
@@ -299,6 +332,8 @@ private:
 	wxCheckBox *m_streaming_chk;
 	wxSlider *m_graphics_mem_sldr;
 	wxTextCtrl *m_graphics_mem_text;
+	wxSlider *m_tex_recycle_sldr;
+	wxTextCtrl *m_tex_recycle_text;
 	wxSlider *m_large_data_sldr;
 	wxTextCtrl *m_large_data_text;
 	wxSlider *m_block_size_sldr;
@@ -307,6 +342,14 @@ private:
 	wxTextCtrl *m_response_time_text;
 	wxSlider *m_main_mem_buf_sldr;
 	wxTextCtrl *m_main_mem_buf_text;
+	//texture upload
+	wxCheckBox *m_upload_stream_chk;
+	wxSlider *m_upload_budget_sldr;
+	wxTextCtrl *m_upload_budget_text;
+	wxSlider *m_upload_buf_num_sldr;
+	wxTextCtrl *m_upload_buf_num_text;
+	wxSlider *m_upload_buf_size_sldr;
+	wxTextCtrl *m_upload_buf_size_text;
 	//font
 	wxComboBox *m_font_cmb;
 	wxComboBox *m_font_size_cmb;
@@ -362,6 +405,9 @@ private:
 	void OnRotLink(wxCommandEvent& event);
 	//override vox
 	void OnOverrideVoxCheck(wxCommandEvent &event);
+	//decoding threads
+	void OnDecodeThreadsChange(wxScrollEvent &event);
+	void OnDecodeThreadsEdit(wxCommandEvent &event);
 	//wavelength color
 	void OnWavColor1Change(wxCommandEvent &event);
 	void OnWavColor2Change(wxCommandEvent &event);
@@ -371,6 +417,8 @@ private:
 	void OnStreamingChk(wxCommandEvent &event);
 	void OnGraphicsMemChange(wxScrollEvent &event);
 	void OnGraphicsMemEdit(wxCommandEvent &event);
+	void OnTexRecycleChange(wxScrollEvent &event);
+	void OnTexRecycleEdit(wxCommandEvent &event);
 	void OnLargeDataChange(wxScrollEvent &event);
 	void OnLargeDataEdit(wxCommandEvent &event);
 	void OnBlockSizeChange(wxScrollEvent &event);
@@ -379,6 +427,14 @@ private:
 	void OnResponseTimeEdit(wxCommandEvent &event);
 	void OnMainMemBufSizeChange(wxScrollEvent &event);
 	void OnMainMemBufSizeEdit(wxCommandEvent &event);
+	//texture upload
+	void OnUploadStreamChk(wxCommandEvent &event);
+	void OnUploadBudgetChange(wxScrollEvent &event);
+	void OnUploadBudgetEdit(wxCommandEvent &event);
+	void OnUploadBufNumChange(wxScrollEvent &event);
+	void OnUploadBufNumEdit(wxCommandEvent &event);
+	void OnUploadBufSizeChange(wxScrollEvent &event);
+	void OnUploadBufSizeEdit(wxCommandEvent &event);
 	//font
 	void OnFontChange(wxCommandEvent &event);
 	void OnFontSizeChange(wxCommandEvent &event);
@@ -3119,6 +3119,13 @@ void TraceDlg::GenMap()
 	BaseReader* reader = vd->GetReader();
 	if (!reader)
 		return;
+	VRenderFrame* vr_frame = (VRenderFrame*)m_frame;
+	DataManager* mgr = vr_frame ? vr_frame->GetDataManager() : 0;
+	if (!mgr)
+		return;
+	//frames decoded by earlier passes or shown in views are reused
+	FrameCache* cache = mgr->GetFrameCache();
+	wxMutex* reader_lock = mgr->GetPrefetcher()->GetReaderLock(reader);
 	LBLReader lbl_reader;
 	m_view->CreateTraceGroup();
 	TraceGroup *trace_group = m_view->GetTraceGroup();
@@ -3155,7 +3162,7 @@ void TraceDlg::GenMap()
 	{
 		if (i == 0)
 		{
-			nrrd_data1 = reader->Convert(i, chan, true);
+			nrrd_data1 = cache->Convert(reader, i, chan, reader_lock);
 			if (!nrrd_data1)
 			{
 				file_err = true;
@@ -3176,7 +3183,7 @@ void TraceDlg::GenMap()
 		}
 		else
 		{
-			nrrd_data2 = reader->Convert(i, chan, true);
+			nrrd_data2 = cache->Convert(reader, i, chan, reader_lock);
 			if (!nrrd_data2)
 			{
 				file_err = true;
@@ -3200,7 +3207,7 @@ void TraceDlg::GenMap()
 				nrrd_data1->data, nrrd_data2->data,
 				nrrd_label1->data, nrrd_label2->data);
 
-			nrrdNuke(nrrd_data1);
+			cache->Release(nrrd_data1);
 			nrrdNuke(nrrd_label1);
 			nrrd_data1 = nrrd_data2;
 			nrrd_label1 = nrrd_label2;
@@ -3214,7 +3221,7 @@ void TraceDlg::GenMap()
 	if (file_err)
 		(*m_stat_text) << "ERROR! Certain file(s) missing. Check if label files exist.\n";
 
-	nrrdNuke(nrrd_data2);
+	cache->Release(nrrd_data2);
 	nrrdNuke(nrrd_label2);
 
 	//resolve multiple links of single vertex
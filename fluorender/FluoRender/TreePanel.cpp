@@ -726,7 +726,8 @@ void DataTreeCtrl::OnSave(wxCommandEvent& event)
 			m_frame, "Save Volume Data", "", "",
 			"Muti-page Tiff file (*.tif, *.tiff)|*.tif;*.tiff|"\
 			"Single-page Tiff sequence (*.tif)|*.tif;*.tiff|"\
-			"Nrrd file (*.nrrd)|*.nrrd",
+			"Nrrd file (*.nrrd)|*.nrrd|"\
+			"VVD pyramid (*.vvd)|*.vvd",
 			wxFD_SAVE|wxFD_OVERWRITE_PROMPT);
 		fopendlg->SetExtraControlCreator(CreateExtraControl);
 
@@ -803,7 +804,8 @@ void DataTreeCtrl::OnBakeVolume(wxCommandEvent& event)
 			m_frame, "Bake Volume Data", "", "",
 			"Muti-page Tiff file (*.tif, *.tiff)|*.tif;*.tiff|"\
 			"Single-page Tiff sequence (*.tif)|*.tif;*.tiff|"\
-			"Nrrd file (*.nrrd)|*.nrrd",
+			"Nrrd file (*.nrrd)|*.nrrd|"\
+			"VVD pyramid (*.vvd)|*.vvd",
 			wxFD_SAVE|wxFD_OVERWRITE_PROMPT);
 		fopendlg->SetExtraControlCreator(CreateExtraControl);
 
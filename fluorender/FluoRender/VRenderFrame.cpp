@@ -342,6 +342,7 @@ VRenderFrame::VRenderFrame(
 	m_vrv_list[0]->SetTextRenderer(m_text_renderer);
 	m_time_id = m_setting_dlg->GetTimeId();
 	m_data_mgr.SetOverrideVox(m_setting_dlg->GetOverrideVox());
+	m_data_mgr.SetDecodeThreads(m_setting_dlg->GetDecodeThreads());
 	m_data_mgr.SetPvxmlFlipX(m_setting_dlg->GetPvxmlFlipX());
 	m_data_mgr.SetPvxmlFlipY(m_setting_dlg->GetPvxmlFlipY());
 	VolumeRenderer::set_soft_threshold(m_setting_dlg->GetSoftThreshold());
@@ -4785,6 +4786,17 @@ void VRenderFrame::SetTextureUndos()
 		Texture::mask_undo_num_ = (size_t)(m_setting_dlg->GetPaintHistDepth());
 }
 
+void VRenderFrame::SetTextureUploadSettings()
+{
+	if (!m_setting_dlg)
+		return;
+
+	TextureRenderer::set_upload_stream(m_setting_dlg->GetUploadStream());
+	TextureRenderer::set_upload_budget(m_setting_dlg->GetUploadBudget());
+	TextureRenderer::set_upload_ring(m_setting_dlg->GetUploadBufNum(),
+		m_setting_dlg->GetUploadBufSize());
+}
+
 void VRenderFrame::SetTextureRendererSettings()
 {
 	if (!m_setting_dlg)
@@ -4814,6 +4826,11 @@ void VRenderFrame::SetTextureRendererSettings()
 	//(TextureRenderer takes no account of 2D textures in calculating allocated memory size)
 	if (mem_size > 1024.0) mem_size -= 300.0;
 	else mem_size *= 0.7;
+	//and for released brick textures kept for reuse
+	//(they are outside the memory limit too)
+	double recycle_size = mem_size * m_setting_dlg->GetTexRecycle() / 100.0;
+	mem_size -= recycle_size;
+	TextureRenderer::set_tex_recycle_size(recycle_size);
 
 	double mem_delta = mem_size - TextureRenderer::get_mem_limit();
 	double prev_available_mem = TextureRenderer::get_available_mem();
@@ -4825,6 +4842,7 @@ void VRenderFrame::SetTextureRendererSettings()
 	TextureRenderer::set_force_brick_size(m_setting_dlg->GetForceBrickSize());
 	TextureRenderer::set_up_time(m_setting_dlg->GetResponseTime());
 	TextureRenderer::set_update_order(m_setting_dlg->GetUpdateOrder());
+	SetTextureUploadSettings();
 }
 
 void VRenderFrame::OnFacebook(wxCommandEvent& WXUNUSED(event))
@@ -314,6 +314,7 @@ public:
 	//tex renderer settings
 	void SetTextureRendererSettings();
 	void SetTextureUndos();
+	void SetTextureUploadSettings();
 
 	//quit option
 	void OnQuit(wxCommandEvent& WXUNUSED(event))
@@ -44,6 +44,7 @@ DEALINGS IN THE SOFTWARE.
 #include <glm/gtc/type_ptr.hpp>
 #include <glm/gtc/matrix_transform.hpp>
 #include <glm/gtx/transform.hpp>
+#include <boost/chrono.hpp>
 //#include <boost/process.hpp>
 #ifdef _WIN32
 #include <Windows.h>
@@ -398,67 +399,300 @@ void LMSeacher::OnMouse(wxMouseEvent& event)
 
 /////////////////////////////////////////////////////////////////////////
 
-VolumeDecompressorThread::VolumeDecompressorThread(VolumeLoader *vl)
-	: wxThread(wxTHREAD_DETACHED), m_vl(vl)
+//least recently used entries compared by distance on eviction
+#define BRICK_CACHE_EVICT_SCAN	8
+
+BrickCache::BrickCache()
 {
+	for (int i = 0; i < CLASS_NUM; i++)
+		m_lists[i].head = m_lists[i].tail = 0;
+}
 
+BrickCache::~BrickCache()
+{
+	Clear();
 }
 
-VolumeDecompressorThread::~VolumeDecompressorThread()
+int BrickCache::Classify(const VolumeLoaderData &data)
 {
-	wxCriticalSectionLocker enter(m_vl->m_pThreadCS);
-	// the thread is being destroyed; make sure not to leave dangling pointers around
-	m_vl->m_running_decomp_th--;
+	if (data.brick->isLoading())
+		return CLASS_LOADING;
+	if (!data.vd->GetDisp())
+		return CLASS_VD_UNDISP;
+	if (!data.brick->get_disp())
+		return CLASS_BRICK_UNDISP;
+	if (data.brick->drawn(data.mode))
+		return CLASS_DRAWN;
+	return CLASS_IN_USE;
 }
 
-wxThread::ExitCode VolumeDecompressorThread::Entry()
+void BrickCache::Link(Entry &e, int cls)
 {
-	unsigned int st_time = GET_TICK_COUNT();
+	List &l = m_lists[cls];
+	e.cls = cls;
+	e.prev = 0;
+	e.next = l.head;
+	if (l.head)
+		l.head->prev = &e;
+	else
+		l.tail = &e;
+	l.head = &e;
+}
 
-	m_vl->m_pThreadCS.Enter();
-	m_vl->m_running_decomp_th++;
-	m_vl->m_pThreadCS.Leave();
+void BrickCache::Unlink(Entry &e)
+{
+	List &l = m_lists[e.cls];
+	if (e.prev)
+		e.prev->next = e.next;
+	else
+		l.head = e.next;
+	if (e.next)
+		e.next->prev = e.prev;
+	else
+		l.tail = e.prev;
+	e.prev = e.next = 0;
+}
 
-	while(1)
+void BrickCache::Place(Entry &e, int cls)
+{
+	Unlink(e);
+	Link(e, cls);
+}
+
+void BrickCache::Erase(unordered_map<TextureBrick*, Entry>::iterator it)
+{
+	Unlink(it->second);
+	it->first->remove_state_listener(this);
+	m_map.erase(it);
+}
+
+void BrickCache::Put(const VolumeLoaderData &data)
+{
+	if (Touch(data))
+		return;
+	Entry &e = m_map[data.brick];
+	e.data = data;
+	Link(e, Classify(data));
+	data.brick->add_state_listener(this);
+}
+
+bool BrickCache::Touch(const VolumeLoaderData &data)
+{
+	auto it = m_map.find(data.brick);
+	if (it == m_map.end())
+		return false;
+	it->second.data = data;
+	Place(it->second, Classify(data));
+	return true;
+}
+
+void BrickCache::Update()
+{
+	//take the set out so the bricks are not held up while reclassifying
+	m_dirty_lock.Lock();
+	m_dirty_swap.assign(m_dirty.begin(), m_dirty.end());
+	m_dirty.clear();
+	m_dirty_lock.Unlock();
+
+	for (size_t i = 0; i < m_dirty_swap.size(); i++)
 	{
-		m_vl->m_pThreadCS.Enter();
+		auto it = m_map.find(m_dirty_swap[i]);
+		if (it == m_map.end())
+			continue;
+		Entry &e = it->second;
+		int cls = Classify(e.data);
+		if (cls == e.cls)
+			continue;
+		//keep the use order within the new class
+		Unlink(e);
+		Link(e, cls);
+	}
+	m_dirty_swap.clear();
+}
 
-		if (m_vl->m_decomp_queues.size() == 0)
+void BrickCache::brick_state_changed(TextureBrick *brick)
+{
+	wxMutexLocker lock(m_dirty_lock);
+	m_dirty.insert(brick);
+}
+
+bool BrickCache::Find(TextureBrick *brick)
+{
+	return m_map.find(brick) != m_map.end();
+}
+
+void BrickCache::Remove(TextureBrick *brick)
+{
+	auto it = m_map.find(brick);
+	if (it != m_map.end())
+		Erase(it);
+}
+
+void BrickCache::Clear()
+{
+	for (auto it = m_map.begin(); it != m_map.end(); ++it)
+		it->first->remove_state_listener(this);
+	for (int i = 0; i < CLASS_NUM; i++)
+		m_lists[i].head = m_lists[i].tail = 0;
+	m_map.clear();
+	wxMutexLocker lock(m_dirty_lock);
+	m_dirty.clear();
+}
+
+void BrickCache::GetAll(vector<VolumeLoaderData> &list)
+{
+	list.reserve(list.size() + m_map.size());
+	for (auto it = m_map.begin(); it != m_map.end(); ++it)
+		list.push_back(it->second.data);
+}
+
+bool BrickCache::PopEvictable(VolumeLoaderData &data, int max_class)
+{
+	Update();
+	for (int c = 0; c <= max_class && c < CLASS_LOADING; c++)
+	{
+		while (m_lists[c].tail)
 		{
-			m_vl->m_pThreadCS.Leave();
-			break;
+			//the farthest from the view among the least recently used
+			Entry *best = 0;
+			double best_d = 0.0;
+			Entry *e = m_lists[c].tail;
+			for (int n = 0; e && n < BRICK_CACHE_EVICT_SCAN; e = e->prev, n++)
+			{
+				double d = e->data.brick->get_d();
+				if (!best || d > best_d)
+				{
+					best = e;
+					best_d = d;
+				}
+			}
+			auto it = m_map.find(best->data.brick);
+			//changed after the update above
+			int cls = Classify(best->data);
+			if (cls != c)
+			{
+				Place(*best, cls);
+				continue;
+			}
+			//the read or decompression failed
+			if (!best->data.brick->isLoaded())
+			{
+				Erase(it);
+				continue;
+			}
+			data = best->data;
+			Erase(it);
+			return true;
 		}
-		VolumeDecompressorData q = m_vl->m_decomp_queues[0];
-		m_vl->m_decomp_queues.erase(m_vl->m_decomp_queues.begin());
+	}
+	return false;
+}
 
-		m_vl->m_pThreadCS.Leave();
+VolumeDecompressorTask::VolumeDecompressorTask(VolumeLoader *vl, const VolumeDecompressorData &q)
+	: m_vl(vl), m_q(q)
+{
 
+}
 
-		size_t bsize = (size_t)(q.b->nx())*(size_t)(q.b->ny())*(size_t)(q.b->nz())*(size_t)(q.b->nb(0));
-		char *result = new char[bsize];
-		if (TextureBrick::decompress_brick(result, q.in_data, bsize, q.in_size, q.finfo->type))
-		{
-			m_vl->m_pThreadCS.Enter();
+VolumeDecompressorTask::~VolumeDecompressorTask()
+{
 
-			delete [] q.in_data;
-			q.b->set_brkdata(result);
-			q.b->set_loading_state(false);
-			m_vl->m_pThreadCS.Leave();
-		}
-		else
-		{
-			delete [] result;
+}
 
-			m_vl->m_pThreadCS.Enter();
-			delete [] q.in_data;
-			m_vl->m_used_memory -= bsize;
-			q.b->set_drawn(q.mode, true);
-			q.b->set_loading_state(false);
-			m_vl->m_pThreadCS.Leave();
-		}
+void VolumeDecompressorTask::run()
+{
+	VolumeLoader::LoaderClock::time_point t1 = VolumeLoader::LoaderClock::now();
+	size_t bsize = (size_t)(m_q.b->nx())*(size_t)(m_q.b->ny())*(size_t)(m_q.b->nz())*(size_t)(m_q.b->nb(0));
+	char *result = new char[bsize];
+	bool succeeded = TextureBrick::decompress_brick(result, m_q.in_data, bsize, m_q.in_size, m_q.finfo->type, m_q.finfo->filter);
+	VolumeLoader::LoaderClock::time_point t2 = VolumeLoader::LoaderClock::now();
+
+	m_vl->m_pThreadCS.Enter();
+	m_vl->FreeInput(m_q.in_data, m_q.in_buf);
+	if (succeeded)
+	{
+		m_q.b->set_brkdata(result);
+		m_vl->m_latency.ready += m_vl->ElapsedSinceRun();
+		m_vl->m_latency.ready_num++;
 	}
+	else
+	{
+		delete [] result;
+		m_vl->m_used_memory -= bsize;
+		m_q.b->set_drawn(m_q.mode, true);
+		m_vl->m_loaded.Remove(m_q.b);
+	}
+	m_q.b->set_loading_state(false);
+	m_vl->m_latency.decomp += VolumeLoader::ElapsedMs(t1, t2);
+	m_vl->m_latency.decomp_num++;
+	m_vl->m_in_flight--;
+	m_vl->m_pThreadCS.Leave();
 
-	return (wxThread::ExitCode)0;
+	m_vl->Notify();
+}
+
+void VolumeDecompressorTask::cancel()
+{
+	//the brick stays in m_loaded as "loading" and is dropped by the next loader run
+	m_vl->m_pThreadCS.Enter();
+	if (m_q.in_data != NULL)
+		m_vl->FreeInput(m_q.in_data, m_q.in_buf);
+	m_vl->m_used_memory -= m_q.datasize;
+	m_vl->m_in_flight--;
+	m_vl->m_pThreadCS.Leave();
+
+	m_vl->Notify();
+}
+
+VolumeReadRequest::VolumeReadRequest(VolumeLoader *vl, const VolumeDecompressorData &q)
+	: m_vl(vl), m_q(q)
+{
+	m_submit_time = VolumeLoader::LoaderClock::now();
+}
+
+VolumeReadRequest::~VolumeReadRequest()
+{
+	if (data)
+		delete [] data;
+}
+
+void VolumeReadRequest::complete(bool succeeded)
+{
+	VolumeLoader::LoaderClock::time_point t2 = VolumeLoader::LoaderClock::now();
+	m_vl->m_pThreadCS.Enter();
+	m_vl->m_latency.read += VolumeLoader::ElapsedMs(m_submit_time, t2);
+	m_vl->m_latency.read_num++;
+	m_vl->m_pThreadCS.Leave();
+
+	if (succeeded && m_q.finfo->type != BRICK_FILE_TYPE_RAW)
+	{
+		//the brick stays in flight until its decompression is done
+		m_q.in_data = data;
+		m_q.in_size = size;
+		data = NULL;
+		m_vl->m_decomp_pool->submit(new VolumeDecompressorTask(m_vl, m_q));
+		return;
+	}
+
+	m_vl->m_pThreadCS.Enter();
+	if (succeeded)
+	{
+		m_q.b->set_brkdata(data);
+		data = NULL;
+		m_vl->m_latency.ready += m_vl->ElapsedSinceRun();
+		m_vl->m_latency.ready_num++;
+	}
+	else
+	{
+		m_vl->m_used_memory -= m_q.datasize;
+		m_q.b->set_drawn(m_q.mode, true);
+		m_vl->m_loaded.Remove(m_q.b);
+	}
+	m_q.b->set_loading_state(false);
+	m_vl->m_in_flight--;
+	m_vl->m_pThreadCS.Leave();
+
+	m_vl->Notify();
 }
 
 /*
@@ -473,48 +707,171 @@ VolumeLoaderThread::VolumeLoaderThread(VolumeLoader *vl)
 
 VolumeLoaderThread::~VolumeLoaderThread()
 {
-	wxCriticalSectionLocker enter(m_vl->m_pThreadCS);
-	if (!m_vl->m_decomp_queues.empty())
+	FreePayloads();
+	//queued decompression jobs belong to this run; running ones are left to finish
+	if (m_vl->m_decomp_pool)
+		m_vl->m_decomp_pool->cancel_pending();
+	// the thread is being destroyed; make sure not to leave dangling pointers around
+}
+
+bool VolumeLoaderThread::Stopping()
+{
+	return m_vl->StopRequested() || TestDestroy();
+}
+
+void VolumeLoaderThread::FreePayloads()
+{
+	for (auto it = m_payloads.begin(); it != m_payloads.end(); ++it)
+		m_vl->FreeInput(it->second.data, it->second.buf);
+	m_payloads.clear();
+}
+
+bool VolumeLoaderThread::ReadCoalesced(const VolumeLoaderData &b, char* &data, size_t &readsize, CoalescedBuffer* &buf)
+{
+	data = NULL;
+	readsize = 0;
+	buf = NULL;
+
+	auto found = m_payloads.find(b.brick);
+	if (found != m_payloads.end())
+	{
+		data = found->second.data;
+		readsize = found->second.size;
+		buf = found->second.buf;
+		m_payloads.erase(found);
+		return true;
+	}
+
+	//only local bricks with a known extent can be merged
+	if (m_vl->m_coalesce_window <= 1 || b.finfo->isurl || b.finfo->datasize <= 0)
+		return false;
+
+	//bricks waiting in the queue that are stored in the same file
+	vector<VolumeLoaderData> run;
+	run.push_back(b);
+	m_vl->m_pThreadCS.Enter();
+	int window = Min((int)m_vl->m_queues.size(), m_vl->m_coalesce_window);
+	for (int i = 0; i < window; i++)
+	{
+		const VolumeLoaderData &q = m_vl->m_queues[i];
+		if (q.brick == b.brick || q.finfo->isurl || q.finfo->datasize <= 0 ||
+			q.brick->isLoaded() || q.brick->isLoading() ||
+			m_payloads.find(q.brick) != m_payloads.end() ||
+			q.finfo->filename != b.finfo->filename)
+			continue;
+		bool dup = false;
+		for (size_t j = 0; j < run.size() && !dup; j++)
+			dup = run[j].brick == q.brick;
+		if (!dup)
+			run.push_back(q);
+	}
+	m_vl->m_pThreadCS.Leave();
+	if (run.size() == 1)
+		return false;
+
+	//grow a contiguous range around b in file order
+	std::sort(run.begin(), run.end(), VolumeLoader::sort_data_offset);
+	int cur = 0;
+	for (int i = 0; i < run.size(); i++)
+		if (run[i].brick == b.brick) cur = i;
+	int first = cur, last = cur;
+	long long start = b.finfo->offset;
+	long long end = start + b.finfo->datasize;
+	while (last + 1 < run.size())
+	{
+		const FileLocInfo *f = run[last + 1].finfo;
+		long long fend = (long long)f->offset + f->datasize;
+		if (fend < end) fend = end;
+		if (f->offset - end > m_vl->m_coalesce_gap || fend - start > m_vl->m_coalesce_span)
+			break;
+		end = fend;
+		last++;
+	}
+	while (first > 0)
+	{
+		const FileLocInfo *f = run[first - 1].finfo;
+		long long fend = (long long)f->offset + f->datasize;
+		if (start - fend > m_vl->m_coalesce_gap || end - f->offset > m_vl->m_coalesce_span)
+			break;
+		start = f->offset;
+		first--;
+	}
+	if (first == last)
+		return false;
+
+	CoalescedBuffer *cb = new CoalescedBuffer;
+	cb->size = (size_t)(end - start);
+	cb->data = new char[cb->size];
+	if (!BrickFileCache::read(b.finfo->filename, cb->data, cb->size, (uint64_t)start))
+	{
+		delete [] cb->data;
+		delete cb;
+		return false;
+	}
+
+	//every brick in the range gets a slice; the read stays charged
+	//to the memory budget until the last slice is consumed or dropped
+	cb->ref = last - first + 1;
+	m_vl->m_pThreadCS.Enter();
+	m_vl->m_used_memory += cb->size;
+	m_vl->m_pThreadCS.Leave();
+	for (int i = first; i <= last; i++)
 	{
-		for (int i = 0; i < m_vl->m_decomp_queues.size(); i++)
+		const FileLocInfo *f = run[i].finfo;
+		char *p = cb->data + (f->offset - start);
+		if (run[i].brick == b.brick)
 		{
-			if (m_vl->m_decomp_queues[i].in_data != NULL)
-				delete [] m_vl->m_decomp_queues[i].in_data;
-			m_vl->m_used_memory -= m_vl->m_decomp_queues[i].datasize;
+			data = p;
+			readsize = f->datasize;
+		}
+		else
+		{
+			Payload pl;
+			pl.data = p;
+			pl.size = f->datasize;
+			pl.buf = cb;
+			m_payloads[run[i].brick] = pl;
 		}
-		m_vl->m_decomp_queues.clear();
 	}
-	// the thread is being destroyed; make sure not to leave dangling pointers around
+	buf = cb;
+
+	return true;
 }
 
 wxThread::ExitCode VolumeLoaderThread::Entry()
 {
 	unsigned int st_time = GET_TICK_COUNT();
 
-	while(m_vl->m_running_decomp_th > 0)
+	//let the decompression jobs of the previous run finish
+	while(1)
 	{
-		if (TestDestroy())
+		unsigned int seq = m_vl->GetWakeSeq();
+		m_vl->m_pThreadCS.Enter();
+		int in_flight = m_vl->m_in_flight;
+		m_vl->m_pThreadCS.Leave();
+		if (in_flight <= 0)
+			break;
+		if (Stopping())
 			return (wxThread::ExitCode)0;
-		Sleep(10);
+		m_vl->WaitForWake(seq);
 	}
 
 	m_vl->m_pThreadCS.Enter();
-	auto ite = m_vl->m_loaded.begin();
-	while(ite != m_vl->m_loaded.end())
+	vector<VolumeLoaderData> loaded;
+	m_vl->m_loaded.GetAll(loaded);
+	for (int i = 0; i < loaded.size(); i++)
 	{
-		if (!ite->second.brick->isLoaded() && ite->second.brick->isLoading())
+		if (!loaded[i].brick->isLoaded() && loaded[i].brick->isLoading())
 		{
-			ite->second.brick->set_loading_state(false);
-			ite = m_vl->m_loaded.erase(ite);
+			loaded[i].brick->set_loading_state(false);
+			m_vl->m_loaded.Remove(loaded[i].brick);
 		}
-		else
-			ite++;
 	}
 	m_vl->m_pThreadCS.Leave();
 
 	while(1)
 	{
-		if (TestDestroy())
+		if (Stopping())
 			break;
 
 		m_vl->m_pThreadCS.Enter();
@@ -526,107 +883,189 @@ wxThread::ExitCode VolumeLoaderThread::Entry()
 		VolumeLoaderData b = m_vl->m_queues[0];
 		b.brick->set_loading_state(false);
 		m_vl->m_queues.erase(m_vl->m_queues.begin());
-		m_vl->m_queued.push_back(b);
+		//datasize of a queued entry holds the bytes it was counted for in Set()
+		m_vl->m_required_memory -= b.datasize;
+		m_vl->m_queued[b.brick] |= 1 << b.mode;
+		m_vl->m_latency.queue_wait += m_vl->ElapsedSinceRun();
+		m_vl->m_latency.queue_wait_num++;
 		m_vl->m_pThreadCS.Leave();
 
 		if (!b.brick->isLoaded() && !b.brick->isLoading())
 		{
-			if (m_vl->m_used_memory >= m_vl->m_memory_limit)
+			m_vl->m_cache_misses++;
+
+			//wait until eviction or a finished decompression frees enough memory
+			while(1)
 			{
+				unsigned int seq = m_vl->GetWakeSeq();
 				m_vl->m_pThreadCS.Enter();
+				if (m_vl->m_used_memory >= m_vl->m_memory_limit)
+					m_vl->CleanupLoadedBrick();
+				bool has_room = m_vl->m_used_memory < m_vl->m_memory_limit;
+				m_vl->m_pThreadCS.Leave();
+				if (has_room || Stopping())
+					break;
+				m_vl->WaitForWake(seq);
+			}
+
+			//local bricks of known size are read asynchronously unless
+			//their data already came with a coalesced read
+			bool async = m_vl->m_reader && !b.finfo->isurl && b.finfo->datasize > 0 &&
+				(b.finfo->type == BRICK_FILE_TYPE_RAW || m_vl->m_decomp_pool) &&
+				m_payloads.find(b.brick) == m_payloads.end();
+
+			//bound the number of bricks read ahead of the decompressors
+			if ((b.finfo->type != BRICK_FILE_TYPE_RAW && m_vl->m_decomp_pool) || async)
+			{
 				while(1)
 				{
-					m_vl->CleanupLoadedBrick();
-					if (m_vl->m_used_memory < m_vl->m_memory_limit || TestDestroy())
-						break;
+					unsigned int seq = m_vl->GetWakeSeq();
+					m_vl->m_pThreadCS.Enter();
+					bool has_slot = m_vl->m_in_flight < m_vl->m_max_in_flight;
 					m_vl->m_pThreadCS.Leave();
-					Sleep(10);
+					if (has_slot || Stopping())
+						break;
+					m_vl->WaitForWake(seq);
+				}
+			}
+			if (Stopping())
+				break;
+
+			VolumeLoader::LoaderClock::time_point t1, t2;
+			if (b.finfo->type == BRICK_FILE_TYPE_RAW)
+			{
+				//RAW bricks are used in place from the mapped file
+				size_t bsize = (size_t)(b.brick->nx())*(size_t)(b.brick->ny())*(size_t)(b.brick->nz())*(size_t)(b.brick->nb(0));
+				MappedFile *mf = NULL;
+				t1 = VolumeLoader::LoaderClock::now();
+				const char *mptr = BrickFileCache::map_brick(b.finfo, bsize, mf);
+				t2 = VolumeLoader::LoaderClock::now();
+				if (mptr)
+				{
 					m_vl->m_pThreadCS.Enter();
+					m_vl->PrefetchQueued();
+					b.brick->set_brkdata_mapped(mptr, mf);
+					b.datasize = bsize;
+					m_vl->AddLoadedBrick(b);
+					m_vl->m_latency.read += VolumeLoader::ElapsedMs(t1, t2);
+					m_vl->m_latency.read_num++;
+					m_vl->m_latency.ready += m_vl->ElapsedSinceRun();
+					m_vl->m_latency.ready_num++;
+					m_vl->m_pThreadCS.Leave();
+					continue;
 				}
-				m_vl->m_pThreadCS.Leave();
 			}
 
 			char *ptr = NULL;
 			size_t readsize;
-			TextureBrick::read_brick_without_decomp(ptr, readsize, b.finfo, this);
+			CoalescedBuffer *cb = NULL;
+			t1 = VolumeLoader::LoaderClock::now();
+			bool coalesced = ReadCoalesced(b, ptr, readsize, cb);
+			if (!coalesced && async)
+			{
+				//the read completes on the reader and hands the data to the decompressors
+				size_t bsize = (size_t)(b.brick->nx())*(size_t)(b.brick->ny())*(size_t)(b.brick->nz())*(size_t)(b.brick->nb(0));
+				VolumeDecompressorData dq;
+				dq.b = b.brick;
+				dq.finfo = b.finfo;
+				dq.vd = b.vd;
+				dq.mode = b.mode;
+				dq.in_data = NULL;
+				dq.in_buf = NULL;
+				dq.in_size = 0;
+				dq.datasize = bsize;
+				b.datasize = bsize;
+
+				m_vl->m_pThreadCS.Enter();
+				m_vl->m_used_memory += bsize;
+				m_vl->m_in_flight++;
+				b.brick->set_loading_state(true);
+				m_vl->m_loaded.Put(b);
+				m_vl->m_pThreadCS.Leave();
+
+				VolumeReadRequest *req = new VolumeReadRequest(m_vl, dq);
+				req->filename = b.finfo->filename;
+				req->offset = b.finfo->offset;
+				req->size = b.finfo->datasize;
+				req->data = new char[req->size];
+				m_vl->m_reader->submit(req);
+				continue;
+			}
+			if (!coalesced)
+				TextureBrick::read_brick_without_decomp(ptr, readsize, b.finfo, this);
+			t2 = VolumeLoader::LoaderClock::now();
 			if (!ptr) continue;
 
+			m_vl->m_pThreadCS.Enter();
+			m_vl->m_latency.read += VolumeLoader::ElapsedMs(t1, t2);
+			m_vl->m_latency.read_num++;
+			m_vl->m_pThreadCS.Leave();
+
 			if (b.finfo->type == BRICK_FILE_TYPE_RAW)
 			{
+				if (cb)
+				{
+					//the brick owns its data, so a slice is copied out
+					char *own = new char[readsize];
+					memcpy(own, ptr, readsize);
+					m_vl->FreeInput(ptr, cb);
+					ptr = own;
+				}
 				m_vl->m_pThreadCS.Enter();
 				b.brick->set_brkdata(ptr);
 				b.datasize = readsize;
 				m_vl->AddLoadedBrick(b);
+				m_vl->m_latency.ready += m_vl->ElapsedSinceRun();
+				m_vl->m_latency.ready_num++;
 				m_vl->m_pThreadCS.Leave();
 			}
 			else
 			{
-				bool decomp_in_this_thread = false;
 				VolumeDecompressorData dq;
 				dq.b = b.brick;
 				dq.finfo = b.finfo;
 				dq.vd = b.vd;
 				dq.mode = b.mode;
 				dq.in_data = ptr;
+				dq.in_buf = cb;
 				dq.in_size = readsize;
 
 				size_t bsize = (size_t)(b.brick->nx())*(size_t)(b.brick->ny())*(size_t)(b.brick->nz())*(size_t)(b.brick->nb(0));
 				b.datasize = bsize;
 				dq.datasize = bsize;
 
-				if (m_vl->m_max_decomp_th == 0)
-					decomp_in_this_thread = true;
-				else if (m_vl->m_max_decomp_th < 0 || 
-					m_vl->m_running_decomp_th < m_vl->m_max_decomp_th)
-				{
-					VolumeDecompressorThread *dthread = new VolumeDecompressorThread(m_vl);
-					if (dthread->Create() == wxTHREAD_NO_ERROR)
-					{
-						m_vl->m_pThreadCS.Enter();
-						m_vl->m_decomp_queues.push_back(dq);
-						m_vl->m_used_memory += bsize;
-						b.brick->set_loading_state(true);
-						m_vl->m_loaded[b.brick] = b;
-						m_vl->m_pThreadCS.Leave();
-
-						dthread->Run();
-					}
-					else
-					{
-						if (m_vl->m_running_decomp_th <= 0)
-							decomp_in_this_thread = true;
-						else
-						{
-							m_vl->m_pThreadCS.Enter();
-							m_vl->m_decomp_queues.push_back(dq);
-							m_vl->m_used_memory += bsize;
-							b.brick->set_loading_state(true);
-							m_vl->m_loaded[b.brick] = b;
-							m_vl->m_pThreadCS.Leave();
-						}
-					}
-				}
-				else
+				if (m_vl->m_decomp_pool)
 				{
+					//hand the brick to the pool and go on reading the next one
 					m_vl->m_pThreadCS.Enter();
-					m_vl->m_decomp_queues.push_back(dq);
 					m_vl->m_used_memory += bsize;
+					m_vl->m_in_flight++;
 					b.brick->set_loading_state(true);
-					m_vl->m_loaded[b.brick] = b;
+					m_vl->m_loaded.Put(b);
 					m_vl->m_pThreadCS.Leave();
-				}
 
-				if (decomp_in_this_thread)
+					m_vl->m_decomp_pool->submit(new VolumeDecompressorTask(m_vl, dq));
+				}
+				else
 				{
 					char *result = new char[bsize];
-					if (TextureBrick::decompress_brick(result, dq.in_data, bsize, dq.in_size, dq.finfo->type))
+					t1 = VolumeLoader::LoaderClock::now();
+					bool succeeded = TextureBrick::decompress_brick(result, dq.in_data, bsize, dq.in_size, dq.finfo->type, dq.finfo->filter);
+					t2 = VolumeLoader::LoaderClock::now();
+					m_vl->m_pThreadCS.Enter();
+					m_vl->m_latency.decomp += VolumeLoader::ElapsedMs(t1, t2);
+					m_vl->m_latency.decomp_num++;
+					m_vl->m_pThreadCS.Leave();
+					if (succeeded)
 					{
 						m_vl->m_pThreadCS.Enter();
-						delete [] dq.in_data;
+						m_vl->FreeInput(dq.in_data, dq.in_buf);
 						b.brick->set_brkdata(result);
 						b.datasize = bsize;
 						m_vl->m_used_memory += bsize;
-						m_vl->m_loaded[b.brick] = b;
+						m_vl->m_loaded.Put(b);
+						m_vl->m_latency.ready += m_vl->ElapsedSinceRun();
+						m_vl->m_latency.ready_num++;
 						m_vl->m_pThreadCS.Leave();
 					}
 					else
@@ -634,7 +1073,7 @@ wxThread::ExitCode VolumeLoaderThread::Entry()
 						delete [] result;
 
 						m_vl->m_pThreadCS.Enter();
-						delete [] dq.in_data;
+						m_vl->FreeInput(dq.in_data, dq.in_buf);
 						m_vl->m_used_memory -= bsize;
 						dq.b->set_drawn(dq.mode, true);
 						m_vl->m_pThreadCS.Leave();
@@ -649,8 +1088,8 @@ wxThread::ExitCode VolumeLoaderThread::Entry()
 			b.datasize = bsize;
 
 			m_vl->m_pThreadCS.Enter();
-			if (m_vl->m_loaded.find(b.brick) != m_vl->m_loaded.end())
-				m_vl->m_loaded[b.brick] = b;
+			if (m_vl->m_loaded.Touch(b) && b.brick->isLoaded())
+				m_vl->m_cache_hits++;
 			m_vl->m_pThreadCS.Leave();
 		}
 	}
@@ -664,18 +1103,36 @@ wxThread::ExitCode VolumeLoaderThread::Entry()
 	evt.SetClientData(data);
 	wxPostEvent(m_pParent, evt);
 	*/
+	FreePayloads();
 	return (wxThread::ExitCode)0;
 }
 
 VolumeLoader::VolumeLoader()
+	: m_wait_cond(m_wait_lock)
 {
 	m_thread = NULL;
-	m_running_decomp_th = 0;
+	m_decomp_pool = NULL;
+	m_reader = NULL;
+	m_async_depth = 32;
 	m_max_decomp_th = wxThread::GetCPUCount()-1;
 	if (m_max_decomp_th < 0)
 		m_max_decomp_th = -1;
+	m_in_flight = 0;
+	m_max_in_flight = 0;
+	m_prefetch_window = 8;
+	m_coalesce_window = 32;
+	m_coalesce_gap = 64LL*1024LL;
+	m_coalesce_span = 16LL*1024LL*1024LL;
+	m_wake_seq = 0;
+	m_stop_req = false;
 	m_memory_limit = 10000000LL;
 	m_used_memory = 0LL;
+	m_required_memory = 0LL;
+	m_cache_hits = 0LL;
+	m_cache_misses = 0LL;
+	m_cache_evictions = 0LL;
+	m_latency.Reset();
+	m_run_time = LoaderClock::now();
 }
 
 VolumeLoader::~VolumeLoader()
@@ -689,12 +1146,38 @@ VolumeLoader::~VolumeLoader()
 		}
 		delete m_thread;
 	}
+	m_thread = NULL;
+	//pending reads still hand their data to the pool
+	if (m_reader)
+		delete m_reader;
+	m_reader = NULL;
+	if (m_decomp_pool)
+		m_decomp_pool->wait_idle();
 	RemoveAllLoadedBrick();
+	if (m_decomp_pool)
+		delete m_decomp_pool;
+	m_decomp_pool = NULL;
+}
+
+void VolumeLoader::SetMaxThreadNum(int num)
+{
+	if (num == m_max_decomp_th)
+		return;
+	//the pool is rebuilt with the new size on the next Run()
+	StopAll();
+	if (m_decomp_pool)
+		delete m_decomp_pool;
+	m_decomp_pool = NULL;
+	m_max_decomp_th = num;
 }
 
 void VolumeLoader::Queue(VolumeLoaderData brick)
 {
 	wxCriticalSectionLocker enter(m_pThreadCS);
+	TextureBrick *b = brick.brick;
+	brick.datasize = b->isLoaded() ? 0 :
+		(size_t)b->nx()*(size_t)b->ny()*(size_t)b->nz()*(size_t)b->nb(0);
+	m_required_memory += brick.datasize;
 	m_queues.push_back(brick);
 }
 
@@ -704,6 +1187,7 @@ void VolumeLoader::ClearQueues()
 	{
 		Abort();
 		m_queues.clear();
+		m_required_memory = 0LL;
 	}
 }
 
@@ -712,12 +1196,33 @@ void VolumeLoader::Set(vector<VolumeLoaderData> vld)
 	Abort();
 	//StopAll();
 	m_queues = vld;
+
+	//bytes still to be read, kept up to date as the loader takes entries
+	m_required_memory = 0LL;
+	for (int i = 0; i < m_queues.size(); i++)
+	{
+		TextureBrick *b = m_queues[i].brick;
+		m_queues[i].datasize = b->isLoaded() ? 0 :
+			(size_t)b->nx()*(size_t)b->ny()*(size_t)b->nz()*(size_t)b->nb(0);
+		m_required_memory += m_queues[i].datasize;
+	}
+
+	//the distances are read when evicting, only the classes may be behind
+	m_pThreadCS.Enter();
+	m_loaded.Update();
+	m_pThreadCS.Leave();
 }
 
 void VolumeLoader::Abort()
 {
 	if (m_thread)
 	{
+		//wake the loader if it is blocked on memory or decompression slots
+		m_wait_lock.Lock();
+		m_stop_req = true;
+		m_wake_seq++;
+		m_wait_cond.Broadcast();
+		m_wait_lock.Unlock();
 		if (m_thread->IsAlive())
 		{
 			m_thread->Delete();
@@ -725,6 +1230,9 @@ void VolumeLoader::Abort()
 		}
 		delete m_thread;
 		m_thread = NULL;
+		m_wait_lock.Lock();
+		m_stop_req = false;
+		m_wait_lock.Unlock();
 	}
 }
 
@@ -732,10 +1240,22 @@ void VolumeLoader::StopAll()
 {
 	Abort();
 
-	while(m_running_decomp_th > 0)
-	{
-		wxMilliSleep(10);
-	}
+	if (m_reader)
+		m_reader->wait_idle();
+	if (m_decomp_pool)
+		m_decomp_pool->wait_idle();
+}
+
+void VolumeLoader::SetAsyncReadDepth(int depth)
+{
+	if (depth == m_async_depth)
+		return;
+	//the reader is rebuilt with the new depth on the next Run()
+	StopAll();
+	if (m_reader)
+		delete m_reader;
+	m_reader = NULL;
+	m_async_depth = depth;
 }
 
 bool VolumeLoader::Run()
@@ -745,6 +1265,29 @@ bool VolumeLoader::Run()
 	if (!m_queued.empty())
 		m_queued.clear();
 
+	//m_max_decomp_th: 0 decompresses on the loader thread, <0 uses every core
+	if (!m_decomp_pool && m_max_decomp_th != 0)
+	{
+		m_decomp_pool = new FLIVR::ThreadPool(m_max_decomp_th > 0 ? m_max_decomp_th : 0);
+		if (m_decomp_pool->get_thread_num() == 0)
+		{
+			delete m_decomp_pool;
+			m_decomp_pool = NULL;
+		}
+	}
+	if (!m_reader && m_async_depth > 0)
+		m_reader = new FLIVR::AsyncBrickReader(m_async_depth);
+	//keep every decompressor busy with one brick waiting behind it
+	m_max_in_flight = m_decomp_pool ? m_decomp_pool->get_thread_num()*2 : 0;
+	//and the reader busy with as many reads as it can take
+	if (m_reader && m_max_in_flight < m_reader->get_depth())
+		m_max_in_flight = m_reader->get_depth();
+
+	m_pThreadCS.Enter();
+	m_latency.Reset();
+	m_run_time = LoaderClock::now();
+	m_pThreadCS.Leave();
+
 	m_thread = new VolumeLoaderThread(this);
 	if (m_thread->Create() != wxTHREAD_NO_ERROR)
 	{
@@ -757,91 +1300,88 @@ bool VolumeLoader::Run()
 	return true;
 }
 
-void VolumeLoader::CleanupLoadedBrick()
+void VolumeLoader::EvictBrick(const VolumeLoaderData &data)
 {
-	long long required = 0;
+	data.brick->freeBrkData();
+	m_used_memory -= data.datasize;
+	m_cache_evictions++;
+}
 
-	for(int i = 0; i < m_queues.size(); i++)
+//issue readahead for the next RAW bricks in queue (priority) order
+//so that the disk works ahead of the first touch of the mapped pages
+void VolumeLoader::PrefetchQueued()
+{
+	int count = 0;
+	for (size_t i = 0; i < m_queues.size() && count < m_prefetch_window; i++)
 	{
-		TextureBrick *b = m_queues[i].brick;
-		if (!m_queues[i].brick->isLoaded())
-			required += (size_t)b->nx()*(size_t)b->ny()*(size_t)b->nz()*(size_t)b->nb(0);
+		const VolumeLoaderData &q = m_queues[i];
+		if (q.finfo->type != BRICK_FILE_TYPE_RAW || q.brick->isLoaded())
+			continue;
+		size_t bsize = (size_t)(q.brick->nx())*(size_t)(q.brick->ny())*(size_t)(q.brick->nz())*(size_t)(q.brick->nb(0));
+		BrickFileCache::prefetch_brick(q.finfo, bsize);
+		count++;
 	}
+}
 
-	vector<VolumeLoaderData> vd_undisp;
-	vector<VolumeLoaderData> b_undisp;
-	vector<VolumeLoaderData> b_drawn;
-	for(auto elem : m_loaded)
-	{
-		if (!elem.second.vd->GetDisp())
-			vd_undisp.push_back(elem.second);
-		else if(!elem.second.brick->get_disp())
-			b_undisp.push_back(elem.second);
-		else if (elem.second.brick->drawn(elem.second.mode))
-			b_drawn.push_back(elem.second);
-	}
-	if (required > 0 || m_used_memory >= m_memory_limit)
+void VolumeLoader::FreeInput(char *data, CoalescedBuffer *buf)
+{
+	if (!buf)
 	{
-		for (int i = 0; i < vd_undisp.size(); i++)
-		{
-			if (!vd_undisp[i].brick->isLoaded())
-				continue;
-			vd_undisp[i].brick->freeBrkData();
-			required -= vd_undisp[i].datasize;
-			m_used_memory -= vd_undisp[i].datasize;
-			m_loaded.erase(vd_undisp[i].brick);
-			if (required <= 0 && m_used_memory < m_memory_limit)
-				break;
-		}
+		delete [] data;
+		return;
 	}
-	if (required > 0 || m_used_memory >= m_memory_limit)
+	m_pThreadCS.Enter();
+	bool last = --buf->ref <= 0;
+	if (last)
 	{
-		for (int i = 0; i < b_undisp.size(); i++)
-		{
-			if (!b_undisp[i].brick->isLoaded())
-				continue;
-			b_undisp[i].brick->freeBrkData();
-			required -= b_undisp[i].datasize;
-			m_used_memory -= b_undisp[i].datasize;
-			m_loaded.erase(b_undisp[i].brick);
-			if (required <= 0 && m_used_memory < m_memory_limit)
-				break;
-		}
+		//the whole range was charged when it was read
+		m_used_memory -= buf->size;
+		delete [] buf->data;
+		delete buf;
 	}
-	if (required > 0 || m_used_memory >= m_memory_limit)
+	m_pThreadCS.Leave();
+	if (last)
+		Notify();
+}
+
+void VolumeLoader::CleanupLoadedBrick()
+{
+	long long required = m_required_memory;
+
+	//hidden volumes first, then bricks out of view, then drawn ones;
+	//least recently used first within each class
+	VolumeLoaderData d;
+	while ((required > 0 || m_used_memory >= m_memory_limit) &&
+		m_loaded.PopEvictable(d))
 	{
-		for (int i = 0; i < b_drawn.size(); i++)
-		{
-			if (!b_drawn[i].brick->isLoaded())
-				continue;
-			b_drawn[i].brick->freeBrkData();
-			required -= b_drawn[i].datasize;
-			m_used_memory -= b_drawn[i].datasize;
-			m_loaded.erase(b_drawn[i].brick);
-			if (required <= 0 && m_used_memory < m_memory_limit)
-				break;
-		}
+		EvictBrick(d);
+		required -= d.datasize;
 	}
+
+	//still over budget: drop the farthest queued bricks that are not waiting to be drawn
 	if (m_used_memory >= m_memory_limit)
 	{
 		for(int i = m_queues.size()-1; i >= 0; i--)
 		{
 			TextureBrick *b = m_queues[i].brick;
-			if (b->isLoaded() && m_loaded.find(b) != m_loaded.end())
+			if (b->isLoaded() && m_loaded.Find(b))
 			{
 				bool skip = false;
-				for (int j = m_queued.size()-1; j >= 0; j--)
+				auto q = m_queued.find(b);
+				if (q != m_queued.end())
 				{
-					if (m_queued[j].brick == b && !b->drawn(m_queued[j].mode))
-						skip = true;
+					for (int mode = 0; mode < TEXTURE_RENDER_MODES; mode++)
+					{
+						if ((q->second & (1<<mode)) && !b->drawn(mode))
+							skip = true;
+					}
 				}
 				if (!skip)
 				{
-					b->freeBrkData();
-					long long datasize = (size_t)(b->nx())*(size_t)(b->ny())*(size_t)(b->nz())*(size_t)(b->nb(0));
-					required -= datasize;
-					m_used_memory -= datasize;
-					m_loaded.erase(b);
+					d.brick = b;
+					d.datasize = (size_t)(b->nx())*(size_t)(b->ny())*(size_t)(b->nz())*(size_t)(b->nb(0));
+					m_loaded.Remove(b);
+					EvictBrick(d);
 					if (m_used_memory < m_memory_limit)
 						break;
 				}
@@ -854,32 +1394,81 @@ void VolumeLoader::CleanupLoadedBrick()
 void VolumeLoader::RemoveAllLoadedBrick()
 {
 	StopAll();
-	for(auto e : m_loaded)
+	vector<VolumeLoaderData> list;
+	m_loaded.GetAll(list);
+	for (int i = 0; i < list.size(); i++)
 	{
-		if (e.second.brick->isLoaded())
+		if (list[i].brick->isLoaded())
 		{
-			e.second.brick->freeBrkData();
-			m_used_memory -= e.second.datasize;
+			list[i].brick->freeBrkData();
+			m_used_memory -= list[i].datasize;
 		}
 	}
-	m_loaded.clear();
+	m_loaded.Clear();
+	Notify();
 }
 
 void VolumeLoader::RemoveBrickVD(VolumeData *vd)
 {
 	StopAll();
-	auto ite = m_loaded.begin();
-	while(ite != m_loaded.end())
+	vector<VolumeLoaderData> list;
+	m_loaded.GetAll(list);
+	for (int i = 0; i < list.size(); i++)
 	{
-		if (ite->second.vd == vd && ite->second.brick->isLoaded())
+		if (list[i].vd == vd && list[i].brick->isLoaded())
 		{
-			ite->second.brick->freeBrkData();
-			m_used_memory -= ite->second.datasize;
-			ite = m_loaded.erase(ite);
+			list[i].brick->freeBrkData();
+			m_used_memory -= list[i].datasize;
+			m_loaded.Remove(list[i].brick);
 		}
-		else
-			ite++;
 	}
+	Notify();
+}
+
+void VolumeLoader::Notify()
+{
+	wxMutexLocker lock(m_wait_lock);
+	m_wake_seq++;
+	m_wait_cond.Broadcast();
+}
+
+unsigned int VolumeLoader::GetWakeSeq()
+{
+	wxMutexLocker lock(m_wait_lock);
+	return m_wake_seq;
+}
+
+bool VolumeLoader::StopRequested()
+{
+	wxMutexLocker lock(m_wait_lock);
+	return m_stop_req;
+}
+
+void VolumeLoader::WaitForWake(unsigned int seq)
+{
+	//every change the loader waits for is followed by Notify()
+	wxMutexLocker lock(m_wait_lock);
+	while (seq == m_wake_seq && !m_stop_req)
+		m_wait_cond.Wait();
+}
+
+double VolumeLoader::ElapsedMs(LoaderClock::time_point t1, LoaderClock::time_point t2)
+{
+	return boost::chrono::duration_cast<boost::chrono::duration<double, boost::milli> >(t2 - t1).count();
+}
+
+double VolumeLoader::ElapsedSinceRun()
+{
+	return ElapsedMs(m_run_time, LoaderClock::now());
+}
+
+void VolumeLoader::GetLatency(double &queue_wait, double &read, double &decomp, double &ready)
+{
+	wxCriticalSectionLocker enter(m_pThreadCS);
+	queue_wait = m_latency.queue_wait_num > 0 ? m_latency.queue_wait / m_latency.queue_wait_num : 0.0;
+	read = m_latency.read_num > 0 ? m_latency.read / m_latency.read_num : 0.0;
+	decomp = m_latency.decomp_num > 0 ? m_latency.decomp / m_latency.decomp_num : 0.0;
+	ready = m_latency.ready_num > 0 ? m_latency.ready / m_latency.ready_num : 0.0;
 }
 
 void VolumeLoader::GetPalams(long long &used_mem, int &running_decomp_th, int &queue_num, int &decomp_queue_num)
@@ -894,9 +1483,18 @@ void VolumeLoader::GetPalams(long long &used_mem, int &running_decomp_th, int &q
 			ll++;
 	}
 */	used_mem = m_used_memory;
-	running_decomp_th = m_running_decomp_th;
+	running_decomp_th = m_decomp_pool ? m_decomp_pool->get_running_num() : 0;
 	queue_num = m_queues.size();
-	decomp_queue_num = m_decomp_queues.size();
+	decomp_queue_num = m_decomp_pool ? m_decomp_pool->get_pending_num() : 0;
+}
+
+void VolumeLoader::GetPalams(long long &used_mem, int &running_decomp_th, int &queue_num, int &decomp_queue_num,
+	long long &cache_hits, long long &cache_misses, long long &cache_evictions)
+{
+	GetPalams(used_mem, running_decomp_th, queue_num, decomp_queue_num);
+	cache_hits = m_cache_hits;
+	cache_misses = m_cache_misses;
+	cache_evictions = m_cache_evictions;
 }
 
 //////////////////////////////////////////////////////////////////////////
@@ -2408,6 +3006,8 @@ void VRenderGLView::DrawVolumes(int peel)
 		if (TextureRenderer::get_start_update_loop() &&
 			TextureRenderer::get_done_update_loop())
 			TextureRenderer::reset_update_loop();
+		//drawn bricks can now be evicted by a loader waiting for memory
+		m_loader.Notify();
 	}
 
 	if (m_interactive)
@@ -6566,7 +7166,8 @@ void VRenderGLView::Get4DSeqFrames(int &start_frame, int &end_frame, int &cur_fr
 
 			int vd_start_frame = 0;
 			int vd_end_frame = reader->GetTimeNum()-1;
-			int vd_cur_frame = reader->GetCurTime();
+			//the reader may be decoding a later frame in the background
+			int vd_cur_frame = vd->GetCurTime();
 
 			if (i==0)
 			{
@@ -6601,6 +7202,8 @@ void VRenderGLView::Set4DSeqFrame(int frame, bool run_script)
 		m_run_script = vframe->GetSettingDlg()->GetRunScript();
 		m_script_file = vframe->GetSettingDlg()->GetScriptFile();
 	}
+	DataManager* mgr = vframe?vframe->GetDataManager():0;
+	FramePrefetcher* prefetcher = mgr?mgr->GetPrefetcher():0;
 
 	for (int i=0; i<(int)m_vd_pop_list.size(); i++)
 	{
@@ -6635,11 +7238,15 @@ void VRenderGLView::Set4DSeqFrame(int frame, bool run_script)
 					double spcx, spcy, spcz;
 					vd->GetSpacings(spcx, spcy, spcz);
 
-					Nrrd* data = reader->Convert(frame, vd->GetCurChannel(), false);
+					//frames decoded ahead are swapped in
+					Nrrd* data = prefetcher?
+						prefetcher->Get(reader, frame, vd->GetCurChannel(),
+							mgr->IsFrameShared(reader, vd->GetCurChannel())):
+						reader->Convert(frame, vd->GetCurChannel(), false);
 					if (!vd->Replace(data, false))
 						continue;
 
-					vd->SetCurTime(reader->GetCurTime());
+					vd->SetCurTime(frame);
 					vd->SetSpacings(spcx, spcy, spcz);
 
 					//update rulers
@@ -6658,6 +7265,16 @@ void VRenderGLView::Set4DSeqFrame(int frame, bool run_script)
 				vd->GetVR()->clear_tex_pool();
 		}
 	}
+
+	//decode the next frames while this one is shown
+	//the current frames of all datasets are loaded first
+	for (int i=0; prefetcher && i<(int)m_vd_pop_list.size(); i++)
+	{
+		VolumeData* vd = m_vd_pop_list[i];
+		if (vd && vd->GetReader() && !vd->isBrxml())
+			prefetcher->Prefetch(vd->GetReader(), frame,
+				vd->GetCurChannel(), start_frame, end_frame);
+	}
 	RefreshGL();
 }
 
@@ -6711,6 +7328,10 @@ void VRenderGLView::Set3DBatFrame(int offset)
 
 	m_tseq_prv_num = m_tseq_cur_num;
 	m_tseq_cur_num = offset;
+	//frames decoded ahead belong to the previous files
+	VRenderFrame* vframe = (VRenderFrame*)m_frame;
+	if (vframe && vframe->GetDataManager())
+		vframe->GetDataManager()->GetPrefetcher()->Clear();
 	for (i=0; i<(int)m_vd_pop_list.size(); i++)
 	{
 		VolumeData* vd = m_vd_pop_list[i];
@@ -10346,10 +10967,25 @@ void VRenderGLView::DrawInfo(int nx, int ny)
 	if (m_cur_vol && m_cur_vol->isBrxml())
 	{
 		str += wxString::Format(" VVD_Level: %d/%d,", m_cur_vol->GetLevel()+1, m_cur_vol->GetLevelNum());
-		long long used_mem;
+		long long used_mem, hits, misses, evictions;
 		int dtnum, qnum, dqnum;
-		m_loader.GetPalams(used_mem, dtnum, qnum, dqnum);
+		m_loader.GetPalams(used_mem, dtnum, qnum, dqnum, hits, misses, evictions);
 		str += wxString::Format(" Mem: %lld Th: %d Q: %d DQ: %d,", used_mem, dtnum, qnum, dqnum);
+		str += wxString::Format(" Cache H: %lld M: %lld E: %lld,", hits, misses, evictions);
+		double lt_queue, lt_read, lt_decomp, lt_ready;
+		m_loader.GetLatency(lt_queue, lt_read, lt_decomp, lt_ready);
+		str += wxString::Format(" Lat(ms) Q: %.1f R: %.1f D: %.1f U: %.1f,", lt_queue, lt_read, lt_decomp, lt_ready);
+	}
+
+	VRenderFrame* vframe = (VRenderFrame*)m_frame;
+	FramePrefetcher* prefetcher = vframe && vframe->GetDataManager()?
+		vframe->GetDataManager()->GetPrefetcher():0;
+	if (prefetcher &&
+		prefetcher->GetHits() + prefetcher->GetWaits() + prefetcher->GetMisses() > 0)
+	{
+		str += wxString::Format(" Prefetch H: %lld W: %lld M: %lld (%.0f%%),",
+			prefetcher->GetHits(), prefetcher->GetWaits(), prefetcher->GetMisses(),
+			prefetcher->GetHitRate()*100.0);
 	}
 
 	wstring wstr_temp = str.ToStdWstring();
@@ -10878,10 +11514,21 @@ void VRenderGLView::StartLoopUpdate()
 					vector<TextureBrick*> *bricks = tex->get_sorted_bricks(view_ray, !m_persp);
 					if (!bricks || bricks->size()==0)
 						continue;
+					//bricks outside the clipping box are culled without the full test
+					BBox clip_box;
+					bool clip_cull = vd->GetVR()->get_clip_box(clip_box);
+					unordered_set<TextureBrick*> in_clip;
+					if (clip_cull)
+					{
+						vector<TextureBrick*> clip_bricks;
+						tex->get_bricks_box(clip_box, clip_bricks);
+						in_clip.insert(clip_bricks.begin(), clip_bricks.end());
+					}
 					for (j=0; j<bricks->size(); j++)
 					{
 						(*bricks)[j]->set_drawn(false);
 						if ((*bricks)[j]->get_priority()>0 ||
+							(clip_cull && in_clip.find((*bricks)[j]) == in_clip.end()) ||
 							!vd->GetVR()->test_against_view_clip((*bricks)[j]->bbox(), (*bricks)[j]->tbox(), (*bricks)[j]->dbox(), m_persp))//changed by takashi
 						{
 							(*bricks)[j]->set_disp(false);
@@ -10976,16 +11623,16 @@ void VRenderGLView::StartLoopUpdate()
 				}
 			}
 			if (TextureRenderer::get_update_order() == 1)
-				std::sort(queues.begin(), queues.end(), VolumeLoader::sort_data_dsc);
+				BrickOrder::sort(queues, VolumeLoader::sort_data_key, false);
 			else if (TextureRenderer::get_update_order() == 0)
-				std::sort(queues.begin(), queues.end(), VolumeLoader::sort_data_asc);
+				BrickOrder::sort(queues, VolumeLoader::sort_data_key, true);
 
 			if (!tmp_shade.empty())
 			{
 				if (TextureRenderer::get_update_order() == 1)
-					std::sort(tmp_shade.begin(), tmp_shade.end(), VolumeLoader::sort_data_dsc);
+					BrickOrder::sort(tmp_shade, VolumeLoader::sort_data_key, false);
 				else if (TextureRenderer::get_update_order() == 0)
-					std::sort(tmp_shade.begin(), tmp_shade.end(), VolumeLoader::sort_data_asc);
+					BrickOrder::sort(tmp_shade, VolumeLoader::sort_data_key, true);
 				queues.insert(queues.end(), tmp_shade.begin(), tmp_shade.end());
 			}
 			if (!tmp_shadow.empty())
@@ -11002,10 +11649,10 @@ void VRenderGLView::StartLoopUpdate()
 						list[i]->GetTexture()->set_sort_bricks();
 					}
 					TextureRenderer::set_update_order(order);
-					std::sort(tmp_shadow.begin(), tmp_shadow.end(), VolumeLoader::sort_data_asc);
+					BrickOrder::sort(tmp_shadow, VolumeLoader::sort_data_key, true);
 				}
 				else if (TextureRenderer::get_update_order() == 0)
-					std::sort(tmp_shadow.begin(), tmp_shadow.end(), VolumeLoader::sort_data_asc);
+					BrickOrder::sort(tmp_shadow, VolumeLoader::sort_data_key, true);
 				queues.insert(queues.end(), tmp_shadow.begin(), tmp_shadow.end());
 			}
 		}
@@ -11072,7 +11719,7 @@ void VRenderGLView::StartLoopUpdate()
 									tex->get_sorted_bricks(view_ray, !m_persp); //recalculate brick.d_
 									tex->set_sort_bricks();
 									TextureRenderer::set_update_order(order);
-									std::sort(tmp_shadow.begin(), tmp_shadow.end(), VolumeLoader::sort_data_asc);
+									BrickOrder::sort(tmp_shadow, VolumeLoader::sort_data_key, true);
 								}
 								queues.insert(queues.end(), tmp_shadow.begin(), tmp_shadow.end());
 							}
@@ -11146,17 +11793,17 @@ void VRenderGLView::StartLoopUpdate()
 							if (!tmp_q.empty())
 							{
 								if (TextureRenderer::get_update_order() == 1)
-									std::sort(tmp_q.begin(), tmp_q.end(), VolumeLoader::sort_data_dsc);
+									BrickOrder::sort(tmp_q, VolumeLoader::sort_data_key, false);
 								else if (TextureRenderer::get_update_order() == 0)
-									std::sort(tmp_q.begin(), tmp_q.end(), VolumeLoader::sort_data_asc);
+									BrickOrder::sort(tmp_q, VolumeLoader::sort_data_key, true);
 								queues.insert(queues.end(), tmp_q.begin(), tmp_q.end());
 							}
 							if (!tmp_shade.empty())
 							{
 								if (TextureRenderer::get_update_order() == 1)
-									std::sort(tmp_shade.begin(), tmp_shade.end(), VolumeLoader::sort_data_dsc);
+									BrickOrder::sort(tmp_shade, VolumeLoader::sort_data_key, false);
 								else if (TextureRenderer::get_update_order() == 0)
-									std::sort(tmp_shade.begin(), tmp_shade.end(), VolumeLoader::sort_data_asc);
+									BrickOrder::sort(tmp_shade, VolumeLoader::sort_data_key, true);
 								queues.insert(queues.end(), tmp_shade.begin(), tmp_shade.end());
 							}
 							if (!tmp_shadow.empty())
@@ -11173,10 +11820,10 @@ void VRenderGLView::StartLoopUpdate()
 										list[i]->GetTexture()->set_sort_bricks();
 									}
 									TextureRenderer::set_update_order(order);
-									std::sort(tmp_shadow.begin(), tmp_shadow.end(), VolumeLoader::sort_data_asc);
+									BrickOrder::sort(tmp_shadow, VolumeLoader::sort_data_key, true);
 								}
 								else if (TextureRenderer::get_update_order() == 0)
-									std::sort(tmp_shadow.begin(), tmp_shadow.end(), VolumeLoader::sort_data_asc);
+									BrickOrder::sort(tmp_shadow, VolumeLoader::sort_data_key, true);
 								queues.insert(queues.end(), tmp_shadow.begin(), tmp_shadow.end());
 							}
 						}
@@ -11229,7 +11876,7 @@ void VRenderGLView::StartLoopUpdate()
 										tex->get_sorted_bricks(view_ray, !m_persp); //recalculate brick.d_
 										tex->set_sort_bricks();
 										TextureRenderer::set_update_order(order);
-										std::sort(tmp_shadow.begin(), tmp_shadow.end(), VolumeLoader::sort_data_asc);
+										BrickOrder::sort(tmp_shadow, VolumeLoader::sort_data_key, true);
 									}
 									queues.insert(queues.end(), tmp_shadow.begin(), tmp_shadow.end());
 								}
@@ -40,6 +40,9 @@ DEALINGS IN THE SOFTWARE.
 #include "FLIVR/Quaternion.h"
 #include "FLIVR/ImgShader.h"
 #include "FLIVR/PaintShader.h"
+#include "FLIVR/ThreadPool.h"
+#include "FLIVR/AsyncBrickReader.h"
+#include "FLIVR/BrickOrder.h"
 #include "compatibility.h"
 
 #include <wx/wx.h>
@@ -51,8 +54,11 @@ DEALINGS IN THE SOFTWARE.
 #include <wx/thread.h>
 
 #include <vector>
+#include <list>
+#include <unordered_set>
 #include <stdarg.h>
 #include <unordered_map>
+#include <boost/chrono.hpp>
 #include "nv/timer.h"
 
 #include <glm/glm.hpp>
@@ -211,9 +217,19 @@ struct VolumeLoaderData
 	int mode;
 };
 
+//one coalesced read shared by the bricks it covers
+//the bricks get slices of data; the buffer is freed with the last slice
+struct CoalescedBuffer
+{
+	char *data;
+	size_t size;
+	int ref;	//guarded by VolumeLoader::m_pThreadCS
+};
+
 struct VolumeDecompressorData
 {
 	char *in_data;
+	CoalescedBuffer *in_buf;	//owner of in_data if it is a slice, NULL otherwise
 	size_t in_size;
 	TextureBrick *b;
 	FileLocInfo *finfo;
@@ -222,16 +238,103 @@ struct VolumeDecompressorData
 	int mode;
 };
 
+//main-memory cache of the bricks read by VolumeLoader
+//entries are kept in one intrusive list per eviction class, the most
+//recently used at the head, so moving an entry is constant time.
+//the bricks note their changes in a dirty set under a small lock of its
+//own, and the entries move to their new classes when the cache is next
+//used under the loader lock; eviction picks the farthest of the few least
+//recently used entries of a class
+class BrickCache : public FLIVR::BrickStateListener
+{
+	public:
+		enum
+		{
+			CLASS_VD_UNDISP = 0,	//the volume is hidden
+			CLASS_BRICK_UNDISP,		//the brick is outside the view
+			CLASS_DRAWN,			//already drawn in the current loop
+			CLASS_IN_USE,			//still needed
+			CLASS_LOADING,			//data not there yet, cannot be evicted
+			CLASS_NUM
+		};
+
+		BrickCache();
+		~BrickCache();
+
+		//insert or update an entry and mark it most recently used
+		void Put(const VolumeLoaderData &data);
+		//update and mark an existing entry; returns false if absent
+		bool Touch(const VolumeLoaderData &data);
+		//move the entries of the bricks changed since the last call
+		void Update();
+		bool Find(TextureBrick *brick);
+		void Remove(TextureBrick *brick);
+		void Clear();
+		//copy of all entries for the rare whole-cache operations
+		void GetAll(vector<VolumeLoaderData> &list);
+		//remove the best loaded eviction candidate of a class <= max_class
+		//entries whose data failed to load are dropped on the way
+		bool PopEvictable(VolumeLoaderData &data, int max_class = CLASS_DRAWN);
+
+		size_t Size() {return m_map.size();}
+
+		static int Classify(const VolumeLoaderData &data);
+
+		//only notes the brick, called from any thread
+		virtual void brick_state_changed(TextureBrick *brick);
+
+	private:
+		struct Entry
+		{
+			VolumeLoaderData data;
+			int cls;
+			Entry *prev;	//more recently used
+			Entry *next;	//less recently used
+		};
+		struct List
+		{
+			Entry *head;
+			Entry *tail;
+		};
+
+		List m_lists[CLASS_NUM];
+		unordered_map<TextureBrick*, Entry> m_map;
+		//bricks changed since the last update
+		wxMutex m_dirty_lock;
+		unordered_set<TextureBrick*> m_dirty;
+		vector<TextureBrick*> m_dirty_swap;
+
+		void Link(Entry &e, int cls);
+		void Unlink(Entry &e);
+		void Place(Entry &e, int cls);
+		void Erase(unordered_map<TextureBrick*, Entry>::iterator it);
+};
+
 class VolumeLoader;
 
-class VolumeDecompressorThread : public wxThread
+class VolumeDecompressorTask : public FLIVR::ThreadPoolTask
 {
     public:
-		VolumeDecompressorThread(VolumeLoader *vl);
-		~VolumeDecompressorThread();
+		VolumeDecompressorTask(VolumeLoader *vl, const VolumeDecompressorData &q);
+		~VolumeDecompressorTask();
+		virtual void run();
+		virtual void cancel();
     protected:
-		virtual ExitCode Entry();
         VolumeLoader* m_vl;
+		VolumeDecompressorData m_q;
+};
+
+//brick data read by the async reader; compressed data go on to the decompressors
+class VolumeReadRequest : public FLIVR::AsyncReadRequest
+{
+    public:
+		VolumeReadRequest(VolumeLoader *vl, const VolumeDecompressorData &q);
+		~VolumeReadRequest();
+		virtual void complete(bool succeeded);
+    protected:
+        VolumeLoader* m_vl;
+		VolumeDecompressorData m_q;
+		boost::chrono::high_resolution_clock::time_point m_submit_time;
 };
 
 class VolumeLoaderThread : public wxThread
@@ -241,7 +344,39 @@ class VolumeLoaderThread : public wxThread
 		~VolumeLoaderThread();
     protected:
 		virtual ExitCode Entry();
+		bool Stopping();
+		//read b together with queued bricks stored next to it in the same file
+		bool ReadCoalesced(const VolumeLoaderData &b, char* &data, size_t &readsize, CoalescedBuffer* &buf);
+		void FreePayloads();
         VolumeLoader* m_vl;
+
+		//compressed data read ahead by ReadCoalesced() for bricks still in the queue
+		struct Payload
+		{
+			char *data;
+			size_t size;
+			CoalescedBuffer *buf;
+		};
+		unordered_map<TextureBrick*, Payload> m_payloads;
+};
+
+//accumulated loader latencies in milliseconds
+struct VolumeLoaderLatency
+{
+	double queue_wait;	//from Run() until the loader takes the brick
+	double read;		//file read
+	double decomp;		//decompression
+	double ready;		//from Run() until the brick data can be uploaded
+	int queue_wait_num;
+	int read_num;
+	int decomp_num;
+	int ready_num;
+
+	void Reset()
+	{
+		queue_wait = read = decomp = ready = 0.0;
+		queue_wait_num = read_num = decomp_num = ready_num = 0;
+	}
 };
 
 class VolumeLoader
@@ -255,41 +390,95 @@ class VolumeLoader
 		void Abort();
 		void StopAll();
 		bool Run();
-		void SetMaxThreadNum(int num) {m_max_decomp_th = num;}
-		void SetMemoryLimitByte(long long limit) {m_memory_limit = limit;}
+		void SetMaxThreadNum(int num);
+		void SetMemoryLimitByte(long long limit) {m_memory_limit = limit; Notify();}
+		//number of queued RAW bricks to hint to the OS ahead of the loader
+		void SetPrefetchWindow(int num) {m_prefetch_window = num;}
+		//merge reads of up to window queued bricks whose data lie within max_gap bytes
+		//of each other, up to max_span bytes per read (window <= 1 disables it)
+		void SetReadCoalescing(int window, long long max_gap, long long max_span)
+		{ m_coalesce_window = window; m_coalesce_gap = max_gap; m_coalesce_span = max_span; }
+		//number of brick reads kept in flight (0: read on the loader thread)
+		void SetAsyncReadDepth(int depth);
 		void CleanupLoadedBrick();
 		void RemoveAllLoadedBrick();
 		void RemoveBrickVD(VolumeData *vd);
 		void GetPalams(long long &used_mem, int &running_decomp_th, int &queue_num, int &decomp_queue_num);
+		void GetPalams(long long &used_mem, int &running_decomp_th, int &queue_num, int &decomp_queue_num,
+			long long &cache_hits, long long &cache_misses, long long &cache_evictions);
+		void GetLatency(double &queue_wait, double &read, double &decomp, double &ready);
+		//wake the loader thread after memory was freed or bricks were drawn
+		void Notify();
 
 		static bool sort_data_dsc(const VolumeLoaderData b1, const VolumeLoaderData b2)
 		{ return b2.brick->get_d() > b1.brick->get_d(); }
 		static bool sort_data_asc(const VolumeLoaderData b1, const VolumeLoaderData b2)
 		{ return b2.brick->get_d() < b1.brick->get_d(); }
+		//distance of the brick, for BrickOrder
+		static double sort_data_key(const VolumeLoaderData d)
+		{ return d.brick->get_d(); }
+		static bool sort_data_offset(const VolumeLoaderData b1, const VolumeLoaderData b2)
+		{ return b1.finfo->offset < b2.finfo->offset; }
 
 	protected:
 		VolumeLoaderThread *m_thread;
 		wxCriticalSection m_pThreadCS;
 		vector<VolumeLoaderData> m_queues;
-		vector<VolumeLoaderData> m_queued;
-		vector<VolumeDecompressorData> m_decomp_queues;
-		vector<VolumeDecompressorThread *> m_decomp_threads;
-		unordered_map<TextureBrick*, VolumeLoaderData> m_loaded;
-		int m_running_decomp_th;
+		//render modes (bit per mode) of the bricks taken from m_queues in this run
+		unordered_map<TextureBrick*, int> m_queued;
+		FLIVR::ThreadPool *m_decomp_pool;
+		FLIVR::AsyncBrickReader *m_reader;
+		int m_async_depth;
+		BrickCache m_loaded;
 		int m_max_decomp_th;
+		//compressed bricks handed to the pool and not finished yet
+		int m_in_flight;
+		int m_max_in_flight;
 		bool m_valid;
+		int m_prefetch_window;
+		int m_coalesce_window;
+		long long m_coalesce_gap;
+		long long m_coalesce_span;
+
+		//back-pressure: the loader sleeps on m_wait_cond until Notify()
+		//m_wake_seq and m_stop_req are guarded by m_wait_lock
+		wxMutex m_wait_lock;
+		wxCondition m_wait_cond;
+		unsigned int m_wake_seq;
+		bool m_stop_req;
+
+		typedef boost::chrono::high_resolution_clock LoaderClock;
+		LoaderClock::time_point m_run_time;
+		VolumeLoaderLatency m_latency;
 
 		long long m_memory_limit;
 		long long m_used_memory;
+		//bytes still to be read for the remaining entries of m_queues
+		long long m_required_memory;
+
+		long long m_cache_hits;
+		long long m_cache_misses;
+		long long m_cache_evictions;
 
 		inline void AddLoadedBrick(VolumeLoaderData lbd)
 		{
-			m_loaded[lbd.brick] = lbd;
+			m_loaded.Put(lbd);
 			m_used_memory += lbd.datasize;
 		}
+		void EvictBrick(const VolumeLoaderData &data);
+		void PrefetchQueued();
+		//free compressed input, or drop its share of a coalesced read
+		void FreeInput(char *data, CoalescedBuffer *buf);
+
+		unsigned int GetWakeSeq();
+		void WaitForWake(unsigned int seq);
+		bool StopRequested();
+		double ElapsedSinceRun();
+		static double ElapsedMs(LoaderClock::time_point t1, LoaderClock::time_point t2);
 
 		friend class VolumeLoaderThread;
-		friend class VolumeDecompressorThread;
+		friend class VolumeDecompressorTask;
+		friend class VolumeReadRequest;
 };
 
 class VRenderGLView: public wxGLCanvas